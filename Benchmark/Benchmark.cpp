@@ -0,0 +1,718 @@
+// Benchmark of the force kernels: cube and octa crystals of IDGPU (Crystal.CreateCube, CreateOctahedron) of growing
+// size for every potential set of the .spp file, Force and Energy of every backend:
+//  CPUOne - every instruction set the CPU has, in float, mixed (float pairs, Kahan sums) and double, all-pairs, with
+//   neighbor lists and with the Coulomb tree;
+//  DX11One - the host backend running the kernels of ForceDX11_IBC (IBC-*.hlsl) natively, in float and mixed, all-pairs
+//   (mode "pairs"); instruction_set is the name of the device. The library is loaded at run time, without it (or with
+//   --dx11one "") its cases are left out. Its kernels do not cut the Morse and Buckingham4 terms, so for those forms the
+//   errors include the part beyond the cutoff of the reference.
+// Each case runs warmup calls, then timed repetitions (min, median, p95), and is compared with the double all-pairs
+// scalar engine of CPUOne: the rms and max error of the force relative to the rms force and the relative error of the
+// energy. The report is JSON, one object per case in a fixed order with fixed keys, so two runs diff line by line.
+//  pairs_per_second - N (N - 1) / 2 per call over the median, all-pairs equivalent for lists and the tree;
+//  gflops - the same with the flops of the pair terms (FlopsPerPair), an effective rate, not a counter.
+// g++ -std=c++11 -O3 -I../CPUOne -I../DX11One -o CPUOneBenchmark Benchmark.cpp -L../CPUOne -lCPUOne -ldl -lpthread -Wl,-rpath,'$ORIGIN/../CPUOne'
+// CPUOneBenchmark [--data ../IDGPU/Data] [--material UO2] [--sizes 4,6,8,10] [--crystals cube,octa] [--warmup 2]
+//  [--repetitions 10] [--threads 0] [--modes pairs,lists,tree] [--skin 1.0] [--period 0 (SolidPeriod at 300 K)]
+//  [--displacement 0.1] [--dx11one ../DX11One/libDX11One.so] [--kernels ../IDGPU/Kernels] [--output results.json]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+#include "CPUOne.h"
+#include "One.h" // the types of DX11One only, its functions come from the library loaded by DX11OneLibrary
+
+#define KE 14.39964415 // eV * A, MDIBC.Ke
+#define CUTOFF 10.0 // A, ForceCPU_IBC.cutoff
+
+// --- Data files of IDGPU: just enough XML for UnitCells.uc, Materials.mat and the .spp sets
+
+static std::string ReadFile(const std::string& filename)
+{
+	std::string s;
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (f == NULL) return s;
+	char buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) s.append(buffer, n);
+	fclose(f);
+	return s;
+}
+
+// Elements <name ...> (or <name .../>) of s with their text up to </name>
+struct Element { std::string tag, body; };
+static std::vector<Element> Elements(const std::string& s, const std::string& name)
+{
+	std::vector<Element> elements;
+	const std::string open = "<" + name, close = "</" + name + ">";
+	for (size_t i = s.find(open); i != std::string::npos; i = s.find(open, i + 1))
+	{
+		char next = s[i + open.size()];
+		if (next != ' ' && next != '>' && next != '/' && next != '\t') continue;
+		size_t tag_end = s.find('>', i);
+		if (tag_end == std::string::npos) break;
+		Element e;
+		e.tag = s.substr(i, tag_end - i + 1);
+		if (s[tag_end - 1] != '/')
+		{
+			size_t body_end = s.find(close, tag_end);
+			if (body_end != std::string::npos) e.body = s.substr(tag_end + 1, body_end - tag_end - 1);
+		}
+		elements.push_back(e);
+	}
+	return elements;
+}
+static std::string Attribute(const Element& e, const std::string& name)
+{
+	const std::string key = " " + name + "=\"";
+	size_t i = e.tag.find(key);
+	if (i == std::string::npos) return std::string();
+	i += key.size();
+	return e.tag.substr(i, e.tag.find('"', i) - i);
+}
+static std::string Text(const Element& e, const std::string& name)
+{
+	std::vector<Element> c = Elements(e.body, name);
+	return c.empty() ? std::string() : c[0].body;
+}
+static std::vector<double> Numbers(const std::string& s)
+{
+	std::vector<double> v;
+	const char* p = s.c_str();
+	char* end;
+	for (double x = strtod(p, &end); end != p; x = strtod(p, &end)) { v.push_back(x); p = end; }
+	return v;
+}
+
+struct Material { std::vector<std::string> names; std::vector<double> charges; std::string cell; };
+struct UnitCell { std::vector<double> pos; std::vector<int> type; }; // pos: 3 per ion, in periods
+struct PotentialSet { std::string name, form; double ionicity; std::vector<double> coefs; std::vector<double> solid_period; };
+
+static bool LoadMaterial(const std::string& data, const std::string& formula, Material& m, UnitCell& cell)
+{
+	std::vector<Element> materials = Elements(ReadFile(data + "/Materials.mat"), "Material");
+	for (size_t k = 0; k < materials.size(); k++)
+	{
+		if (Attribute(materials[k], "formula") != formula) continue;
+		m.cell = Attribute(materials[k], "unit-cell");
+		std::vector<Element> ions = Elements(materials[k].body, "Ion");
+		for (size_t i = 0; i < ions.size(); i++)
+		{
+			m.names.push_back(Attribute(ions[i], "name"));
+			m.charges.push_back(atof(Attribute(ions[i], "charge").c_str()));
+		}
+	}
+	std::vector<Element> cells = Elements(ReadFile(data + "/UnitCells.uc"), "Cell");
+	for (size_t k = 0; k < cells.size(); k++)
+	{
+		if (Attribute(cells[k], "name") != m.cell) continue;
+		std::vector<Element> ions = Elements(cells[k].body, "Ion");
+		for (size_t i = 0; i < ions.size(); i++)
+		{
+			std::vector<double> p = Numbers(Attribute(ions[i], "position"));
+			if (p.size() != 3) return false;
+			cell.pos.insert(cell.pos.end(), p.begin(), p.end());
+			cell.type.push_back(atoi(Attribute(ions[i], "type").c_str()));
+		}
+	}
+	return m.names.size() == 2 && !cell.type.empty();
+}
+
+// PairPotentials.CoefsDouble8 of every set of the material (two types)
+static std::vector<PotentialSet> LoadPotentials(const std::string& filename, const std::string& formula, const Material& m)
+{
+	std::vector<PotentialSet> sets;
+	std::vector<Element> elements = Elements(ReadFile(filename), "Set");
+	for (size_t k = 0; k < elements.size(); k++)
+	{
+		const Element& e = elements[k];
+		if (Attribute(e, "material") != formula) continue;
+		PotentialSet p;
+		p.name = Attribute(e, "name");
+		p.form = Attribute(e, "form");
+		p.ionicity = atof(Text(e, "Ionicity").c_str());
+		p.solid_period = Numbers(Text(e, "SolidPeriod"));
+		double c[12] = { 0 };
+		std::vector<double> spline; // Range2, Range3, Bounds of the O-O pair of Buckingham4
+		std::vector<Element> pairs = Elements(e.body, "Pair");
+		for (size_t i = 0; i < pairs.size(); i++)
+		{
+			std::string ions = Attribute(pairs[i], "ions");
+			std::vector<double> bm = Numbers(Attribute(pairs[i], "BornMayer")), morse = Numbers(Attribute(pairs[i], "Morse"));
+			if (ions == m.names[0] + " " + m.names[0])
+			{
+				if (bm.size() >= 2) { c[1] = bm[0]; c[2] = -bm[1]; }
+				c[3] = atof(Attribute(pairs[i], "Dispersion").c_str());
+				std::vector<double> r2 = Numbers(Attribute(pairs[i], "Range2")), r3 = Numbers(Attribute(pairs[i], "Range3")), bounds = Numbers(Attribute(pairs[i], "Bounds"));
+				if (bounds.size() < 2) bounds = { 2.1, 2.6 }; // PairTerms.Bounds
+				if (r2.size() == 6 && r3.size() == 4)
+				{
+					spline = r2;
+					spline.insert(spline.end(), r3.begin(), r3.end());
+					spline.insert(spline.end(), bounds.begin(), bounds.begin() + 2);
+				}
+			}
+			else if (ions == m.names[0] + " " + m.names[1] || ions == m.names[1] + " " + m.names[0])
+			{
+				if (bm.size() >= 2) { c[4] = bm[0]; c[5] = -bm[1]; }
+				if (morse.size() >= 3) { c[6] = morse[0]; c[7] = -morse[1]; c[8] = morse[2]; }
+			}
+			else if (ions == m.names[1] + " " + m.names[1] && bm.size() >= 2) { c[9] = bm[0]; c[10] = -bm[1]; }
+		}
+		double q0 = m.charges[0] * p.ionicity, q1 = m.charges[1] * p.ionicity;
+		double coefs[32] = {
+			KE * q0 * q0, c[1], c[2], c[3], 0, 0, 0, 0,
+			KE * q0 * q1, c[4], c[5], 0, c[6], c[7], c[8], 0,
+			KE * q0 * q1, c[4], c[5], 0, c[6], c[7], c[8], 0,
+			KE * q1 * q1, c[9], c[10], 0, 0, 0, 0, 0 };
+		p.coefs.assign(coefs, coefs + 32);
+		if (p.form == "Buckingham4")
+		{
+			if (spline.empty()) continue; // no O-O spline in the set
+			p.coefs.insert(p.coefs.end(), spline.begin(), spline.end());
+		}
+		sets.push_back(p);
+	}
+	return sets;
+}
+
+static double SolidPeriod(const PotentialSet& p, double T) // Polynom.Eval, the highest power first
+{
+	if (p.solid_period.empty()) return 5.47;
+	double y = p.solid_period[0];
+	for (size_t i = 1; i < p.solid_period.size(); i++) y = y * T + p.solid_period[i];
+	return y;
+}
+
+// --- Crystals: the loops of Crystal.CreateCube and CreateOctahedron, then sorted by type as MDIBC.Init does
+
+struct Crystal { std::vector<double> pos; std::vector<int> type; int Ions() const { return (int)type.size(); } };
+
+static Crystal CreateCrystal(const UnitCell& cell, const std::string& shape, int edge_cells)
+{
+	Crystal c;
+	const int ions = (int)cell.type.size();
+	for (int x = -edge_cells; x <= edge_cells; x++)
+		for (int y = -edge_cells; y <= edge_cells; y++)
+			for (int z = -edge_cells; z <= edge_cells; z++)
+			{
+				double shift;
+				if (shape == "cube")
+				{
+					if (x < 0 || y < 0 || z < 0 || x >= edge_cells || y >= edge_cells || z >= edge_cells) continue;
+					shift = 0.5 * edge_cells;
+				}
+				else
+				{
+					if (abs(x) + abs(y) + abs(z) >= edge_cells) continue;
+					shift = 0.5;
+				}
+				for (int i = 0; i < ions; i++)
+				{
+					c.pos.push_back(x - shift + cell.pos[i * 3]);
+					c.pos.push_back(y - shift + cell.pos[i * 3 + 1]);
+					c.pos.push_back(z - shift + cell.pos[i * 3 + 2]);
+					c.type.push_back(cell.type[i]);
+				}
+			}
+	std::vector<int> order(c.type.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return c.type[a] < c.type[b]; });
+	Crystal sorted;
+	for (size_t k = 0; k < order.size(); k++)
+	{
+		sorted.type.push_back(c.type[order[k]]);
+		for (int a = 0; a < 3; a++) sorted.pos.push_back(c.pos[order[k] * 3 + a]);
+	}
+	return sorted;
+}
+
+// Scaled by the period and displaced by up to displacement A (a fixed generator, the same positions on every machine),
+// so the ions are off the symmetric sites where the forces cancel
+static std::vector<double> Positions(const Crystal& c, double period, double displacement)
+{
+	std::vector<double> pos(c.pos.size());
+	unsigned long long state = 88172645463325252ULL;
+	for (size_t i = 0; i < pos.size(); i++)
+	{
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		double u = (double)(state >> 11) / 9007199254740992.0; // [0, 1)
+		pos[i] = c.pos[i] * period + (2 * u - 1) * displacement;
+	}
+	return pos;
+}
+
+// Flops of a pair by its terms: R^2 (8), R and 1/R (3), dU applied to both ions (9), then per term
+static double FlopsPerPair(const std::string& form, const std::vector<double>& coefs, const std::vector<int>& type, bool energy)
+{
+	long long count[4] = { 0 };
+	for (size_t i = 0; i < type.size(); i++) count[type[i]]++;
+	double flops = 0, pairs = 0;
+	for (int a = 0; a < 2; a++)
+		for (int b = a; b < 2; b++)
+		{
+			const double* c = &coefs[(a * 2 + b) * 8];
+			double n = a == b ? count[a] * (count[a] - 1) / 2.0 : (double)count[a] * count[b];
+			double f = 20 + 3; // + Coulomb
+			if (form == "Buckingham4" && a == 0 && b == 0) f += 16; // spline polynomials and the dispersion above them
+			else
+			{
+				if (c[1] != 0) f += 6; // exp, A exp, dU
+				if (c[3] != 0) f += 5;
+				if (c[4] != 0 && form == "BuckinghamMorse") f += 12;
+			}
+			if (energy) f += 4;
+			flops += n * f;
+			pairs += n;
+		}
+	return pairs > 0 ? flops / pairs : 0;
+}
+
+// --- Timing and errors
+
+struct Timing { double min, median, p95; };
+static Timing Statistics(std::vector<double> t)
+{
+	std::sort(t.begin(), t.end());
+	Timing s;
+	s.min = t[0];
+	s.median = t[t.size() / 2];
+	s.p95 = t[std::min(t.size() - 1, (size_t)ceil(0.95 * t.size()) - 1)]; // nearest rank
+	return s;
+}
+static double Seconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Options
+{
+	std::string data, material, output, isa_best, dx11one, kernels;
+	std::vector<int> sizes;
+	std::vector<std::string> crystals, modes;
+	int warmup, repetitions, threads;
+	double skin, period, displacement;
+};
+
+static std::vector<std::string> Split(const std::string& s)
+{
+	std::vector<std::string> words;
+	size_t begin = 0;
+	for (size_t i = 0; i <= s.size(); i++)
+		if (i == s.size() || s[i] == ',')
+		{
+			if (i > begin) words.push_back(s.substr(begin, i - begin));
+			begin = i + 1;
+		}
+	return words;
+}
+
+static std::string Escape(const std::string& s)
+{
+	std::string e;
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		if (s[i] == '"' || s[i] == '\\') e += '\\';
+		e += s[i];
+	}
+	return e;
+}
+
+// --- DX11One: the host backend with the kernels of ForceDX11_IBC
+
+// Both libraries export DecodeError, so DX11One is loaded with its own symbol scope and called through pointers
+#define DX11ONE_FUNCTIONS(X) X(CreateDevice) X(GetDeviceName) X(LoadOrCompileShader) X(CreateRWBuffer) X(CreateStagingBuffer) \
+	X(CreateConstantBuffer) X(CreateInputTexture2D) X(WriteToBuffer) X(WriteToTexture2D) X(GetResults) X(SetRBuffersAndTextures) \
+	X(SetCBuffers) X(SetRWBuffers) X(DispatchShader) X(UnbindResources) X(ReleaseBuffer) X(ReleaseShader) X(ReleaseTexture) \
+	X(Dispose) X(DecodeError)
+
+// The ids of the handles (One.cpp and Host.cpp), as the library is loaded rather than linked
+decltype(Device::ID) Device::ID = 1001001;
+decltype(Context::ID) Context::ID = 1001002;
+decltype(Shader::ID) Shader::ID = 1001003;
+decltype(Buffer::ID) Buffer::ID = 1001004;
+decltype(Texture2D::ID) Texture2D::ID = 1001005;
+
+struct DX11OneLibrary
+{
+#define DX11ONE_POINTER(f) decltype(&::f) f;
+	DX11ONE_FUNCTIONS(DX11ONE_POINTER)
+#undef DX11ONE_POINTER
+	Device device;
+	Context context;
+	std::string name; // of the device, empty if the library is not loaded
+
+	bool Load(const std::string& filename, int threads)
+	{
+		if (filename.empty()) return false;
+#ifdef _WIN32
+		HMODULE library = LoadLibraryA(filename.c_str());
+#define DX11ONE_SYMBOL(f) (library == NULL ? NULL : (void*)GetProcAddress(library, #f))
+#else
+		void* library = dlopen(filename.c_str(), RTLD_NOW | RTLD_LOCAL);
+#define DX11ONE_SYMBOL(f) (library == NULL ? NULL : dlsym(library, #f))
+#endif
+		bool found = library != NULL;
+#define DX11ONE_LOAD(f) f = (decltype(f))DX11ONE_SYMBOL(f); found = found && f != NULL;
+		DX11ONE_FUNCTIONS(DX11ONE_LOAD)
+#undef DX11ONE_LOAD
+#undef DX11ONE_SYMBOL
+		if (!found) { fprintf(stderr, "No DX11One in %s, its cases are left out\n", filename.c_str()); return false; }
+		if (threads > 0)
+		{
+#ifdef _WIN32
+			_putenv_s("DX11ONE_THREADS", std::to_string(threads).c_str());
+#else
+			setenv("DX11ONE_THREADS", std::to_string(threads).c_str(), 1);
+#endif
+		}
+		char buffer[256] = "";
+		if (FAILED(CreateDevice(D3D_DRIVER_TYPE_HARDWARE, D3D_FEATURE_LEVEL_11_0, &device, &context)) || FAILED(GetDeviceName(device, buffer, sizeof(buffer)))) return false;
+		name = buffer;
+		return true;
+	}
+};
+
+// ForceDX11_IBC for one case: Init with the default tiling of SetTiling (no tuning database), then RunKernel
+class DX11OneCase
+{
+public:
+	DX11OneCase(DX11OneLibrary& one) : one(one), initialized(false) { }
+	~DX11OneCase() { Release(); }
+
+	HRESULT Init(const PotentialSet& p, const Crystal& c, bool compensated, const std::string& kernels, std::string* message)
+	{
+		const char* file = p.form == "Buckingham" ? "IBC-B" : p.form == "BuckinghamMorse" ? "IBC-BM" : p.form == "Buckingham4" ? "IBC-B4" : NULL;
+		if (file == NULL) { *message = "No DX11One kernels for the form"; return E_NOTIMPL; }
+		std::string source = ReadFile(kernels + "/" + file + ".hlsl");
+		if (source.empty()) { *message = "No " + kernels + "/" + file + ".hlsl"; return E_FAIL; }
+
+		ions = c.Ions();
+		const int width = 384;
+		threads = 64; bj = 10;
+		ww = width; hh = (ions + width - 1) / width;
+		texels = ww * hh;
+		bi = (texels + threads * 4 - 1) / (threads * 4);
+		// unroll 2 unless a run of a type (or the padding of type 1) starts at an odd texel, ValidUnroll of ForceDX11_IBC
+		int unroll = 2;
+		for (int i = 1; i <= ions; i++)
+			if ((i < ions ? c.type[i] : 1) != c.type[i - 1] && i % 2 != 0) unroll = 1;
+		char definitions[256];
+		snprintf(definitions, sizeof(definitions), "#define n %d\n#define threads %d\n#define types 2\n#define unroll %d\n", texels, threads, unroll);
+		std::string prefix = definitions;
+		if (compensated) prefix += "#define compensated 1\n";
+		if (p.form == "Buckingham4") prefix += SplineDefinitions(p.coefs);
+
+		// Fictitious particles at the end, as Init of ForceDX11_IBC
+		pos_in.assign(texels * 4, 1e+10f);
+		std::vector<int> type_in(texels, 1);
+		for (int i = 0; i < ions; i++) type_in[i] = c.type[i];
+		std::vector<float> coefs(p.coefs.begin(), p.coefs.begin() + 32);
+		unsigned tiling[4] = { (unsigned)((hh + bj - 1) / bj), (unsigned)bj, (unsigned)ww, (unsigned)hh };
+		out.resize(texels * 4);
+
+		HRESULT hr = Compile(prefix + source, "ForceNxN", &force_kernel, message);
+		if (!FAILED(hr)) hr = Compile(prefix + source, "EnergyNxN", &energy_kernel, message);
+		if (!FAILED(hr)) hr = Compile(prefix + source, "Sum", &sum_kernel, message);
+		initialized = true;
+		if (!FAILED(hr)) hr = one.CreateInputTexture2D(one.device, ww, hh, DXGI_FORMAT_R32G32B32A32_FLOAT, NULL, &pos);
+		if (!FAILED(hr)) hr = one.CreateInputTexture2D(one.device, ww, hh, DXGI_FORMAT_R32_UINT, &type_in[0], &type);
+		if (!FAILED(hr)) hr = one.CreateInputTexture2D(one.device, 2, 4, DXGI_FORMAT_R32G32B32A32_FLOAT, &coefs[0], &coefs_texture);
+		if (!FAILED(hr)) hr = one.CreateRWBuffer(one.device, 16, texels * bj, NULL, &force);
+		if (!FAILED(hr)) hr = one.CreateStagingBuffer(one.device, 16, texels * bj, &staging);
+		if (!FAILED(hr)) hr = one.CreateConstantBuffer(one.device, sizeof(tiling), &constants);
+		if (!FAILED(hr)) hr = one.WriteToBuffer(one.context, constants, tiling, sizeof(tiling));
+		return hr;
+	}
+
+	// RunKernel, then the forces (and the energy, half of the sum of the w components) as Force and Energy
+	HRESULT Run(const std::vector<double>& pos_ext, bool energy, std::vector<double>& acc, double* value)
+	{
+		for (int i = 0; i < ions; i++)
+			for (int a = 0; a < 3; a++) pos_in[i * 4 + a] = (float)pos_ext[i * 3 + a];
+		Texture2D textures[3] = { pos, type, coefs_texture };
+		HRESULT hr = one.WriteToTexture2D(one.context, pos, &pos_in[0], ww, hh, 16);
+		if (!FAILED(hr)) hr = one.SetRBuffersAndTextures(one.context, NULL, 0, textures, 3);
+		if (!FAILED(hr)) hr = one.SetCBuffers(one.context, &constants, 1);
+		if (!FAILED(hr)) hr = one.SetRWBuffers(one.context, &force, 1);
+		if (!FAILED(hr)) hr = one.DispatchShader(one.context, energy ? energy_kernel : force_kernel, bi, bj, 1);
+		if (!FAILED(hr) && bj > 1) hr = one.DispatchShader(one.context, sum_kernel, bi, 1, 1);
+		if (!FAILED(hr)) hr = one.GetResults(one.context, staging, force, &out[0], 16 * texels);
+		one.UnbindResources(one.context);
+		double sum = 0;
+		for (int i = 0; i < ions; i++)
+		{
+			for (int a = 0; a < 3; a++) acc[i * 3 + a] = out[i * 4 + a];
+			sum += out[i * 4 + 3];
+		}
+		*value = sum * 0.5;
+		return hr;
+	}
+
+	void Release()
+	{
+		if (!initialized) return;
+		initialized = false;
+		one.ReleaseShader(force_kernel); one.ReleaseShader(energy_kernel); one.ReleaseShader(sum_kernel);
+		one.ReleaseTexture(pos); one.ReleaseTexture(type); one.ReleaseTexture(coefs_texture);
+		one.ReleaseBuffer(force); one.ReleaseBuffer(staging); one.ReleaseBuffer(constants);
+	}
+
+private:
+	HRESULT Compile(const std::string& source, const char* entry_point, Shader* shader, std::string* message)
+	{
+		const char* errors = NULL;
+		HRESULT hr = one.LoadOrCompileShader(one.device, source.c_str(), (int)source.size(), entry_point, "cs_5_0", 0, shader, &errors);
+		if (FAILED(hr)) *message = errors != NULL ? errors : entry_point;
+		return hr;
+	}
+	// The O-O spline of Buckingham4 (the last 12 coefficients), SplineDefinitions of ForceDX11_IBC
+	static std::string SplineDefinitions(const std::vector<double>& coefs)
+	{
+		static const char* names[3] = { "spline_range2", "spline_range3", "spline_bounds" };
+		static const int counts[3] = { 6, 4, 2 };
+		std::string s;
+		for (int k = 0, m = (int)coefs.size() - 12; k < 3; k++)
+		{
+			s += std::string("#define ") + names[k] + " ";
+			for (int i = 0; i < counts[k]; i++, m++)
+			{
+				char value[32];
+				snprintf(value, sizeof(value), "%s%.9g", i > 0 ? ", " : "", (float)coefs[m]);
+				s += value;
+			}
+			s += "\n";
+		}
+		return s;
+	}
+
+	DX11OneLibrary& one;
+	bool initialized;
+	int ions, threads, bj, bi, ww, hh, texels;
+	Shader force_kernel, energy_kernel, sum_kernel;
+	Texture2D pos, type, coefs_texture;
+	Buffer force, staging, constants;
+	std::vector<float> pos_in, out;
+};
+
+// An engine of the case; the instruction set comes from CPUONE_ISA, read by the engine constructor
+static HRESULT CreateCase(const PotentialSet& p, const Crystal& c, const char* isa, int precision, const std::string& mode,
+	const Options& o, Engine* engine)
+{
+#ifdef _WIN32
+	_putenv_s("CPUONE_ISA", isa);
+#else
+	setenv("CPUONE_ISA", isa, 1);
+#endif
+	HRESULT hr = CreateEngine(p.form.c_str(), precision, CUTOFF, engine);
+	if (!FAILED(hr)) hr = SetEngineThreads(*engine, o.threads);
+	if (!FAILED(hr) && mode == "lists") hr = SetNeighborSkin(*engine, o.skin);
+	if (!FAILED(hr) && mode == "tree") hr = SetCoulombTree(*engine, 0.2, 2);
+	if (!FAILED(hr)) hr = InitEngine(*engine, &c.type[0], &p.coefs[0], 2, c.Ions());
+	return hr;
+}
+
+struct Reference { std::vector<double> acc; double energy, rms; };
+
+// The timing and the errors of a case against the reference, after its keys
+static void WriteResult(FILE* out, const std::vector<double>& times, const std::vector<double>& acc, double value, bool energy,
+	const Reference& ref, const PotentialSet& p, const Crystal& c)
+{
+	const int ions = c.Ions();
+	double rms = 0, max = 0;
+	for (int i = 0; i < ions; i++)
+	{
+		double d2 = 0;
+		for (int a = 0; a < 3; a++) d2 += (acc[i * 3 + a] - ref.acc[i * 3 + a]) * (acc[i * 3 + a] - ref.acc[i * 3 + a]);
+		rms += d2;
+		max = std::max(max, sqrt(d2));
+	}
+	rms = sqrt(rms / ions) / ref.rms;
+	max /= ref.rms;
+	Timing t = Statistics(times);
+	double pairs = (double)ions * (ions - 1) / 2, flops = FlopsPerPair(p.form, p.coefs, c.type, energy);
+	fprintf(out, "\"repetitions\": %d, \"min\": %.6e, \"median\": %.6e, \"p95\": %.6e, \"pairs_per_second\": %.4e, \"gflops\": %.3f, ",
+		(int)times.size(), t.min, t.median, t.p95, pairs / t.median, pairs * flops / t.median * 1e-9);
+	fprintf(out, "\"force_error_rms\": %.3e, \"force_error_max\": %.3e", rms, max);
+	if (energy) fprintf(out, ", \"energy_error\": %.3e", fabs(value - ref.energy) / fabs(ref.energy));
+	fprintf(out, " }");
+}
+
+static void Run(const Options& o, DX11OneLibrary& one, FILE* out)
+{
+	Material m;
+	UnitCell cell;
+	if (!LoadMaterial(o.data, o.material, m, cell)) { fprintf(stderr, "No material %s in %s\n", o.material.c_str(), o.data.c_str()); exit(1); }
+	std::vector<PotentialSet> sets = LoadPotentials(o.data + "/" + o.material + ".spp", o.material, m);
+	static const struct { const char* option; const char* name; } isas[] = { { "scalar", "scalar" }, { "avx2", "AVX2" }, { "avx512", "AVX-512" } }; // CPUONE_ISA, InstructionSetName
+	static const struct { int precision; const char* name; } precisions[] = { { 1, "float" }, { 2, "mixed" }, { 0, "double" } }; // of CreateEngine
+	bool first = true;
+
+	fprintf(out, "{\n\t\"benchmark\": \"CPUOne\",\n\t\"version\": 2,\n");
+	fprintf(out, "\t\"host\": { \"hardware_threads\": %u, \"instruction_set\": \"%s\", \"dx11one_device\": \"%s\" },\n",
+		std::thread::hardware_concurrency(), o.isa_best.c_str(), Escape(one.name).c_str());
+	fprintf(out, "\t\"settings\": { \"material\": \"%s\", \"warmup\": %d, \"repetitions\": %d, \"threads\": %d, \"skin\": %g, \"displacement\": %g, \"cutoff\": %g },\n",
+		Escape(o.material).c_str(), o.warmup, o.repetitions, o.threads, o.skin, o.displacement, CUTOFF);
+	fprintf(out, "\t\"results\": [");
+	for (size_t s = 0; s < sets.size(); s++)
+		for (size_t k = 0; k < o.crystals.size(); k++)
+			for (size_t n = 0; n < o.sizes.size(); n++)
+			{
+				const PotentialSet& p = sets[s];
+				Crystal c = CreateCrystal(cell, o.crystals[k], o.sizes[n]);
+				const int ions = c.Ions();
+				const double period = o.period > 0 ? o.period : SolidPeriod(p, 300);
+				std::vector<double> pos = Positions(c, period, o.displacement), acc(pos.size());
+				fprintf(stderr, "%s %s %d: %d ions\n", p.name.c_str(), o.crystals[k].c_str(), o.sizes[n], ions);
+
+				// Double all-pairs scalar reference
+				Reference ref;
+				Engine engine;
+				HRESULT hr = CreateCase(p, c, "scalar", 0, "pairs", o, &engine);
+				if (!FAILED(hr)) hr = SetPositions(engine, &pos[0], ions);
+				if (!FAILED(hr)) { ref.acc.resize(pos.size()); hr = ComputeEnergy(engine, &ref.acc[0], &ref.energy); }
+				ReleaseEngine(engine);
+				if (FAILED(hr))
+				{
+					const char* message = "";
+					DecodeError(hr, &message);
+					fprintf(out, "%s\n\t\t{ \"potentials\": \"%s\", \"form\": \"%s\", \"crystal\": \"%s\", \"edge_cells\": %d, \"ions\": %d, \"skipped\": \"%s\" }",
+						first ? "" : ",", Escape(p.name).c_str(), Escape(p.form).c_str(), o.crystals[k].c_str(), o.sizes[n], ions, Escape(message).c_str());
+					first = false;
+					continue;
+				}
+				ref.rms = 0;
+				for (size_t i = 0; i < ref.acc.size(); i++) ref.rms += ref.acc[i] * ref.acc[i];
+				ref.rms = sqrt(ref.rms / ions);
+
+				for (int isa = 0; isa < 3; isa++)
+					for (int precision = 0; precision < 3; precision++)
+						for (size_t md = 0; md < o.modes.size(); md++)
+							for (int energy = 0; energy < 2; energy++)
+							{
+								const std::string& mode = o.modes[md];
+								const char* isa_name = "";
+								Engine e;
+								HRESULT hc = CreateCase(p, c, isas[isa].option, precisions[precision].precision, mode, o, &e);
+								if (!FAILED(hc)) GetInstructionSet(e, &isa_name);
+								if (!FAILED(hc) && strcmp(isa_name, isas[isa].name) != 0) { ReleaseEngine(e); continue; } // not on this CPU
+
+								fprintf(out, "%s\n\t\t{ \"potentials\": \"%s\", \"form\": \"%s\", \"crystal\": \"%s\", \"edge_cells\": %d, \"ions\": %d, \"backend\": \"CPUOne\", ",
+									first ? "" : ",", Escape(p.name).c_str(), Escape(p.form).c_str(), o.crystals[k].c_str(), o.sizes[n], ions);
+								fprintf(out, "\"instruction_set\": \"%s\", \"precision\": \"%s\", \"mode\": \"%s\", \"kernel\": \"%s\", ",
+									isas[isa].name, precisions[precision].name, mode.c_str(), energy ? "energy" : "force");
+								first = false;
+
+								std::vector<double> times;
+								double value = 0;
+								for (int r = 0; r < o.warmup + o.repetitions && !FAILED(hc); r++)
+								{
+									double t = Seconds();
+									hc = SetPositions(e, &pos[0], ions);
+									if (!FAILED(hc)) hc = energy ? ComputeEnergy(e, &acc[0], &value) : ComputeForce(e, &acc[0]);
+									if (r >= o.warmup) times.push_back(Seconds() - t);
+								}
+								ReleaseEngine(e);
+								if (FAILED(hc))
+								{
+									const char* message = "";
+									DecodeError(hc, &message);
+									fprintf(out, "\"skipped\": \"%s\" }", Escape(message).c_str());
+									continue;
+								}
+								WriteResult(out, times, acc, value, energy != 0, ref, p, c);
+							}
+
+				// DX11One: all pairs in float and mixed
+				if (one.name.empty() || std::find(o.modes.begin(), o.modes.end(), "pairs") == o.modes.end()) continue;
+				for (int precision = 0; precision < 2; precision++)
+					for (int energy = 0; energy < 2; energy++)
+					{
+						fprintf(out, "%s\n\t\t{ \"potentials\": \"%s\", \"form\": \"%s\", \"crystal\": \"%s\", \"edge_cells\": %d, \"ions\": %d, \"backend\": \"DX11One\", ",
+							first ? "" : ",", Escape(p.name).c_str(), Escape(p.form).c_str(), o.crystals[k].c_str(), o.sizes[n], ions);
+						fprintf(out, "\"instruction_set\": \"%s\", \"precision\": \"%s\", \"mode\": \"pairs\", \"kernel\": \"%s\", ",
+							Escape(one.name).c_str(), precisions[precision].name, energy ? "energy" : "force");
+						first = false;
+						DX11OneCase dx(one);
+						std::string message;
+						HRESULT hd = dx.Init(p, c, precision == 1, o.kernels, &message);
+						std::vector<double> times;
+						double value = 0;
+						for (int r = 0; r < o.warmup + o.repetitions && !FAILED(hd); r++)
+						{
+							double t = Seconds();
+							hd = dx.Run(pos, energy != 0, acc, &value);
+							if (r >= o.warmup) times.push_back(Seconds() - t);
+						}
+						if (FAILED(hd))
+						{
+							if (message.empty())
+							{
+								const char* text = "";
+								one.DecodeError(hd, &text);
+								message = text;
+							}
+							fprintf(out, "\"skipped\": \"%s\" }", Escape(message).c_str());
+							continue;
+						}
+						WriteResult(out, times, acc, value, energy != 0, ref, p, c);
+					}
+			}
+	fprintf(out, "\n\t]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+	Options o;
+	o.data = "../IDGPU/Data"; o.material = "UO2";
+	o.sizes = { 4, 6, 8, 10 };
+	o.crystals = { "cube", "octa" };
+	o.modes = { "pairs", "lists", "tree" };
+	o.warmup = 2; o.repetitions = 10; o.threads = 0;
+	o.skin = 1.0; o.period = 0; o.displacement = 0.1;
+	o.dx11one = "../DX11One/libDX11One.so"; o.kernels = "../IDGPU/Kernels";
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string key = argv[i], value = argv[i + 1];
+		if (key == "--data") o.data = value;
+		else if (key == "--material") o.material = value;
+		else if (key == "--output") o.output = value;
+		else if (key == "--sizes") { o.sizes.clear(); std::vector<std::string> w = Split(value); for (size_t k = 0; k < w.size(); k++) o.sizes.push_back(atoi(w[k].c_str())); }
+		else if (key == "--crystals") o.crystals = Split(value);
+		else if (key == "--modes") o.modes = Split(value);
+		else if (key == "--warmup") o.warmup = atoi(value.c_str());
+		else if (key == "--repetitions") o.repetitions = std::max(1, atoi(value.c_str()));
+		else if (key == "--threads") o.threads = atoi(value.c_str());
+		else if (key == "--skin") o.skin = atof(value.c_str());
+		else if (key == "--period") o.period = atof(value.c_str());
+		else if (key == "--displacement") o.displacement = atof(value.c_str());
+		else if (key == "--dx11one") o.dx11one = value;
+		else if (key == "--kernels") o.kernels = value;
+		else { fprintf(stderr, "Unknown option %s\n", key.c_str()); return 1; }
+	}
+
+	// The best instruction set, before CPUONE_ISA is set per case
+	Engine e;
+	const char* best = "";
+	if (!FAILED(CreateEngine("Buckingham", 0, CUTOFF, &e))) { GetInstructionSet(e, &best); o.isa_best = best; ReleaseEngine(e); }
+
+	FILE* out = o.output.empty() ? stdout : fopen(o.output.c_str(), "w");
+	if (out == NULL) { fprintf(stderr, "Cannot write %s\n", o.output.c_str()); return 1; }
+	DX11OneLibrary one;
+	one.Load(o.dx11one, o.threads);
+	Run(o, one, out);
+	if (out != stdout) fclose(out);
+	if (!one.name.empty()) one.Dispose();
+	return 0;
+}
@@ -0,0 +1,181 @@
+#include "stdafx.h"
+#include <math.h>
+
+#define ANALYSIS_CHUNK 2048 // ions per partial sum
+
+AnalysisEngine::AnalysisEngine(int threads) : ions(0), types(0)
+{
+	pool = new ThreadPool(threads);
+}
+
+HRESULT AnalysisEngine::Init(const int* type, int types, int ions)
+{
+	if (type == NULL || types <= 0 || ions <= 0) return E_INVALIDARG;
+	for (int i = 0; i < ions; i++)
+		if (type[i] < 0 || type[i] >= types) return E_INVALIDARG;
+	this->type.assign(type, type + ions);
+	this->types = types;
+	this->ions = ions;
+	return S_OK;
+}
+
+int AnalysisEngine::Layer(double r, double period, int layers)
+{
+	int j = (int)ceil(r / period) - 1;
+	if (j >= layers) j = layers - 1;
+	if (j < 0) j = 0;
+	// the division may round across a border, the comparisons decide as the loop does
+	if (j > 0 && !(r > j * period)) j--;
+	else if (j + 1 < layers && r > (j + 1) * period) j++;
+	return j;
+}
+
+HRESULT AnalysisEngine::Analyze(const double* pos, const double* origin, const AnalysisParameters& p, int* rfr,
+	int* layer_count, double* layer_dist, int* bilayer_count, double* bilayer_dist)
+{
+	if (ions == 0) return E_FAIL;
+	if (pos == NULL || rfr == NULL || p.rfr_intervals <= 0 || p.rfr_radius <= 0) return E_INVALIDARG;
+	const bool layers = layer_count != NULL;
+	if (layers && (origin == NULL || layer_dist == NULL || bilayer_count == NULL || bilayer_dist == NULL || p.layers <= 0 || p.period <= 0)) return E_INVALIDARG;
+
+	const int L = layers ? p.layers : 0, intervals = p.rfr_intervals;
+	const int rfr_size = types * intervals, layer_size = L * L * types, bilayer_size = layers ? 2 * types : 0;
+	const int counts = rfr_size + layer_size + bilayer_size, dists = layer_size + bilayer_size;
+	const int chunks = (ions + ANALYSIS_CHUNK - 1) / ANALYSIS_CHUNK, threads = pool->Threads();
+	if ((int)worker_counts.size() != threads) worker_counts.resize(threads);
+	for (int w = 0; w < threads; w++) worker_counts[w].assign(counts, 0);
+	chunk_dists.assign((size_t)chunks * dists, 0);
+	const double period = p.period, border = p.border;
+
+	pool->Run(chunks, [&](int c, int worker) {
+		const int begin = c * ANALYSIS_CHUNK, end = begin + ANALYSIS_CHUNK < ions ? begin + ANALYSIS_CHUNK : ions;
+		int* h = &worker_counts[worker][0];
+		double* d = dists > 0 ? &chunk_dists[(size_t)c * dists] : NULL;
+		for (int i = begin; i < end; i++)
+		{
+			const double x = pos[i * 3], y = pos[i * 3 + 1], z = pos[i * 3 + 2];
+			const double r = sqrt(x * x + y * y + z * z);
+			const int t = type[i], j = (int)(r * intervals / p.rfr_radius); // as ComputeDensity rounds
+			if (j >= 0 && j < intervals) h[t * intervals + j]++;
+			if (!layers) continue;
+
+			const double ox = origin[i * 3], oy = origin[i * 3 + 1], oz = origin[i * 3 + 2];
+			const double o = sqrt(ox * ox + oy * oy + oz * oz);
+			const double dx = x - ox, dy = y - oy, dz = z - oz, d2 = dx * dx + dy * dy + dz * dz;
+			const int lo = Layer(o, period, L), lr = Layer(r, period, L), n = (lo * L + lr) * types + t;
+			h[rfr_size + n]++;
+			d[n] += lo == lr ? d2 : lo > lr ? (lr + 1) * period - r : r - lr * period;
+
+			const int b = o < border && r < border ? 0 : o > border && r > border ? 1 : -1;
+			if (b >= 0)
+			{
+				h[rfr_size + layer_size + b * types + t]++;
+				d[layer_size + b * types + t] += d2;
+			}
+		}
+	});
+
+	// Merge: counts of the workers, distances of the chunks in order
+	for (int n = 0; n < counts; n++)
+	{
+		int sum = 0;
+		for (int w = 0; w < threads; w++) sum += worker_counts[w][n];
+		if (n < rfr_size) rfr[n] = sum;
+		else if (n < rfr_size + layer_size) layer_count[n - rfr_size] = sum;
+		else bilayer_count[n - rfr_size - layer_size] = sum;
+	}
+	for (int n = 0; n < dists; n++)
+	{
+		double sum = 0;
+		for (int c = 0; c < chunks; c++) sum += chunk_dists[(size_t)c * dists + n];
+		if (n < layer_size) layer_dist[n] = sum;
+		else bilayer_dist[n - layer_size] = sum;
+	}
+	return S_OK;
+}
+
+HRESULT AnalysisEngine::PairHistogram(const double* pos, double r_max, double core, int bins, int* histogram, int* centers)
+{
+	if (ions == 0) return E_FAIL;
+	if (pos == NULL || histogram == NULL || centers == NULL || r_max <= 0 || bins <= 0) return E_INVALIDARG;
+
+	// Grid over the bounding box; cells grow beyond r_max if evaporated ions stretch the box too much
+	double lo[3], hi[3];
+	for (int a = 0; a < 3; a++) lo[a] = hi[a] = pos[a];
+	for (int i = 1; i < ions; i++)
+		for (int a = 0; a < 3; a++)
+		{
+			double v = pos[i * 3 + a];
+			if (v < lo[a]) lo[a] = v;
+			if (v > hi[a]) hi[a] = v;
+		}
+	double size = r_max;
+	int n[3];
+	for (;;)
+	{
+		for (int a = 0; a < 3; a++) n[a] = (int)((hi[a] - lo[a]) / size) + 1;
+		if ((double)n[0] * n[1] * n[2] <= 2.0 * ions + 27) break;
+		size *= 1.25;
+	}
+	const int cells = n[0] * n[1] * n[2];
+	cell_start.assign(cells + 1, 0);
+	cell_ions.resize(ions);
+	ion_cell.resize(ions);
+	for (int i = 0; i < ions; i++)
+	{
+		int c[3];
+		for (int a = 0; a < 3; a++)
+		{
+			c[a] = (int)((pos[i * 3 + a] - lo[a]) / size);
+			if (c[a] >= n[a]) c[a] = n[a] - 1;
+		}
+		ion_cell[i] = (c[2] * n[1] + c[1]) * n[0] + c[0];
+		cell_start[ion_cell[i] + 1]++;
+	}
+	for (int c = 0; c < cells; c++) cell_start[c + 1] += cell_start[c];
+	{
+		std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+		for (int i = 0; i < ions; i++) cell_ions[fill[ion_cell[i]]++] = i;
+	}
+
+	// Centers in the order of the cells, so a chunk reads the same few cells again and again
+	const int size_h = types * types * bins, chunks = (ions + ANALYSIS_CHUNK - 1) / ANALYSIS_CHUNK, threads = pool->Threads();
+	if ((int)worker_counts.size() != threads) worker_counts.resize(threads);
+	for (int w = 0; w < threads; w++) worker_counts[w].assign(size_h + types, 0);
+	const double core2 = core * core, r2_max = r_max * r_max, scale = bins / r_max;
+	pool->Run(chunks, [&](int chunk, int worker) {
+		const int begin = chunk * ANALYSIS_CHUNK, end = begin + ANALYSIS_CHUNK < ions ? begin + ANALYSIS_CHUNK : ions;
+		int* h = &worker_counts[worker][0];
+		for (int k = begin; k < end; k++)
+		{
+			const int i = cell_ions[k], ti = type[i];
+			const double x = pos[i * 3], y = pos[i * 3 + 1], z = pos[i * 3 + 2];
+			if (x * x + y * y + z * z >= core2) continue;
+			h[size_h + ti]++;
+			int* row = h + ti * types * bins;
+			const int c = ion_cell[i], cx = c % n[0], cy = c / n[0] % n[1], cz = c / (n[0] * n[1]);
+			for (int gz = cz > 0 ? cz - 1 : 0; gz <= cz + 1 && gz < n[2]; gz++)
+				for (int gy = cy > 0 ? cy - 1 : 0; gy <= cy + 1 && gy < n[1]; gy++)
+					for (int gx = cx > 0 ? cx - 1 : 0; gx <= cx + 1 && gx < n[0]; gx++)
+					{
+						const int g = (gz * n[1] + gy) * n[0] + gx;
+						for (int m = cell_start[g]; m < cell_start[g + 1]; m++)
+						{
+							const int j = cell_ions[m];
+							const double dx = pos[j * 3] - x, dy = pos[j * 3 + 1] - y, dz = pos[j * 3 + 2] - z, d2 = dx * dx + dy * dy + dz * dz;
+							if (d2 >= r2_max || j == i) continue;
+							const int bin = (int)(sqrt(d2) * scale);
+							if (bin < bins) row[type[j] * bins + bin]++;
+						}
+					}
+		}
+	});
+	for (int m = 0; m < size_h + types; m++)
+	{
+		int sum = 0;
+		for (int w = 0; w < threads; w++) sum += worker_counts[w][m];
+		if (m < size_h) histogram[m] = sum;
+		else centers[m - size_h] = sum;
+	}
+	return S_OK;
+}
@@ -0,0 +1,52 @@
+#ifndef _ANALYSIS_H_
+#define _ANALYSIS_H_
+
+#include <vector>
+#include "ThreadPool.h"
+
+// Parameters of Analyze, the same layout as AnalysisParameters in CPUOne.cs
+struct AnalysisParameters
+{
+	double rfr_radius; // A: radius of the RFR histogram
+	double period; // A: thickness of a sphere layer
+	double border; // A: radius between the bulk and the surface of the bilayer
+	int rfr_intervals, layers; // layers = edge-cells / 2
+};
+
+// The per-ion part of MDIBC.ComputeDensity and MDIBC.ComputeCKC in one parallel sweep: |pos| and |origin| once per
+// ion, the RFR histogram (rfr_intervals per type), and optionally the sums of the sphere layers and of the bilayer:
+//  layer_count, layer_dist - layers * layers * types, [origin layer][current layer][type]: the squared displacement
+//  if the layers are the same, else the distance to the border of the layer crossed;
+//  bilayer_count, bilayer_dist - 2 * types: [bulk, surface][type] with the squared displacement.
+// The layer of r is the largest j < layers with r > j * period (0 if none) - the loop of SphereLayers, in O(1).
+// Histograms are per worker and merged; the distances are summed per chunk of ions and the chunks are added in order,
+// so the sums do not depend on threads.
+// PairHistogram counts the pairs closer than r_max for g(r) in O(N): the ions are sorted into a grid of cells of at
+// least r_max, and every center (an ion with |r| < core, so its sphere of r_max is inside the cluster) looks at the
+// 27 cells around it. histogram - types * types * bins, [center type][partner type][bin], bins of r_max / bins;
+// centers - types, the number of centers per type.
+class AnalysisEngine
+{
+public:
+	AnalysisEngine(int threads); // threads as ThreadPool::Resolve
+	~AnalysisEngine() { delete pool; }
+
+	HRESULT Init(const int* type, int types, int ions);
+	// layer_count == NULL: the histogram only
+	HRESULT Analyze(const double* pos, const double* origin, const AnalysisParameters& p, int* rfr,
+		int* layer_count, double* layer_dist, int* bilayer_count, double* bilayer_dist);
+
+	HRESULT PairHistogram(const double* pos, double r_max, double core, int bins, int* histogram, int* centers);
+
+	static int Layer(double r, double period, int layers);
+
+private:
+	ThreadPool* pool;
+	int ions, types;
+	std::vector<int> type;
+	std::vector<std::vector<int> > worker_counts; // rfr, then layer and bilayer counts
+	std::vector<double> chunk_dists; // layer and bilayer distances per chunk
+	std::vector<int> cell_start, cell_ions, ion_cell; // grid of PairHistogram: ions of cell c are cell_ions[cell_start[c] .. cell_start[c + 1])
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include "stdafx.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+static void CPUID(int leaf, int subleaf, unsigned r[4])
+{
+#if defined(_MSC_VER)
+	int info[4]; __cpuidex(info, leaf, subleaf);
+	for (int i = 0; i < 4; i++) r[i] = (unsigned)info[i];
+#else
+	__cpuid_count(leaf, subleaf, r[0], r[1], r[2], r[3]);
+#endif
+}
+static unsigned long long XCR0()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned lo, hi;
+	__asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+static InstructionSet Supported()
+{
+	unsigned r[4];
+	CPUID(0, 0, r);
+	if (r[0] < 7) return ISA_SCALAR;
+	CPUID(1, 0, r);
+	bool osxsave = (r[2] & (1 << 27)) != 0, fma = (r[2] & (1 << 12)) != 0, avx = (r[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || !fma) return ISA_SCALAR;
+	unsigned long long xcr0 = XCR0();
+	if ((xcr0 & 0x6) != 0x6) return ISA_SCALAR; // XMM and YMM state saved by OS
+	CPUID(7, 0, r);
+	bool avx2 = (r[1] & (1 << 5)) != 0, avx512f = (r[1] & (1 << 16)) != 0;
+	if (avx512f && (xcr0 & 0xE6) == 0xE6) return ISA_AVX512; // + opmask, ZMM0-15 and ZMM16-31 state
+	return avx2 ? ISA_AVX2 : ISA_SCALAR;
+}
+#else
+static InstructionSet Supported() { return ISA_SCALAR; }
+#endif
+
+InstructionSet DetectInstructionSet()
+{
+	static InstructionSet isa = Supported();
+	InstructionSet wanted = isa;
+	const char* s = getenv("CPUONE_ISA");
+	if (s != NULL)
+	{
+		if (strcmp(s, "scalar") == 0) wanted = ISA_SCALAR;
+		else if (strcmp(s, "avx2") == 0) wanted = ISA_AVX2;
+		else if (strcmp(s, "avx512") == 0) wanted = ISA_AVX512;
+	}
+	return wanted < isa ? wanted : isa;
+}
+
+const char* InstructionSetName(InstructionSet isa)
+{
+	switch (isa)
+	{
+		case ISA_AVX512: return "AVX-512";
+		case ISA_AVX2: return "AVX2";
+		default: return "scalar";
+	}
+}
@@ -0,0 +1,355 @@
+#include "stdafx.h"
+#include "Partition.h"
+#include "Ensemble.h"
+#include <mutex>
+#include <map>
+
+int Engine::ID = 1002001;
+int Analysis::ID = 1002002;
+int Partition::ID = 1002003;
+int Ensemble::ID = 1002004;
+
+// The objects behind the handles that are not released yet, with the serial of their handle. Handles are passed by
+// value and a release cannot reset the copies of the caller: a stale copy (or a struct that never held an object) fails
+// every call, even when a new object got the address of the released one.
+static std::mutex live_mutex;
+static std::map<const void*, int> live;
+static int last_serial = 0;
+
+template <class Handle, class T> static void Live(Handle* handle, T* ptr)
+{
+	std::lock_guard<std::mutex> lock(live_mutex);
+	if (++last_serial <= 0) last_serial = 1;
+	handle->serial = last_serial;
+	handle->ptr = ptr;
+	live[ptr] = last_serial;
+}
+
+template <class Handle> static bool Matches(const Handle& handle) // under live_mutex
+{
+	std::map<const void*, int>::const_iterator k = live.find(handle.ptr);
+	return handle.id == handle.ID && handle.ptr != NULL && k != live.end() && k->second == handle.serial;
+}
+
+template <class Handle> static bool Valid(const Handle& handle)
+{
+	std::lock_guard<std::mutex> lock(live_mutex);
+	return Matches(handle);
+}
+
+template <class Handle> static HRESULT Retire(const Handle& handle)
+{
+	std::lock_guard<std::mutex> lock(live_mutex);
+	if (!Matches(handle)) return E_FAIL;
+	live.erase(handle.ptr);
+	return S_OK;
+}
+
+static bool ParseForm(const char* form, PotentialForm* f)
+{
+	if (form == NULL) return false;
+	else if (strcmp(form, "Buckingham") == 0) *f = FORM_BUCKINGHAM;
+	else if (strcmp(form, "BuckinghamMorse") == 0) *f = FORM_BUCKINGHAM_MORSE;
+	else if (strcmp(form, "Buckingham4") == 0) *f = FORM_BUCKINGHAM4;
+	else return false;
+	return true;
+}
+
+static bool ValidPrecision(int precision) { return precision >= PRECISION_DOUBLE && precision <= PRECISION_MIXED; }
+
+HRESULT CPU_API CreateEngine(const char* form, int precision, double cutoff, Engine* engine)
+{
+	if (engine == NULL) return E_FAIL;
+	if (engine->id == engine->ID) ReleaseEngine(*engine);
+	*engine = Engine();
+	PotentialForm f;
+	if (form == NULL || !ValidPrecision(precision)) { engine->id = -1; return E_INVALIDARG; }
+	if (!ParseForm(form, &f)) { engine->id = -1; return E_NOTIMPL; }
+	Live(engine, new ForceEngine(f, (Precision)precision, cutoff));
+	return S_OK;
+}
+
+HRESULT CPU_API InitEngine(Engine engine, const int* type, const double* coefs, int types, int ions)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->Init(type, coefs, types, ions);
+}
+
+HRESULT CPU_API SetEngineThreads(Engine engine, int threads)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->SetThreads(threads);
+}
+
+HRESULT CPU_API SetEngineTileSize(Engine engine, int tile)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->SetTileSize(tile);
+}
+
+HRESULT CPU_API SetNeighborSkin(Engine engine, double skin)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->SetNeighborSkin(skin);
+}
+
+HRESULT CPU_API GetNeighborListStats(Engine engine, int* builds, long long* neighbors)
+{
+	if (!Valid(engine) || builds == NULL || neighbors == NULL) return E_FAIL;
+	*builds = engine.ptr->Neighbors().Builds();
+	*neighbors = engine.ptr->Neighbors().Neighbors();
+	return S_OK;
+}
+
+HRESULT CPU_API SetPotentialTable(Engine engine, const double* table, int types, int intervals, double r2_min, double scale)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->SetPotentialTable(table, types, intervals, r2_min, scale);
+}
+
+HRESULT CPU_API SetCoulombTree(Engine engine, double theta, int order)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->SetCoulombTree(theta, order);
+}
+
+HRESULT CPU_API GetCoulombTreeError(Engine engine, int samples, double* rms, double* max)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->CoulombTreeError(samples, rms, max);
+}
+
+HRESULT CPU_API SetPositions(Engine engine, const double* pos, int ions)
+{
+	if (!Valid(engine)) return E_FAIL;
+	if (ions != engine.ptr->Ions()) return E_INVALIDARG;
+	return engine.ptr->SetPositions(pos);
+}
+
+HRESULT CPU_API ComputeForce(Engine engine, double* acc)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->Force(acc);
+}
+
+HRESULT CPU_API ComputeEnergy(Engine engine, double* acc, double* energy)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->Energy(acc, energy);
+}
+
+HRESULT CPU_API ComputeForcePart(Engine engine, int part, double* acc, double* energy)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->Part((ForcePart)part, acc, energy);
+}
+
+HRESULT CPU_API InitDynamics(Engine engine, const double* pos, const double* vel, const double* mass)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->InitDynamics(pos, vel, mass);
+}
+
+HRESULT CPU_API StepDynamics(Engine engine, const DynamicsParameters* parameters, int steps, double* temperatures, double* energies)
+{
+	if (!Valid(engine)) return E_FAIL;
+	if (parameters == NULL) return E_INVALIDARG;
+	return engine.ptr->StepDynamics(*parameters, steps, temperatures, energies);
+}
+
+HRESULT CPU_API GetDynamics(Engine engine, double* pos, double* vel)
+{
+	if (!Valid(engine)) return E_FAIL;
+	return engine.ptr->GetDynamics(pos, vel);
+}
+
+HRESULT CPU_API GetInstructionSet(Engine engine, const char** name)
+{
+	if (!Valid(engine) || name == NULL) return E_FAIL;
+	*name = InstructionSetName(engine.ptr->ISA());
+	return S_OK;
+}
+
+HRESULT CPU_API ReleaseEngine(Engine engine)
+{
+	HRESULT hr = Retire(engine);
+	if (FAILED(hr)) return hr;
+	delete engine.ptr;
+	return S_OK;
+}
+
+HRESULT CPU_API CreateAnalysis(const int* type, int types, int ions, int threads, Analysis* analysis)
+{
+	if (analysis == NULL) return E_FAIL;
+	if (analysis->id == analysis->ID) ReleaseAnalysis(*analysis);
+	*analysis = Analysis();
+	Live(analysis, new AnalysisEngine(threads));
+	HRESULT hr = analysis->ptr->Init(type, types, ions);
+	if (FAILED(hr)) { ReleaseAnalysis(*analysis); *analysis = Analysis(); analysis->id = -1; }
+	return hr;
+}
+
+HRESULT CPU_API Analyze(Analysis analysis, const double* pos, const double* origin, const AnalysisParameters* parameters,
+	int* rfr, int* layer_count, double* layer_dist, int* bilayer_count, double* bilayer_dist)
+{
+	if (!Valid(analysis)) return E_FAIL;
+	if (parameters == NULL) return E_INVALIDARG;
+	return analysis.ptr->Analyze(pos, origin, *parameters, rfr, layer_count, layer_dist, bilayer_count, bilayer_dist);
+}
+
+HRESULT CPU_API PairHistogram(Analysis analysis, const double* pos, double r_max, double core, int bins, int* histogram, int* centers)
+{
+	if (!Valid(analysis)) return E_FAIL;
+	return analysis.ptr->PairHistogram(pos, r_max, core, bins, histogram, centers);
+}
+
+HRESULT CPU_API ReleaseAnalysis(Analysis analysis)
+{
+	HRESULT hr = Retire(analysis);
+	if (FAILED(hr)) return hr;
+	delete analysis.ptr;
+	return S_OK;
+}
+
+HRESULT CPU_API CreatePartition(const char* address, int workers, int max_ions, double timeout, Partition* partition)
+{
+	if (partition == NULL) return E_FAIL;
+	if (partition->id == partition->ID) ReleasePartition(*partition);
+	*partition = Partition();
+	if (workers <= 0 || max_ions <= 0) { partition->id = -1; return E_INVALIDARG; }
+	Transport* transport;
+	HRESULT hr = Transport::Listen(address, workers, PartitionedForce::Capacity(workers, max_ions), timeout, &transport);
+	if (FAILED(hr)) { partition->id = -1; return hr; }
+	Live(partition, new PartitionedForce(transport));
+	return S_OK;
+}
+
+HRESULT CPU_API InitPartition(Partition partition, const char* form, int precision, double cutoff, const int* type, const double* coefs, int types, int ions)
+{
+	if (!Valid(partition)) return E_FAIL;
+	if (!ValidPrecision(precision)) return E_INVALIDARG;
+	PotentialForm f;
+	if (!ParseForm(form, &f)) return E_NOTIMPL;
+	return partition.ptr->Init(f, (Precision)precision, cutoff, type, coefs, types, ions);
+}
+
+HRESULT CPU_API PartitionForce(Partition partition, const double* pos, double* acc)
+{
+	if (!Valid(partition)) return E_FAIL;
+	return partition.ptr->Force(pos, acc, NULL);
+}
+
+HRESULT CPU_API PartitionEnergy(Partition partition, const double* pos, double* acc, double* energy)
+{
+	if (!Valid(partition)) return E_FAIL;
+	if (energy == NULL) return E_INVALIDARG;
+	return partition.ptr->Force(pos, acc, energy);
+}
+
+HRESULT CPU_API GetPartitionRows(Partition partition, int* bounds, double* seconds)
+{
+	if (!Valid(partition) || bounds == NULL || seconds == NULL) return E_FAIL;
+	int workers = partition.ptr->Workers();
+	for (int w = 0; w < workers; w++) bounds[w] = seconds[w] = 0;
+	bounds[workers] = 0;
+	if (partition.ptr->Bounds() == NULL) return S_FALSE; // not initialized
+	memcpy(bounds, partition.ptr->Bounds(), sizeof(int) * (workers + 1));
+	memcpy(seconds, partition.ptr->Seconds(), sizeof(double) * workers);
+	return S_OK;
+}
+
+HRESULT CPU_API ReleasePartition(Partition partition)
+{
+	HRESULT hr = Retire(partition);
+	if (FAILED(hr)) return hr;
+	delete partition.ptr;
+	return S_OK;
+}
+
+HRESULT CPU_API RunPartitionWorker(const char* address, int rank, int threads, double timeout)
+{
+	Transport* transport;
+	HRESULT hr = Transport::Connect(address, rank, timeout, &transport);
+	if (FAILED(hr)) return hr;
+	hr = PartitionWorker(transport, rank, threads);
+	delete transport;
+	return hr;
+}
+
+HRESULT CPU_API CreateEnsemble(int precision, double cutoff, int threads, Ensemble* ensemble)
+{
+	if (ensemble == NULL) return E_FAIL;
+	if (ensemble->id == ensemble->ID) ReleaseEnsemble(*ensemble);
+	*ensemble = Ensemble();
+	if (!ValidPrecision(precision)) { ensemble->id = -1; return E_INVALIDARG; }
+	Live(ensemble, new EnsembleEngine((Precision)precision, cutoff, threads));
+	return S_OK;
+}
+
+HRESULT CPU_API InitEnsembleSystem(Ensemble ensemble, int system, const char* form, const int* type, const double* coefs, int types, int ions)
+{
+	if (!Valid(ensemble)) return E_FAIL;
+	PotentialForm f;
+	if (form == NULL) return E_INVALIDARG;
+	if (!ParseForm(form, &f)) return E_NOTIMPL;
+	return ensemble.ptr->InitSystem(system, f, type, coefs, types, ions);
+}
+
+HRESULT CPU_API SetSystemPositions(Ensemble ensemble, int system, const double* pos)
+{
+	if (!Valid(ensemble)) return E_FAIL;
+	return ensemble.ptr->SetPositions(system, pos);
+}
+
+HRESULT CPU_API ComputeEnsemble(Ensemble ensemble, double* energies)
+{
+	if (!Valid(ensemble)) return E_FAIL;
+	return ensemble.ptr->Compute(energies);
+}
+
+HRESULT CPU_API GetSystemForces(Ensemble ensemble, int system, double* acc)
+{
+	if (!Valid(ensemble)) return E_FAIL;
+	return ensemble.ptr->GetForces(system, acc);
+}
+
+HRESULT CPU_API ReleaseEnsemble(Ensemble ensemble)
+{
+	HRESULT hr = Retire(ensemble);
+	if (FAILED(hr)) return hr;
+	delete ensemble.ptr;
+	return S_OK;
+}
+
+static const char* error_text[8] = {
+	"Unknown error code.",
+	"E_NOTIMPL - Not implemented (unknown potential form, or charges the Coulomb tree cannot factorize).",
+	"E_FAIL - An undetermined error occurred (or an invalid handle).",
+	"E_INVALIDARG - An invalid parameter was passed to the returning function.",
+	"E_OUTOFMEMORY - Could not allocate sufficient memory to complete the call.",
+	"S_FALSE - Alternate success value, indicating a successful but nonstandard completion (the precise meaning depends on context).",
+	"S_OK - No error occurred.",
+	"E_BOUNDS - A force component is out of the range of the fixed-point sums (overlapping ions).",
+};
+
+void CPU_API DecodeError(HRESULT hr, const char **output)
+{
+	switch (hr)
+	{
+		case E_NOTIMPL:
+			*output = error_text[1]; break;
+		case E_FAIL:
+			*output = error_text[2]; break;
+		case E_INVALIDARG:
+			*output = error_text[3]; break;
+		case E_OUTOFMEMORY:
+			*output = error_text[4]; break;
+		case S_FALSE:
+			*output = error_text[5]; break;
+		case S_OK:
+			*output = error_text[6]; break;
+		case E_BOUNDS:
+			*output = error_text[7]; break;
+		default: *output = error_text[0]; break;
+	}
+}
@@ -0,0 +1,119 @@
+#ifndef _CPU_ONE_H_
+#define _CPU_ONE_H_
+
+// Native CPU force engine: SoA positions in float or double, all-pairs kernels for every instruction set
+// (scalar, AVX2, AVX-512) selected at runtime by CPUID, parallel over the tiles of the i < j triangle.
+// The life cycle mirrors IForce of the managed side: CreateEngine, InitEngine (types, coefficients), SetPositions,
+// ComputeForce/ComputeEnergy, ReleaseEngine. The forces do not depend on the number of threads (SetEngineThreads);
+// SetEngineTileSize (before InitEngine) overrides the default tile of the triangle, as the tuning database says.
+// SetNeighborSkin > 0 moves the terms cut at the cutoff to Verlet neighbor lists (see ForceEngine).
+// SetCoulombTree > 0 computes Coulomb (and the uncut dispersion) with a Barnes-Hut tree (see CoulombTree),
+// GetCoulombTreeError compares it with the exact all-pairs sum at the current positions.
+// SetPotentialTable (before InitEngine) replaces the cut terms by cubic splines on an R^2 grid: table has
+// types^2 * intervals * 8 doubles (dU and U cubics per interval, see ForceEngine::SetPotentialTable).
+// InitDynamics copies positions and velocities in, then StepDynamics runs whole MD steps of MDIBC.Update (forces,
+// integration, impulse/angular momentum correction, Berendsen scaling, evaporation guard) on the engine side, and
+// GetDynamics copies the state out (see Dynamics). ComputeForcePart gives the short- and long-range parts of the
+// forces separately for multiple time steps (r-RESPA, respa_outer of DynamicsParameters).
+// CreateAnalysis/Analyze/ReleaseAnalysis: the per-ion sweep of MDIBC.ComputeDensity and ComputeCKC (RFR histogram,
+// sphere layer and bilayer sums), independent of an engine, so any technique can use it (see AnalysisEngine);
+// PairHistogram counts the pairs for g(r) on a cell grid.
+// CreatePartition/InitPartition/PartitionForce/PartitionEnergy/ReleasePartition: the same forces split by rows over
+// worker processes that run RunPartitionWorker (PartitionWorker/PartitionWorker.cpp) at a shm: or tcp: address
+// (see Transport.h), balanced by the cost of the rows and the measured speed of the workers (see Partition.h).
+// CreateEnsemble/InitEnsembleSystem/SetSystemPositions/ComputeEnsemble/GetSystemForces/ReleaseEnsemble: many
+// independent systems (the runs of a sweep) in one set of buffers, computed by one parallel job (see EnsembleEngine).
+// Every call with a handle that is not live (a wrong id or serial, NULL, a copy of a released handle) returns E_FAIL;
+// Release* of one deletes nothing.
+// precision of CreateEngine, InitPartition and CreateEnsemble: 0 double, 1 float, 2 mixed - float pair terms added up
+// with Kahan sums, near the double forces and energies at about the float speed (see Precision in Engine.h).
+// g++ -std=c++11 -O3 -fPIC -shared -o libCPUOne.so *.cpp -lpthread
+// The tests in Tests/ link the sources directly, each file starts with the line that builds and runs it.
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define CPU_API __declspec(dllexport) _stdcall
+#else
+typedef int HRESULT;
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001)
+#define E_FAIL ((HRESULT)0x80004005)
+#define E_INVALIDARG ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000E)
+#define E_BOUNDS ((HRESULT)0x8000000B)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define CPU_API __attribute__((visibility("default")))
+#endif
+
+class ForceEngine;
+struct DynamicsParameters;
+class AnalysisEngine;
+struct AnalysisParameters;
+class PartitionedForce;
+class EnsembleEngine;
+
+// Handles have the same layout as CPU_* structures in CPUOne.cs; serial is unique to every object created, so a copy of
+// a released handle does not match a new object at the same address
+struct Engine { static int ID; int id, serial; ForceEngine* ptr; Engine() { id = Engine::ID; serial = 0; ptr = NULL; } };
+struct Analysis { static int ID; int id, serial; AnalysisEngine* ptr; Analysis() { id = Analysis::ID; serial = 0; ptr = NULL; } };
+struct Partition { static int ID; int id, serial; PartitionedForce* ptr; Partition() { id = Partition::ID; serial = 0; ptr = NULL; } };
+struct Ensemble { static int ID; int id, serial; EnsembleEngine* ptr; Ensemble() { id = Ensemble::ID; serial = 0; ptr = NULL; } };
+
+// External functions:
+extern "C" HRESULT CPU_API CreateEngine(const char* form, int precision, double cutoff, Engine* engine);
+extern "C" HRESULT CPU_API InitEngine(Engine engine, const int* type, const double* coefs, int types, int ions);
+extern "C" HRESULT CPU_API SetEngineThreads(Engine engine, int threads);
+extern "C" HRESULT CPU_API SetEngineTileSize(Engine engine, int tile);
+extern "C" HRESULT CPU_API SetNeighborSkin(Engine engine, double skin);
+extern "C" HRESULT CPU_API GetNeighborListStats(Engine engine, int* builds, long long* neighbors);
+extern "C" HRESULT CPU_API SetCoulombTree(Engine engine, double theta, int order);
+extern "C" HRESULT CPU_API SetPotentialTable(Engine engine, const double* table, int types, int intervals, double r2_min, double scale);
+extern "C" HRESULT CPU_API GetCoulombTreeError(Engine engine, int samples, double* rms, double* max);
+extern "C" HRESULT CPU_API SetPositions(Engine engine, const double* pos, int ions);
+extern "C" HRESULT CPU_API ComputeForce(Engine engine, double* acc);
+extern "C" HRESULT CPU_API ComputeEnergy(Engine engine, double* acc, double* energy);
+// part 0: the terms cut at the cutoff over the neighbor lists, 1: Coulomb and the uncut dispersion; energy may be NULL
+extern "C" HRESULT CPU_API ComputeForcePart(Engine engine, int part, double* acc, double* energy);
+extern "C" HRESULT CPU_API InitDynamics(Engine engine, const double* pos, const double* vel, const double* mass);
+extern "C" HRESULT CPU_API StepDynamics(Engine engine, const DynamicsParameters* parameters, int steps, double* temperatures, double* energies);
+extern "C" HRESULT CPU_API GetDynamics(Engine engine, double* pos, double* vel);
+extern "C" HRESULT CPU_API GetInstructionSet(Engine engine, const char** name);
+extern "C" HRESULT CPU_API ReleaseEngine(Engine engine);
+extern "C" HRESULT CPU_API CreateAnalysis(const int* type, int types, int ions, int threads, Analysis* analysis);
+extern "C" HRESULT CPU_API Analyze(Analysis analysis, const double* pos, const double* origin, const AnalysisParameters* parameters,
+	int* rfr, int* layer_count, double* layer_dist, int* bilayer_count, double* bilayer_dist);
+extern "C" HRESULT CPU_API PairHistogram(Analysis analysis, const double* pos, double r_max, double core, int bins, int* histogram, int* centers);
+extern "C" HRESULT CPU_API ReleaseAnalysis(Analysis analysis);
+// Waits up to timeout seconds for the workers; max_ions bounds the messages
+extern "C" HRESULT CPU_API CreatePartition(const char* address, int workers, int max_ions, double timeout, Partition* partition);
+extern "C" HRESULT CPU_API InitPartition(Partition partition, const char* form, int precision, double cutoff, const int* type, const double* coefs, int types, int ions);
+extern "C" HRESULT CPU_API PartitionForce(Partition partition, const double* pos, double* acc);
+extern "C" HRESULT CPU_API PartitionEnergy(Partition partition, const double* pos, double* acc, double* energy);
+// bounds - int[workers + 1], the rows of the workers; seconds - double[workers], their compute time in the last call
+extern "C" HRESULT CPU_API GetPartitionRows(Partition partition, int* bounds, double* seconds);
+extern "C" HRESULT CPU_API ReleasePartition(Partition partition);
+// Serves the master at address as worker rank until it releases the partition (threads <= 0: CPUONE_THREADS or all hardware threads)
+extern "C" HRESULT CPU_API RunPartitionWorker(const char* address, int rank, int threads, double timeout);
+extern "C" HRESULT CPU_API CreateEnsemble(int precision, double cutoff, int threads, Ensemble* ensemble);
+// system == the number of systems adds one, a smaller index replaces it
+extern "C" HRESULT CPU_API InitEnsembleSystem(Ensemble ensemble, int system, const char* form, const int* type, const double* coefs, int types, int ions);
+extern "C" HRESULT CPU_API SetSystemPositions(Ensemble ensemble, int system, const double* pos);
+// energies - double[systems] or NULL for the forces only
+extern "C" HRESULT CPU_API ComputeEnsemble(Ensemble ensemble, double* energies);
+extern "C" HRESULT CPU_API GetSystemForces(Ensemble ensemble, int system, double* acc);
+extern "C" HRESULT CPU_API ReleaseEnsemble(Ensemble ensemble);
+
+extern "C" void CPU_API DecodeError(HRESULT hr, const char **output);
+
+// Arrays of the managed side:
+//  type - int[ions], sorted by type (MDIBC.Init), so the ions of each type form one contiguous run;
+//  coefs - PairPotentials.CoefsDouble8: 8 doubles per pair of types (Ke*qi*qj, Born-Mayer A and -1/rho, dispersion C, Morse D, -alpha, r0),
+//   for Buckingham4 followed by the O-O spline of the .spp: Range2 (6, highest power first), Range3 (4), Bounds (2);
+//  pos, acc - Double3[ions], 3 doubles per ion; acc is overwritten (not accumulated);
+//  vel - Double3[ions], mass - MDIBC.mass, per type;
+//  origin - MDIBC.origin, Double3[ions]; rfr, layer_*, bilayer_* - flat arrays of AnalysisEngine::Analyze.
+
+#endif
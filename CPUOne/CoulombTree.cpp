@@ -0,0 +1,237 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <math.h>
+
+#define TREE_LEVELS 21 // bits of Morton keys per axis
+
+HRESULT CoulombTree::SetParameters(double theta, int order, int leaf_size)
+{
+	// theta >= 1 would accept a cell seen from inside its own sphere of sources, the ion's own cell among them
+	if (!(theta > 0 && theta < 1) || order < 0 || order > 2 || leaf_size < 1) return E_INVALIDARG;
+	this->theta = theta; this->order = order; this->leaf_size = leaf_size;
+	return S_OK;
+}
+
+void CoulombTree::SetSources(const std::vector<double>& charge, const std::vector<double>& dispersion, const int* type, int ions)
+{
+	charge_of_type = charge;
+	dispersion_of_type = dispersion;
+	this->type.assign(type, type + ions);
+	this->ions = ions;
+	nodes.clear();
+}
+
+static unsigned long long Spread(unsigned v) // 21 bits -> every third bit
+{
+	unsigned long long x = v & 0x1FFFFF;
+	x = (x | x << 32) & 0x1F00000000FFFFULL;
+	x = (x | x << 16) & 0x1F0000FF0000FFULL;
+	x = (x | x << 8) & 0x100F00F00F00F00FULL;
+	x = (x | x << 4) & 0x10C30C30C30C30C3ULL;
+	x = (x | x << 2) & 0x1249249249249249ULL;
+	return x;
+}
+
+template <class real> void CoulombTree::Build(ThreadPool& pool, const real* px, const real* py, const real* pz)
+{
+	// Bounding cube and Morton order of the ions
+	double lo[3] = { px[0], py[0], pz[0] }, hi[3] = { px[0], py[0], pz[0] };
+	for (int i = 1; i < ions; i++)
+	{
+		double p[3] = { px[i], py[i], pz[i] };
+		for (int m = 0; m < 3; m++) { if (p[m] < lo[m]) lo[m] = p[m]; if (p[m] > hi[m]) hi[m] = p[m]; }
+	}
+	double size = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2])) * 1.0001 + 1e-6;
+	double center[3] = { lo[0] + size / 2, lo[1] + size / 2, lo[2] + size / 2 }, cells = (double)(1 << TREE_LEVELS);
+	std::vector<std::pair<unsigned long long, int> > order_keys(ions);
+	for (int i = 0; i < ions; i++)
+	{
+		unsigned c[3] = { (unsigned)((px[i] - lo[0]) / size * cells), (unsigned)((py[i] - lo[1]) / size * cells), (unsigned)((pz[i] - lo[2]) / size * cells) };
+		order_keys[i] = std::make_pair(Spread(c[0]) | Spread(c[1]) << 1 | Spread(c[2]) << 2, i);
+	}
+	std::sort(order_keys.begin(), order_keys.end());
+
+	std::vector<unsigned long long> keys(ions);
+	index.resize(ions); x.resize(ions); y.resize(ions); z.resize(ions); charge.resize(ions); dispersion.resize(ions);
+	for (int t = 0; t < ions; t++)
+	{
+		int i = index[t] = order_keys[t].second;
+		keys[t] = order_keys[t].first;
+		x[t] = px[i]; y[t] = py[i]; z[t] = pz[i];
+		charge[t] = charge_of_type[type[i]];
+		dispersion[t] = dispersion_of_type[type[i]];
+	}
+
+	nodes.clear();
+	nodes.reserve(2 * ions / leaf_size + 64);
+	nodes.push_back(Leaf(center, size, 0, ions));
+	Split(keys, 0, 0);
+	pool.Run((int)nodes.size(), [&](int k, int worker) { Moments(nodes[k]); });
+}
+
+void CoulombTree::Split(const std::vector<unsigned long long>& keys, int k, int level)
+{
+	Node n = nodes[k];
+	if (n.end - n.begin <= leaf_size || level == TREE_LEVELS) return;
+
+	// Octants are contiguous in Morton order: split the range by the 3 bits of this level
+	int shift = 3 * (TREE_LEVELS - 1 - level), split[9];
+	split[0] = n.begin; split[8] = n.end;
+	for (int o = 1; o < 8; o++)
+	{
+		int a = split[o - 1], b = n.end;
+		while (a < b) { int m = (a + b) / 2; if ((int)((keys[m] >> shift) & 7) < o) a = m + 1; else b = m; }
+		split[o] = a;
+	}
+	// The children of a node are contiguous, the traversal pushes first_child .. first_child + children - 1
+	int first = (int)nodes.size();
+	for (int o = 0; o < 8; o++)
+	{
+		if (split[o] == split[o + 1]) continue;
+		double h = n.size / 4, c[3] = { n.center[0] + ((o & 1) ? h : -h), n.center[1] + ((o & 2) ? h : -h), n.center[2] + ((o & 4) ? h : -h) };
+		nodes.push_back(Leaf(c, n.size / 2, split[o], split[o + 1]));
+	}
+	int last = (int)nodes.size();
+	nodes[k].first_child = first; nodes[k].children = last - first;
+	for (int c = first; c < last; c++) Split(keys, c, level + 1);
+}
+
+CoulombTree::Node CoulombTree::Leaf(const double* center, double size, int begin, int end)
+{
+	Node n;
+	n.center[0] = center[0]; n.center[1] = center[1]; n.center[2] = center[2]; n.size = size;
+	n.begin = begin; n.end = end; n.first_child = -1; n.children = 0;
+	return n;
+}
+
+void CoulombTree::Moments(Node& n) const
+{
+	// Expansion about the |q|-weighted centroid (the cube center for a cell without charges), radius: the farthest ion
+	double a = 0, o[3] = { 0, 0, 0 };
+	for (int t = n.begin; t < n.end; t++) { double s = fabs(charge[t]); a += s; o[0] += s * x[t]; o[1] += s * y[t]; o[2] += s * z[t]; }
+	for (int m = 0; m < 3; m++) n.origin[m] = a > 0 ? o[m] / a : n.center[m];
+	n.radius = 0;
+	for (int t = n.begin; t < n.end; t++)
+	{
+		double d[3] = { x[t] - n.origin[0], y[t] - n.origin[1], z[t] - n.origin[2] };
+		n.radius = std::max(n.radius, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+	n.radius = sqrt(n.radius);
+
+	n.q = n.w = 0;
+	for (int m = 0; m < 3; m++) n.p[m] = n.centroid[m] = 0;
+	for (int m = 0; m < 6; m++) n.Q[m] = 0;
+	for (int t = n.begin; t < n.end; t++)
+	{
+		double d[3] = { x[t] - n.origin[0], y[t] - n.origin[1], z[t] - n.origin[2] }, s = charge[t], d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+		n.q += s;
+		for (int m = 0; m < 3; m++) n.p[m] += s * d[m];
+		n.Q[0] += s * (3 * d[0] * d[0] - d2); n.Q[1] += s * (3 * d[1] * d[1] - d2); n.Q[2] += s * (3 * d[2] * d[2] - d2);
+		n.Q[3] += s * 3 * d[0] * d[1]; n.Q[4] += s * 3 * d[0] * d[2]; n.Q[5] += s * 3 * d[1] * d[2];
+		n.w += dispersion[t];
+		n.centroid[0] += dispersion[t] * x[t]; n.centroid[1] += dispersion[t] * y[t]; n.centroid[2] += dispersion[t] * z[t];
+	}
+	for (int m = 0; m < 3; m++) n.centroid[m] = n.w != 0 ? n.centroid[m] / n.w : n.center[m];
+}
+
+void CoulombTree::Field(int t, double* f, double* u) const
+{
+	const double xi = x[t], yi = y[t], zi = z[t], si = charge[t], di = dispersion[t], theta2 = theta * theta;
+	double fx = 0, fy = 0, fz = 0, U = 0;
+	int stack[8 * TREE_LEVELS + 8], top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const Node& n = nodes[stack[--top]];
+		double d[3] = { xi - n.origin[0], yi - n.origin[1], zi - n.origin[2] }, R2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+		if (n.radius * n.radius < theta2 * R2)
+		{
+			// Multipole expansion, E = -grad(phi)
+			double r1 = 1 / sqrt(R2), r2 = r1 * r1, r3 = r1 * r2, r5 = r3 * r2;
+			double phi = n.q * r1, E[3] = { n.q * r3 * d[0], n.q * r3 * d[1], n.q * r3 * d[2] };
+			if (order >= 1)
+			{
+				double pd = n.p[0] * d[0] + n.p[1] * d[1] + n.p[2] * d[2];
+				phi += pd * r3;
+				for (int m = 0; m < 3; m++) E[m] += 3 * pd * r5 * d[m] - n.p[m] * r3;
+			}
+			if (order >= 2)
+			{
+				double Qd[3] = { n.Q[0] * d[0] + n.Q[3] * d[1] + n.Q[4] * d[2], n.Q[3] * d[0] + n.Q[1] * d[1] + n.Q[5] * d[2], n.Q[4] * d[0] + n.Q[5] * d[1] + n.Q[2] * d[2] };
+				double dQd = Qd[0] * d[0] + Qd[1] * d[1] + Qd[2] * d[2], r7 = r5 * r2;
+				phi += 0.5 * dQd * r5;
+				for (int m = 0; m < 3; m++) E[m] += 2.5 * dQd * r7 * d[m] - Qd[m] * r5;
+			}
+			fx += si * E[0]; fy += si * E[1]; fz += si * E[2]; U += si * phi;
+			if (n.w != 0 && di != 0)
+			{
+				double e[3] = { xi - n.centroid[0], yi - n.centroid[1], zi - n.centroid[2] }, r = 1 / (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]), r6 = r * r * r, c = di * n.w;
+				double dU = -6 * c * r6 * r;
+				fx += e[0] * dU; fy += e[1] * dU; fz += e[2] * dU; U -= c * r6;
+			}
+		}
+		else if (n.children == 0)
+		{
+			for (int j = n.begin; j < n.end; j++)
+			{
+				if (j == t) continue;
+				double dx = xi - x[j], dy = yi - y[j], dz = zi - z[j], r = 1 / sqrt(dx * dx + dy * dy + dz * dz), r2 = r * r;
+				double c = si * charge[j], C = di * dispersion[j], r6 = r2 * r2 * r2;
+				double dU = c * r2 * r - 6 * C * r6 * r2;
+				fx += dx * dU; fy += dy * dU; fz += dz * dU; U += c * r - C * r6;
+			}
+		}
+		else for (int c = 0; c < n.children; c++) stack[top++] = n.first_child + c;
+	}
+	f[0] = fx; f[1] = fy; f[2] = fz; *u = U;
+}
+
+void CoulombTree::Compute(ThreadPool& pool, double* acc, double* energy) const
+{
+	const int chunk = 256, chunks = (ions + chunk - 1) / chunk;
+	std::vector<double> chunk_energy(chunks);
+	pool.Run(chunks, [&](int c, int worker) {
+		double U = 0, u;
+		for (int t = c * chunk, end = std::min(ions, t + chunk); t < end; t++) { Field(t, acc + 3 * index[t], &u); U += u; }
+		chunk_energy[c] = U;
+	});
+	if (energy != NULL)
+	{
+		double U = 0;
+		for (int c = 0; c < chunks; c++) U += chunk_energy[c];
+		*energy = 0.5 * U;
+	}
+}
+
+void CoulombTree::Exact(int t, double* f) const
+{
+	double fx = 0, fy = 0, fz = 0;
+	for (int j = 0; j < ions; j++)
+	{
+		if (j == t) continue;
+		double dx = x[t] - x[j], dy = y[t] - y[j], dz = z[t] - z[j], r = 1 / sqrt(dx * dx + dy * dy + dz * dz), r2 = r * r, r6 = r2 * r2 * r2;
+		double dU = charge[t] * charge[j] * r2 * r - 6 * dispersion[t] * dispersion[j] * r6 * r2;
+		fx += dx * dU; fy += dy * dU; fz += dz * dU;
+	}
+	f[0] = fx; f[1] = fy; f[2] = fz;
+}
+
+void CoulombTree::Error(ThreadPool& pool, int samples, double* rms, double* max) const
+{
+	int stride = samples <= 0 || samples >= ions ? 1 : ions / samples, count = (ions + stride - 1) / stride;
+	std::vector<double> df2(count), f2(count);
+	pool.Run(count, [&](int s, int worker) {
+		double f[3], e[3], u;
+		Field(s * stride, f, &u);
+		Exact(s * stride, e);
+		df2[s] = (f[0] - e[0]) * (f[0] - e[0]) + (f[1] - e[1]) * (f[1] - e[1]) + (f[2] - e[2]) * (f[2] - e[2]);
+		f2[s] = e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+	});
+	double sum_df2 = 0, sum_f2 = 0, max_df2 = 0;
+	for (int s = 0; s < count; s++) { sum_df2 += df2[s]; sum_f2 += f2[s]; max_df2 = std::max(max_df2, df2[s]); }
+	*rms = sum_f2 > 0 ? sqrt(sum_df2 / sum_f2) : 0;
+	*max = sum_f2 > 0 ? sqrt(max_df2 / (sum_f2 / count)) : 0;
+}
+
+template void CoulombTree::Build<float>(ThreadPool&, const float*, const float*, const float*);
+template void CoulombTree::Build<double>(ThreadPool&, const double*, const double*, const double*);
@@ -0,0 +1,58 @@
+#ifndef _COULOMB_TREE_H_
+#define _COULOMB_TREE_H_
+
+#include <vector>
+#include "ThreadPool.h"
+
+// Barnes-Hut octree for the long-range terms of an isolated cluster (free space, no periodic images): Coulomb and,
+// for Buckingham and BuckinghamMorse, the dispersion that ForceCPU_IBC does not cut. O(N log N) per evaluation.
+// Sources factorize the pair coefficients: charge[type_i] * charge[type_j] = Ke * qi * qj (c0 of CoefsDouble8),
+// dispersion[type_i] * dispersion[type_j] = C (c3). The multipoles of a cell are taken about the |q|-weighted
+// centroid of its ions; a cell whose ions lie within radius b of it, seen from distance d, is replaced by its
+// expansion when b < theta * d: monopole (order 0), + dipole (1), + quadrupole (2); the dispersion of a cell is its
+// monopole at the dispersion-weighted centroid. 0 < theta < 1, so an ion never takes its own cell as far away.
+// Smaller theta: more accurate, slower.
+// Every ion is evaluated independently, so the result does not depend on the number of threads.
+class CoulombTree
+{
+public:
+	CoulombTree() : theta(0.2), order(2), leaf_size(16), ions(0) { }
+
+	HRESULT SetParameters(double theta, int order, int leaf_size);
+	void SetSources(const std::vector<double>& charge, const std::vector<double>& dispersion, const int* type, int ions);
+	template <class real> void Build(ThreadPool& pool, const real* x, const real* y, const real* z);
+	void Compute(ThreadPool& pool, double* acc, double* energy) const; // acc is overwritten, 3 per ion
+	// Forces of every (ions / samples)-th ion against the exact all-pairs sum: sqrt(sum |dF|^2 / sum |F|^2) and
+	// max |dF| / rms |F|; samples <= 0: all ions
+	void Error(ThreadPool& pool, int samples, double* rms, double* max) const;
+
+	double Theta() const { return theta; }
+	int Order() const { return order; }
+	int Nodes() const { return (int)nodes.size(); }
+
+private:
+	struct Node
+	{
+		double center[3], size; // cube
+		int begin, end; // ions in tree order
+		int first_child, children; // children are contiguous in nodes, none for a leaf
+		double origin[3], radius; // of the expansion: the |q|-weighted centroid and the distance of the farthest ion
+		double q, p[3], Q[6]; // multipoles about origin: xx, yy, zz, xy, xz, yz of the traceless quadrupole
+		double w, centroid[3]; // dispersion monopole
+	};
+	static Node Leaf(const double* center, double size, int begin, int end);
+	void Split(const std::vector<unsigned long long>& keys, int k, int level);
+	void Moments(Node& n) const;
+	void Field(int t, double* f, double* u) const; // ion t in tree order: long-range force and energy
+	void Exact(int t, double* f) const;
+
+	double theta;
+	int order, leaf_size, ions;
+	std::vector<Node> nodes;
+	std::vector<int> index; // tree order -> ion
+	std::vector<double> x, y, z, charge, dispersion; // in tree order
+	std::vector<double> charge_of_type, dispersion_of_type;
+	std::vector<int> type;
+};
+
+#endif
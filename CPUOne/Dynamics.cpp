@@ -0,0 +1,160 @@
+#include "stdafx.h"
+#include <math.h>
+
+#define DYNAMICS_CHUNK 2048 // ions per partial sum
+
+HRESULT Dynamics::Init(const double* pos, const double* vel, const double* mass, const int* type, int types, int ions)
+{
+	if (pos == NULL || vel == NULL || mass == NULL || type == NULL || ions <= 0) return E_INVALIDARG;
+	this->ions = ions;
+	x.resize(ions); y.resize(ions); z.resize(ions); vx.resize(ions); vy.resize(ions); vz.resize(ions); m.resize(ions);
+	acc.assign(ions * 3, 0);
+	acc_long.assign(ions * 3, 0);
+	for (int i = 0; i < ions; i++)
+	{
+		if (type[i] < 0 || type[i] >= types || mass[type[i]] <= 0) { this->ions = 0; return E_INVALIDARG; }
+		x[i] = pos[i * 3]; y[i] = pos[i * 3 + 1]; z[i] = pos[i * 3 + 2];
+		vx[i] = vel[i * 3]; vy[i] = vel[i * 3 + 1]; vz[i] = vel[i * 3 + 2];
+		m[i] = mass[type[i]];
+	}
+	chunk_sums.resize((ions + DYNAMICS_CHUNK - 1) / DYNAMICS_CHUNK * SUMS);
+	return S_OK;
+}
+
+HRESULT Dynamics::Get(double* pos, double* vel) const
+{
+	if (ions == 0) return E_FAIL;
+	for (int i = 0; i < ions; i++)
+	{
+		if (pos != NULL) { pos[i * 3] = x[i]; pos[i * 3 + 1] = y[i]; pos[i * 3 + 2] = z[i]; }
+		if (vel != NULL) { vel[i * 3] = vx[i]; vel[i * 3 + 1] = vy[i]; vel[i * 3 + 2] = vz[i]; }
+	}
+	return S_OK;
+}
+
+static inline double Sign(double a) { return a > 0 ? 1 : a < 0 ? -1 : 0; } // Math.Sign
+
+template <class real> void Dynamics::Drift(ThreadPool& pool, real** engine_pos, const DynamicsParameters& p, double scale)
+{
+	const int chunks = (ions + DYNAMICS_CHUNK - 1) / DYNAMICS_CHUNK;
+	const double dt = p.dt, r2 = p.evaporation_r2;
+	pool.Run(chunks, [&](int c, int worker) {
+		const int begin = c * DYNAMICS_CHUNK, end = begin + DYNAMICS_CHUNK < ions ? begin + DYNAMICS_CHUNK : ions;
+		real *ex = engine_pos[0], *ey = engine_pos[1], *ez = engine_pos[2];
+		for (int i = begin; i < end; i++)
+		{
+			double ux = vx[i] * scale, uy = vy[i] * scale, uz = vz[i] * scale;
+			double px = x[i] + ux * dt, py = y[i] + uy * dt, pz = z[i] + uz * dt;
+			if (px * px + py * py + pz * pz > r2) // RevertEvaporatedParticles
+			{
+				ux = -Sign(px) * fabs(ux); uy = -Sign(py) * fabs(uy); uz = -Sign(pz) * fabs(uz);
+			}
+			vx[i] = ux; vy[i] = uy; vz[i] = uz;
+			x[i] = px; y[i] = py; z[i] = pz;
+			ex[i] = (real)px; ey[i] = (real)py; ez[i] = (real)pz;
+		}
+	});
+}
+
+HRESULT Dynamics::Step(ThreadPool& pool, ForceEngine& engine, const DynamicsParameters& p, int steps, double* temperatures, double* energies)
+{
+	if (ions == 0 || ions != engine.Ions()) return E_FAIL;
+	if (steps < 0 || p.dt <= 0 || p.tau <= 0 || p.tau_relaxation <= 0 || p.energy_interval <= 0) return E_INVALIDARG;
+	if (steps > 0 && (temperatures == NULL || energies == NULL)) return E_INVALIDARG;
+	const int chunks = (ions + DYNAMICS_CHUNK - 1) / DYNAMICS_CHUNK;
+	const double dt = p.dt, k3N = KB * 3 * ions;
+	double *a = &acc[0], *l = &acc_long[0];
+	const int respa = p.respa_outer > 1 ? p.respa_outer : 1;
+
+	HRESULT hr = engine.SetPositions(&x[0], &y[0], &z[0]);
+	if (FAILED(hr)) return hr;
+	for (int k = 0; k < steps; k++)
+	{
+		const int step = p.step + 1 + k;
+		const bool energy = step % p.energy_interval == 0, outer = respa > 1 && step % respa == 0;
+		if (respa == 1) hr = energy ? engine.Energy(a, &energies[k]) : engine.Force(a);
+		else
+		{
+			double U_long = 0, U_short = 0;
+			if (outer || energy) hr = engine.Part(PART_LONG, l, energy ? &U_long : NULL);
+			if (!FAILED(hr)) hr = engine.Part(PART_SHORT, a, energy ? &U_short : NULL);
+			if (energy) energies[k] = U_short + U_long;
+		}
+		if (FAILED(hr)) return hr;
+		const double long_kick = outer ? respa : 0;
+
+		// Sweep 1: kick, impulse, inertia, angular momentum and position sums
+		pool.Run(chunks, [&](int c, int worker) {
+			const int begin = c * DYNAMICS_CHUNK, end = begin + DYNAMICS_CHUNK < ions ? begin + DYNAMICS_CHUNK : ions;
+			double s[SUMS] = { 0 };
+			for (int i = begin; i < end; i++)
+			{
+				double mi = m[i], h = dt / mi, rx = x[i], ry = y[i], rz = z[i];
+				double ax = a[i * 3] + long_kick * l[i * 3], ay = a[i * 3 + 1] + long_kick * l[i * 3 + 1], az = a[i * 3 + 2] + long_kick * l[i * 3 + 2];
+				double ux = vx[i] + ax * h, uy = vy[i] + ay * h, uz = vz[i] + az * h;
+				vx[i] = ux; vy[i] = uy; vz[i] = uz;
+				s[SUM_IMPULSE] += mi * ux; s[SUM_IMPULSE + 1] += mi * uy; s[SUM_IMPULSE + 2] += mi * uz;
+				s[SUM_MOMENT] += mi * (ry * uz - rz * uy); s[SUM_MOMENT + 1] += mi * (rz * ux - rx * uz); s[SUM_MOMENT + 2] += mi * (rx * uy - ry * ux);
+				s[SUM_POSITION] += rx; s[SUM_POSITION + 1] += ry; s[SUM_POSITION + 2] += rz;
+				s[SUM_INERTIA] += mi * (ry * ry + rz * rz); s[SUM_INERTIA + 1] += mi * (rx * rx + rz * rz); s[SUM_INERTIA + 2] += mi * (rx * rx + ry * ry);
+				s[SUM_INERTIA + 3] -= mi * rx * ry; s[SUM_INERTIA + 4] -= mi * ry * rz; s[SUM_INERTIA + 5] -= mi * rx * rz;
+			}
+			for (int n = 0; n < SUMS; n++) chunk_sums[c * SUMS + n] = s[n];
+		});
+		double s[SUMS] = { 0 };
+		for (int c = 0; c < chunks; c++)
+			for (int n = 0; n < SUMS; n++) s[n] += chunk_sums[c * SUMS + n];
+
+		// Correct: impulse per ion, the angular momentum after its correction L - (sum r) x impulse, w = I^-1 L
+		double P[3] = { s[SUM_IMPULSE] / ions, s[SUM_IMPULSE + 1] / ions, s[SUM_IMPULSE + 2] / ions };
+		const double* R = s + SUM_POSITION;
+		double L[3] = {
+			s[SUM_MOMENT] - (R[1] * P[2] - R[2] * P[1]),
+			s[SUM_MOMENT + 1] - (R[2] * P[0] - R[0] * P[2]),
+			s[SUM_MOMENT + 2] - (R[0] * P[1] - R[1] * P[0]) };
+		const double* I = s + SUM_INERTIA;
+		double xx = I[0], yy = I[1], zz = I[2], xy = I[3], yz = I[4], xz = I[5];
+		double c0 = yy * zz - yz * yz, c1 = xz * yz - xy * zz, c2 = xy * yz - yy * xz;
+		double det = 1 / (xx * c0 + xy * c1 + xz * c2);
+		double inv[3][3] = {
+			{ c0 * det, c1 * det, c2 * det },
+			{ c1 * det, (xx * zz - xz * xz) * det, (xy * xz - xx * yz) * det },
+			{ c2 * det, (xy * xz - xx * yz) * det, (xx * yy - xy * xy) * det } };
+		double w[3];
+		for (int n = 0; n < 3; n++) w[n] = inv[n][0] * L[0] + inv[n][1] * L[1] + inv[n][2] * L[2];
+
+		// Sweep 2: corrected velocities and the kinetic energy
+		pool.Run(chunks, [&](int c, int worker) {
+			const int begin = c * DYNAMICS_CHUNK, end = begin + DYNAMICS_CHUNK < ions ? begin + DYNAMICS_CHUNK : ions;
+			double mvv = 0;
+			for (int i = begin; i < end; i++)
+			{
+				double mi = m[i], rx = x[i], ry = y[i], rz = z[i];
+				double ux = vx[i] - P[0] / mi - (w[1] * rz - w[2] * ry);
+				double uy = vy[i] - P[1] / mi - (w[2] * rx - w[0] * rz);
+				double uz = vz[i] - P[2] / mi - (w[0] * ry - w[1] * rx);
+				vx[i] = ux; vy[i] = uy; vz[i] = uz;
+				mvv += mi * (ux * ux + uy * uy + uz * uz);
+			}
+			chunk_sums[c * SUMS] = mvv;
+		});
+		double mvv = 0;
+		for (int c = 0; c < chunks; c++) mvv += chunk_sums[c * SUMS];
+		double T_system = temperatures[k] = mvv / k3N;
+
+		// Sweep 3: Berendsen scaling (tau = 1 step is plain velocity scaling), drift and the evaporation guard
+		double tau = step < p.relaxation ? p.tau_relaxation : p.tau;
+		double scale = sqrt(1 + (p.T / T_system - 1) / tau);
+		if (engine.Single())
+		{
+			float* e[3] = { engine.Positions<float>(0), engine.Positions<float>(1), engine.Positions<float>(2) };
+			Drift(pool, e, p, scale);
+		}
+		else
+		{
+			double* e[3] = { engine.Positions<double>(0), engine.Positions<double>(1), engine.Positions<double>(2) };
+			Drift(pool, e, p, scale);
+		}
+	}
+	return S_OK;
+}
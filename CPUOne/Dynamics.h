@@ -0,0 +1,54 @@
+#ifndef _DYNAMICS_H_
+#define _DYNAMICS_H_
+
+#include <vector>
+#include "ThreadPool.h"
+
+class ForceEngine;
+
+#define KB 8.617342791E-5 // eV / K, the same as MDIBC.Kb
+
+// Parameters of StepDynamics, the same layout as DynamicsParameters in IForce.cs
+struct DynamicsParameters
+{
+	double dt, T; // 1e-14 s, K
+	double tau, tau_relaxation; // Berendsen coupling in steps, tau_relaxation before step relaxation
+	double evaporation_r2; // A^2: an ion farther from the center gets its velocity turned back to the center
+	int step, relaxation, energy_interval; // step of the first call is step + 1, as MDIBC.Update counts
+	int respa_outer; // > 1: r-RESPA, the long-range part (ForceEngine::Part) only on steps that are multiples of it
+};
+
+// The integration part of MDIBC.Update on SoA arrays: velocity update, correction of the impulse and the angular
+// momentum, Berendsen scaling, position update and the evaporation guard. The managed code walks the ions eight
+// times per step; here it is three parallel sweeps:
+//  1) kick v += a dt / m, sums of the impulse, the inertia tensor, the angular momentum and the positions;
+//  2) v -= impulse / m + w x r with w from the sums of sweep 1 (the angular momentum of the corrected velocities
+//     follows from them), sum of m v^2 for the temperature;
+//  3) Berendsen scaling, drift r += v dt, evaporation guard, positions into the engine for the next force call.
+// Every sweep sums per chunk of ions and the chunks are added in order, so the results do not depend on threads.
+// With respa_outer = k > 1 the kick of sweep 1 takes the short-range forces every step and k times the long-range
+// forces every k-th step (impulse r-RESPA, as MDIBC.Force); the long part is also computed on energy steps, for the energy.
+class Dynamics
+{
+public:
+	Dynamics() : ions(0) { }
+
+	// pos, vel - 3 per ion; mass per type
+	HRESULT Init(const double* pos, const double* vel, const double* mass, const int* type, int types, int ions);
+	// steps from p.step + 1: temperatures[k] gets T_system of step k (before the Berendsen scaling, as Correct),
+	// energies[k] the potential energy where (p.step + 1 + k) % p.energy_interval == 0 and is not written otherwise
+	HRESULT Step(ThreadPool& pool, ForceEngine& engine, const DynamicsParameters& p, int steps, double* temperatures, double* energies);
+	HRESULT Get(double* pos, double* vel) const; // 3 per ion, either may be NULL
+
+	bool Empty() const { return ions == 0; }
+
+private:
+	template <class real> void Drift(ThreadPool& pool, real** engine_pos, const DynamicsParameters& p, double scale);
+
+	enum { SUM_IMPULSE = 0, SUM_MOMENT = 3, SUM_POSITION = 6, SUM_INERTIA = 9, SUMS = 15 }; // inertia: xx, yy, zz, xy, yz, xz
+	int ions;
+	std::vector<double> x, y, z, vx, vy, vz, m, acc, acc_long; // acc 3 per ion, as ForceEngine writes it
+	std::vector<double> chunk_sums; // SUMS per chunk
+};
+
+#endif
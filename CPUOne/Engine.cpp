@@ -0,0 +1,512 @@
+#include "stdafx.h"
+#include <math.h>
+
+template <class T> bool AlignedArray<T>::Resize(size_t n)
+{
+	Free(ptr); ptr = NULL; count = 0;
+	if (n == 0) return true;
+	void* p = NULL;
+#ifdef _WIN32
+	p = _aligned_malloc(n * sizeof(T), 64);
+#else
+	if (posix_memalign(&p, 64, n * sizeof(T)) != 0) p = NULL;
+#endif
+	if (p == NULL) return false;
+	ptr = (T*)p; count = n;
+	return true;
+}
+template <class T> void AlignedArray<T>::Free(T* p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+template class AlignedArray<float>;
+template class AlignedArray<double>;
+template class AlignedArray<int>;
+
+const KernelSet* Kernels(InstructionSet isa)
+{
+	switch (isa)
+	{
+		case ISA_AVX512: return &avx512_kernels;
+		case ISA_AVX2: return &avx2_kernels;
+		default: return &scalar_kernels;
+	}
+}
+
+ForceEngine::ForceEngine(PotentialForm form, Precision precision, double cutoff, int threads) : form(form), single(precision != PRECISION_DOUBLE), compensated(precision == PRECISION_MIXED), cutoff(cutoff), pool(NULL), ions(0), types(0), tile_size(0), tile_request(0), table_types(0), table_intervals(0), table_min(0), table_scale(0), skin(0), use_tree(false), tree_sources(E_FAIL)
+{
+	pool = new ThreadPool(threads);
+	isa = DetectInstructionSet();
+	kernels = Kernels(isa);
+}
+
+ForceEngine::~ForceEngine()
+{
+	for (size_t i = 0; i < workers.size(); i++) delete workers[i];
+	delete pool;
+}
+
+HRESULT ForceEngine::SetThreads(int threads)
+{
+	delete pool;
+	pool = new ThreadPool(threads);
+	if (ions > 0) AllocateWorkers();
+	return S_OK;
+}
+
+HRESULT ForceEngine::SetTileSize(int tile)
+{
+	if (tile < 0 || tile % 16 != 0 || tile > MAX_TILE) return E_INVALIDARG;
+	tile_request = tile;
+	return S_OK;
+}
+
+HRESULT ForceEngine::SetNeighborSkin(double skin)
+{
+	if (skin < 0) skin = 0;
+	this->skin = skin;
+	list.Clear();
+	return S_OK;
+}
+
+HRESULT ForceEngine::SetPotentialTable(const double* table, int types, int intervals, double r2_min, double scale)
+{
+	if (table == NULL) { this->table.clear(); table_intervals = 0; return S_OK; }
+	if (cutoff <= 0 || types <= 0 || intervals < 2 || r2_min < 0 || scale <= 0) return E_INVALIDARG;
+	if (fabs(r2_min + intervals / scale - cutoff * cutoff) > 1e-6 * cutoff * cutoff) return E_INVALIDARG; // must end at the cutoff
+	this->table.assign(table, table + (size_t)types * types * intervals * TABLE_COEFS);
+	table_types = types;
+	table_intervals = intervals;
+	table_min = r2_min;
+	table_scale = scale;
+	return S_OK;
+}
+
+HRESULT ForceEngine::SetCoulombTree(double theta, int order)
+{
+	if (theta <= 0) { use_tree = false; return S_OK; }
+	if (cutoff <= 0) return E_INVALIDARG; // the short-range terms would need all pairs anyway
+	HRESULT hr = tree.SetParameters(theta, order, 16);
+	if (FAILED(hr)) return hr;
+	if (ions > 0 && FAILED(tree_sources)) return tree_sources;
+	use_tree = true;
+	return S_OK;
+}
+
+HRESULT ForceEngine::CoulombTreeError(int samples, double* rms, double* max)
+{
+	if (rms == NULL || max == NULL) return E_INVALIDARG;
+	if (ions == 0) return E_FAIL;
+	if (FAILED(tree_sources)) return tree_sources;
+	if (single) BuildTree(pos_float); else BuildTree(pos_double);
+	tree.Error(*pool, samples, rms, max);
+	return S_OK;
+}
+
+// Per-type sources of the tree: f[t] * f[u] must give c[t * types + u] of every pair within 1e-9 relative,
+// c0 (Ke * qt * qu) for the charges, the uncut c3 for the dispersion
+static bool Factorize(const std::vector<double>& c, int types, std::vector<double>& f)
+{
+	f.assign(types, 0);
+	int r = 0;
+	while (r < types && c[r * types + r] == 0) r++;
+	if (r == types) { for (size_t k = 0; k < c.size(); k++) if (c[k] != 0) return false; return true; }
+	double crr = c[r * types + r], sr = sqrt(fabs(crr)), sign = crr > 0 ? 1 : -1;
+	for (int t = 0; t < types; t++) f[t] = c[r * types + t] / (sign * sr);
+	for (int t = 0; t < types; t++)
+		for (int u = 0; u < types; u++)
+			if (fabs(f[t] * f[u] - c[t * types + u]) > 1e-9 * fabs(crr)) return false;
+	return true;
+}
+
+HRESULT ForceEngine::TreeSources(const double* coefs)
+{
+	std::vector<double> c0(types * types), c3(types * types), charge, dispersion;
+	for (int k = 0; k < types * types; k++)
+	{
+		c0[k] = coefs[k * 8];
+		c3[k] = (coefs_double[LONG_RANGE][k].terms & TERM_DISPERSION) ? coefs[k * 8 + 3] : 0;
+	}
+	if (!Factorize(c0, types, charge) || !Factorize(c3, types, dispersion)) return E_NOTIMPL;
+	tree.SetSources(charge, dispersion, &type[0], ions);
+	return S_OK;
+}
+
+int PairVariant(PotentialForm form, int terms)
+{
+#define PAIR_VARIANT_ROW(f, t) { f, t },
+	static const struct { PotentialForm form; int terms; } rows[PAIR_VARIANT_COUNT] = { PAIR_VARIANTS(PAIR_VARIANT_ROW) };
+#undef PAIR_VARIANT_ROW
+	for (int k = 0; k < PAIR_VARIANT_COUNT; k++)
+		if (rows[k].form == form && rows[k].terms == terms) return k;
+	return PAIR_VARIANT_COUNT;
+}
+
+int PairTerms(PotentialForm form, const double* c, int k)
+{
+	int terms = TERM_COULOMB;
+	if (c[1] != 0) terms |= TERM_BORN_MAYER;
+	if (c[3] != 0) terms |= TERM_DISPERSION;
+	if (c[4] != 0 && form == FORM_BUCKINGHAM_MORSE) terms |= TERM_MORSE;
+	if (form == FORM_BUCKINGHAM4 && k == 0) terms = TERM_COULOMB | TERM_SPLINE; // the same rule as Buckingham4_Force of ForceCPU_IBC and IBC-B4.hlsl
+	return terms;
+}
+
+size_t CoefsCount(PotentialForm form, int types)
+{
+	return (size_t)types * types * 8 + (form == FORM_BUCKINGHAM4 ? SPLINE_COEFS : 0);
+}
+
+// The spline of the coefficients (SPLINE_COEFS: Range2, Range3, Bounds of the .spp) as PairCoefs::spline
+template <class real> static void SplineTerms(const double* spline, real* terms)
+{
+	const double *u2 = spline, *u3 = spline + 6;
+	terms[0] = (real)spline[10]; terms[1] = (real)spline[11];
+	for (int m = 0; m < 6; m++) terms[2 + m] = (real)u2[m];
+	for (int m = 0; m < 4; m++) terms[8 + m] = (real)u3[m];
+	for (int m = 0; m < 5; m++) terms[12 + m] = (real)(u2[m] * (5 - m));
+	for (int m = 0; m < 3; m++) terms[17 + m] = (real)(u3[m] * (3 - m));
+}
+
+int ForceEngine::TileSize(int ions)
+{
+	return ions < 8192 ? 64 : ions < 32768 ? 128 : 256;
+}
+
+void ForceEngine::AllocateWorkers()
+{
+	for (size_t i = 0; i < workers.size(); i++) delete workers[i];
+	workers.resize(pool->Threads());
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		Worker* w = workers[i] = new Worker();
+		w->acc.assign(ions * 3, 0);
+		w->row.resize((tile_size > 256 ? tile_size : 256) * 3); // rows of a tile or of a chunk of ShortRange
+		if (single) w->column_float.Resize(COLUMN_ARRAYS * (tile_size + PAD_IONS)); else w->column_double.Resize(COLUMN_ARRAYS * (tile_size + PAD_IONS));
+	}
+}
+
+// The arguments are checked before any state changes; a later failure (memory, the tree) leaves no ions, so the
+// other calls fail with E_FAIL instead of using buffers that are missing or sized for another number of ions
+HRESULT ForceEngine::Init(const int* type, const double* coefs, int types, int ions)
+{
+	if (type == NULL || coefs == NULL || types <= 0 || ions <= 0) return E_INVALIDARG;
+	for (int i = 0; i < ions; i++) if (type[i] < 0 || type[i] >= types) return E_INVALIDARG;
+	if (!table.empty() && table_types != types) return E_INVALIDARG;
+	this->ions = 0;
+	HRESULT hr = Setup(type, coefs, types, ions);
+	if (FAILED(hr)) this->ions = 0;
+	return hr;
+}
+
+HRESULT ForceEngine::Setup(const int* type, const double* coefs, int types, int ions)
+{
+	this->types = types;
+	this->ions = ions;
+	this->type.assign(type, type + ions);
+
+	// Runs of equal types: the kernels broadcast the coefficients of a run instead of gathering them per pair
+	runs.clear();
+	for (int i = 0; i < ions; i++)
+	{
+		if (runs.empty() || runs.back().type != type[i]) { Run r = { i, i + 1, type[i] }; runs.push_back(r); }
+		else runs.back().end = i + 1;
+	}
+
+	// Potential table: the cut terms of every pair become one lookup, in the precision of the engine
+	const size_t pair_table = (size_t)table_intervals * TABLE_COEFS;
+	if (!table.empty())
+	{
+		bool ok = single ? table_float.Resize(table.size()) : table_double.Resize(table.size());
+		if (!ok) return E_OUTOFMEMORY;
+		for (size_t m = 0; m < table.size(); m++)
+			if (single) table_float[m] = (float)table[m]; else table_double[m] = table[m];
+	}
+
+	short_pair.assign(types * types, 0);
+	for (int set = 0; set < 3; set++) { coefs_float[set].resize(types * types); coefs_double[set].resize(types * types); }
+	for (int k = 0; k < types * types; k++)
+	{
+		const double* c = coefs + k * 8;
+		int terms = PairTerms(form, c, k);
+		int short_terms = terms & (TERM_BORN_MAYER | TERM_MORSE | TERM_SPLINE);
+		if (form == FORM_BUCKINGHAM4) short_terms |= terms & TERM_DISPERSION; // cut there, see Buckingham4_Force
+		int long_terms = terms & ~short_terms;
+		if (!table.empty())
+		{
+			short_terms = 0;
+			for (size_t m = k * pair_table; m < (k + 1) * pair_table && short_terms == 0; m++) if (table[m] != 0) short_terms = TERM_TABLE;
+		}
+		int set_terms[3] = { long_terms | short_terms, long_terms, short_terms };
+		for (int set = 0; set < 3; set++)
+		{
+			for (int m = 0; m < 8; m++) { coefs_float[set][k].c[m] = (float)c[m]; coefs_double[set][k].c[m] = c[m]; }
+			coefs_float[set][k].terms = coefs_double[set][k].terms = set_terms[set];
+			coefs_float[set][k].variant = coefs_double[set][k].variant = PairVariant(form, set_terms[set]);
+			coefs_float[set][k].table = table.empty() || !single ? NULL : table_float.Data() + k * pair_table;
+			coefs_double[set][k].table = table.empty() || single ? NULL : table_double.Data() + k * pair_table;
+			if (terms & TERM_SPLINE)
+			{
+				SplineTerms(coefs + types * types * 8, coefs_float[set][k].spline);
+				SplineTerms(coefs + types * types * 8, coefs_double[set][k].spline);
+			}
+		}
+		short_pair[k] = short_terms != 0;
+	}
+
+	for (int m = 0; m < 3; m++)
+	{
+		bool ok = single ? pos_float[m].Resize(ions + PAD_IONS) : pos_double[m].Resize(ions + PAD_IONS);
+		if (!ok) return E_OUTOFMEMORY;
+		for (int i = ions; i < ions + PAD_IONS; i++)
+			if (single) pos_float[m][i] = 1e+10f; else pos_double[m][i] = 1e+10;
+	}
+
+	tree_sources = TreeSources(coefs);
+	if (use_tree && FAILED(tree_sources)) return tree_sources;
+
+	tile_size = tile_request > 0 ? tile_request : TileSize(ions); // fixed for the run, so the sums stay the same
+	int blocks = (ions + tile_size - 1) / tile_size;
+	tiles.clear();
+	for (int i = 0; i < blocks; i++)
+		for (int j = i; j < blocks; j++) { TileIndex t = { i, j }; tiles.push_back(t); }
+	tile_energy.resize(tiles.size());
+	list.Clear();
+	AllocateWorkers();
+	return S_OK;
+}
+
+HRESULT ForceEngine::SetPositions(const double* pos)
+{
+	if (pos == NULL) return E_INVALIDARG;
+	if (ions == 0) return E_FAIL;
+	if (single)
+	{
+		float *x = pos_float[0].Data(), *y = pos_float[1].Data(), *z = pos_float[2].Data();
+		for (int i = 0; i < ions; i++) { x[i] = (float)pos[i * 3]; y[i] = (float)pos[i * 3 + 1]; z[i] = (float)pos[i * 3 + 2]; }
+	}
+	else
+	{
+		double *x = pos_double[0].Data(), *y = pos_double[1].Data(), *z = pos_double[2].Data();
+		for (int i = 0; i < ions; i++) { x[i] = pos[i * 3]; y[i] = pos[i * 3 + 1]; z[i] = pos[i * 3 + 2]; }
+	}
+	return S_OK;
+}
+
+HRESULT ForceEngine::SetPositions(const double* px, const double* py, const double* pz)
+{
+	if (px == NULL || py == NULL || pz == NULL) return E_INVALIDARG;
+	if (ions == 0) return E_FAIL;
+	for (int i = 0; i < ions; i++)
+		if (single) { pos_float[0][i] = (float)px[i]; pos_float[1][i] = (float)py[i]; pos_float[2][i] = (float)pz[i]; }
+		else { pos_double[0][i] = px[i]; pos_double[1][i] = py[i]; pos_double[2][i] = pz[i]; }
+	return S_OK;
+}
+
+template <> float* ForceEngine::Positions<float>(int axis) { return pos_float[axis].Data(); }
+template <> double* ForceEngine::Positions<double>(int axis) { return pos_double[axis].Data(); }
+
+HRESULT ForceEngine::InitDynamics(const double* pos, const double* vel, const double* mass)
+{
+	if (ions == 0) return E_FAIL;
+	return dynamics.Init(pos, vel, mass, &type[0], types, ions);
+}
+
+template <class real> PairSystem<real> ForceEngine::System(const AlignedArray<real>* xyz, const std::vector<PairCoefs<real> >& coefs) const
+{
+	PairSystem<real> s;
+	s.ions = ions; s.types = types; s.runs = (int)runs.size();
+	s.x = xyz[0].Data(); s.y = xyz[1].Data(); s.z = xyz[2].Data();
+	s.type = &type[0];
+	s.run = &runs[0];
+	s.coefs = &coefs[0];
+	s.cutoff = cutoff > 0 ? (real)cutoff : (real)1e+30; // 0 = no cutoff
+	s.table_min = (real)table_min;
+	s.table_scale = (real)table_scale;
+	s.table_last = (real)(table_intervals - 1);
+	return s;
+}
+
+template <> PairSystem<float> ForceEngine::AllPairs<float>() const { return System(pos_float, coefs_float[ALL_TERMS]); }
+template <> PairSystem<double> ForceEngine::AllPairs<double>() const { return System(pos_double, coefs_double[ALL_TERMS]); }
+
+template <> float* ForceEngine::Columns<float>(int worker) { return workers[worker]->column_float.Data(); }
+template <> double* ForceEngine::Columns<double>(int worker) { return workers[worker]->column_double.Data(); }
+
+template <class real> HRESULT ForceEngine::Triangle(const PairSystem<real>& s, typename TileKernel<real>::f tile, double* acc, double* energy)
+{
+	const double scale = (double)(1LL << FIXED_BITS);
+	const int stride = tile_size + PAD_IONS;
+	std::atomic<bool> bounded(true);
+	pool->Run((int)tiles.size(), [&](int t, int worker) {
+		Worker& w = *workers[worker];
+		int i0 = tiles[t].i * tile_size, i1 = i0 + tile_size < ions ? i0 + tile_size : ions;
+		int j0 = tiles[t].j * tile_size, j1 = j0 + tile_size < ions ? j0 + tile_size : ions;
+		real* column = Columns<real>(worker);
+		memset(column, 0, sizeof(real) * COLUMN_ARRAYS * stride);
+		tile(s, i0, i1, j0, j1, &w.row[0], column, stride, energy != NULL ? &tile_energy[t] : NULL);
+
+		long long* a = &w.acc[0];
+		bool ok = true;
+		for (int i = i0; i < i1; i++)
+			for (int m = 0; m < 3; m++) ok &= AddFixed(a[i * 3 + m], (double)w.row[(i - i0) * 3 + m]);
+		for (int j = j0; j < j1; j++)
+			for (int m = 0; m < 3; m++) ok &= AddFixed(a[j * 3 + m], (double)ColumnSum(column, stride, m, j - j0, compensated));
+		if (!ok) bounded = false;
+	});
+
+	// Reduction in worker order, the buffers are cleared for the next call
+	const int chunk = 1024, workers_count = (int)workers.size();
+	pool->Run((ions + chunk - 1) / chunk, [&](int c, int worker) {
+		for (int k = c * chunk * 3, end = (c + 1) * chunk < ions ? (c + 1) * chunk * 3 : ions * 3; k < end; k++)
+		{
+			long long sum = 0;
+			bool ok = true;
+			for (int w = 0; w < workers_count; w++) { ok &= AddFixed(sum, workers[w]->acc[k]); workers[w]->acc[k] = 0; }
+			if (!ok) bounded = false;
+			acc[k] = sum / scale;
+		}
+	});
+	if (!bounded) return E_BOUNDS;
+
+	if (energy != NULL)
+	{
+		double U = 0;
+		for (size_t t = 0; t < tiles.size(); t++) U += tile_energy[t];
+		*energy = U;
+	}
+	return S_OK;
+}
+
+// Blocks of tile_size rows run on the pool. A block takes its own pairs from the triangle kernel on its diagonal tile
+// (row and column sums, both in the block) and the rest of its rows from tiles over [0, i0) and [i1, ions), whose
+// column sums are dropped; every row is summed in the same order for any number of threads.
+template <class real> void ForceEngine::RowSlice(const PairSystem<real>& s, typename TileKernel<real>::f tile, int begin, int end, double* acc, double* energy)
+{
+	const int stride = tile_size + PAD_IONS, blocks = (end - begin + tile_size - 1) / tile_size;
+	chunk_energy.assign(blocks, 0);
+	pool->Run(blocks, [&](int b, int worker) {
+		Worker& w = *workers[worker];
+		int i0 = begin + b * tile_size, i1 = i0 + tile_size < end ? i0 + tile_size : end;
+		real* column = Columns<real>(worker);
+		double* out = acc + (i0 - begin) * 3, U = 0;
+		memset(column, 0, sizeof(real) * COLUMN_ARRAYS * stride);
+		tile(s, i0, i1, i0, i1, &w.row[0], column, stride, energy != NULL ? &U : NULL);
+		for (int i = i0; i < i1; i++)
+			for (int m = 0; m < 3; m++) out[(i - i0) * 3 + m] = w.row[(i - i0) * 3 + m] + ColumnSum(column, stride, m, i - i0, compensated);
+
+		const int ranges[2][2] = { { 0, i0 }, { i1, ions } };
+		for (int r = 0; r < 2; r++)
+			for (int j0 = ranges[r][0]; j0 < ranges[r][1]; j0 += tile_size)
+			{
+				int j1 = j0 + tile_size < ranges[r][1] ? j0 + tile_size : ranges[r][1];
+				double u = 0;
+				memset(column, 0, sizeof(real) * COLUMN_ARRAYS * stride);
+				tile(s, i0, i1, j0, j1, &w.row[0], column, stride, energy != NULL ? &u : NULL);
+				for (int k = 0; k < (i1 - i0) * 3; k++) out[k] += w.row[k];
+				U += 0.5 * u;
+			}
+		chunk_energy[b] = U;
+	});
+	if (energy != NULL)
+	{
+		double U = 0;
+		for (int b = 0; b < blocks; b++) U += chunk_energy[b];
+		*energy = U;
+	}
+}
+
+template <class real> void ForceEngine::ShortRange(const PairSystem<real>& s, typename NeighborKernel<real>::f neighbors, double* acc, double* energy)
+{
+	const int chunk = 256, chunks = (ions + chunk - 1) / chunk;
+	chunk_energy.resize(chunks);
+	pool->Run(chunks, [&](int c, int worker) {
+		int begin = c * chunk, end = begin + chunk < ions ? begin + chunk : ions;
+		double* row = &workers[worker]->row[0];
+		neighbors(s, list.Offsets(), list.Indices(), begin, end, row, energy != NULL ? &chunk_energy[c] : NULL);
+		for (int k = begin * 3; k < end * 3; k++) acc[k] += row[k - begin * 3];
+	});
+	if (energy != NULL)
+	{
+		double U = 0;
+		for (int c = 0; c < chunks; c++) U += chunk_energy[c];
+		*energy += 0.5 * U;
+	}
+}
+
+template <class real> HRESULT ForceEngine::Compute(const AlignedArray<real>* xyz, const std::vector<PairCoefs<real> >* coefs, typename TileKernel<real>::f tile, typename NeighborKernel<real>::f neighbors, double* acc, double* energy)
+{
+	if (use_tree)
+	{
+		if (!list.Valid(*pool, xyz[0].Data(), xyz[1].Data(), xyz[2].Data(), ions))
+			list.Build(*pool, xyz[0].Data(), xyz[1].Data(), xyz[2].Data(), &type[0], types, short_pair, ions, cutoff, skin);
+		BuildTree(xyz);
+		tree.Compute(*pool, acc, energy);
+		ShortRange(System(xyz, coefs[SHORT_RANGE]), neighbors, acc, energy);
+		return S_OK;
+	}
+	if (skin <= 0 || cutoff <= 0) return Triangle(System(xyz, coefs[ALL_TERMS]), tile, acc, energy);
+	if (!list.Valid(*pool, xyz[0].Data(), xyz[1].Data(), xyz[2].Data(), ions))
+		list.Build(*pool, xyz[0].Data(), xyz[1].Data(), xyz[2].Data(), &type[0], types, short_pair, ions, cutoff, skin);
+	HRESULT hr = Triangle(System(xyz, coefs[LONG_RANGE]), tile, acc, energy);
+	if (FAILED(hr)) return hr;
+	ShortRange(System(xyz, coefs[SHORT_RANGE]), neighbors, acc, energy);
+	return S_OK;
+}
+
+template <class real> HRESULT ForceEngine::ComputePart(const AlignedArray<real>* xyz, const std::vector<PairCoefs<real> >* coefs, typename TileKernel<real>::f tile, typename NeighborKernel<real>::f neighbors, ForcePart part, double* acc, double* energy)
+{
+	if (part == PART_LONG)
+	{
+		if (!use_tree) return Triangle(System(xyz, coefs[LONG_RANGE]), tile, acc, energy);
+		BuildTree(xyz);
+		tree.Compute(*pool, acc, energy);
+		return S_OK;
+	}
+	if (!list.Valid(*pool, xyz[0].Data(), xyz[1].Data(), xyz[2].Data(), ions))
+		list.Build(*pool, xyz[0].Data(), xyz[1].Data(), xyz[2].Data(), &type[0], types, short_pair, ions, cutoff, skin);
+	memset(acc, 0, sizeof(double) * 3 * ions);
+	if (energy != NULL) *energy = 0;
+	ShortRange(System(xyz, coefs[SHORT_RANGE]), neighbors, acc, energy);
+	return S_OK;
+}
+
+HRESULT ForceEngine::Part(ForcePart part, double* acc, double* energy)
+{
+	if (acc == NULL || (part != PART_SHORT && part != PART_LONG)) return E_INVALIDARG;
+	if (ions == 0) return E_FAIL;
+	if (cutoff <= 0) return E_INVALIDARG; // no term is cut, nothing to split
+	if (single) return ComputePart(pos_float, coefs_float, TileFloat(), NeighborsFloat(), part, acc, energy);
+	return ComputePart(pos_double, coefs_double, kernels->tile_double, kernels->neighbors_double, part, acc, energy);
+}
+
+HRESULT ForceEngine::Force(double* acc)
+{
+	if (acc == NULL) return E_INVALIDARG;
+	if (ions == 0) return E_FAIL;
+	if (single) return Compute(pos_float, coefs_float, TileFloat(), NeighborsFloat(), acc, NULL);
+	return Compute(pos_double, coefs_double, kernels->tile_double, kernels->neighbors_double, acc, NULL);
+}
+
+HRESULT ForceEngine::Rows(int begin, int end, double* acc, double* energy)
+{
+	if (acc == NULL || begin < 0 || end < begin) return E_INVALIDARG;
+	if (ions == 0 || end > ions) return E_FAIL;
+	if (energy != NULL) *energy = 0;
+	if (begin == end) return S_OK;
+	if (single) RowSlice(System(pos_float, coefs_float[ALL_TERMS]), TileFloat(), begin, end, acc, energy);
+	else RowSlice(System(pos_double, coefs_double[ALL_TERMS]), kernels->tile_double, begin, end, acc, energy);
+	return S_OK;
+}
+
+HRESULT ForceEngine::Energy(double* acc, double* energy)
+{
+	if (acc == NULL || energy == NULL) return E_INVALIDARG;
+	if (ions == 0) return E_FAIL;
+	if (single) return Compute(pos_float, coefs_float, TileFloat(), NeighborsFloat(), acc, energy);
+	return Compute(pos_double, coefs_double, kernels->tile_double, kernels->neighbors_double, acc, energy);
+}
@@ -0,0 +1,260 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include <math.h>
+#include <vector>
+#include "ThreadPool.h"
+#include "NeighborList.h"
+#include "CoulombTree.h"
+#include "Dynamics.h"
+
+enum PotentialForm { FORM_BUCKINGHAM, FORM_BUCKINGHAM_MORSE, FORM_BUCKINGHAM4 };
+enum InstructionSet { ISA_SCALAR, ISA_AVX2, ISA_AVX512 };
+enum ForcePart { PART_SHORT, PART_LONG }; // the cut terms, and Coulomb with the uncut dispersion (see ForceEngine::Part)
+// The positions and pair terms in double or float; PRECISION_MIXED computes the pair terms in float like
+// PRECISION_SINGLE and adds them up with Kahan sums (the rows of a run, the columns of a tile), so the sums lose
+// about as much as one float rounding instead of growing with the number of ions
+enum Precision { PRECISION_DOUBLE, PRECISION_SINGLE, PRECISION_MIXED };
+
+InstructionSet DetectInstructionSet(); // the best one supported by CPU and OS, CPUONE_ISA=scalar|avx2|avx512 lowers it
+const char* InstructionSetName(InstructionSet isa);
+
+// Terms of a pair interaction (see CPUOne.h for the coefficient layout)
+#define TERM_COULOMB 16
+#define TERM_BORN_MAYER 1
+#define TERM_DISPERSION 2
+#define TERM_MORSE 4
+#define TERM_SPLINE 8 // Buckingham4 O-O: polynomials below the bounds of the spline, dispersion above
+#define TERM_TABLE 32 // the cut terms of the pair from the potential table (SetPotentialTable) instead of the above
+
+#define TABLE_COEFS 8 // per interval: cubic of dU, cubic of U
+#define SPLINE_COEFS 12 // after the pairs in the coefficients of FORM_BUCKINGHAM4 (see CPUOne.h)
+// PairCoefs::spline: bounds 2, U below bounds[0] (5th power first) 6, U below bounds[1] 4, then dU/dR of both 5 + 3
+#define SPLINE_TERMS 20
+
+// Term sets the pair kernels are compiled for, by potential form: the loop over a run of one type calls the
+// instantiation for the terms of the pair (PairCoefs::variant, the row here), so O-O, U-O and U-U each get an inlined
+// loop without tests of the terms. Init sets the variant of other term sets (zero coefficients the .spp does not
+// have) to PAIR_VARIANT_COUNT, the generic loop that tests the terms at runtime.
+#define PAIR_VARIANTS(X) \
+	X(FORM_BUCKINGHAM, TERM_COULOMB | TERM_BORN_MAYER | TERM_DISPERSION) \
+	X(FORM_BUCKINGHAM, TERM_COULOMB | TERM_BORN_MAYER) \
+	X(FORM_BUCKINGHAM, TERM_COULOMB | TERM_DISPERSION) \
+	X(FORM_BUCKINGHAM, TERM_COULOMB) \
+	X(FORM_BUCKINGHAM, TERM_BORN_MAYER) \
+	X(FORM_BUCKINGHAM, TERM_COULOMB | TERM_DISPERSION | TERM_TABLE) \
+	X(FORM_BUCKINGHAM, TERM_COULOMB | TERM_TABLE) \
+	X(FORM_BUCKINGHAM, TERM_TABLE) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_COULOMB | TERM_BORN_MAYER | TERM_DISPERSION) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_COULOMB | TERM_BORN_MAYER | TERM_MORSE) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_COULOMB | TERM_BORN_MAYER) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_COULOMB | TERM_DISPERSION) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_COULOMB) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_BORN_MAYER) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_BORN_MAYER | TERM_MORSE) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_COULOMB | TERM_DISPERSION | TERM_TABLE) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_COULOMB | TERM_TABLE) \
+	X(FORM_BUCKINGHAM_MORSE, TERM_TABLE) \
+	X(FORM_BUCKINGHAM4, TERM_COULOMB | TERM_SPLINE) \
+	X(FORM_BUCKINGHAM4, TERM_COULOMB | TERM_BORN_MAYER | TERM_DISPERSION) \
+	X(FORM_BUCKINGHAM4, TERM_COULOMB | TERM_BORN_MAYER) \
+	X(FORM_BUCKINGHAM4, TERM_COULOMB) \
+	X(FORM_BUCKINGHAM4, TERM_SPLINE) \
+	X(FORM_BUCKINGHAM4, TERM_BORN_MAYER | TERM_DISPERSION) \
+	X(FORM_BUCKINGHAM4, TERM_BORN_MAYER) \
+	X(FORM_BUCKINGHAM4, TERM_COULOMB | TERM_TABLE) \
+	X(FORM_BUCKINGHAM4, TERM_TABLE)
+#define PAIR_VARIANT_ROW_COUNT(form, terms) + 1
+enum { PAIR_VARIANT_COUNT = 0 PAIR_VARIANTS(PAIR_VARIANT_ROW_COUNT) };
+#define TERMS_GENERIC -1 // the terms template argument of the generic loop
+int PairVariant(PotentialForm form, int terms); // the row of PAIR_VARIANTS or PAIR_VARIANT_COUNT
+int PairTerms(PotentialForm form, const double* c, int k); // of the pair k = type_i * types + type_j with coefficients c
+size_t CoefsCount(PotentialForm form, int types); // doubles of the coefficients of a system
+
+template <class real> struct PairCoefs { real c[8]; int terms, variant; const real* table; real spline[SPLINE_TERMS]; }; // table: intervals of the pair
+struct Run { int begin, end, type; }; // contiguous ions of one type
+
+// SoA view of the engine state for the kernels; x, y, z are padded by PAD_IONS far-away ions after the last one
+#define PAD_IONS 16
+template <class real> struct PairSystem
+{
+	int ions, types, runs;
+	const real *x, *y, *z;
+	const int* type;
+	const Run* run;
+	const PairCoefs<real>* coefs; // [type_i * types + type_j]
+	real cutoff; // of Born-Mayer, Morse and Buckingham4 dispersion terms
+	real table_min, table_scale, table_last; // interval of R2 = (R2 - table_min) * table_scale, up to table_last
+};
+
+// Tile [i0, i1) x [j0, j1) of the upper triangle (see PairKernel::Tile): row gets 3 * (i1 - i0) sums, the column
+// arrays x, y, z at columns + m * stride (stride >= j1 - j0 + PAD_IONS) are accumulated into, energy (if not NULL) is
+// set to the tile sum. The mixed kernels need COLUMN_ARRAYS arrays: their compensations follow (see ColumnSum).
+template <class real> struct TileKernel { typedef void (*f)(const PairSystem<real>& s, int i0, int i1, int j0, int j1, double* row, real* columns, int stride, double* energy); };
+// Rows [begin, end) over the neighbor lists (see PairKernel::Neighbors): row gets 3 * (end - begin) sums, energy
+// (if not NULL) the sum of the pair energies of the rows (every pair is counted twice over all rows)
+template <class real> struct NeighborKernel { typedef void (*f)(const PairSystem<real>& s, const int* offsets, const int* neighbors, int begin, int end, double* row, double* energy); };
+struct KernelSet
+{
+	TileKernel<float>::f tile_float;
+	TileKernel<double>::f tile_double;
+	TileKernel<float>::f tile_mixed;
+	NeighborKernel<float>::f neighbors_float;
+	NeighborKernel<double>::f neighbors_double;
+	NeighborKernel<float>::f neighbors_mixed;
+};
+#define COLUMN_ARRAYS 6 // per tile: x, y, z and the compensations of the mixed kernels
+// Column m of element j (from j0) of a tile, stride apart (see TileKernel)
+template <class real> inline double ColumnSum(const real* columns, int stride, int m, int j, bool compensated)
+{
+	return compensated ? (double)columns[m * stride + j] - columns[(3 + m) * stride + j] : columns[m * stride + j];
+}
+extern const KernelSet scalar_kernels, avx2_kernels, avx512_kernels;
+const KernelSet* Kernels(InstructionSet isa);
+
+template <class T> class AlignedArray // 64-byte aligned storage for vector loads
+{
+public:
+	AlignedArray() : ptr(NULL), count(0) { }
+	~AlignedArray() { Free(ptr); }
+	bool Resize(size_t n);
+	T* Data() { return ptr; }
+	const T* Data() const { return ptr; }
+	T& operator[](size_t i) { return ptr[i]; }
+	size_t Count() const { return count; }
+private:
+	AlignedArray(const AlignedArray&);
+	AlignedArray& operator=(const AlignedArray&);
+	static void Free(T* p);
+	T* ptr; size_t count;
+};
+
+// Forces of every pair are computed once (the i < j triangle) and applied to both ions. The triangle is cut into
+// square tiles of TileSize(ions) ions, scheduled on a work-stealing pool. Each worker accumulates the tile sums in its
+// own buffer of 64-bit fixed-point numbers (FIXED_BITS fractional bits), the buffers are reduced in worker order.
+// Integer addition is associative, so the forces are bitwise the same for any number of threads and any schedule;
+// the tile energies are stored per tile and summed in tile order for the same reason.
+// With a neighbor skin > 0 (and a cutoff) the pair terms are split: the terms cut at the cutoff (Born-Mayer, Morse,
+// Buckingham4 O-O) go over the neighbor lists, the triangle keeps Coulomb and the dispersion of Buckingham and
+// BuckinghamMorse, which ForceCPU_IBC does not cut. The lists are rebuilt when an ion has moved by skin / 2.
+// With a Coulomb tree (SetCoulombTree) the triangle is replaced by the Barnes-Hut tree of CoulombTree and the cut terms
+// go over the neighbor lists (rebuilt every call if the skin is 0).
+#define FIXED_BITS 40 // resolution 9e-13; terms and sums stay within +-2^62, +-4.2e6 of a force component
+#define FIXED_LIMIT 4611686018427387904LL // 2^62
+// Adds a force component x (or a worker sum b) to the fixed-point sum a. Out of range, a is left unchanged and the
+// result is false, so that no addition wraps; the callers fail with E_BOUNDS (overlapping ions) instead.
+inline bool AddFixed(long long& a, long long b)
+{
+	long long s = a + b; // |a| < 2^62, |b| <= 2^62
+	if (s >= FIXED_LIMIT || s <= -FIXED_LIMIT) return false;
+	a = s;
+	return true;
+}
+inline bool AddFixed(long long& a, double x)
+{
+	double v = x * (double)(1LL << FIXED_BITS);
+	return v > -(double)FIXED_LIMIT && v < (double)FIXED_LIMIT && AddFixed(a, llround(v)); // false for NaN too
+}
+class ForceEngine
+{
+public:
+	ForceEngine(PotentialForm form, Precision precision, double cutoff, int threads = 0); // threads as SetThreads
+	~ForceEngine();
+
+	HRESULT Init(const int* type, const double* coefs, int types, int ions);
+	HRESULT SetPositions(const double* pos);
+	HRESULT SetPositions(const double* x, const double* y, const double* z);
+	HRESULT SetThreads(int threads); // threads as ThreadPool::Resolve (<= 0: CPUONE_THREADS or the hardware threads)
+	HRESULT SetTileSize(int tile); // before Init, 0: TileSize(ions); a multiple of 16 from the tuning database
+	HRESULT SetNeighborSkin(double skin); // <= 0: all pairs in the triangle, no neighbor lists
+	HRESULT SetCoulombTree(double theta, int order); // theta <= 0: no tree, >= 1: E_INVALIDARG; needs a cutoff and factorizable coefficients
+	// Cubic splines of the cut terms on a uniform R^2 grid from r2_min to cutoff^2, TABLE_COEFS per interval and
+	// intervals per pair (see PotentialTable.cs); before Init, NULL: analytic terms
+	HRESULT SetPotentialTable(const double* table, int types, int intervals, double r2_min, double scale);
+	HRESULT CoulombTreeError(int samples, double* rms, double* max); // of the tree forces at the current positions
+	HRESULT Force(double* acc);
+	HRESULT Energy(double* acc, double* energy);
+	// Rows [begin, end) against every ion with all terms, the slice of a partitioned force (Partition.h): acc gets
+	// 3 * (end - begin) doubles, energy (if not NULL) the share of the rows, half of every pair with an ion among them
+	HRESULT Rows(int begin, int end, double* acc, double* energy);
+	// One part of the forces for multiple time steps (r-RESPA): PART_SHORT over the neighbor lists (rebuilt every call
+	// if the skin is 0), PART_LONG over the triangle or the Coulomb tree; acc gets the part only, energy (if not NULL)
+	// its energy. Force = the sum of both parts.
+	HRESULT Part(ForcePart part, double* acc, double* energy);
+	// Integration on the engine side (see Dynamics): the state is copied in once, then every step runs natively
+	HRESULT InitDynamics(const double* pos, const double* vel, const double* mass);
+	HRESULT StepDynamics(const DynamicsParameters& p, int steps, double* temperatures, double* energies) { return dynamics.Step(*pool, *this, p, steps, temperatures, energies); }
+	HRESULT GetDynamics(double* pos, double* vel) const { return dynamics.Get(pos, vel); }
+	InstructionSet ISA() const { return isa; }
+	int Ions() const { return ions; }
+	int Threads() const { return pool->Threads(); }
+	const NeighborList& Neighbors() const { return list; }
+	bool Single() const { return single; } // positions in float, PRECISION_SINGLE or PRECISION_MIXED
+	bool Compensated() const { return compensated; }
+	template <class real> real* Positions(int axis); // SoA positions the kernels read, in the precision of the engine
+	template <class real> PairSystem<real> AllPairs() const; // the triangle with all terms, for the tiles of an EnsembleEngine
+
+	static int TileSize(int ions); // depends on the number of ions only, not on threads: the sums must not change
+	enum { MAX_TILE = 4096 };
+
+private:
+	enum CoefsSet { ALL_TERMS, LONG_RANGE, SHORT_RANGE };
+	template <class real> HRESULT Compute(const AlignedArray<real>* xyz, const std::vector<PairCoefs<real> >* coefs, typename TileKernel<real>::f tile, typename NeighborKernel<real>::f neighbors, double* acc, double* energy);
+	template <class real> HRESULT ComputePart(const AlignedArray<real>* xyz, const std::vector<PairCoefs<real> >* coefs, typename TileKernel<real>::f tile, typename NeighborKernel<real>::f neighbors, ForcePart part, double* acc, double* energy);
+	template <class real> HRESULT Triangle(const PairSystem<real>& s, typename TileKernel<real>::f tile, double* acc, double* energy);
+	template <class real> void RowSlice(const PairSystem<real>& s, typename TileKernel<real>::f tile, int begin, int end, double* acc, double* energy);
+	template <class real> void ShortRange(const PairSystem<real>& s, typename NeighborKernel<real>::f neighbors, double* acc, double* energy);
+	template <class real> PairSystem<real> System(const AlignedArray<real>* xyz, const std::vector<PairCoefs<real> >& coefs) const;
+	template <class real> real* Columns(int worker);
+	TileKernel<float>::f TileFloat() const { return compensated ? kernels->tile_mixed : kernels->tile_float; }
+	NeighborKernel<float>::f NeighborsFloat() const { return compensated ? kernels->neighbors_mixed : kernels->neighbors_float; }
+	template <class real> void BuildTree(const AlignedArray<real>* xyz) { tree.Build(*pool, xyz[0].Data(), xyz[1].Data(), xyz[2].Data()); }
+	HRESULT Setup(const int* type, const double* coefs, int types, int ions); // of Init, after the checks
+	HRESULT TreeSources(const double* coefs);
+	void AllocateWorkers();
+
+	struct Worker
+	{
+		std::vector<long long> acc; // fixed-point, 3 per ion
+		std::vector<double> row;
+		AlignedArray<float> column_float;
+		AlignedArray<double> column_double;
+	};
+	struct TileIndex { int i, j; };
+
+	PotentialForm form;
+	bool single, compensated;
+	double cutoff;
+	InstructionSet isa;
+	const KernelSet* kernels;
+	ThreadPool* pool;
+
+	int ions, types, tile_size, tile_request;
+	std::vector<int> type;
+	std::vector<Run> runs;
+	std::vector<PairCoefs<float> > coefs_float[3]; // CoefsSet
+	std::vector<PairCoefs<double> > coefs_double[3];
+	std::vector<char> short_pair;
+	std::vector<double> table;
+	int table_types, table_intervals;
+	double table_min, table_scale;
+	AlignedArray<float> table_float;
+	AlignedArray<double> table_double;
+	AlignedArray<float> pos_float[3];
+	AlignedArray<double> pos_double[3];
+	std::vector<TileIndex> tiles;
+	std::vector<double> tile_energy, chunk_energy;
+	double skin;
+	NeighborList list;
+	CoulombTree tree;
+	bool use_tree;
+	HRESULT tree_sources; // of the last Init
+	std::vector<Worker*> workers;
+	Dynamics dynamics;
+};
+template <> float* ForceEngine::Positions<float>(int axis);
+template <> double* ForceEngine::Positions<double>(int axis);
+template <> PairSystem<float> ForceEngine::AllPairs<float>() const;
+template <> PairSystem<double> ForceEngine::AllPairs<double>() const;
+
+#endif
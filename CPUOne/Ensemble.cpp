@@ -0,0 +1,136 @@
+#include "stdafx.h"
+#include <math.h>
+#include "Ensemble.h"
+
+EnsembleEngine::EnsembleEngine(Precision precision, double cutoff, int threads) : precision(precision), cutoff(cutoff), max_tile(0), layout(false)
+{
+	pool = new ThreadPool(threads);
+	kernels = Kernels(DetectInstructionSet());
+	offset.assign(1, 0);
+}
+
+EnsembleEngine::~EnsembleEngine()
+{
+	for (size_t i = 0; i < workers.size(); i++) delete workers[i];
+	for (size_t s = 0; s < systems.size(); s++) delete systems[s];
+	delete pool;
+}
+
+HRESULT EnsembleEngine::InitSystem(int system, PotentialForm form, const int* type, const double* coefs, int types, int ions)
+{
+	if (system < 0 || system > Systems()) return E_INVALIDARG;
+	ForceEngine* engine = new ForceEngine(form, precision, cutoff, 1);
+	HRESULT hr = engine->Init(type, coefs, types, ions);
+	if (FAILED(hr)) { delete engine; return hr; }
+	if (system == Systems()) systems.push_back(engine);
+	else { delete systems[system]; systems[system] = engine; }
+	layout = false;
+	return S_OK;
+}
+
+HRESULT EnsembleEngine::SetPositions(int system, const double* pos)
+{
+	if (system < 0 || system >= Systems()) return E_INVALIDARG;
+	return systems[system]->SetPositions(pos);
+}
+
+// The tiles of every system in the order of its ForceEngine, and the worker buffers for all the ions
+void EnsembleEngine::Layout()
+{
+	offset.resize(systems.size() + 1);
+	tiles.clear();
+	max_tile = 0;
+	for (int s = 0; s < Systems(); s++)
+	{
+		int ions = systems[s]->Ions(), tile = ForceEngine::TileSize(ions), blocks = (ions + tile - 1) / tile;
+		offset[s + 1] = offset[s] + ions;
+		if (tile > max_tile) max_tile = tile;
+		for (int i = 0; i < blocks; i++)
+			for (int j = i; j < blocks; j++)
+			{
+				Tile t = { s, i * tile, (i + 1) * tile < ions ? (i + 1) * tile : ions, j * tile, (j + 1) * tile < ions ? (j + 1) * tile : ions };
+				tiles.push_back(t);
+			}
+	}
+	tile_energy.resize(tiles.size());
+	acc.resize(offset.back() * 3);
+
+	for (size_t i = 0; i < workers.size(); i++) delete workers[i];
+	workers.resize(pool->Threads());
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		Worker* w = workers[i] = new Worker();
+		w->acc.assign(offset.back() * 3, 0);
+		w->row.resize(max_tile * 3);
+		if (precision != PRECISION_DOUBLE) w->column_float.Resize(COLUMN_ARRAYS * (max_tile + PAD_IONS));
+		else w->column_double.Resize(COLUMN_ARRAYS * (max_tile + PAD_IONS));
+	}
+	layout = true;
+}
+
+template <> float* EnsembleEngine::Columns<float>(int worker) { return workers[worker]->column_float.Data(); }
+template <> double* EnsembleEngine::Columns<double>(int worker) { return workers[worker]->column_double.Data(); }
+
+// ForceEngine::Triangle over the tiles of every system at once, each system at its offset in the buffers
+template <class real> HRESULT EnsembleEngine::Run(typename TileKernel<real>::f tile, double* energies)
+{
+	const double scale = (double)(1LL << FIXED_BITS);
+	std::atomic<bool> bounded(true);
+	const int stride = max_tile + PAD_IONS, ions = offset.back();
+	const bool compensated = precision == PRECISION_MIXED;
+	std::vector<PairSystem<real> > s(systems.size());
+	for (size_t k = 0; k < systems.size(); k++) s[k] = systems[k]->template AllPairs<real>();
+
+	pool->Run((int)tiles.size(), [&](int t, int worker) {
+		Worker& w = *workers[worker];
+		const Tile& b = tiles[t];
+		real* column = Columns<real>(worker);
+		memset(column, 0, sizeof(real) * COLUMN_ARRAYS * stride);
+		tile(s[b.system], b.i0, b.i1, b.j0, b.j1, &w.row[0], column, stride, energies != NULL ? &tile_energy[t] : NULL);
+
+		long long* a = &w.acc[offset[b.system] * 3];
+		bool ok = true;
+		for (int i = b.i0; i < b.i1; i++)
+			for (int m = 0; m < 3; m++) ok &= AddFixed(a[i * 3 + m], (double)w.row[(i - b.i0) * 3 + m]);
+		for (int j = b.j0; j < b.j1; j++)
+			for (int m = 0; m < 3; m++) ok &= AddFixed(a[j * 3 + m], (double)ColumnSum(column, stride, m, j - b.j0, compensated));
+		if (!ok) bounded = false;
+	});
+
+	const int chunk = 1024, workers_count = (int)workers.size();
+	pool->Run((ions + chunk - 1) / chunk, [&](int c, int worker) {
+		for (int k = c * chunk * 3, end = (c + 1) * chunk < ions ? (c + 1) * chunk * 3 : ions * 3; k < end; k++)
+		{
+			long long sum = 0;
+			bool ok = true;
+			for (int w = 0; w < workers_count; w++) { ok &= AddFixed(sum, workers[w]->acc[k]); workers[w]->acc[k] = 0; }
+			if (!ok) bounded = false;
+			acc[k] = sum / scale;
+		}
+	});
+	if (!bounded) return E_BOUNDS;
+
+	if (energies != NULL)
+	{
+		for (int k = 0; k < Systems(); k++) energies[k] = 0;
+		for (size_t t = 0; t < tiles.size(); t++) energies[tiles[t].system] += tile_energy[t];
+	}
+	return S_OK;
+}
+
+HRESULT EnsembleEngine::Compute(double* energies)
+{
+	if (systems.empty()) return E_FAIL;
+	if (!layout) Layout();
+	if (precision == PRECISION_MIXED) return Run<float>(kernels->tile_mixed, energies);
+	if (precision == PRECISION_SINGLE) return Run<float>(kernels->tile_float, energies);
+	return Run<double>(kernels->tile_double, energies);
+}
+
+HRESULT EnsembleEngine::GetForces(int system, double* acc) const
+{
+	if (acc == NULL || system < 0 || system >= Systems()) return E_INVALIDARG;
+	if (!layout) return E_FAIL; // no Compute since the systems changed
+	memcpy(acc, &this->acc[offset[system] * 3], sizeof(double) * 3 * (offset[system + 1] - offset[system]));
+	return S_OK;
+}
@@ -0,0 +1,54 @@
+#ifndef _ENSEMBLE_H_
+#define _ENSEMBLE_H_
+
+#include <vector>
+#include "Engine.h"
+
+// Independent systems of a sweep (temperatures, potential sets, cluster sizes) computed together: one small cluster
+// cannot fill the cores, the tiles of all of them can. Every system keeps a ForceEngine of one thread for its types,
+// coefficients and SoA positions (never run), Compute runs the triangles of all systems as one job on one pool.
+// There are no pairs across systems. A system is cut into the tiles a ForceEngine of its size would use and the
+// worker sums are fixed-point as there, so the forces and energies of every system are bitwise the same as with its
+// own engine (all terms: no neighbor lists, tree or potential table).
+class EnsembleEngine
+{
+public:
+	EnsembleEngine(Precision precision, double cutoff, int threads); // threads as ForceEngine::SetThreads
+	~EnsembleEngine();
+
+	// system == Systems() adds one, a smaller index replaces it (a restart of that run)
+	HRESULT InitSystem(int system, PotentialForm form, const int* type, const double* coefs, int types, int ions);
+	HRESULT SetPositions(int system, const double* pos);
+	HRESULT Compute(double* energies); // every system, energies (if not NULL) gets one per system
+	HRESULT GetForces(int system, double* acc) const; // of the last Compute
+	int Systems() const { return (int)systems.size(); }
+	int Threads() const { return pool->Threads(); }
+
+private:
+	template <class real> HRESULT Run(typename TileKernel<real>::f tile, double* energies);
+	template <class real> real* Columns(int worker);
+	void Layout();
+
+	struct Tile { int system, i0, i1, j0, j1; };
+	struct Worker
+	{
+		std::vector<long long> acc; // fixed-point, 3 per ion of every system
+		std::vector<double> row;
+		AlignedArray<float> column_float;
+		AlignedArray<double> column_double;
+	};
+
+	Precision precision;
+	double cutoff;
+	const KernelSet* kernels;
+	ThreadPool* pool;
+	std::vector<ForceEngine*> systems;
+	std::vector<int> offset; // first ion of every system, offset[Systems()] the total
+	std::vector<Tile> tiles; // system by system
+	std::vector<double> tile_energy, acc;
+	int max_tile;
+	bool layout; // tiles and workers match the systems
+	std::vector<Worker*> workers;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "stdafx.h"
+#include <immintrin.h>
+
+// AVX2 + FMA kernels: 8 floats or 4 doubles per vector. Only this file is compiled for the target, the engine
+// calls it after DetectInstructionSet has checked the CPU and OS support.
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#elif defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#endif
+
+namespace
+{
+	struct Float8Mask { __m256 m; };
+	struct Float8
+	{
+		typedef float real;
+		typedef Float8Mask mask;
+		static const int W = 8;
+		__m256 v;
+		static inline Float8 Set1(float x) { Float8 a = { _mm256_set1_ps(x) }; return a; }
+		static inline Float8 Load(const float* p) { Float8 a = { _mm256_loadu_ps(p) }; return a; }
+		static inline void Store(float* p, Float8 a) { _mm256_storeu_ps(p, a.v); }
+		static inline Float8 Gather(const float* p, const int* index) { Float8 a = { _mm256_i32gather_ps(p, _mm256_loadu_si256((const __m256i*)index), 4) }; return a; }
+		typedef __m256i index;
+		static inline __m256i Index(Float8 x, int stride) { return _mm256_mullo_epi32(_mm256_cvttps_epi32(x.v), _mm256_set1_epi32(stride)); }
+		static inline Float8 Gather(const float* p, __m256i index) { Float8 a = { _mm256_i32gather_ps(p, index, 4) }; return a; }
+		static inline Float8Mask FirstN(int n) { Float8Mask a = { _mm256_cmp_ps(_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_ps((float)n), _CMP_LT_OQ) }; return a; }
+	};
+	inline Float8 F8(__m256 v) { Float8 a = { v }; return a; }
+	inline Float8Mask M8(__m256 m) { Float8Mask a = { m }; return a; }
+	inline Float8 operator+(Float8 a, Float8 b) { return F8(_mm256_add_ps(a.v, b.v)); }
+	inline Float8 operator-(Float8 a, Float8 b) { return F8(_mm256_sub_ps(a.v, b.v)); }
+	inline Float8 operator*(Float8 a, Float8 b) { return F8(_mm256_mul_ps(a.v, b.v)); }
+	inline Float8 operator/(Float8 a, Float8 b) { return F8(_mm256_div_ps(a.v, b.v)); }
+	inline Float8Mask operator<(Float8 a, Float8 b) { return M8(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+	inline Float8Mask operator>(Float8 a, Float8 b) { return M8(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+	inline Float8Mask operator&(Float8Mask a, Float8Mask b) { return M8(_mm256_and_ps(a.m, b.m)); }
+	inline Float8 Sqrt(Float8 a) { return F8(_mm256_sqrt_ps(a.v)); }
+	inline Float8 Trunc(Float8 a) { return F8(_mm256_round_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)); }
+	inline Float8 Select(Float8Mask m, Float8 a) { return F8(_mm256_and_ps(m.m, a.v)); }
+	inline Float8 Blend(Float8Mask m, Float8 a, Float8 b) { return F8(_mm256_blendv_ps(b.v, a.v, m.m)); }
+	inline double Sum(Float8 a)
+	{
+		__m256d s = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(a.v)), _mm256_cvtps_pd(_mm256_extractf128_ps(a.v, 1)));
+		__m128d h = _mm_add_pd(_mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+	}
+	// Cephes expf: e^x = 2^k * e^f, |f| <= ln2 / 2, e^f by a polynomial of degree 6; the relative error is about 1 ulp
+	inline Float8 Exp(Float8 a)
+	{
+		__m256 x = _mm256_min_ps(_mm256_max_ps(a.v, _mm256_set1_ps(-87.33f)), _mm256_set1_ps(88.37f));
+		__m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		x = _mm256_fnmadd_ps(k, _mm256_set1_ps(0.693359375f), x);
+		x = _mm256_fnmadd_ps(k, _mm256_set1_ps(-2.12194440e-4f), x);
+		__m256 p = _mm256_set1_ps(1.9875691500E-4f);
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(1.3981999507E-3f));
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(8.3334519073E-3f));
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(4.1665795894E-2f));
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(1.6666665459E-1f));
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(5.0000001201E-1f));
+		p = _mm256_fmadd_ps(p, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1)));
+		__m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127)), 23);
+		return F8(_mm256_mul_ps(p, _mm256_castsi256_ps(e)));
+	}
+
+	struct Double4Mask { __m256d m; };
+	struct Double4
+	{
+		typedef double real;
+		typedef Double4Mask mask;
+		static const int W = 4;
+		__m256d v;
+		static inline Double4 Set1(double x) { Double4 a = { _mm256_set1_pd(x) }; return a; }
+		static inline Double4 Load(const double* p) { Double4 a = { _mm256_loadu_pd(p) }; return a; }
+		static inline void Store(double* p, Double4 a) { _mm256_storeu_pd(p, a.v); }
+		static inline Double4 Gather(const double* p, const int* index) { Double4 a = { _mm256_i32gather_pd(p, _mm_loadu_si128((const __m128i*)index), 8) }; return a; }
+		typedef __m128i index;
+		static inline __m128i Index(Double4 x, int stride) { return _mm_mullo_epi32(_mm256_cvttpd_epi32(x.v), _mm_set1_epi32(stride)); }
+		static inline Double4 Gather(const double* p, __m128i index) { Double4 a = { _mm256_i32gather_pd(p, index, 8) }; return a; }
+		static inline Double4Mask FirstN(int n) { Double4Mask a = { _mm256_cmp_pd(_mm256_setr_pd(0, 1, 2, 3), _mm256_set1_pd(n), _CMP_LT_OQ) }; return a; }
+	};
+	inline Double4 D4(__m256d v) { Double4 a = { v }; return a; }
+	inline Double4Mask M4(__m256d m) { Double4Mask a = { m }; return a; }
+	inline Double4 operator+(Double4 a, Double4 b) { return D4(_mm256_add_pd(a.v, b.v)); }
+	inline Double4 operator-(Double4 a, Double4 b) { return D4(_mm256_sub_pd(a.v, b.v)); }
+	inline Double4 operator*(Double4 a, Double4 b) { return D4(_mm256_mul_pd(a.v, b.v)); }
+	inline Double4 operator/(Double4 a, Double4 b) { return D4(_mm256_div_pd(a.v, b.v)); }
+	inline Double4Mask operator<(Double4 a, Double4 b) { return M4(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)); }
+	inline Double4Mask operator>(Double4 a, Double4 b) { return M4(_mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ)); }
+	inline Double4Mask operator&(Double4Mask a, Double4Mask b) { return M4(_mm256_and_pd(a.m, b.m)); }
+	inline Double4 Sqrt(Double4 a) { return D4(_mm256_sqrt_pd(a.v)); }
+	inline Double4 Trunc(Double4 a) { return D4(_mm256_round_pd(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)); }
+	inline Double4 Select(Double4Mask m, Double4 a) { return D4(_mm256_and_pd(m.m, a.v)); }
+	inline Double4 Blend(Double4Mask m, Double4 a, Double4 b) { return D4(_mm256_blendv_pd(b.v, a.v, m.m)); }
+	inline double Sum(Double4 a)
+	{
+		__m128d h = _mm_add_pd(_mm256_castpd256_pd128(a.v), _mm256_extractf128_pd(a.v, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+	}
+	// Cephes exp: e^x = 2^k * e^f, |f| <= ln2 / 2, e^f = 1 + 2 P(f^2) f / (Q(f^2) - P(f^2) f)
+	inline Double4 Exp(Double4 a)
+	{
+		__m256d x = _mm256_min_pd(_mm256_max_pd(a.v, _mm256_set1_pd(-708.0)), _mm256_set1_pd(708.0));
+		__m256d k = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(1.4426950408889634073599)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		x = _mm256_fnmadd_pd(k, _mm256_set1_pd(6.93145751953125E-1), x);
+		x = _mm256_fnmadd_pd(k, _mm256_set1_pd(1.42860682030941723212E-6), x);
+		__m256d xx = _mm256_mul_pd(x, x);
+		__m256d p = _mm256_set1_pd(1.26177193074810590878E-4);
+		p = _mm256_fmadd_pd(p, xx, _mm256_set1_pd(3.02994407707441961300E-2));
+		p = _mm256_fmadd_pd(p, xx, _mm256_set1_pd(9.99999999999999999910E-1));
+		p = _mm256_mul_pd(p, x);
+		__m256d q = _mm256_set1_pd(3.00198505138664455042E-6);
+		q = _mm256_fmadd_pd(q, xx, _mm256_set1_pd(2.52448340349684104192E-3));
+		q = _mm256_fmadd_pd(q, xx, _mm256_set1_pd(2.27265548208155028766E-1));
+		q = _mm256_fmadd_pd(q, xx, _mm256_set1_pd(2.00000000000000000009E0));
+		x = _mm256_div_pd(p, _mm256_sub_pd(q, p));
+		x = _mm256_fmadd_pd(x, _mm256_set1_pd(2), _mm256_set1_pd(1));
+		__m256i e = _mm256_slli_epi64(_mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k)), _mm256_set1_epi64x(1023)), 52);
+		return D4(_mm256_mul_pd(x, _mm256_castsi256_pd(e)));
+	}
+}
+
+#include "PairKernel.h"
+
+const KernelSet avx2_kernels = { Tile<Float8, false>, Tile<Double4, false>, Tile<Float8, true>, Neighbors<Float8, false>, Neighbors<Double4, false>, Neighbors<Float8, true> };
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#elif defined(__clang__)
+#pragma clang attribute pop
+#endif
@@ -0,0 +1,119 @@
+#include "stdafx.h"
+#include <immintrin.h>
+
+// AVX-512F kernels: 16 floats or 8 doubles per vector, opmask registers for the tails and cutoffs.
+// The exponent is applied by vscalef, the rest of exp is the same as in Kernels_AVX2.cpp.
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma")
+#elif defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f,avx2,fma"))), apply_to = function)
+#endif
+
+namespace
+{
+	struct Float16
+	{
+		typedef float real;
+		typedef __mmask16 mask;
+		static const int W = 16;
+		__m512 v;
+		static inline Float16 Set1(float x) { Float16 a = { _mm512_set1_ps(x) }; return a; }
+		static inline Float16 Load(const float* p) { Float16 a = { _mm512_loadu_ps(p) }; return a; }
+		static inline void Store(float* p, Float16 a) { _mm512_storeu_ps(p, a.v); }
+		static inline Float16 Gather(const float* p, const int* index) { Float16 a = { _mm512_i32gather_ps(_mm512_loadu_si512(index), p, 4) }; return a; }
+		typedef __m512i index;
+		static inline __m512i Index(Float16 x, int stride) { return _mm512_mullo_epi32(_mm512_cvttps_epi32(x.v), _mm512_set1_epi32(stride)); }
+		static inline Float16 Gather(const float* p, __m512i index) { Float16 a = { _mm512_i32gather_ps(index, p, 4) }; return a; }
+		static inline __mmask16 FirstN(int n) { return n >= W ? (__mmask16)0xFFFF : (__mmask16)((1u << n) - 1); }
+	};
+	inline Float16 F16(__m512 v) { Float16 a = { v }; return a; }
+	inline Float16 operator+(Float16 a, Float16 b) { return F16(_mm512_add_ps(a.v, b.v)); }
+	inline Float16 operator-(Float16 a, Float16 b) { return F16(_mm512_sub_ps(a.v, b.v)); }
+	inline Float16 operator*(Float16 a, Float16 b) { return F16(_mm512_mul_ps(a.v, b.v)); }
+	inline Float16 operator/(Float16 a, Float16 b) { return F16(_mm512_div_ps(a.v, b.v)); }
+	inline __mmask16 operator<(Float16 a, Float16 b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+	inline __mmask16 operator>(Float16 a, Float16 b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+	inline Float16 Sqrt(Float16 a) { return F16(_mm512_sqrt_ps(a.v)); }
+	inline Float16 Trunc(Float16 a) { return F16(_mm512_roundscale_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)); }
+	inline Float16 Select(__mmask16 m, Float16 a) { return F16(_mm512_maskz_mov_ps(m, a.v)); }
+	inline Float16 Blend(__mmask16 m, Float16 a, Float16 b) { return F16(_mm512_mask_blend_ps(m, b.v, a.v)); }
+	inline double Sum(Float16 a)
+	{
+		__m512d s = _mm512_add_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(a.v)), _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a.v), 1))));
+		return _mm512_reduce_add_pd(s);
+	}
+	inline Float16 Exp(Float16 a)
+	{
+		__m512 x = _mm512_min_ps(_mm512_max_ps(a.v, _mm512_set1_ps(-87.33f)), _mm512_set1_ps(88.37f));
+		__m512 k = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		x = _mm512_fnmadd_ps(k, _mm512_set1_ps(0.693359375f), x);
+		x = _mm512_fnmadd_ps(k, _mm512_set1_ps(-2.12194440e-4f), x);
+		__m512 p = _mm512_set1_ps(1.9875691500E-4f);
+		p = _mm512_fmadd_ps(p, x, _mm512_set1_ps(1.3981999507E-3f));
+		p = _mm512_fmadd_ps(p, x, _mm512_set1_ps(8.3334519073E-3f));
+		p = _mm512_fmadd_ps(p, x, _mm512_set1_ps(4.1665795894E-2f));
+		p = _mm512_fmadd_ps(p, x, _mm512_set1_ps(1.6666665459E-1f));
+		p = _mm512_fmadd_ps(p, x, _mm512_set1_ps(5.0000001201E-1f));
+		p = _mm512_fmadd_ps(p, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1)));
+		return F16(_mm512_scalef_ps(p, k));
+	}
+
+	struct Double8
+	{
+		typedef double real;
+		typedef __mmask8 mask;
+		static const int W = 8;
+		__m512d v;
+		static inline Double8 Set1(double x) { Double8 a = { _mm512_set1_pd(x) }; return a; }
+		static inline Double8 Load(const double* p) { Double8 a = { _mm512_loadu_pd(p) }; return a; }
+		static inline void Store(double* p, Double8 a) { _mm512_storeu_pd(p, a.v); }
+		static inline Double8 Gather(const double* p, const int* index) { Double8 a = { _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i*)index), p, 8) }; return a; }
+		typedef __m256i index;
+		static inline __m256i Index(Double8 x, int stride) { return _mm256_mullo_epi32(_mm512_cvttpd_epi32(x.v), _mm256_set1_epi32(stride)); }
+		static inline Double8 Gather(const double* p, __m256i index) { Double8 a = { _mm512_i32gather_pd(index, p, 8) }; return a; }
+		static inline __mmask8 FirstN(int n) { return n >= W ? (__mmask8)0xFF : (__mmask8)((1u << n) - 1); }
+	};
+	inline Double8 D8(__m512d v) { Double8 a = { v }; return a; }
+	inline Double8 operator+(Double8 a, Double8 b) { return D8(_mm512_add_pd(a.v, b.v)); }
+	inline Double8 operator-(Double8 a, Double8 b) { return D8(_mm512_sub_pd(a.v, b.v)); }
+	inline Double8 operator*(Double8 a, Double8 b) { return D8(_mm512_mul_pd(a.v, b.v)); }
+	inline Double8 operator/(Double8 a, Double8 b) { return D8(_mm512_div_pd(a.v, b.v)); }
+	inline __mmask8 operator<(Double8 a, Double8 b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ); }
+	inline __mmask8 operator>(Double8 a, Double8 b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_GT_OQ); }
+	inline Double8 Sqrt(Double8 a) { return D8(_mm512_sqrt_pd(a.v)); }
+	inline Double8 Trunc(Double8 a) { return D8(_mm512_roundscale_pd(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)); }
+	inline Double8 Select(__mmask8 m, Double8 a) { return D8(_mm512_maskz_mov_pd(m, a.v)); }
+	inline Double8 Blend(__mmask8 m, Double8 a, Double8 b) { return D8(_mm512_mask_blend_pd(m, b.v, a.v)); }
+	inline double Sum(Double8 a) { return _mm512_reduce_add_pd(a.v); }
+	inline Double8 Exp(Double8 a)
+	{
+		__m512d x = _mm512_min_pd(_mm512_max_pd(a.v, _mm512_set1_pd(-708.0)), _mm512_set1_pd(708.0));
+		__m512d k = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(1.4426950408889634073599)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		x = _mm512_fnmadd_pd(k, _mm512_set1_pd(6.93145751953125E-1), x);
+		x = _mm512_fnmadd_pd(k, _mm512_set1_pd(1.42860682030941723212E-6), x);
+		__m512d xx = _mm512_mul_pd(x, x);
+		__m512d p = _mm512_set1_pd(1.26177193074810590878E-4);
+		p = _mm512_fmadd_pd(p, xx, _mm512_set1_pd(3.02994407707441961300E-2));
+		p = _mm512_fmadd_pd(p, xx, _mm512_set1_pd(9.99999999999999999910E-1));
+		p = _mm512_mul_pd(p, x);
+		__m512d q = _mm512_set1_pd(3.00198505138664455042E-6);
+		q = _mm512_fmadd_pd(q, xx, _mm512_set1_pd(2.52448340349684104192E-3));
+		q = _mm512_fmadd_pd(q, xx, _mm512_set1_pd(2.27265548208155028766E-1));
+		q = _mm512_fmadd_pd(q, xx, _mm512_set1_pd(2.00000000000000000009E0));
+		x = _mm512_div_pd(p, _mm512_sub_pd(q, p));
+		x = _mm512_fmadd_pd(x, _mm512_set1_pd(2), _mm512_set1_pd(1));
+		return D8(_mm512_scalef_pd(x, k));
+	}
+}
+
+#include "PairKernel.h"
+
+const KernelSet avx512_kernels = { Tile<Float16, false>, Tile<Double8, false>, Tile<Float16, true>, Neighbors<Float16, false>, Neighbors<Double8, false>, Neighbors<Float16, true> };
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#elif defined(__clang__)
+#pragma clang attribute pop
+#endif
@@ -0,0 +1,42 @@
+#include "stdafx.h"
+#include <math.h>
+
+// Reference kernels: one lane, plain C++ (and whatever the compiler vectorizes on its own)
+
+namespace
+{
+	template <class T> struct Scalar
+	{
+		typedef T real;
+		typedef bool mask;
+		static const int W = 1;
+		T v;
+		static inline Scalar Set1(T x) { Scalar a = { x }; return a; }
+		static inline Scalar Load(const T* p) { Scalar a = { *p }; return a; }
+		static inline void Store(T* p, Scalar a) { *p = a.v; }
+		static inline Scalar Gather(const T* p, const int* index) { Scalar a = { p[*index] }; return a; }
+		typedef int index;
+		static inline int Index(Scalar x, int stride) { return (int)x.v * stride; }
+		static inline Scalar Gather(const T* p, int index) { Scalar a = { p[index] }; return a; }
+		static inline bool FirstN(int n) { return n > 0; }
+	};
+	template <class T> inline Scalar<T> operator+(Scalar<T> a, Scalar<T> b) { return Scalar<T>::Set1(a.v + b.v); }
+	template <class T> inline Scalar<T> operator-(Scalar<T> a, Scalar<T> b) { return Scalar<T>::Set1(a.v - b.v); }
+	template <class T> inline Scalar<T> operator*(Scalar<T> a, Scalar<T> b) { return Scalar<T>::Set1(a.v * b.v); }
+	template <class T> inline Scalar<T> operator/(Scalar<T> a, Scalar<T> b) { return Scalar<T>::Set1(a.v / b.v); }
+	template <class T> inline bool operator<(Scalar<T> a, Scalar<T> b) { return a.v < b.v; }
+	template <class T> inline bool operator>(Scalar<T> a, Scalar<T> b) { return a.v > b.v; }
+	inline Scalar<float> Sqrt(Scalar<float> a) { return Scalar<float>::Set1(sqrtf(a.v)); }
+	inline Scalar<double> Sqrt(Scalar<double> a) { return Scalar<double>::Set1(sqrt(a.v)); }
+	inline Scalar<float> Exp(Scalar<float> a) { return Scalar<float>::Set1(expf(a.v)); }
+	inline Scalar<double> Exp(Scalar<double> a) { return Scalar<double>::Set1(exp(a.v)); }
+	template <class T> inline Scalar<T> Trunc(Scalar<T> a) { return Scalar<T>::Set1((T)(long long)a.v); }
+	template <class T> inline Scalar<T> Select(bool m, Scalar<T> a) { return Scalar<T>::Set1(m ? a.v : 0); }
+	template <class T> inline Scalar<T> Blend(bool m, Scalar<T> a, Scalar<T> b) { return m ? a : b; }
+	template <class T> inline double Sum(Scalar<T> a) { return a.v; }
+}
+
+#include "PairKernel.h"
+
+const KernelSet scalar_kernels = { Tile<Scalar<float>, false>, Tile<Scalar<double>, false>, Tile<Scalar<float>, true>,
+	Neighbors<Scalar<float>, false>, Neighbors<Scalar<double>, false>, Neighbors<Scalar<float>, true> };
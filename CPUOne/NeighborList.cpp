@@ -0,0 +1,101 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <math.h>
+
+template <class real> void NeighborList::Build(ThreadPool& pool, const real* x, const real* y, const real* z, const int* type, int types, const std::vector<char>& pair, int ions, double cutoff, double skin)
+{
+	this->radius = cutoff + skin;
+	this->skin = skin;
+	builds++;
+
+	// Grid: cells not smaller than radius, at most about 2 cells per ion (evaporated ions stretch the box)
+	double lo[3] = { x[0], y[0], z[0] }, hi[3] = { x[0], y[0], z[0] };
+	for (int i = 1; i < ions; i++)
+	{
+		double p[3] = { x[i], y[i], z[i] };
+		for (int m = 0; m < 3; m++) { if (p[m] < lo[m]) lo[m] = p[m]; if (p[m] > hi[m]) hi[m] = p[m]; }
+	}
+	double h = radius, cells_wanted = 2.0 * ions + 8;
+	for (;;)
+	{
+		double product = 1;
+		for (int m = 0; m < 3; m++) product *= floor((hi[m] - lo[m]) / h) + 1;
+		if (product <= cells_wanted) break;
+		h *= 1.25;
+	}
+	int n[3];
+	for (int m = 0; m < 3; m++) n[m] = (int)floor((hi[m] - lo[m]) / h) + 1;
+	int cells = n[0] * n[1] * n[2];
+
+	// Linked cells as a counting sort of ions by cell
+	std::vector<int> cell_of(ions), cell_start(cells + 1, 0), cell_ions(ions);
+	for (int i = 0; i < ions; i++)
+	{
+		int c[3] = { (int)((x[i] - lo[0]) / h), (int)((y[i] - lo[1]) / h), (int)((z[i] - lo[2]) / h) };
+		for (int m = 0; m < 3; m++) if (c[m] >= n[m]) c[m] = n[m] - 1;
+		cell_of[i] = (c[2] * n[1] + c[1]) * n[0] + c[0];
+		cell_start[cell_of[i] + 1]++;
+	}
+	for (int c = 0; c < cells; c++) cell_start[c + 1] += cell_start[c];
+	{
+		std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+		for (int i = 0; i < ions; i++) cell_ions[fill[cell_of[i]]++] = i;
+	}
+
+	// Two passes over the 27 neighboring cells: count, then fill the rows at their offsets
+	const double radius2 = radius * radius;
+	auto search = [&](int i, int* out) -> int {
+		int c = cell_of[i], cx = c % n[0], cy = (c / n[0]) % n[1], cz = c / (n[0] * n[1]), count = 0;
+		const char* pair_i = &pair[type[i] * types];
+		for (int kz = cz > 0 ? cz - 1 : 0; kz <= cz + 1 && kz < n[2]; kz++)
+			for (int ky = cy > 0 ? cy - 1 : 0; ky <= cy + 1 && ky < n[1]; ky++)
+				for (int kx = cx > 0 ? cx - 1 : 0; kx <= cx + 1 && kx < n[0]; kx++)
+				{
+					int k = (kz * n[1] + ky) * n[0] + kx;
+					for (int p = cell_start[k]; p < cell_start[k + 1]; p++)
+					{
+						int j = cell_ions[p];
+						if (j == i || !pair_i[type[j]]) continue;
+						double dx = (double)x[i] - x[j], dy = (double)y[i] - y[j], dz = (double)z[i] - z[j];
+						if (dx * dx + dy * dy + dz * dz >= radius2) continue;
+						if (out != NULL) out[count] = j;
+						count++;
+					}
+				}
+		if (out != NULL) std::sort(out, out + count);
+		return count;
+	};
+	const int chunk = 256, chunks = (ions + chunk - 1) / chunk;
+	offsets.assign(ions + 1, 0);
+	pool.Run(chunks, [&](int c, int worker) {
+		for (int i = c * chunk, end = std::min(ions, i + chunk); i < end; i++) offsets[i + 1] = search(i, NULL);
+	});
+	for (int i = 0; i < ions; i++) offsets[i + 1] += offsets[i];
+	indices.assign(offsets[ions] + PAD_IONS, ions);
+	pool.Run(chunks, [&](int c, int worker) {
+		for (int i = c * chunk, end = std::min(ions, i + chunk); i < end; i++) search(i, &indices[offsets[i]]);
+	});
+
+	x0.assign(x, x + ions); y0.assign(y, y + ions); z0.assign(z, z + ions);
+}
+
+template <class real> bool NeighborList::Valid(ThreadPool& pool, const real* x, const real* y, const real* z, int ions) const
+{
+	if (offsets.empty() || (int)x0.size() != ions) return false;
+	const double limit2 = 0.25 * skin * skin;
+	const int chunk = 4096;
+	std::atomic<bool> moved(false);
+	pool.Run((ions + chunk - 1) / chunk, [&](int c, int worker) {
+		for (int i = c * chunk, end = std::min(ions, i + chunk); i < end && !moved; i++)
+		{
+			double dx = x[i] - x0[i], dy = y[i] - y0[i], dz = z[i] - z0[i];
+			if (dx * dx + dy * dy + dz * dz > limit2) moved = true;
+		}
+	});
+	return !moved;
+}
+
+template void NeighborList::Build<float>(ThreadPool&, const float*, const float*, const float*, const int*, int, const std::vector<char>&, int, double, double);
+template void NeighborList::Build<double>(ThreadPool&, const double*, const double*, const double*, const int*, int, const std::vector<char>&, int, double, double);
+template bool NeighborList::Valid<float>(ThreadPool&, const float*, const float*, const float*, int) const;
+template bool NeighborList::Valid<double>(ThreadPool&, const double*, const double*, const double*, int) const;
@@ -0,0 +1,34 @@
+#ifndef _NEIGHBOR_LIST_H_
+#define _NEIGHBOR_LIST_H_
+
+#include <vector>
+#include "ThreadPool.h"
+
+// Verlet neighbor lists of the short-range terms, built on a linked-cell grid over the bounding box of the cluster
+// (no periodic images: the crystal is isolated). The list of i holds every j != i closer than radius = cutoff + skin
+// whose pair of types has short-range terms, sorted by j; both directions of a pair are listed. The lists stay valid
+// until an ion moves by more than skin / 2 from its position at the build.
+class NeighborList
+{
+public:
+	NeighborList() : radius(0), skin(0), builds(0) { }
+
+	// pair[type_i * types + type_j] != 0: the pair is listed
+	template <class real> void Build(ThreadPool& pool, const real* x, const real* y, const real* z, const int* type, int types, const std::vector<char>& pair, int ions, double cutoff, double skin);
+	template <class real> bool Valid(ThreadPool& pool, const real* x, const real* y, const real* z, int ions) const;
+	void Clear() { offsets.clear(); indices.clear(); }
+
+	bool Empty() const { return offsets.empty(); }
+	const int* Offsets() const { return &offsets[0]; } // ions + 1
+	const int* Indices() const { return &indices[0]; } // padded by PAD_IONS indices of the first far-away ion
+	long long Neighbors() const { return offsets.empty() ? 0 : offsets.back(); }
+	int Builds() const { return builds; }
+
+private:
+	std::vector<int> offsets, indices;
+	std::vector<double> x0, y0, z0; // positions at the build
+	double radius, skin;
+	int builds;
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef _PAIR_KERNEL_H_
+#define _PAIR_KERNEL_H_
+
+// All-pairs kernels written once for any vector type V. A Kernels_*.cpp file defines V for its instruction set
+// (in an anonymous namespace, so the instantiations never mix code compiled for different targets) and includes
+// this file. V provides:
+//  V::real, V::mask, V::W (lanes), V::Set1(real), V::Load(const real*) and V::Store(real*, V) (unaligned),
+//  V::Gather(const real* base, const int* index) (W indices), V::FirstN(n) (first min(n, W) lanes);
+//  V::index, V::Index(V x, int stride) (W ints x * stride, x whole and >= 0), V::Gather(const real* base, V::index);
+//  operators + - * / and < > on V, & on masks; Sqrt(V), Exp(V), Trunc(V), Select(mask, a) (a or 0), Blend(mask, a, b),
+//  Sum(V) (double).
+// compensated: the sums of the rows and columns are Kahan sums (PRECISION_MIXED), the pair terms stay in V::real.
+
+template <class V, bool with_energy, bool compensated> struct PairKernel
+{
+	typedef typename V::real real;
+	typedef typename V::mask mask;
+
+	static inline V C(real x) { return V::Set1(x); }
+	// sum += x; k keeps the rounding errors of the Kahan sum, which is sum - k
+	static inline void Add(V& sum, V& k, V x)
+	{
+		if (!compensated) { sum = sum + x; return; }
+		V y = x - k, t = sum + y;
+		k = (t - sum) - y;
+		sum = t;
+	}
+	static inline double Total(V sum, V k) { return compensated ? Sum(sum) - Sum(k) : Sum(sum); }
+
+	// Terms of the pair: TERMS is a row of PAIR_VARIANTS, so every test folds at compile time, or TERMS_GENERIC
+	template <int TERMS> static inline bool Has(const PairCoefs<real>& pc, int term) { return ((TERMS == TERMS_GENERIC ? pc.terms : TERMS) & term) != 0; }
+
+	// dU of the pairs (acc_i += (pos_i - pos_j) * dU) and their energies U; lanes out of valid and self pairs give zeros.
+	// The cutoff applies to Born-Mayer, Morse and Buckingham4 O-O dispersion only, the same as in ForceCPU_IBC.
+	template <int TERMS> static inline V Pair(const PairCoefs<real>& pc, const PairSystem<real>& s, V R2, mask valid, V& U)
+	{
+		const real* c = pc.c;
+		const real cutoff = s.cutoff;
+		valid = valid & (R2 > C(0));
+		R2 = Blend(valid, R2, C(1));
+		V R = Sqrt(R2), r = C(1) / R, r2 = r * r, r6 = r2 * r2 * r2;
+		mask cut = R < C(cutoff);
+
+		V dU = C(0);
+		if (with_energy) U = C(0);
+		if (Has<TERMS>(pc, TERM_COULOMB))
+		{
+			dU = C(c[0]) * r2 * r;
+			if (with_energy) U = C(c[0]) * r;
+		}
+		if (Has<TERMS>(pc, TERM_DISPERSION))
+		{
+			dU = dU - C(6 * c[3]) * r6 * r2;
+			if (with_energy) U = U - C(c[3]) * r6;
+		}
+		if (Has<TERMS>(pc, TERM_BORN_MAYER))
+		{
+			V e = Select(cut, C(c[1]) * Exp(C(c[2]) * R));
+			dU = dU - C(c[2]) * e * r;
+			if (with_energy) U = U + e;
+		}
+		if (Has<TERMS>(pc, TERM_MORSE))
+		{
+			V ee = Exp(C(c[5]) * (R - C(c[6]))), d = Select(cut, C(c[4]) * ee);
+			dU = dU - C(c[5]) * d * (C(2) * ee - C(2)) * r;
+			if (with_energy) U = U + d * (ee - C(2));
+		}
+		if (Has<TERMS>(pc, TERM_SPLINE))
+		{
+			// PairCoefs::spline: the bounds, the polynomials of U, then of dU/dR, highest power first
+			const real* sp = pc.spline;
+			mask near = R < C(sp[0]), middle = R < C(sp[1]);
+			V p5 = ((((C(sp[12]) * R + C(sp[13])) * R + C(sp[14])) * R + C(sp[15])) * R + C(sp[16])) * r;
+			V p3 = ((C(sp[17]) * R + C(sp[18])) * R + C(sp[19])) * r;
+			V far = Select(cut, C(6 * c[3]) * r6 * r2);
+			dU = dU - Blend(near, p5, Blend(middle, p3, far));
+			if (with_energy)
+			{
+				p5 = ((((C(sp[2]) * R + C(sp[3])) * R + C(sp[4])) * R + C(sp[5])) * R + C(sp[6])) * R + C(sp[7]);
+				p3 = ((C(sp[8]) * R + C(sp[9])) * R + C(sp[10])) * R + C(sp[11]);
+				far = Select(cut, C(-c[3]) * r6);
+				U = U + Blend(near, p5, Blend(middle, p3, far));
+			}
+		}
+		if (Has<TERMS>(pc, TERM_TABLE))
+		{
+			// Cubic splines on the R^2 grid, TABLE_COEFS per interval: dU, then U
+			V x = (R2 - C(s.table_min)) * C(s.table_scale);
+			x = Blend(x > C(0), x, C(0));
+			x = Blend(x < C(s.table_last), x, C(s.table_last));
+			V k = Trunc(x), t = x - k;
+			typename V::index i = V::Index(k, TABLE_COEFS);
+			const real* p = pc.table;
+			V f = ((V::Gather(p + 3, i) * t + V::Gather(p + 2, i)) * t + V::Gather(p + 1, i)) * t + V::Gather(p, i);
+			dU = dU + Select(cut, f);
+			if (with_energy)
+			{
+				V u = ((V::Gather(p + 7, i) * t + V::Gather(p + 6, i)) * t + V::Gather(p + 5, i)) * t + V::Gather(p + 4, i);
+				U = U + Select(cut, u);
+			}
+		}
+		if (with_energy) U = Select(valid, U);
+		return Select(valid, dU);
+	}
+
+	// Columns [jb, je) of row p = (x, y, z) of a tile starting at column j0, all of one type: dU of every pair goes to the
+	// row sums[0..2] and, with the opposite sign, to the columns m = 0, 1, 2 at columns[m * stride + j - j0]; U to sums[3].
+	// The compensated kernels keep the Kahan compensations of the columns at columns[(3 + m) * stride + j - j0].
+	template <int TERMS> static void TileRun(const PairCoefs<real>& pc, const PairSystem<real>& s, const real* p, int jb, int je, int j0, real* columns, int stride, double* sums)
+	{
+		V xi = C(p[0]), yi = C(p[1]), zi = C(p[2]), U;
+		V fx = C(0), fy = C(0), fz = C(0), u = C(0), kx = C(0), ky = C(0), kz = C(0), ku = C(0);
+		for (int j = jb; j < je; j += V::W)
+		{
+			V dx = xi - V::Load(s.x + j), dy = yi - V::Load(s.y + j), dz = zi - V::Load(s.z + j);
+			V dU = Pair<TERMS>(pc, s, dx * dx + dy * dy + dz * dz, V::FirstN(je - j), U);
+			V d[3] = { dx * dU, dy * dU, dz * dU };
+			Add(fx, kx, d[0]); Add(fy, ky, d[1]); Add(fz, kz, d[2]);
+			for (int m = 0; m < 3; m++)
+			{
+				real* column = columns + m * stride + (j - j0);
+				V c = V::Load(column);
+				if (compensated)
+				{
+					V k = V::Load(column + 3 * stride);
+					Add(c, k, C(0) - d[m]);
+					V::Store(column + 3 * stride, k);
+				}
+				else c = c - d[m];
+				V::Store(column, c);
+			}
+			if (with_energy) Add(u, ku, U);
+		}
+		sums[0] += Total(fx, kx); sums[1] += Total(fy, ky); sums[2] += Total(fz, kz);
+		if (with_energy) sums[3] += Total(u, ku);
+	}
+	// Neighbors index[0..count) of row p, all of one type
+	template <int TERMS> static void NeighborRun(const PairCoefs<real>& pc, const PairSystem<real>& s, const real* p, const int* index, int count, double* sums)
+	{
+		V xi = C(p[0]), yi = C(p[1]), zi = C(p[2]), U;
+		V fx = C(0), fy = C(0), fz = C(0), u = C(0), kx = C(0), ky = C(0), kz = C(0), ku = C(0);
+		for (int n = 0; n < count; n += V::W)
+		{
+			V dx = xi - V::Gather(s.x, index + n), dy = yi - V::Gather(s.y, index + n), dz = zi - V::Gather(s.z, index + n);
+			V dU = Pair<TERMS>(pc, s, dx * dx + dy * dy + dz * dz, V::FirstN(count - n), U);
+			Add(fx, kx, dx * dU); Add(fy, ky, dy * dU); Add(fz, kz, dz * dU);
+			if (with_energy) Add(u, ku, U);
+		}
+		sums[0] += Total(fx, kx); sums[1] += Total(fy, ky); sums[2] += Total(fz, kz);
+		if (with_energy) sums[3] += Total(u, ku);
+	}
+	typedef void (*TileRunF)(const PairCoefs<real>& pc, const PairSystem<real>& s, const real* p, int jb, int je, int j0, real* columns, int stride, double* sums);
+	typedef void (*NeighborRunF)(const PairCoefs<real>& pc, const PairSystem<real>& s, const real* p, const int* index, int count, double* sums);
+
+	// Tile [i0, i1) x [j0, j1) of the upper triangle of the interaction matrix (j > i when i0 == j0): every pair is
+	// computed once, the row sums go to row[3 * (i - i0)] and the column sums, with the opposite sign (Newton's third
+	// law), are added to columns[m * stride + j - j0] (see TileRun). The column arrays must have V::W - 1 spare elements
+	// for the tails.
+	static void Tile(const PairSystem<real>& s, int i0, int i1, int j0, int j1, double* row, real* columns, int stride, double* energy)
+	{
+#define PAIR_TILE_RUN(form, terms) &TileRun<(terms)>,
+		static const TileRunF variants[PAIR_VARIANT_COUNT + 1] = { PAIR_VARIANTS(PAIR_TILE_RUN) &TileRun<TERMS_GENERIC> };
+#undef PAIR_TILE_RUN
+		double U_tile = 0;
+		for (int i = i0; i < i1; i++)
+		{
+			const real p[3] = { s.x[i], s.y[i], s.z[i] };
+			const PairCoefs<real>* coefs_i = s.coefs + s.type[i] * s.types;
+			int begin = i0 == j0 ? i + 1 : j0;
+			double sums[4] = { 0, 0, 0, 0 };
+			for (int k = 0; k < s.runs; k++)
+			{
+				const Run& run = s.run[k];
+				int jb = run.begin > begin ? run.begin : begin, je = run.end < j1 ? run.end : j1;
+				if (jb >= je) continue;
+				const PairCoefs<real>& pc = coefs_i[run.type];
+				variants[pc.variant](pc, s, p, jb, je, j0, columns, stride, sums);
+			}
+			row[(i - i0) * 3] = sums[0]; row[(i - i0) * 3 + 1] = sums[1]; row[(i - i0) * 3 + 2] = sums[2];
+			U_tile += sums[3];
+		}
+		if (with_energy) *energy = U_tile;
+	}
+	// Rows [begin, end) over the neighbor lists: the neighbors of i are neighbors[offsets[i]..offsets[i + 1]), sorted,
+	// so the neighbors of every run are contiguous and share the coefficients. Both directions of a pair are listed,
+	// rows are independent and need no column sums.
+	static void Neighbors(const PairSystem<real>& s, const int* offsets, const int* neighbors, int begin, int end, double* row, double* energy)
+	{
+#define PAIR_NEIGHBOR_RUN(form, terms) &NeighborRun<(terms)>,
+		static const NeighborRunF variants[PAIR_VARIANT_COUNT + 1] = { PAIR_VARIANTS(PAIR_NEIGHBOR_RUN) &NeighborRun<TERMS_GENERIC> };
+#undef PAIR_NEIGHBOR_RUN
+		double U_rows = 0;
+		for (int i = begin; i < end; i++)
+		{
+			const real p[3] = { s.x[i], s.y[i], s.z[i] };
+			const PairCoefs<real>* coefs_i = s.coefs + s.type[i] * s.types;
+			double sums[4] = { 0, 0, 0, 0 };
+			int n = offsets[i], last = offsets[i + 1];
+			for (int k = 0; k < s.runs && n < last; k++)
+			{
+				int q = n;
+				while (q < last && neighbors[q] < s.run[k].end) q++;
+				const PairCoefs<real>& pc = coefs_i[s.run[k].type];
+				if (q > n) variants[pc.variant](pc, s, p, neighbors + n, q - n, sums);
+				n = q;
+			}
+			row[(i - begin) * 3] = sums[0]; row[(i - begin) * 3 + 1] = sums[1]; row[(i - begin) * 3 + 2] = sums[2];
+			U_rows += sums[3];
+		}
+		if (with_energy) *energy = U_rows;
+	}
+};
+
+template <class V, bool compensated> void Tile(const PairSystem<typename V::real>& s, int i0, int i1, int j0, int j1, double* row, typename V::real* columns, int stride, double* energy)
+{
+	if (energy != NULL) PairKernel<V, true, compensated>::Tile(s, i0, i1, j0, j1, row, columns, stride, energy);
+	else PairKernel<V, false, compensated>::Tile(s, i0, i1, j0, j1, row, columns, stride, NULL);
+}
+
+template <class V, bool compensated> void Neighbors(const PairSystem<typename V::real>& s, const int* offsets, const int* neighbors, int begin, int end, double* row, double* energy)
+{
+	if (energy != NULL) PairKernel<V, true, compensated>::Neighbors(s, offsets, neighbors, begin, end, row, energy);
+	else PairKernel<V, false, compensated>::Neighbors(s, offsets, neighbors, begin, end, row, NULL);
+}
+
+#endif
@@ -0,0 +1,182 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <chrono>
+#include "Partition.h"
+
+static size_t Padded(size_t bytes) { return (bytes + 7) / 8 * 8; }
+
+size_t PartitionedForce::Capacity(int workers, int max_ions)
+{
+	size_t init = Padded(sizeof(int) * max_ions) + sizeof(double) * CoefsCount(FORM_BUCKINGHAM4, PARTITION_MAX_TYPES);
+	size_t force = Padded(sizeof(int) * (workers + 1)) + sizeof(double) * 3 * max_ions;
+	return sizeof(PartitionMessage) + (init > force ? init : force);
+}
+
+PartitionedForce::~PartitionedForce()
+{
+	PartitionMessage m = { PARTITION_QUIT };
+	transport->Broadcast(&m, sizeof(m));
+	delete transport;
+}
+
+// Flops of the terms in PairKernel::Pair, an exponential counted as 10
+double PartitionedForce::PairCost(int terms)
+{
+	double cost = 10; // the distance, its square root and inverse
+	if (terms & TERM_COULOMB) cost += 3;
+	if (terms & TERM_DISPERSION) cost += 4;
+	if (terms & TERM_BORN_MAYER) cost += 14;
+	if (terms & TERM_MORSE) cost += 18;
+	if (terms & TERM_SPLINE) cost += 20;
+	return cost / 13;
+}
+
+HRESULT PartitionedForce::Init(PotentialForm form, Precision precision, double cutoff, const int* type, const double* coefs, int types, int ions)
+{
+	const int workers = Workers();
+	if (type == NULL || coefs == NULL || types <= 0 || types > PARTITION_MAX_TYPES || ions <= 0) return E_INVALIDARG;
+	if (Capacity(workers, ions) > transport->Capacity()) return E_INVALIDARG; // more ions than the partition was created for
+	this->ions = 0;
+
+	PartitionMessage m = { PARTITION_INIT, (int)form, (int)precision, ions, types, workers, cutoff };
+	message.resize(transport->Capacity());
+	char* p = &message[0];
+	memcpy(p, &m, sizeof(m)); p += sizeof(m);
+	memcpy(p, type, sizeof(int) * ions); p += Padded(sizeof(int) * ions);
+	memcpy(p, coefs, sizeof(double) * CoefsCount(form, types)); p += sizeof(double) * CoefsCount(form, types);
+	HRESULT hr = transport->Broadcast(&message[0], p - &message[0]);
+	if (FAILED(hr)) return hr;
+
+	reply.resize(transport->Capacity());
+	speed.assign(workers, 1);
+	for (int w = 0; w < workers; w++)
+	{
+		size_t bytes;
+		HRESULT hw = transport->Gather(w, &reply[0], &bytes);
+		const PartitionReply& r = *(const PartitionReply*)&reply[0];
+		if (FAILED(hw) || bytes < sizeof(PartitionReply)) hr = E_FAIL;
+		else if (FAILED(r.status)) hr = r.status;
+		else speed[w] = r.threads;
+	}
+	if (FAILED(hr)) return hr;
+
+	// Cost of a row of type t: the pairs with every run of ions
+	std::vector<int> count(types, 0);
+	for (int i = 0; i < ions; i++) count[type[i]]++;
+	std::vector<double> row_cost(types, 0);
+	for (int t = 0; t < types; t++)
+		for (int u = 0; u < types; u++)
+			row_cost[t] += count[u] * PairCost(PairTerms(form, coefs + (t * types + u) * 8, t * types + u));
+	prefix.resize(ions + 1);
+	prefix[0] = 0;
+	for (int i = 0; i < ions; i++) prefix[i + 1] = prefix[i] + row_cost[type[i]];
+
+	this->ions = ions;
+	seconds.assign(workers, 0);
+	Cut();
+	return S_OK;
+}
+
+// Worker w gets the rows up to the first one where the predicted cost reaches its cumulative share of the speeds
+void PartitionedForce::Cut()
+{
+	const int workers = Workers();
+	double total_speed = 0, cumulative = 0;
+	for (int w = 0; w < workers; w++) total_speed += speed[w];
+	bounds.assign(workers + 1, 0);
+	bounds[workers] = ions;
+	for (int w = 1; w < workers; w++)
+	{
+		cumulative += speed[w - 1];
+		double target = prefix[ions] * cumulative / total_speed;
+		int row = (int)(std::lower_bound(prefix.begin(), prefix.end(), target) - prefix.begin());
+		row = (row + ROW_ALIGN / 2) / ROW_ALIGN * ROW_ALIGN;
+		bounds[w] = std::min(std::max(row, bounds[w - 1]), ions);
+	}
+}
+
+HRESULT PartitionedForce::Force(const double* pos, double* acc, double* energy)
+{
+	const int workers = Workers();
+	if (pos == NULL || acc == NULL) return E_INVALIDARG;
+	if (ions == 0) return E_FAIL;
+
+	PartitionMessage m = { energy != NULL ? PARTITION_ENERGY : PARTITION_FORCE, 0, 0, ions, 0, workers, 0 };
+	char* p = &message[0];
+	memcpy(p, &m, sizeof(m)); p += sizeof(m);
+	memcpy(p, &bounds[0], sizeof(int) * (workers + 1)); p += Padded(sizeof(int) * (workers + 1));
+	memcpy(p, pos, sizeof(double) * 3 * ions); p += sizeof(double) * 3 * ions;
+	HRESULT hr = transport->Broadcast(&message[0], p - &message[0]);
+	if (FAILED(hr)) return hr;
+
+	double U = 0;
+	for (int w = 0; w < workers; w++)
+	{
+		size_t bytes;
+		HRESULT hw = transport->Gather(w, &reply[0], &bytes);
+		const PartitionReply& r = *(const PartitionReply*)&reply[0];
+		if (FAILED(hw) || bytes < sizeof(PartitionReply)) { hr = E_FAIL; continue; }
+		if (FAILED(r.status)) { hr = r.status; continue; }
+		if (r.begin != bounds[w] || r.end != bounds[w + 1] || bytes != sizeof(PartitionReply) + sizeof(double) * 3 * (r.end - r.begin)) { hr = E_FAIL; continue; }
+		memcpy(acc + 3 * r.begin, &reply[sizeof(PartitionReply)], sizeof(double) * 3 * (r.end - r.begin));
+		U += r.energy;
+		seconds[w] = r.seconds;
+	}
+	if (FAILED(hr)) return hr;
+	if (energy != NULL) *energy = U;
+
+	// Speeds of this call, smoothed; a new cut if the slowest worker is too far behind
+	double mean = 0, slowest = 0;
+	for (int w = 0; w < workers; w++)
+	{
+		mean += seconds[w] / workers;
+		slowest = std::max(slowest, seconds[w]);
+		double cost = prefix[bounds[w + 1]] - prefix[bounds[w]];
+		if (cost > 0 && seconds[w] > 0) speed[w] = 0.5 * speed[w] + 0.5 * cost / seconds[w];
+	}
+	if (slowest > (1 + BALANCE_TOLERANCE) * mean) Cut();
+	return S_OK;
+}
+
+HRESULT PartitionWorker(Transport* transport, int rank, int threads)
+{
+	std::vector<char> message(transport->Capacity()), reply;
+	ForceEngine* engine = NULL;
+	HRESULT hr = S_OK;
+	for (;;)
+	{
+		size_t bytes;
+		hr = transport->Receive(&message[0], &bytes);
+		if (FAILED(hr) || bytes < sizeof(PartitionMessage)) break;
+		const PartitionMessage& m = *(const PartitionMessage*)&message[0];
+		const char* p = &message[0] + sizeof(m);
+		PartitionReply r = { S_OK, 0, 0, 0, 0, 0 };
+		if (m.command == PARTITION_QUIT) break;
+		if (m.command == PARTITION_INIT)
+		{
+			delete engine;
+			engine = new ForceEngine((PotentialForm)m.form, (Precision)m.precision, m.cutoff);
+			if (threads > 0) engine->SetThreads(threads);
+			r.status = engine->Init((const int*)p, (const double*)(p + Padded(sizeof(int) * m.ions)), m.types, m.ions);
+			r.threads = engine->Threads();
+			hr = transport->Reply(&r, sizeof(r));
+		}
+		else
+		{
+			const int* bounds = (const int*)p;
+			const double* pos = (const double*)(p + Padded(sizeof(int) * (m.workers + 1)));
+			r.begin = bounds[rank]; r.end = bounds[rank + 1];
+			reply.resize(sizeof(r) + sizeof(double) * 3 * (r.end - r.begin));
+			auto start = std::chrono::steady_clock::now();
+			if (engine == NULL || m.ions != engine->Ions()) r.status = E_FAIL;
+			if (!FAILED(r.status)) r.status = engine->SetPositions(pos);
+			if (!FAILED(r.status)) r.status = engine->Rows(r.begin, r.end, (double*)&reply[sizeof(r)], m.command == PARTITION_ENERGY ? &r.energy : NULL);
+			r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			memcpy(&reply[0], &r, sizeof(r));
+			hr = transport->Reply(&reply[0], FAILED(r.status) ? sizeof(r) : reply.size());
+		}
+		if (FAILED(hr)) break;
+	}
+	delete engine;
+	return hr;
+}
@@ -0,0 +1,60 @@
+#ifndef _PARTITION_H_
+#define _PARTITION_H_
+
+#include <vector>
+#include "Transport.h"
+
+// All-pairs forces split by rows over worker processes on this machine or others (Transport): every worker has an
+// engine with all the ions, gets all the positions every call and computes the forces of its slice of rows only
+// (ForceEngine::Rows, no Newton's third law across slices), the master puts the slices together.
+// The ions are sorted by type (MDIBC.Init), so the cost of a row is constant along a run of one type and differs
+// between runs: O-O pairs of Buckingham4 have the spline, U-U pairs only Coulomb. The master predicts the cost of a row
+// from the terms of its pairs (PairCost) and cuts the rows so that every worker gets a share of the total cost
+// proportional to its speed: at first its hardware threads, then the cost it did per second, measured every call.
+// The slices are cut again only when the slowest worker is more than BALANCE_TOLERANCE behind the mean, so the rows
+// of a worker (and the order of its sums) stay the same while the speeds do. Slices start at multiples of ROW_ALIGN.
+#define PARTITION_MAX_TYPES 16 // of the messages: the coefficients of Init
+#define BALANCE_TOLERANCE 0.05
+#define ROW_ALIGN 16
+
+enum PartitionCommand { PARTITION_INIT = 1, PARTITION_FORCE, PARTITION_ENERGY, PARTITION_QUIT };
+
+// A broadcast: the header, then
+//  PARTITION_INIT - int type[ions], double coefs[CoefsCount(form, types)];
+//  PARTITION_FORCE, PARTITION_ENERGY - int bounds[workers + 1] (padded to 8 bytes), double pos[ions * 3]
+struct PartitionMessage { int command, form, precision, ions, types, workers; double cutoff; }; // precision: Precision
+// A reply: the header, then double acc[(end - begin) * 3] of the rows [begin, end) for force and energy
+struct PartitionReply { int status, threads, begin, end; double seconds, energy; };
+
+class PartitionedForce
+{
+public:
+	PartitionedForce(Transport* transport) : transport(transport), ions(0) { }
+	~PartitionedForce(); // the workers exit
+
+	static size_t Capacity(int workers, int max_ions); // of the messages
+	HRESULT Init(PotentialForm form, Precision precision, double cutoff, const int* type, const double* coefs, int types, int ions);
+	HRESULT Force(const double* pos, double* acc, double* energy); // energy NULL: forces only
+	int Workers() const { return transport->Workers(); }
+	const int* Bounds() const { return bounds.empty() ? NULL : &bounds[0]; } // rows of worker w: [bounds[w], bounds[w + 1]), NULL before Init
+	const double* Seconds() const { return seconds.empty() ? NULL : &seconds[0]; } // compute time of every worker in the last call
+
+	static double PairCost(int terms); // relative to Coulomb
+
+private:
+	void Cut();
+
+	Transport* transport;
+	int ions;
+	std::vector<double> prefix; // prefix[i]: predicted cost of rows [0, i)
+	std::vector<double> speed; // cost per second of every worker
+	std::vector<int> bounds;
+	std::vector<double> seconds;
+	std::vector<char> message, reply;
+};
+
+// The loop of a worker: serves the broadcasts of the master until PARTITION_QUIT or the master is gone (threads as
+// ThreadPool::Resolve)
+HRESULT PartitionWorker(Transport* transport, int rank, int threads);
+
+#endif
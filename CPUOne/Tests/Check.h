@@ -0,0 +1,14 @@
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+// Checks of the CPUOne tests: a failed CHECK prints its expression and counts, RUN prints the result of a test, and
+// main returns Failures() so that a script sees the result in the exit code.
+#include <stdio.h>
+
+static int check_failures = 0;
+static int Failures() { return check_failures; }
+
+#define CHECK(condition) do { if (!(condition)) { check_failures++; printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); } } while (0)
+#define RUN(test) do { int before = check_failures; test(); printf("%s %s\n", check_failures == before ? "ok  " : "FAIL", #test); } while (0)
+
+#endif
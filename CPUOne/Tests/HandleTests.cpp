@@ -0,0 +1,85 @@
+// Tests of the life cycle of the CPUOne handles: stale copies of released handles fail every call, and a failed
+// InitEngine leaves an engine whose other calls fail cleanly.
+// g++ -std=c++11 -march=native -I.. -o HandleTests HandleTests.cpp ../*.cpp -lpthread && ./HandleTests
+
+#include "stdafx.h"
+#include <vector>
+#include "Check.h"
+
+static const double coefs[32] = { 14.4, 1000, -3, 0, 0, 0, 0, 0, -14.4, 1000, -3, 0, 0, 0, 0, 0, -14.4, 1000, -3, 0, 0, 0, 0, 0, 14.4, 1000, -3, 0, 0, 0, 0, 0 };
+
+// A failed Init (a type out of range, a table of other types) must not leave buffers sized for no or other ions
+static void FailedInit()
+{
+	Engine e;
+	CHECK(CreateEngine("Buckingham", 0, 10, &e) == S_OK);
+	int bad[4] = { 0, 0, 5, 1 };
+	double pos[12] = { 0, 0, 0, 3, 0, 0, 0, 3, 0, 0, 0, 3 }, acc[12];
+	CHECK(InitEngine(e, bad, coefs, 2, 4) == E_INVALIDARG);
+	CHECK(FAILED(SetPositions(e, pos, 4)));
+	CHECK(FAILED(ComputeForce(e, acc)));
+
+	// A good Init works after the failed one; a bad one after it changes nothing, the engine keeps its 4 ions
+	int type[4] = { 0, 0, 1, 1 };
+	CHECK(InitEngine(e, type, coefs, 2, 4) == S_OK);
+	CHECK(SetPositions(e, pos, 4) == S_OK && ComputeForce(e, acc) == S_OK);
+	std::vector<int> more(8, 0);
+	more[7] = 2;
+	std::vector<double> more_pos(24, 0);
+	CHECK(InitEngine(e, &more[0], coefs, 2, 8) == E_INVALIDARG);
+	CHECK(SetPositions(e, &more_pos[0], 8) == E_INVALIDARG);
+	CHECK(SetPositions(e, pos, 4) == S_OK && ComputeForce(e, acc) == S_OK);
+
+	// A failure after the checks (coefficients the Coulomb tree cannot factorize) leaves no ions
+	CHECK(SetCoulombTree(e, 0.5, 0) == S_OK);
+	double mixed[32];
+	memcpy(mixed, coefs, sizeof(mixed));
+	mixed[8] = 3; // Ke q0 q1 of the pair 0-1 but not of 1-0: no charges give these products
+	CHECK(InitEngine(e, type, mixed, 2, 4) == E_NOTIMPL);
+	CHECK(FAILED(SetPositions(e, pos, 4)));
+	CHECK(FAILED(ComputeForce(e, acc)));
+	CHECK(ReleaseEngine(e) == S_OK);
+}
+
+// A copy of a released handle fails every call, also when a new object takes the address of the released one
+static void StaleHandles()
+{
+	int type[4] = { 0, 0, 1, 1 };
+	double pos[12] = { 0, 0, 0, 3, 0, 0, 0, 3, 0, 0, 0, 3 }, acc[12];
+	Engine e, stale;
+	CHECK(CreateEngine("Buckingham", 0, 10, &stale) == S_OK);
+	CHECK(ReleaseEngine(stale) == S_OK);
+	CHECK(CreateEngine("Buckingham", 0, 10, &e) == S_OK); // often at the address of stale
+	CHECK(e.serial != stale.serial);
+	CHECK(InitEngine(stale, type, coefs, 2, 4) == E_FAIL);
+	CHECK(SetPositions(stale, pos, 4) == E_FAIL && ComputeForce(stale, acc) == E_FAIL);
+	CHECK(ReleaseEngine(stale) == E_FAIL);
+	CHECK(InitEngine(e, type, coefs, 2, 4) == S_OK && SetPositions(e, pos, 4) == S_OK && ComputeForce(e, acc) == S_OK);
+
+	Engine wrong = e;
+	wrong.id = Analysis::ID;
+	CHECK(ComputeForce(wrong, acc) == E_FAIL && ReleaseEngine(wrong) == E_FAIL);
+	CHECK(ComputeForce(Engine(), acc) == E_FAIL && ReleaseEngine(Engine()) == E_FAIL);
+	CHECK(ReleaseEngine(e) == S_OK && ReleaseEngine(e) == E_FAIL);
+
+	Ensemble s, stale_s;
+	CHECK(CreateEnsemble(0, 10, 1, &stale_s) == S_OK && ReleaseEnsemble(stale_s) == S_OK);
+	CHECK(CreateEnsemble(0, 10, 1, &s) == S_OK);
+	CHECK(InitEnsembleSystem(stale_s, 0, "Buckingham", type, coefs, 2, 4) == E_FAIL && ReleaseEnsemble(stale_s) == E_FAIL);
+	CHECK(InitEnsembleSystem(s, 0, "Buckingham", type, coefs, 2, 4) == S_OK && ReleaseEnsemble(s) == S_OK);
+
+	Analysis a, stale_a;
+	CHECK(CreateAnalysis(type, 2, 4, 1, &stale_a) == S_OK && ReleaseAnalysis(stale_a) == S_OK);
+	CHECK(CreateAnalysis(type, 2, 4, 1, &a) == S_OK);
+	int histogram[8], centers[4];
+	CHECK(PairHistogram(stale_a, pos, 5, 0, 8, histogram, centers) == E_FAIL && ReleaseAnalysis(stale_a) == E_FAIL);
+	CHECK(ReleaseAnalysis(a) == S_OK);
+	CHECK(ReleasePartition(Partition()) == E_FAIL);
+}
+
+int main()
+{
+	RUN(StaleHandles);
+	RUN(FailedInit);
+	return Failures();
+}
@@ -0,0 +1,107 @@
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+namespace CPUOne {
+
+int ThreadPool::Resolve(int threads)
+{
+	const char* env = getenv("CPUONE_THREADS");
+	if (threads <= 0 && env != NULL) threads = atoi(env);
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	return threads > 0 ? threads : 1;
+}
+
+ThreadPool::ThreadPool(int threads) : job(NULL), active(0), generation(0), stop(false)
+{
+	threads = Resolve(threads);
+	shares = std::vector<Share>(threads);
+	for (int i = 1; i < threads; i++) workers.push_back(std::thread(&ThreadPool::Work, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	started.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+void ThreadPool::Run(int count, const std::function<void(int index, int worker)>& f)
+{
+	if (count <= 0) return;
+	if (workers.empty() || count == 1) { for (int i = 0; i < count; i++) f(i, 0); return; }
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		int threads = Threads();
+		for (int w = 0; w < threads; w++)
+			shares[w].range = Pack((unsigned)((long long)count * w / threads), (unsigned)((long long)count * (w + 1) / threads));
+		job = &f;
+		active = (int)workers.size();
+		generation++;
+	}
+	started.notify_all();
+	Execute(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this] { return active == 0; });
+	job = NULL;
+}
+
+void ThreadPool::Execute(int worker)
+{
+	std::atomic<unsigned long long>& range = shares[worker].range;
+	do
+	{
+		unsigned long long r = range.load();
+		while ((unsigned)(r >> 32) < (unsigned)r)
+		{
+			unsigned begin = (unsigned)(r >> 32);
+			if (range.compare_exchange_weak(r, Pack(begin + 1, (unsigned)r))) { (*job)((int)begin, worker); r = range.load(); }
+		}
+	} while (Steal(worker));
+}
+
+bool ThreadPool::Steal(int worker)
+{
+	int threads = Threads();
+	for (;;)
+	{
+		int victim = -1; unsigned most = 0; unsigned long long r = 0;
+		for (int w = 0; w < threads; w++)
+		{
+			if (w == worker) continue;
+			unsigned long long v = shares[w].range.load();
+			unsigned left = (unsigned)v - (unsigned)(v >> 32);
+			if ((unsigned)v > (unsigned)(v >> 32) && left > most) { most = left; victim = w; r = v; }
+		}
+		if (victim < 0) return false;
+		unsigned begin = (unsigned)(r >> 32), end = (unsigned)r, middle = end - (end - begin + 1) / 2;
+		if (shares[victim].range.compare_exchange_strong(r, Pack(begin, middle)))
+		{
+			shares[worker].range = Pack(middle, end);
+			return true;
+		}
+	}
+}
+
+void ThreadPool::Work(int worker)
+{
+	long seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			started.wait(lock, [&] { return stop || generation != seen; });
+			if (stop) return;
+			seen = generation;
+		}
+		Execute(worker);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--active == 0) finished.notify_one();
+	}
+}
+
+}
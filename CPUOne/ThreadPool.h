@@ -0,0 +1,48 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool. Run(count, f) gives every worker a contiguous share of [0, count) (the calling thread is
+// worker 0); a worker takes indices from the front of its share and, when it is empty, steals the back half of
+// the largest remaining share. Indices of one share are called in increasing order, which keeps neighboring
+// tiles on one core. Run returns when every call is finished and is not reentrant.
+// In a namespace of its own: DX11One has another ThreadPool, and both libraries can be loaded in one process.
+namespace CPUOne {
+class ThreadPool
+{
+public:
+	ThreadPool(int threads); // threads as Resolve
+	static int Resolve(int threads); // threads <= 0: CPUONE_THREADS if it is set, else one per hardware thread
+	~ThreadPool();
+
+	int Threads() const { return (int)workers.size() + 1; }
+	void Run(int count, const std::function<void(int index, int worker)>& f);
+
+private:
+	void Work(int worker);
+	void Execute(int worker);
+	bool Steal(int worker);
+
+	// [begin, end) of a share packed into one word, so that the owner and thieves change it by CAS
+	struct Share { std::atomic<unsigned long long> range; char pad[64 - sizeof(std::atomic<unsigned long long>)]; };
+	static unsigned long long Pack(unsigned begin, unsigned end) { return ((unsigned long long)begin << 32) | end; }
+
+	std::vector<std::thread> workers;
+	std::vector<Share> shares;
+	std::mutex mutex;
+	std::condition_variable started, finished;
+	const std::function<void(int, int)>* job;
+	int active;
+	long generation;
+	bool stop;
+};
+}
+using CPUOne::ThreadPool;
+
+#endif
@@ -0,0 +1,486 @@
+#ifdef _WIN32
+#include <winsock2.h> // before windows.h of CPUOne.h
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET socket_t;
+#else
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+#include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Transport.h"
+
+#define TRANSPORT_MAGIC 0x31505254 // "TRP1"
+
+// Waits until done() with a growing pause: spins, then yields, then sleeps 50 us, so an idle peer costs little CPU.
+// timeout < 0: no limit; false on timeout, or when alive(), asked every 0.1 s, says that the peer is gone.
+template <class F, class A> static bool Poll(F done, A alive, double timeout)
+{
+	auto start = std::chrono::steady_clock::now();
+	double checked = 0;
+	for (long long n = 0; !done(); n++)
+	{
+		if (n < 1000) continue;
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (timeout >= 0 && elapsed > timeout) return false;
+		if (elapsed > checked + 0.1) { if (!alive()) return done(); checked = elapsed; }
+		if (elapsed < 1e-3) std::this_thread::yield();
+		else std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	return true;
+}
+template <class F> static bool Poll(F done, double timeout) { return Poll(done, []() { return true; }, timeout); }
+
+static long long ProcessId()
+{
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return getpid();
+#endif
+}
+// Whether the process still runs (0: not known yet, taken as running). A peer killed on the spot never marks the
+// segment, this is what ends the waits for it then.
+static bool ProcessAlive(long long pid)
+{
+	if (pid <= 0) return true;
+#ifdef _WIN32
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+	if (process == NULL) return GetLastError() == ERROR_ACCESS_DENIED;
+	bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return alive;
+#else
+	return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+// --- shm: the segment holds the header, a slot per worker, the broadcast area and a reply area per worker
+
+struct SharedHeader
+{
+	std::atomic<int> magic; // stored last by the master, the rest is valid then
+	std::atomic<int> closed; // the master is gone
+	int workers;
+	long long capacity, area; // area: capacity rounded up to 64 bytes
+	std::atomic<long long> sequence; // of the message in the broadcast area
+	long long bytes;
+	long long pid; // of the master process
+};
+struct SharedSlot
+{
+	std::atomic<int> state; // 0 free, 1 connected, 2 gone
+	std::atomic<long long> reply; // the sequence number this worker has replied to
+	long long bytes;
+	std::atomic<long long> pid; // of the worker process, 0 until it is connected
+	char pad[64 - 4 * sizeof(long long)]; // a slot per cache line
+};
+
+class SharedMemoryTransport : public Transport
+{
+public:
+	SharedMemoryTransport(const std::string& name, bool master) : Transport(0, 0), name(name), master(master), rank(-1), last(0), base(NULL), size(0)
+	{
+#ifdef _WIN32
+		mapping = NULL;
+#else
+		fd = -1;
+#endif
+	}
+	~SharedMemoryTransport()
+	{
+		if (base != NULL)
+		{
+			if (master) Header()->closed.store(1, std::memory_order_release);
+			else if (rank >= 0) Slot(rank)->state.store(2, std::memory_order_release);
+		}
+#ifdef _WIN32
+		if (base != NULL) UnmapViewOfFile(base);
+		if (mapping != NULL) CloseHandle(mapping);
+#else
+		if (base != NULL) munmap(base, size);
+		if (fd >= 0) close(fd);
+		if (master && fd >= 0) shm_unlink(name.c_str());
+#endif
+	}
+
+	HRESULT Create(int workers, size_t capacity)
+	{
+		this->workers = workers;
+		this->capacity = capacity;
+		long long area = (capacity + 63) / 64 * 64;
+		size = (size_t)(64 + 64 * workers + area * (workers + 1));
+#ifdef _WIN32
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, name.c_str());
+		if (mapping == NULL) return E_FAIL;
+		if (GetLastError() == ERROR_ALREADY_EXISTS) return E_FAIL; // another master
+		base = (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+		shm_unlink(name.c_str()); // of a master that did not exit cleanly
+		fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0) return E_FAIL;
+		if (ftruncate(fd, size) != 0) return E_OUTOFMEMORY;
+		void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		base = p == MAP_FAILED ? NULL : (char*)p;
+#endif
+		if (base == NULL) return E_OUTOFMEMORY;
+		memset(base, 0, 64 + 64 * workers);
+		SharedHeader* h = Header();
+		h->workers = workers;
+		h->capacity = capacity;
+		h->area = area;
+		h->pid = ProcessId();
+		h->magic.store(TRANSPORT_MAGIC, std::memory_order_release);
+		return S_OK;
+	}
+	HRESULT WaitWorkers(double timeout)
+	{
+		bool all = Poll([&]() { for (int w = 0; w < workers; w++) if (Slot(w)->state.load(std::memory_order_acquire) != 1) return false; return true; }, timeout);
+		return all ? S_OK : E_FAIL;
+	}
+	HRESULT Open(int rank, double timeout)
+	{
+		bool opened = Poll([&]() {
+#ifdef _WIN32
+			if (mapping == NULL) mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+			if (mapping == NULL) return false;
+			if (base == NULL) base = (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+			if (base == NULL) return false;
+#else
+			if (fd < 0) fd = shm_open(name.c_str(), O_RDWR, 0600);
+			if (fd < 0) return false;
+			struct stat st;
+			if (base == NULL && fstat(fd, &st) == 0 && st.st_size >= 64)
+			{
+				size = (size_t)st.st_size;
+				void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				base = p == MAP_FAILED ? NULL : (char*)p;
+			}
+			if (base == NULL) return false;
+#endif
+			return Header()->magic.load(std::memory_order_acquire) == TRANSPORT_MAGIC;
+		}, timeout);
+		if (!opened) return E_FAIL;
+		SharedHeader* h = Header();
+		workers = h->workers;
+		capacity = (size_t)h->capacity;
+		if (rank < 0 || rank >= workers) return E_INVALIDARG;
+		int free_state = 0;
+		if (!Slot(rank)->state.compare_exchange_strong(free_state, 1)) return E_FAIL; // the rank is taken
+		Slot(rank)->pid.store(ProcessId(), std::memory_order_release);
+		this->rank = rank;
+		last = h->sequence.load(std::memory_order_acquire);
+		return S_OK;
+	}
+
+	HRESULT Broadcast(const void* data, size_t bytes)
+	{
+		if (bytes > capacity) return E_INVALIDARG;
+		SharedHeader* h = Header();
+		long long sequence = h->sequence.load(std::memory_order_relaxed);
+		for (int w = 0; w < workers; w++) // the last broadcast must be read before it is overwritten
+			if (!Poll([&]() { return Slot(w)->reply.load(std::memory_order_acquire) == sequence || Slot(w)->state.load() == 2; }, [&]() { return WorkerAlive(w); }, -1)) return E_FAIL;
+		memcpy(Area(-1), data, bytes);
+		h->bytes = bytes;
+		h->sequence.store(sequence + 1, std::memory_order_release);
+		return S_OK;
+	}
+	HRESULT Gather(int worker, void* data, size_t* bytes)
+	{
+		if (worker < 0 || worker >= workers || bytes == NULL) return E_INVALIDARG;
+		SharedSlot* s = Slot(worker);
+		long long sequence = Header()->sequence.load(std::memory_order_relaxed);
+		Poll([&]() { return s->reply.load(std::memory_order_acquire) == sequence || s->state.load(std::memory_order_acquire) == 2; }, [&]() { return WorkerAlive(worker); }, -1);
+		if (s->reply.load(std::memory_order_acquire) != sequence) return E_FAIL;
+		*bytes = (size_t)s->bytes;
+		memcpy(data, Area(worker), *bytes);
+		return S_OK;
+	}
+	HRESULT Receive(void* data, size_t* bytes)
+	{
+		if (bytes == NULL) return E_INVALIDARG;
+		SharedHeader* h = Header();
+		Poll([&]() { return h->sequence.load(std::memory_order_acquire) > last || h->closed.load(std::memory_order_acquire) != 0; }, [&]() { return ProcessAlive(h->pid); }, -1);
+		if (h->sequence.load(std::memory_order_acquire) <= last) return E_FAIL;
+		last++;
+		*bytes = (size_t)h->bytes;
+		memcpy(data, Area(-1), *bytes);
+		return S_OK;
+	}
+	HRESULT Reply(const void* data, size_t bytes)
+	{
+		if (bytes > capacity) return E_INVALIDARG;
+		SharedSlot* s = Slot(rank);
+		memcpy(Area(rank), data, bytes);
+		s->bytes = bytes;
+		s->reply.store(last, std::memory_order_release);
+		return S_OK;
+	}
+
+private:
+	SharedHeader* Header() { return (SharedHeader*)base; }
+	SharedSlot* Slot(int worker) { return (SharedSlot*)(base + 64 + 64 * worker); }
+	bool WorkerAlive(int worker) // marks the slot gone when the process is
+	{
+		if (ProcessAlive(Slot(worker)->pid.load(std::memory_order_acquire))) return true;
+		Slot(worker)->state.store(2, std::memory_order_release);
+		return false;
+	}
+	char* Area(int worker) { return base + 64 + 64 * workers + Header()->area * (worker + 1); } // -1: the broadcast
+
+	std::string name;
+	bool master;
+	int rank;
+	long long last; // worker: the sequence number of the last broadcast received
+	char* base;
+	size_t size;
+#ifdef _WIN32
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+};
+
+// --- tcp: a socket per worker, messages are a 64-bit length and the bytes
+
+static bool SendAll(socket_t s, const void* data, size_t bytes)
+{
+	const char* p = (const char*)data;
+	while (bytes > 0)
+	{
+		int n = send(s, p, bytes < (1 << 30) ? (int)bytes : (1 << 30), 0);
+		if (n <= 0) return false;
+		p += n; bytes -= n;
+	}
+	return true;
+}
+static bool ReceiveAll(socket_t s, void* data, size_t bytes)
+{
+	char* p = (char*)data;
+	while (bytes > 0)
+	{
+		int n = recv(s, p, bytes < (1 << 30) ? (int)bytes : (1 << 30), 0);
+		if (n <= 0) return false;
+		p += n; bytes -= n;
+	}
+	return true;
+}
+static void NoDelay(socket_t s)
+{
+	int one = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+}
+static bool Startup()
+{
+#ifdef _WIN32
+	static bool started = false;
+	WSADATA data;
+	if (!started) started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	return started;
+#else
+	return true;
+#endif
+}
+
+class SocketTransport : public Transport
+{
+public:
+	SocketTransport() : Transport(0, 0), listener(INVALID_SOCKET) { }
+	~SocketTransport()
+	{
+		for (size_t k = 0; k < sockets.size(); k++) if (sockets[k] != INVALID_SOCKET) closesocket(sockets[k]);
+		if (listener != INVALID_SOCKET) closesocket(listener);
+	}
+
+	HRESULT Listen(const std::string& host, const std::string& port, int workers, size_t capacity, double timeout)
+	{
+		this->workers = workers;
+		this->capacity = capacity;
+		sockets.assign(workers, INVALID_SOCKET);
+		addrinfo hints, *address = NULL;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		if (getaddrinfo(host == "*" ? NULL : host.c_str(), port.c_str(), &hints, &address) != 0) return E_INVALIDARG;
+		listener = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		int one = 1;
+		if (listener != INVALID_SOCKET) setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+		bool ok = listener != INVALID_SOCKET && bind(listener, address->ai_addr, (int)address->ai_addrlen) == 0 && listen(listener, workers) == 0;
+		freeaddrinfo(address);
+		if (!ok) return E_FAIL;
+
+		auto start = std::chrono::steady_clock::now();
+		for (int connected = 0; connected < workers; )
+		{
+			double left = timeout - std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (left <= 0) return E_FAIL;
+			fd_set set;
+			FD_ZERO(&set);
+			FD_SET(listener, &set);
+			timeval wait = { (long)left, (long)((left - (long)left) * 1e6) };
+			if (select((int)listener + 1, &set, NULL, NULL, &wait) <= 0) continue;
+			socket_t s = accept(listener, NULL, NULL);
+			if (s == INVALID_SOCKET) continue;
+			int hello[2]; // magic, rank
+			if (!ReceiveAll(s, hello, sizeof(hello)) || hello[0] != TRANSPORT_MAGIC || hello[1] < 0 || hello[1] >= workers || sockets[hello[1]] != INVALID_SOCKET)
+			{
+				closesocket(s);
+				continue;
+			}
+			long long welcome[3] = { TRANSPORT_MAGIC, workers, (long long)capacity };
+			if (!SendAll(s, welcome, sizeof(welcome))) { closesocket(s); continue; }
+			NoDelay(s);
+			sockets[hello[1]] = s;
+			connected++;
+		}
+		return S_OK;
+	}
+	HRESULT Connect(const std::string& host, const std::string& port, int rank, double timeout)
+	{
+		addrinfo hints, *address = NULL;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host == "*" ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &address) != 0) return E_INVALIDARG;
+		socket_t s = INVALID_SOCKET;
+		bool connected = Poll([&]() {
+			s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (s != INVALID_SOCKET && connect(s, address->ai_addr, (int)address->ai_addrlen) == 0) return true;
+			if (s != INVALID_SOCKET) closesocket(s);
+			s = INVALID_SOCKET;
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			return false;
+		}, timeout);
+		freeaddrinfo(address);
+		if (!connected) return E_FAIL;
+		sockets.assign(1, s);
+		int hello[2] = { TRANSPORT_MAGIC, rank };
+		long long welcome[3];
+		if (!SendAll(s, hello, sizeof(hello)) || !ReceiveAll(s, welcome, sizeof(welcome)) || welcome[0] != TRANSPORT_MAGIC) return E_FAIL;
+		workers = (int)welcome[1];
+		capacity = (size_t)welcome[2];
+		NoDelay(s);
+		return S_OK;
+	}
+
+	HRESULT Broadcast(const void* data, size_t bytes)
+	{
+		if (bytes > capacity) return E_INVALIDARG;
+		unsigned long long length = bytes;
+		for (int w = 0; w < workers; w++)
+			if (!SendAll(sockets[w], &length, sizeof(length)) || !SendAll(sockets[w], data, bytes)) return E_FAIL;
+		return S_OK;
+	}
+	HRESULT Gather(int worker, void* data, size_t* bytes)
+	{
+		if (worker < 0 || worker >= workers || bytes == NULL) return E_INVALIDARG;
+		return Read(sockets[worker], data, bytes);
+	}
+	HRESULT Receive(void* data, size_t* bytes) { return bytes == NULL ? E_INVALIDARG : Read(sockets[0], data, bytes); }
+	HRESULT Reply(const void* data, size_t bytes)
+	{
+		if (bytes > capacity) return E_INVALIDARG;
+		unsigned long long length = bytes;
+		return SendAll(sockets[0], &length, sizeof(length)) && SendAll(sockets[0], data, bytes) ? S_OK : E_FAIL;
+	}
+
+private:
+	HRESULT Read(socket_t s, void* data, size_t* bytes)
+	{
+		unsigned long long length;
+		if (!ReceiveAll(s, &length, sizeof(length)) || length > capacity) return E_FAIL;
+		*bytes = (size_t)length;
+		return ReceiveAll(s, data, *bytes) ? S_OK : E_FAIL;
+	}
+
+	std::vector<socket_t> sockets; // master: by rank; worker: the master
+	socket_t listener;
+};
+
+// "shm:name" or "tcp:host:port"
+static bool ParseAddress(const char* address, std::string& kind, std::string& host, std::string& port)
+{
+	if (address == NULL) return false;
+	std::string a(address);
+	size_t colon = a.find(':');
+	if (colon == std::string::npos) return false;
+	kind = a.substr(0, colon);
+	host = a.substr(colon + 1);
+	if (kind == "shm")
+	{
+#ifdef _WIN32
+		host = "Local\\" + host;
+#else
+		host = "/" + host;
+#endif
+		return host.size() > 1;
+	}
+	if (kind != "tcp") return false;
+	size_t last = host.rfind(':');
+	if (last == std::string::npos) return false;
+	port = host.substr(last + 1);
+	host = host.substr(0, last);
+	return !host.empty() && !port.empty();
+}
+
+HRESULT Transport::Listen(const char* address, int workers, size_t capacity, double timeout, Transport** transport)
+{
+	std::string kind, host, port;
+	if (transport == NULL || workers <= 0 || capacity == 0 || !ParseAddress(address, kind, host, port)) return E_INVALIDARG;
+	*transport = NULL;
+	HRESULT hr;
+	if (kind == "shm")
+	{
+		SharedMemoryTransport* t = new SharedMemoryTransport(host, true);
+		hr = t->Create(workers, capacity);
+		if (!FAILED(hr)) hr = t->WaitWorkers(timeout);
+		if (FAILED(hr)) delete t; else *transport = t;
+	}
+	else
+	{
+		if (!Startup()) return E_FAIL;
+		SocketTransport* t = new SocketTransport();
+		hr = t->Listen(host, port, workers, capacity, timeout);
+		if (FAILED(hr)) delete t; else *transport = t;
+	}
+	return hr;
+}
+
+HRESULT Transport::Connect(const char* address, int rank, double timeout, Transport** transport)
+{
+	std::string kind, host, port;
+	if (transport == NULL || rank < 0 || !ParseAddress(address, kind, host, port)) return E_INVALIDARG;
+	*transport = NULL;
+	HRESULT hr;
+	if (kind == "shm")
+	{
+		SharedMemoryTransport* t = new SharedMemoryTransport(host, false);
+		hr = t->Open(rank, timeout);
+		if (FAILED(hr)) delete t; else *transport = t;
+	}
+	else
+	{
+		if (!Startup()) return E_FAIL;
+		SocketTransport* t = new SocketTransport();
+		hr = t->Connect(host, port, rank, timeout);
+		if (FAILED(hr)) delete t; else *transport = t;
+	}
+	return hr;
+}
@@ -0,0 +1,36 @@
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+// Messages between the master of a partitioned force and its workers (see Partition.h): the master broadcasts a message
+// to every worker and gathers one reply from each, a worker receives the broadcasts in order and replies to every one.
+// Addresses:
+//  shm:name - a shared memory segment on this machine, created by the master (shm_open("/name"), "Local\name" on
+//   Windows): a broadcast area and a reply area per worker, handed over by sequence numbers that the other side polls;
+//  tcp:host:port - the master listens on host:port (host * for every interface), the workers connect to it; messages
+//   are framed by their length.
+// A message is at most the capacity given to Listen, the workers learn it when they connect. Waits for a peer end with
+// E_FAIL when the peer is gone (the socket closes, the shared segment says so, or the process of the peer has exited);
+// only connecting has a timeout.
+class Transport
+{
+public:
+	virtual ~Transport() { }
+	virtual HRESULT Broadcast(const void* data, size_t bytes) = 0; // master
+	virtual HRESULT Gather(int worker, void* data, size_t* bytes) = 0; // master: the reply of worker to the last broadcast
+	virtual HRESULT Receive(void* data, size_t* bytes) = 0; // worker: the next broadcast
+	virtual HRESULT Reply(const void* data, size_t bytes) = 0; // worker
+	int Workers() const { return workers; }
+	size_t Capacity() const { return capacity; }
+
+	// Master: waits up to timeout seconds until every worker has connected
+	static HRESULT Listen(const char* address, int workers, size_t capacity, double timeout, Transport** transport);
+	// Worker rank of [0, workers): retries up to timeout seconds while the master is not there yet
+	static HRESULT Connect(const char* address, int rank, double timeout, Transport** transport);
+
+protected:
+	Transport(int workers, size_t capacity) : workers(workers), capacity(capacity) { }
+	int workers;
+	size_t capacity;
+};
+
+#endif
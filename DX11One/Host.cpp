@@ -0,0 +1,592 @@
+#include "stdafx.h"
+#ifdef DX11ONE_HOST
+#include <algorithm>
+#include <atomic>
+
+int Device::ID = 1001001;
+int Context::ID = 1001002;
+int Shader::ID = 1001003;
+int Buffer::ID = 1001004;
+int Texture2D::ID = 1001005;
+
+// Every device and context of CreateDevice, freed by Dispose; the contexts are independent of each other
+std::mutex devices_lock;
+std::vector<HostDevice*> devices;
+std::vector<HostContext*> contexts;
+ResourcePool<Buffer> buffer_pool;
+ResourcePool<Texture2D> texture_pool;
+// The messages *errors of CompileShader and LoadOrCompileShader point to, valid until the next compile on the thread
+static thread_local std::string compile_errors;
+
+// The context of a handle, NULL unless CreateDevice made it and Dispose has not freed it (State of One.cpp)
+static HostContext* State(const Context& context)
+{
+	if (context.id != context.ID || context.ptr == NULL) return NULL;
+	std::lock_guard<std::mutex> guard(devices_lock);
+	return std::find(contexts.begin(), contexts.end(), context.ptr) == contexts.end() ? NULL : context.ptr;
+}
+
+// A handle of a resource that has not been released since it was made or taken from the pool (ResourcePool.h)
+static bool Live(const Buffer& b) { return b.id == b.ID && b.p_buffer != NULL && buffer_pool.Live(b.p_buffer, b.serial); }
+static bool Live(const Texture2D& t) { return t.id == t.ID && t.p_texture != NULL && texture_pool.Live(t.p_texture, t.serial); }
+
+// Host memory does not belong to a device: one pool for all of them, the usage and flags are the views
+static PoolKey HostKey(int dimension, int width, int height, int format, bool srv, bool uav)
+{
+	PoolKey key = { NULL, dimension, 0, 0, 0, width, height, format, (srv ? 1 : 0) | (uav ? 2 : 0) };
+	return key;
+}
+
+int FormatSize(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+		case DXGI_FORMAT_R32G32B32A32_TYPELESS: case DXGI_FORMAT_R32G32B32A32_FLOAT: case DXGI_FORMAT_R32G32B32A32_UINT: case DXGI_FORMAT_R32G32B32A32_SINT: return 16;
+		case DXGI_FORMAT_R32G32B32_TYPELESS: case DXGI_FORMAT_R32G32B32_FLOAT: case DXGI_FORMAT_R32G32B32_UINT: case DXGI_FORMAT_R32G32B32_SINT: return 12;
+		case DXGI_FORMAT_R32G32_TYPELESS: case DXGI_FORMAT_R32G32_FLOAT: case DXGI_FORMAT_R32G32_UINT: case DXGI_FORMAT_R32G32_SINT: return 8;
+		case DXGI_FORMAT_R32_TYPELESS: case DXGI_FORMAT_D32_FLOAT: case DXGI_FORMAT_R32_FLOAT: case DXGI_FORMAT_R32_UINT: case DXGI_FORMAT_R32_SINT: return 4;
+		default: return 0;
+	}
+}
+
+HostResource* HostResource::Create(int element_size, int width, int height, DXGI_FORMAT format, void *init_data)
+{
+	HostResource* r = new HostResource();
+	r->element_size = element_size; r->width = width; r->height = height; r->format = format;
+	r->length = (size_t)element_size * width * height;
+	r->data = (char*)calloc(r->length, 1);
+	if (r->data == NULL) { delete r; return NULL; }
+	if (init_data != NULL) memcpy(r->data, init_data, r->length);
+	return r;
+}
+
+HostContext::HostContext(HostDevice* device) : device(device), readback(NULL)
+{
+	Unbind();
+}
+HostContext::~HostContext()
+{
+	delete readback;
+}
+void HostContext::Unbind()
+{
+	memset(srv, 0, sizeof(srv));
+	memset(uav, 0, sizeof(uav));
+	memset(cb, 0, sizeof(cb));
+}
+HRESULT HostContext::Dispatch(const HostShader& shader, int thread_group_x, int thread_group_y, int thread_group_z)
+{
+	if (shader.kernel == NULL || thread_group_x < 0 || thread_group_y < 0 || thread_group_z < 0) return E_INVALIDARG;
+	int xy = thread_group_x * thread_group_y;
+	std::atomic<HRESULT> result(S_OK); // the bindings are the same for every group, so all of them fail or none
+	device->pool.Run(xy * thread_group_z, [&](int index, int worker) {
+		HRESULT hr = shader.kernel(shader, *this, index % thread_group_x, (index % xy) / thread_group_x, index / xy);
+		if (FAILED(hr)) result.store(hr, std::memory_order_relaxed);
+	});
+	return result.load();
+}
+
+HostShader::HostShader(const char* source, int length, const char* entry_point) : entry_point(entry_point), kernel(NULL)
+{
+	// The only preprocessing needed: "#define name value" lines (the managed side prepends n, threads, types). The first
+	// definition of a name counts, the later ones are the #ifndef defaults of the shader.
+	const char *s = source, *end = source + length;
+	while (s < end)
+	{
+		const char* eol = (const char*)memchr(s, '\n', end - s); if (eol == NULL) eol = end;
+		std::string line(s, eol); s = eol + 1;
+		size_t i = line.find_first_not_of(" \t");
+		if (i == std::string::npos || line.compare(i, 7, "#define") != 0) continue;
+		size_t name = line.find_first_not_of(" \t", i + 7), name_end = line.find_first_of(" \t\r", name);
+		if (name == std::string::npos) continue;
+		std::string value = name_end == std::string::npos ? std::string() : line.substr(name_end);
+		value = value.substr(0, value.find("//"));
+		size_t first = value.find_first_not_of(" \t\r"), last = value.find_last_not_of(" \t\r");
+		defines.insert(std::make_pair(line.substr(name, name_end - name), first == std::string::npos ? std::string() : value.substr(first, last - first + 1)));
+	}
+	std::map<std::string, std::string>::const_iterator kernels = defines.find("host_kernels");
+	if (kernels == defines.end()) { error = "The source has no \"#define host_kernels\" line, no native kernels to use."; return; }
+	kernel = FindHostKernel(kernels->second, entry_point);
+	if (kernel == NULL) error = "No native kernel '" + this->entry_point + "' is registered for '" + kernels->second + "'.";
+}
+int HostShader::Define(const char* name, int default_value) const
+{
+	std::map<std::string, std::string>::const_iterator i = defines.find(name);
+	return i == defines.end() ? default_value : atoi(i->second.c_str());
+}
+int HostShader::Values(const char* name, float* values, int count) const
+{
+	std::map<std::string, std::string>::const_iterator i = defines.find(name);
+	if (i == defines.end()) return 0;
+	const char* s = i->second.c_str();
+	int read = 0;
+	for (char* end; read < count; s = end + strspn(end, "fF, \t"))
+	{
+		values[read] = strtof(s, &end);
+		if (end == s) break;
+		read++;
+	}
+	return read;
+}
+
+HRESULT DX11W_API CreateDevice(D3D_DRIVER_TYPE driver_type, D3D_FEATURE_LEVEL level_wanted, Device* device, Context* context)
+{
+	TRACE(CreateDevice, 0);
+	if (device == NULL || context == NULL) return E_FAIL;
+	std::lock_guard<std::mutex> guard(devices_lock);
+	if (context->id == context->ID && context->ptr != NULL)
+	{
+		std::vector<HostContext*>::iterator i = std::find(contexts.begin(), contexts.end(), context->ptr);
+		if (i != contexts.end()) { delete *i; contexts.erase(i); }
+	}
+	if (device->id == device->ID && device->ptr != NULL)
+	{
+		std::vector<HostDevice*>::iterator i = std::find(devices.begin(), devices.end(), device->ptr);
+		if (i != devices.end()) { delete *i; devices.erase(i); }
+	}
+	*device = Device(); *context = Context();
+
+	// Driver type and feature level do not matter: every kernel runs on the thread pool of the device
+	const char* threads = getenv("DX11ONE_THREADS");
+	device->ptr = new HostDevice(threads == NULL ? 0 : atoi(threads));
+	context->ptr = new HostContext(device->ptr);
+	devices.push_back(device->ptr);
+	contexts.push_back(context->ptr);
+	return S_OK;
+}
+
+HRESULT DX11W_API GetDeviceName(Device device, char* name, int length)
+{
+	TRACE(GetDeviceName, 0);
+	if (device.id != device.ID || device.ptr == NULL || name == NULL || length <= 0) return E_FAIL;
+	snprintf(name, length, "Host x%d", device.ptr->pool.Threads());
+	return S_OK;
+}
+
+HRESULT DX11W_API CreateAndCompileShader(Device device, LPCSTR filename, LPCSTR entry_point, LPCSTR shader_profile, unsigned int flags, Shader* shader)
+{
+	TRACE(CreateAndCompileShader, 0);
+	if (shader == NULL) return E_FAIL;
+	if (shader->id == shader->ID) ReleaseShader(*shader);
+	*shader = Shader();
+	FILE* f = filename == NULL ? NULL : fopen(filename, "rb");
+	if (device.id != device.ID || f == NULL) { shader->id = -1; return E_FAIL; }
+	std::string source; char block[4096]; size_t read;
+	while ((read = fread(block, 1, sizeof(block), f)) > 0) source.append(block, read);
+	fclose(f);
+	const char* errors = NULL;
+	return CompileShader(device, source.c_str(), (int)source.length(), entry_point, shader_profile, flags, shader, &errors);
+}
+
+HRESULT DX11W_API CompileShader(Device device, LPCSTR shader_source, int shader_length, LPCSTR entry_point, LPCSTR shader_profile, unsigned int flags, Shader* shader, const char **errors)
+{
+	TRACE(CompileShader, 0);
+	if (shader == NULL) return E_FAIL;
+	if (shader->id == shader->ID) ReleaseShader(*shader);
+	*shader = Shader();
+	if (device.id != device.ID || shader_source == NULL || entry_point == NULL) { shader->id = -1; return E_FAIL; }
+	shader->ptr = new HostShader(shader_source, shader_length, entry_point);
+	compile_errors = shader->ptr->error;
+	if (errors != NULL) *errors = compile_errors.c_str();
+	if (shader->ptr->kernel != NULL) return S_OK;
+	delete shader->ptr; shader->ptr = NULL; shader->id = -1;
+	return E_FAIL;
+}
+
+// The compiler of the cache: the "bytecode" is the source itself, once it is known to have its native kernel
+static HRESULT DX11W_CALLBACK HostCompiler(const char* source, int length, const char* entry_point, const char* profile, unsigned int flags,
+	const void** bytecode, int* bytecode_length, const char** errors)
+{
+	static thread_local std::string messages;
+	HostShader shader(source, length, entry_point);
+	messages = shader.error;
+	*errors = messages.c_str();
+	if (shader.kernel == NULL) return E_FAIL;
+	*bytecode = source; *bytecode_length = length;
+	return S_OK;
+}
+
+ShaderCompiler DefaultShaderCompiler(const char** version)
+{
+	*version = "host 1";
+	return HostCompiler;
+}
+
+HRESULT DX11W_API LoadOrCompileShader(Device device, LPCSTR shader_source, int shader_length, LPCSTR entry_point, LPCSTR shader_profile, unsigned int flags, Shader* shader, const char **errors)
+{
+	TRACE(LoadOrCompileShader, 0);
+	if (shader == NULL) return E_FAIL;
+	if (shader->id == shader->ID) ReleaseShader(*shader);
+	*shader = Shader();
+	if (device.id != device.ID || shader_source == NULL || entry_point == NULL) { shader->id = -1; return E_FAIL; }
+	std::string bytecode;
+	HRESULT hr = TheShaderCache().Get(shader_source, shader_length, entry_point, shader_profile, flags, &bytecode, &compile_errors);
+	if (errors != NULL) *errors = compile_errors.c_str();
+	if (FAILED(hr)) { shader->id = -1; return hr; }
+	shader->ptr = new HostShader(bytecode.data(), (int)bytecode.size(), entry_point);
+	if (shader->ptr->kernel != NULL) return S_OK;
+	compile_errors = shader->ptr->error;
+	delete shader->ptr; shader->ptr = NULL; shader->id = -1;
+	return E_FAIL;
+}
+
+HRESULT CreateHostBuffer(Device device, int element_size, int element_count, void *init_data, bool srv, bool uav, Buffer* buffer)
+{
+	if (buffer == NULL) return E_FAIL;
+	if (buffer->id == buffer->ID) ReleaseBuffer(*buffer);
+	*buffer = Buffer();
+	if (device.id != device.ID) { buffer->id = -1; return E_FAIL; }
+	if (element_size <= 0 || element_count <= 0) { buffer->id = -1; return E_INVALIDARG; }
+	if (buffer_pool.Take(HostKey(1, element_count, 1, element_size, srv, uav), buffer)) { buffer->p_buffer->Reset(init_data); return S_OK; }
+	buffer->p_buffer = HostResource::Create(element_size, element_count, 1, DXGI_FORMAT_UNKNOWN, init_data);
+	if (buffer->p_buffer == NULL) { buffer->id = -1; return E_OUTOFMEMORY; }
+	if (srv) buffer->p_SRV = buffer->p_buffer;
+	if (uav) buffer->p_UAV = buffer->p_buffer;
+	return S_OK;
+}
+
+HRESULT DX11W_API CreateRWBuffer(Device device, int element_size, int element_count, void *init_data, Buffer* buffer)
+{
+	TRACE(CreateRWBuffer, (long long)element_size * element_count * (init_data != NULL));
+	return CreateHostBuffer(device, element_size, element_count, init_data, true, true, buffer);
+}
+
+HRESULT DX11W_API CreateRBuffer(Device device, int element_size, int element_count, void *init_data, Buffer* buffer)
+{
+	TRACE(CreateRBuffer, (long long)element_size * element_count * (init_data != NULL));
+	return CreateHostBuffer(device, element_size, element_count, init_data, true, false, buffer);
+}
+
+HRESULT DX11W_API CreateInputBuffer(Device device, int element_size, int element_count, Buffer* buffer)
+{
+	TRACE(CreateInputBuffer, 0);
+	return CreateHostBuffer(device, element_size, element_count, NULL, false, false, buffer);
+}
+
+HRESULT DX11W_API CreateStagingBuffer(Device device, int element_size, int element_count, Buffer* buffer)
+{
+	TRACE(CreateStagingBuffer, 0);
+	return CreateHostBuffer(device, element_size, element_count, NULL, false, false, buffer);
+}
+
+HRESULT DX11W_API CreateConstantBuffer(Device device, int length, Buffer* buffer)
+{
+	TRACE(CreateConstantBuffer, 0);
+	return CreateHostBuffer(device, length, 1, NULL, false, false, buffer);
+}
+
+HRESULT CreateHostTexture2D(Device device, int width, int height, DXGI_FORMAT format, void *init_data, bool uav, Texture2D* t)
+{
+	if (t == NULL) return E_FAIL;
+	if (t->id == t->ID) ReleaseTexture(*t);
+	*t = Texture2D();
+	if (device.id != device.ID || device.ptr == NULL) { t->id = -1; return E_FAIL; }
+	if (width <= 0 || height <= 0 || FormatSize(format) == 0) { t->id = -1; return E_INVALIDARG; }
+	if (texture_pool.Take(HostKey(2, width, height, format, true, uav), t)) { t->p_texture->Reset(init_data); return S_OK; }
+	t->p_texture = HostResource::Create(FormatSize(format), width, height, format, init_data);
+	if (t->p_texture == NULL) { t->id = -1; return E_OUTOFMEMORY; }
+	t->p_SRV = t->p_texture;
+	if (uav) t->p_UAV = t->p_texture;
+	return S_OK;
+}
+
+HRESULT DX11W_API CreateInputTexture2D(Device device, int width, int height, DXGI_FORMAT format, void *init_data, Texture2D* t)
+{
+	TRACE(CreateInputTexture2D, 0);
+	return CreateHostTexture2D(device, width, height, format, init_data, false, t);
+}
+
+HRESULT DX11W_API CreateRWTexture2D(Device device, int width, int height, DXGI_FORMAT format, void *init_data, Texture2D* t)
+{
+	TRACE(CreateRWTexture2D, 0);
+	return CreateHostTexture2D(device, width, height, format, init_data, true, t);
+}
+
+
+HRESULT DX11W_API WriteToBuffer(Context context, Buffer destination, void* source, int length)
+{
+	TRACE(WriteToBuffer, length);
+	if (State(context) == NULL || !Live(destination) || source == NULL) return E_FAIL;
+	if (length < 0 || (size_t)length > destination.p_buffer->length) return E_INVALIDARG;
+	memcpy(destination.p_buffer->data, source, length);
+	return S_OK;
+}
+
+HRESULT DX11W_API WriteToTexture2D(Context context, Texture2D texture, void* source, int width, int height, int element_size)
+{
+	TRACE(WriteToTexture2D, (long long)width * height * element_size);
+	if (State(context) == NULL || !Live(texture) || source == NULL) return E_FAIL;
+	HostResource* t = texture.p_texture;
+	int pitch = width * element_size, row_pitch = t->width * t->element_size;
+	if (pitch > row_pitch || height > t->height) return E_INVALIDARG;
+	if (height == 1 || pitch == row_pitch) memcpy(t->data, source, pitch * height);
+	else for (int i = 0; i < height; ++i) memcpy(t->data + i * row_pitch, (char*)source + i * pitch, pitch);
+	return S_OK;
+}
+
+HRESULT DX11W_API ReadTexture2D(Context context, Texture2D texture, void* destination, int width, int height, int element_size)
+{
+	TRACE(ReadTexture2D, (long long)width * height * element_size);
+	if (State(context) == NULL || !Live(texture) || destination == NULL) return E_FAIL;
+	HostResource* t = texture.p_texture;
+	int pitch = width * element_size, row_pitch = t->width * t->element_size;
+	if (pitch > row_pitch || height > t->height) return E_INVALIDARG;
+	if (height == 1 || pitch == row_pitch) memcpy(destination, t->data, pitch * height);
+	else for (int i = 0; i < height; ++i) memcpy((char*)destination + i * pitch, t->data + i * row_pitch, pitch);
+	return S_OK;
+}
+
+HRESULT DX11W_API CopyBuffer(Context context, Buffer destination, Buffer source)
+{
+	TRACE(CopyBuffer, 0);
+	if (State(context) == NULL || !Live(destination) || !Live(source)) return E_FAIL;
+	size_t length = destination.p_buffer->length < source.p_buffer->length ? destination.p_buffer->length : source.p_buffer->length;
+	TRACE_BYTES((long long)length);
+	memcpy(destination.p_buffer->data, source.p_buffer->data, length);
+	return S_OK;
+}
+
+// Resources are validated before binding; unlike D3D11 an invalid handle fails the call instead of unbinding the slot
+template <class Handle> HRESULT Bind(HostResource** slots, int max_count, Handle *handles, int count, HostResource* Handle::*view)
+{
+	if (count > max_count) return E_INVALIDARG;
+	for (int i = 0; handles != NULL && i < count; i++)
+		if (!Live(handles[i]) || handles[i].*view == NULL) return E_FAIL;
+	for (int i = 0; i < count; i++) slots[i] = handles == NULL ? NULL : handles[i].*view;
+	return S_OK;
+}
+
+HRESULT DX11W_API SetRBuffers(Context context, Buffer *r_buffers, int count)
+{
+	TRACE(SetRBuffers, 0);
+	HostContext* state = State(context);
+	if (state == NULL) return E_FAIL;
+	return Bind(state->srv, HOST_SRV_SLOTS, r_buffers, count, &Buffer::p_SRV);
+}
+HRESULT DX11W_API SetRBuffersAndTextures(Context context, Buffer *r_buffers, int r_count, Texture2D *textures, int t_count)
+{
+	TRACE(SetRBuffersAndTextures, 0);
+	HostContext* state = State(context);
+	if (state == NULL) return E_FAIL;
+	if (r_count < 0 || t_count < 0 || r_count + t_count > HOST_SRV_SLOTS) return E_INVALIDARG;
+	HRESULT hr = Bind(state->srv, HOST_SRV_SLOTS, r_buffers, r_count, &Buffer::p_SRV);
+	if (FAILED(hr)) return hr;
+	return Bind(state->srv + r_count, HOST_SRV_SLOTS - r_count, textures, t_count, &Texture2D::p_SRV);
+}
+HRESULT DX11W_API SetCBuffers(Context context, Buffer *c_buffers, int count)
+{
+	TRACE(SetCBuffers, 0);
+	HostContext* state = State(context);
+	if (state == NULL) return E_FAIL;
+	return Bind(state->cb, HOST_CB_SLOTS, c_buffers, count, &Buffer::p_buffer);
+}
+HRESULT DX11W_API SetRWBuffers(Context context, Buffer *rw_buffers, int count)
+{
+	TRACE(SetRWBuffers, 0);
+	HostContext* state = State(context);
+	if (state == NULL) return E_FAIL;
+	return Bind(state->uav, HOST_UAV_SLOTS, rw_buffers, count, &Buffer::p_UAV);
+}
+HRESULT DX11W_API SetRWBuffersAndTextures(Context context, Buffer *rw_buffers, int rw_count, Texture2D *textures, int t_count)
+{
+	TRACE(SetRWBuffersAndTextures, 0);
+	HostContext* state = State(context);
+	if (state == NULL) return E_FAIL;
+	if (rw_count < 0 || t_count < 0 || rw_count + t_count > HOST_UAV_SLOTS) return E_INVALIDARG;
+	HRESULT hr = Bind(state->uav, HOST_UAV_SLOTS, rw_buffers, rw_count, &Buffer::p_UAV);
+	if (FAILED(hr)) return hr;
+	return Bind(state->uav + rw_count, HOST_UAV_SLOTS - rw_count, textures, t_count, &Texture2D::p_UAV);
+}
+
+HRESULT DX11W_API DispatchShader(Context context, Shader shader, int thread_group_x, int thread_group_y, int thread_group_z)
+{
+	TRACE(DispatchShader, 0);
+	HostContext* state = State(context);
+	if (state == NULL || shader.id != shader.ID || shader.ptr == NULL) return E_FAIL;
+	return state->Dispatch(*shader.ptr, thread_group_x, thread_group_y, thread_group_z);
+}
+
+HRESULT DX11W_API GetResults(Context context, Buffer staging_buffer, Buffer buffer, void *destination, int length)
+{
+	TRACE(GetResults, length);
+	// Host memory is directly readable, the staging buffer is only validated
+	if (State(context) != NULL && Live(staging_buffer) && Live(buffer) && destination != NULL && length > 0)
+	{
+		if ((size_t)length > buffer.p_buffer->length) return E_INVALIDARG;
+		memcpy(destination, buffer.p_buffer->data, length);
+		return S_OK;
+	}
+	return E_FAIL;
+}
+
+// Readback staging in host memory: the copy is made by Copy, DX11ONE_READBACK_LATENCY polls report it in flight before
+// it completes, so the pending paths of the callers run on the host backend too
+class HostStaging : public ReadbackStaging
+{
+public:
+	HostStaging() : memory(READBACK_MAX_SLOTS), pending(READBACK_MAX_SLOTS, 0)
+	{
+		const char* latency = getenv("DX11ONE_READBACK_LATENCY");
+		this->latency = latency == NULL ? 0 : atoi(latency);
+	}
+	HRESULT Reserve(int slot, int length)
+	{
+		if ((int)memory[slot].size() < length) memory[slot].resize(length);
+		return S_OK;
+	}
+	HRESULT Copy(int slot, Buffer source, int length)
+	{
+		if (!Live(source)) return E_FAIL;
+		if ((size_t)length > source.p_buffer->length) return E_INVALIDARG;
+		memcpy(&memory[slot][0], source.p_buffer->data, length);
+		pending[slot] = latency;
+		return S_OK;
+	}
+	HRESULT Poll(int slot)
+	{
+		if (pending[slot] == 0) return S_OK;
+		pending[slot]--;
+		return S_FALSE;
+	}
+	HRESULT Read(int slot, void* destination, int length)
+	{
+		memcpy(destination, &memory[slot][0], length);
+		return S_OK;
+	}
+
+private:
+	std::vector<std::vector<char> > memory;
+	std::vector<int> pending;
+	int latency;
+};
+
+HRESULT DX11W_API BeginReadback(Context context, Buffer buffer, int length, int* readback)
+{
+	TRACE(BeginReadback, length);
+	HostContext* state = State(context);
+	if (state == NULL) return E_FAIL;
+	if (state->readback == NULL) state->readback = new ReadbackRing(new HostStaging());
+	return state->readback->Begin(buffer, length, readback);
+}
+HRESULT DX11W_API TryEndReadback(Context context, int readback, void* destination, int length)
+{
+	TRACE(TryEndReadback, length);
+	HostContext* state = State(context);
+	if (state == NULL || state->readback == NULL) return E_FAIL;
+	return state->readback->TryEnd(readback, destination, length);
+}
+HRESULT DX11W_API WaitReadback(Context context, int readback, void* destination, int length)
+{
+	TRACE(WaitReadback, length);
+	HostContext* state = State(context);
+	if (state == NULL || state->readback == NULL) return E_FAIL;
+	return state->readback->Wait(readback, destination, length);
+}
+
+HRESULT DX11W_API UnbindResources(Context context)
+{
+	TRACE(UnbindResources, 0);
+	HostContext* state = State(context);
+	if (state == NULL) return E_FAIL;
+	state->Unbind();
+	return S_OK;
+}
+
+HRESULT DX11W_API ReleaseBuffer(Buffer b)
+{
+	TRACE(ReleaseBuffer, 0);
+	if (b.id == b.ID && b.p_buffer != NULL && !Live(b)) return E_FAIL; // a copy of a handle released before
+	if (b.id == b.ID && b.p_buffer != NULL && buffer_pool.Give(HostKey(1, b.p_buffer->width, 1, b.p_buffer->element_size, b.p_SRV != NULL, b.p_UAV != NULL),
+		b.p_buffer->length, b, b.p_buffer)) return S_OK;
+	buffer_pool.Forget(b.p_buffer);
+	delete b.p_buffer; // views are aliases of the resource
+	b.p_SRV = NULL; b.p_UAV = NULL; b.p_buffer = NULL; b.id = -1;
+	return S_OK;
+}
+
+HRESULT DX11W_API ReleaseShader(Shader s)
+{
+	TRACE(ReleaseShader, 0);
+	delete s.ptr;
+	s.blob = NULL; s.ptr = NULL; s.id = -1;
+	return S_OK;
+}
+
+HRESULT DX11W_API ReleaseTexture(Texture2D t)
+{
+	TRACE(ReleaseTexture, 0);
+	if (t.id == t.ID && t.p_texture != NULL && !Live(t)) return E_FAIL;
+	if (t.id == t.ID && t.p_texture != NULL && texture_pool.Give(HostKey(2, t.p_texture->width, t.p_texture->height, t.p_texture->format, true, t.p_UAV != NULL),
+		t.p_texture->length, t, t.p_texture)) return S_OK;
+	texture_pool.Forget(t.p_texture);
+	delete t.p_texture;
+	t.p_texture = NULL; t.p_UAV = NULL; t.p_SRV = NULL; t.id = -1;
+	return S_OK;
+}
+
+HRESULT DX11W_API Dispose()
+{
+	TRACE(Dispose, 0);
+	std::lock_guard<std::mutex> guard(devices_lock);
+	for (size_t k = 0; k < contexts.size(); k++) delete contexts[k];
+	for (size_t k = 0; k < devices.size(); k++) delete devices[k];
+	contexts.clear(); devices.clear();
+	std::vector<Buffer> buffers; std::vector<Texture2D> textures;
+	buffer_pool.Drain(NULL, &buffers); texture_pool.Drain(NULL, &textures);
+	for (size_t k = 0; k < buffers.size(); k++) delete buffers[k].p_buffer;
+	for (size_t k = 0; k < textures.size(); k++) delete textures[k].p_texture;
+	return S_OK;
+}
+
+HRESULT DX11W_API SetResourcePool(long long idle_bytes)
+{
+	TRACE(SetResourcePool, 0);
+	std::vector<Buffer> buffers; std::vector<Texture2D> textures;
+	buffer_pool.SetBudget(idle_bytes, &buffers); texture_pool.SetBudget(idle_bytes, &textures);
+	for (size_t k = 0; k < buffers.size(); k++) delete buffers[k].p_buffer;
+	for (size_t k = 0; k < textures.size(); k++) delete textures[k].p_texture;
+	return S_OK;
+}
+
+HRESULT DX11W_API GetResourcePoolStats(ResourcePoolStats* stats)
+{
+	TRACE(GetResourcePoolStats, 0);
+	if (stats == NULL) return E_INVALIDARG;
+	memset(stats, 0, sizeof(*stats));
+	buffer_pool.AddStats(stats); texture_pool.AddStats(stats);
+	return S_OK;
+}
+
+static const char* error_text[8] = {
+	"Unknown error code.",
+	"E_NOTIMPL - Not implemented.",
+	"E_FAIL - An undetermined error occurred.",
+	"E_INVALIDARG - An invalid parameter was passed to the returning function.",
+	"E_OUTOFMEMORY - Could not allocate sufficient memory to complete the call.",
+	"S_FALSE - Alternate success value, indicating a successful but nonstandard completion (the precise meaning depends on context).",
+	"S_OK - No error occurred.",
+	"E_PENDING - The data necessary to complete this operation is not yet available."
+};
+void DX11W_API DecodeError(HRESULT hr, const char **output)
+{
+	switch (hr)
+	{
+		case E_NOTIMPL:
+			*output = error_text[1]; break;
+		case E_FAIL:
+			*output = error_text[2]; break;
+		case E_INVALIDARG:
+			*output = error_text[3]; break;
+		case E_OUTOFMEMORY:
+			*output = error_text[4]; break;
+		case S_FALSE:
+			*output = error_text[5]; break;
+		case S_OK:
+			*output = error_text[6]; break;
+		case E_PENDING:
+			*output = error_text[7]; break;
+		default: *output = error_text[0]; break;
+	}
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef _HOST_H_
+#define _HOST_H_
+
+// Host backend of DX11One: the same exported functions as the D3D11 backend (One.cpp), but buffers and textures
+// live in host memory and "shaders" are native C++ kernels (HostKernels.cpp), found by the "host_kernels" define
+// of the HLSL source and the entry point. DispatchShader runs the thread groups of a kernel on a thread pool.
+
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define DX11W_API __declspec(dllexport) _stdcall
+#else
+typedef int HRESULT;
+typedef const char* LPCSTR;
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001)
+#define E_FAIL ((HRESULT)0x80004005)
+#define E_INVALIDARG ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000E)
+#define E_PENDING ((HRESULT)0x8000000A)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define DX11W_API __attribute__((visibility("default")))
+#endif
+
+// Subsets of the D3D enumerations used by the managed side (values are the same as in d3dcommon.h and dxgiformat.h)
+enum D3D_DRIVER_TYPE { D3D_DRIVER_TYPE_UNKNOWN = 0, D3D_DRIVER_TYPE_HARDWARE, D3D_DRIVER_TYPE_REFERENCE, D3D_DRIVER_TYPE_NULL, D3D_DRIVER_TYPE_SOFTWARE, D3D_DRIVER_TYPE_WARP };
+enum D3D_FEATURE_LEVEL { D3D_FEATURE_LEVEL_10_0 = 0xa000, D3D_FEATURE_LEVEL_10_1 = 0xa100, D3D_FEATURE_LEVEL_11_0 = 0xb000 };
+enum DXGI_FORMAT
+{
+	DXGI_FORMAT_UNKNOWN = 0,
+	DXGI_FORMAT_R32G32B32A32_TYPELESS = 1, DXGI_FORMAT_R32G32B32A32_FLOAT = 2, DXGI_FORMAT_R32G32B32A32_UINT = 3, DXGI_FORMAT_R32G32B32A32_SINT = 4,
+	DXGI_FORMAT_R32G32B32_TYPELESS = 5, DXGI_FORMAT_R32G32B32_FLOAT = 6, DXGI_FORMAT_R32G32B32_UINT = 7, DXGI_FORMAT_R32G32B32_SINT = 8,
+	DXGI_FORMAT_R32G32_TYPELESS = 15, DXGI_FORMAT_R32G32_FLOAT = 16, DXGI_FORMAT_R32G32_UINT = 17, DXGI_FORMAT_R32G32_SINT = 18,
+	DXGI_FORMAT_R32_TYPELESS = 39, DXGI_FORMAT_D32_FLOAT = 40, DXGI_FORMAT_R32_FLOAT = 41, DXGI_FORMAT_R32_UINT = 42, DXGI_FORMAT_R32_SINT = 43
+};
+int FormatSize(DXGI_FORMAT format); // bytes per texel, 0 for unsupported formats
+
+// Register counts of cs_5_0
+#define HOST_SRV_SLOTS 128
+#define HOST_UAV_SLOTS 8
+#define HOST_CB_SLOTS 14
+
+struct HostResource
+{
+	static HostResource* Create(int element_size, int width, int height, DXGI_FORMAT format, void *init_data); // NULL if out of memory
+	~HostResource() { free(data); }
+	void Reset(void *init_data) { if (init_data != NULL) memcpy(data, init_data, length); else memset(data, 0, length); } // taken from the pool
+
+	int element_size, width, height; // buffers have height = 1 and width = number of elements
+	DXGI_FORMAT format;
+	size_t length;
+	char *data;
+
+private:
+	HostResource() { data = NULL; }
+};
+
+struct HostDevice
+{
+	HostDevice(int threads) : pool(threads) { }
+	ThreadPool pool;
+};
+
+struct HostShader;
+class ReadbackRing;
+struct HostContext
+{
+	HostContext(HostDevice* device);
+	~HostContext();
+	HRESULT Dispatch(const HostShader& shader, int thread_group_x, int thread_group_y, int thread_group_z);
+	void Unbind();
+
+	template <class T> const T* SRV(int slot) const { return srv[slot] == NULL ? NULL : (const T*)srv[slot]->data; }
+	template <class T> const T* CB(int slot) const { return cb[slot] == NULL ? NULL : (const T*)cb[slot]->data; }
+	template <class T> T* UAV(int slot) const { return uav[slot] == NULL ? NULL : (T*)uav[slot]->data; }
+	int UAVLength(int slot) const { return uav[slot] == NULL ? 0 : uav[slot]->width; }
+
+	HostDevice* device;
+	HostResource* srv[HOST_SRV_SLOTS];
+	HostResource* uav[HOST_UAV_SLOTS];
+	HostResource* cb[HOST_CB_SLOTS];
+	ReadbackRing* readback; // of BeginReadback, made by its first call
+};
+
+// One thread group of a kernel: the kernel loops over SV_GroupThreadID itself; E_FAIL if a slot it uses is unbound
+typedef HRESULT (*HostKernel)(const HostShader& shader, const HostContext& context, int group_x, int group_y, int group_z);
+HostKernel FindHostKernel(const std::string& kernels, const std::string& entry_point); // see HostKernels.cpp
+
+struct HostShader
+{
+	HostShader(const char* source, int length, const char* entry_point); // kernel == NULL and error is set on failure
+	int Define(const char* name, int default_value = 0) const;
+	int Values(const char* name, float* values, int count) const; // of a list "a, b, ...", returns how many were read
+
+	std::string entry_point, error;
+	std::map<std::string, std::string> defines;
+	HostKernel kernel;
+};
+
+// Handles have the same layout as the D3D11 ones (and as DC_* structures in DirectCompute.cs)
+struct Device { static int ID; int id; HostDevice* ptr; Device() { id = Device::ID; ptr = NULL; } };
+struct Context { static int ID; int id; HostContext* ptr; Context() { id = Context::ID; ptr = NULL; } };
+struct Shader { static int ID; int id; void* blob; HostShader* ptr; Shader() { id = Shader::ID; blob = NULL; ptr = NULL; } };
+struct Buffer { static int ID; int id, serial; HostResource *p_buffer, *p_UAV, *p_SRV; Buffer() { id = Buffer::ID; serial = 0; p_buffer = NULL; p_UAV = NULL; p_SRV = NULL; } };
+struct Texture2D { static int ID; int id, serial; HostResource *p_texture, *p_UAV, *p_SRV; Texture2D() { id = Texture2D::ID; serial = 0; p_texture = NULL; p_UAV = NULL; p_SRV = NULL; } };
+
+#endif
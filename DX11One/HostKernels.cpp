@@ -0,0 +1,393 @@
+#include "stdafx.h"
+#ifdef DX11ONE_HOST
+#include <math.h>
+
+// Native counterparts of the kernels in IDGPU\Kernels\IBC-*.hlsl and MD-VV.hlsl for the host backend. A kernel function executes
+// one thread group: it loops over SV_GroupThreadID and reads the same defines (n, threads, types), tiling constants
+// (cTiling), textures and buffers as the shader, so ForceDX11_IBC drives both backends without changes. A slot the
+// kernel uses that is unbound fails it with E_FAIL before anything is written.
+
+struct float4
+{
+	float x, y, z, w;
+	float4& operator+=(const float4& a) { x += a.x; y += a.y; z += a.z; w += a.w; return *this; }
+};
+inline float4 Float4(float x, float y, float z, float w) { float4 a = { x, y, z, w }; return a; }
+
+// add() of the shaders: a += b, or the Kahan sum a - c with the "compensated" define
+template <bool compensated> inline void Add(float& a, float& c, float b)
+{
+	if (!compensated) { a += b; return; }
+	float y = b - c, s = a + y;
+	c = (s - a) - y;
+	a = s;
+}
+template <bool compensated> inline void Add(float4& a, float4& c, const float4& b)
+{
+	Add<compensated>(a.x, c.x, b.x); Add<compensated>(a.y, c.y, b.y); Add<compensated>(a.z, c.z, b.z); Add<compensated>(a.w, c.w, b.w);
+}
+inline float4 operator-(const float4& a, const float4& b) { return Float4(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w); }
+
+struct cTiling { unsigned cycles, bj, ww, hh; };
+struct cTable { float table_min, table_scale, table_last, cutoff2; };
+
+// Pair interactions, the same expressions (and precision) as force_ij/energy_ij of the shaders. A form is constructed
+// per thread group from the shader and the context, for the defines and resources it reads besides the ones of PairsNxN.
+struct Buckingham
+{
+	Buckingham(const HostShader& shader, const HostContext& context) { }
+	bool Bound() const { return true; }
+	static inline float4 Force(const float4& pos_i, const float4& pos_j, const float4& c1, const float4& c2, unsigned type_ij)
+	{
+		float x = pos_i.x - pos_j.x, y = pos_i.y - pos_j.y, z = pos_i.z - pos_j.z, R2 = x * x + y * y + z * z;
+		float r = 1 / sqrtf(R2 > 1e-4f ? R2 : 1e-4f), r2 = r * r;
+		float dU = r * (c1.x * r2 - c1.z * c1.y * expf(c1.z / r)) - 6 * c1.w * (r2 * r2) * (r2 * r2);
+		return Float4(x * dU, y * dU, z * dU, 0);
+	}
+	static inline float4 Energy(const float4& pos_i, const float4& pos_j, const float4& c1, const float4& c2, unsigned type_ij)
+	{
+		float x = pos_i.x - pos_j.x, y = pos_i.y - pos_j.y, z = pos_i.z - pos_j.z, R2 = x * x + y * y + z * z;
+		if (R2 == 0) return Float4(0, 0, 0, 0);
+		float r = 1 / sqrtf(R2), r3 = r * r * r, e = c1.y * expf(c1.z / r), cc = c1.w * r3 * r3;
+		float dU = c1.x * r3 - (c1.z * e + 6 * cc * r) * r;
+		return Float4(x * dU, y * dU, z * dU, c1.x * r + e - cc);
+	}
+};
+struct BuckinghamMorse
+{
+	BuckinghamMorse(const HostShader& shader, const HostContext& context) { }
+	bool Bound() const { return true; }
+	static inline float4 Force(const float4& pos_i, const float4& pos_j, const float4& c1, const float4& c2, unsigned type_ij)
+	{
+		float x = pos_i.x - pos_j.x, y = pos_i.y - pos_j.y, z = pos_i.z - pos_j.z, R2 = x * x + y * y + z * z;
+		float r = 1 / sqrtf(R2 > 1e-4f ? R2 : 1e-4f), r2 = r * r, ee = expf(c2.y * (1 / r - c2.z));
+		float dU = r * (c1.x * r2 - c1.z * c1.y * expf(c1.z / r) - c2.x * c2.y * ee * (2 * ee - 2)) - 6 * c1.w * (r2 * r2) * (r2 * r2);
+		return Float4(x * dU, y * dU, z * dU, 0);
+	}
+	static inline float4 Energy(const float4& pos_i, const float4& pos_j, const float4& c1, const float4& c2, unsigned type_ij)
+	{
+		float x = pos_i.x - pos_j.x, y = pos_i.y - pos_j.y, z = pos_i.z - pos_j.z, R2 = x * x + y * y + z * z;
+		if (R2 == 0) return Float4(0, 0, 0, 0);
+		float r = 1 / sqrtf(R2), r3 = r * r * r, e = c1.y * expf(c1.z / r), ee = expf(c2.y * (1 / r - c2.z)), cc = c1.w * r3 * r3;
+		float dU = c1.x * r3 - (c1.z * e + c2.x * c2.y * ee * (2 * ee - 2) + 6 * cc * r) * r;
+		return Float4(x * dU, y * dU, z * dU, c1.x * r + e + c2.x * ee * (ee - 2) - cc);
+	}
+};
+struct Buckingham4
+{
+	// The O-O spline below bounds[1] comes from the potential set through the defines of ForceDX11_IBC (see IBC-B4.hlsl)
+	Buckingham4(const HostShader& shader, const HostContext& context) : bound(shader.Values("spline_range2", range2, 6) == 6 && shader.Values("spline_range3", range3, 4) == 4 && shader.Values("spline_bounds", bounds, 2) == 2) { }
+	bool Bound() const { return bound; }
+	inline float4 Force(const float4& pos_i, const float4& pos_j, const float4& c1, const float4& c2, unsigned type_ij) const
+	{
+		float x = pos_i.x - pos_j.x, y = pos_i.y - pos_j.y, z = pos_i.z - pos_j.z, R2 = x * x + y * y + z * z;
+		float r = 1 / sqrtf(R2 > 1e-4f ? R2 : 1e-4f), _r = 1 / r, r2 = r * r, dU = c1.x * r2 * r;
+		switch (type_ij)
+		{
+			case 0:
+				if (_r < bounds[0]) dU -= ((((range2[0] * 5 * _r + range2[1] * 4) * _r + range2[2] * 3) * _r + range2[3] * 2) * _r + range2[4]) * r;
+				else if (_r < bounds[1]) dU -= ((range3[0] * 3 * _r + range3[1] * 2) * _r + range3[2]) * r;
+				else dU -= 6 * c1.w * r2 * r2 * r2 * r2;
+				break;
+			case 1:
+			case 2:
+				dU -= c1.z * c1.y * expf(c1.z * _r) * r;
+				break;
+		}
+		return Float4(x * dU, y * dU, z * dU, 0);
+	}
+	inline float4 Energy(const float4& pos_i, const float4& pos_j, const float4& c1, const float4& c2, unsigned type_ij) const
+	{
+		float x = pos_i.x - pos_j.x, y = pos_i.y - pos_j.y, z = pos_i.z - pos_j.z, R2 = x * x + y * y + z * z;
+		if (R2 == 0) return Float4(0, 0, 0, 0);
+		float r = 1 / sqrtf(R2), r2 = r * r, _r = 1 / r, energy = c1.x * r, dU = c1.x * r2 * r;
+		switch (type_ij)
+		{
+			case 0:
+				if (_r < bounds[0])
+				{
+					dU -= ((((range2[0] * 5 * _r + range2[1] * 4) * _r + range2[2] * 3) * _r + range2[3] * 2) * _r + range2[4]) * r;
+					energy += ((((range2[0] * _r + range2[1]) * _r + range2[2]) * _r + range2[3]) * _r + range2[4]) * _r + range2[5];
+				}
+				else if (_r < bounds[1])
+				{
+					dU -= ((range3[0] * 3 * _r + range3[1] * 2) * _r + range3[2]) * r;
+					energy += ((range3[0] * _r + range3[1]) * _r + range3[2]) * _r + range3[3];
+				}
+				else
+				{
+					dU -= 6 * c1.w * r2 * r2 * r2 * r2;
+					energy -= c1.w * r2 * r2 * r2;
+				}
+				break;
+			case 1:
+			case 2:
+				energy += c1.y * expf(c1.z * _r);
+				dU -= c1.z * c1.y * expf(c1.z * _r) * r;
+				break;
+		}
+		return Float4(x * dU, y * dU, z * dU, energy);
+	}
+
+	float range2[6], range3[4], bounds[2];
+	bool bound;
+};
+
+// IBC-T.hlsl: analytic Coulomb and dispersion (c1.x, c1.w), the short-range terms from the spline table (t3, cTable b1)
+struct Tabulated
+{
+	Tabulated(const HostShader& shader, const HostContext& context) : constants(context.CB<cTable>(1)), table(context.SRV<float4>(3)), width(context.srv[3] == NULL ? 0 : context.srv[3]->width) { }
+	bool Bound() const { return constants != NULL && table != NULL; }
+
+	inline float Spline(float R2, unsigned column, unsigned k) const
+	{
+		float x = (R2 - constants->table_min) * constants->table_scale;
+		x = x < 0 ? 0 : x > constants->table_last ? constants->table_last : x;
+		float i = floorf(x), t = x - i;
+		const float4& c = table[k * width + 2 * (unsigned)i + column];
+		return ((c.w * t + c.z) * t + c.y) * t + c.x;
+	}
+	inline float4 Force(const float4& pos_i, const float4& pos_j, const float4& c1, const float4& c2, unsigned k) const
+	{
+		float x = pos_i.x - pos_j.x, y = pos_i.y - pos_j.y, z = pos_i.z - pos_j.z, R2 = x * x + y * y + z * z;
+		float r = 1 / sqrtf(R2 > 1e-4f ? R2 : 1e-4f), r2 = r * r;
+		float dU = c1.x * r2 * r - 6 * c1.w * (r2 * r2) * (r2 * r2);
+		if (R2 < constants->cutoff2) dU += Spline(R2, 0, k);
+		return Float4(x * dU, y * dU, z * dU, 0);
+	}
+	inline float4 Energy(const float4& pos_i, const float4& pos_j, const float4& c1, const float4& c2, unsigned k) const
+	{
+		float x = pos_i.x - pos_j.x, y = pos_i.y - pos_j.y, z = pos_i.z - pos_j.z, R2 = x * x + y * y + z * z;
+		if (R2 == 0) return Float4(0, 0, 0, 0);
+		float r = 1 / sqrtf(R2), r2 = r * r, r6 = r2 * r2 * r2;
+		float dU = c1.x * r2 * r - 6 * c1.w * r6 * r2, energy = c1.x * r - c1.w * r6;
+		if (R2 < constants->cutoff2)
+		{
+			dU += Spline(R2, 0, k);
+			energy += Spline(R2, 1, k);
+		}
+		return Float4(x * dU, y * dU, z * dU, energy);
+	}
+
+	const cTable* constants;
+	const float4* table;
+	int width;
+};
+
+// ForceNxN/EnergyNxN: every thread sums the interactions of 4 ions with the rows g.y, g.y + bj, ... of the position texture
+template <class Form, bool energy, bool compensated> HRESULT PairsNxN(const HostShader& shader, const HostContext& context, int group_x, int group_y, int group_z)
+{
+	const cTiling* tiling = context.CB<cTiling>(0);
+	const float4* pos = context.SRV<float4>(0);
+	const int* type = context.SRV<int>(1);
+	const float4* coefs = context.SRV<float4>(2);
+	float4* force = context.UAV<float4>(0);
+	Form form(shader, context);
+	if (tiling == NULL || pos == NULL || type == NULL || coefs == NULL || force == NULL || !form.Bound()) return E_FAIL;
+	unsigned n = shader.Define("n"), threads = shader.Define("threads"), types = shader.Define("types", 2);
+	unsigned bj = tiling->bj, ww = tiling->ww, hh = tiling->hh;
+
+	for (unsigned t = 0; t < threads; t++)
+	{
+		unsigned i = (t + group_x * threads) * 4;
+		if (i >= n) break;
+		float4 pos_i[4] = { pos[i + 0], pos[i + 1], pos[i + 2], pos[i + 3] }, force_i[4] = { }, comp_i[4] = { };
+		unsigned type_i = type[i] * types;
+
+		for (unsigned y = group_y; y < hh; y += bj)
+			for (unsigned j = y * ww, end = j + ww; j < end; j++)
+			{
+				unsigned k = type_i + type[j];
+				const float4 &CC1 = coefs[k * 2], &CC2 = coefs[k * 2 + 1], &pos_j = pos[j];
+				for (int m = 0; m < 4; m++)
+					Add<compensated>(force_i[m], comp_i[m], energy ? form.Energy(pos_i[m], pos_j, CC1, CC2, k) : form.Force(pos_i[m], pos_j, CC1, CC2, k));
+			}
+
+		for (int m = 0; m < 4; m++) force[i + group_y * n + m] = force_i[m] - comp_i[m];
+	}
+	return S_OK;
+}
+template <class Form, bool energy> HRESULT PairsNxN(const HostShader& shader, const HostContext& context, int group_x, int group_y, int group_z)
+{
+	if (shader.Define("compensated") != 0) return PairsNxN<Form, energy, true>(shader, context, group_x, group_y, group_z);
+	return PairsNxN<Form, energy, false>(shader, context, group_x, group_y, group_z);
+}
+
+// Sum: reduction of the bj partial sums of every ion into the first slice
+HRESULT Sum(const HostShader& shader, const HostContext& context, int group_x, int group_y, int group_z)
+{
+	const cTiling* tiling = context.CB<cTiling>(0);
+	float4* force = context.UAV<float4>(0);
+	if (tiling == NULL || force == NULL) return E_FAIL;
+	unsigned n = shader.Define("n"), threads = shader.Define("threads"), bj = tiling->bj;
+	bool compensated = shader.Define("compensated") != 0;
+
+	for (unsigned t = 0; t < threads; t++)
+	{
+		unsigned i = (group_x * threads + t) * 4;
+		if (i >= n) break;
+		float4 sum[4] = { }, comp[4] = { };
+		for (unsigned j = 0; j < bj; j++)
+			for (int m = 0; m < 4; m++)
+				if (compensated) Add<true>(sum[m], comp[m], force[i + j * n + m]);
+				else sum[m] += force[i + j * n + m];
+		for (int m = 0; m < 4; m++) force[i + m] = sum[m] - comp[m];
+	}
+	return S_OK;
+}
+
+// MD-VV.hlsl: integration on the device, see the shader for the steps. The per-group sums are added in thread order
+// instead of the tree of the shader, so the host results differ from the device ones in the last bits only.
+struct cDynamics { float dt, T, tau, evaporation_r2; unsigned ions, ww, groups, slot; };
+#define Kb 8.617342791E-5f
+
+struct Integration
+{
+	Integration(const HostShader& shader, const HostContext& context) : threads(shader.Define("threads"))
+	{
+		c = context.CB<cDynamics>(0);
+		vel = context.UAV<float4>(0); pos_lo = context.UAV<float4>(1); force = context.UAV<float4>(2);
+		partial = context.UAV<float4>(3); history = context.UAV<float4>(4); pos = context.UAV<float4>(5);
+	}
+	bool Bound() const { return c != NULL && vel != NULL && pos_lo != NULL && force != NULL && partial != NULL && history != NULL && pos != NULL; }
+	unsigned Begin(int group) const { return group * threads; }
+	unsigned End(int group) const { unsigned end = (group + 1) * threads; return end < c->ions ? end : c->ions; }
+
+	unsigned threads;
+	const cDynamics* c;
+	float4 *vel, *pos_lo, *force, *partial, *history, *pos; // pos: the texture, row pitch ww texels as in HostResource
+};
+
+HRESULT Kick(const HostShader& shader, const HostContext& context, int group_x, int group_y, int group_z)
+{
+	Integration d(shader, context);
+	if (!d.Bound()) return E_FAIL;
+	const float dt = d.c->dt;
+	float s[16] = { };
+	for (unsigned i = d.Begin(group_x), end = d.End(group_x); i < end; i++)
+	{
+		float4 v = d.vel[i], f = d.force[i];
+		float m = v.w, h = dt / m;
+		float rx = d.pos[i].x + d.pos_lo[i].x, ry = d.pos[i].y + d.pos_lo[i].y, rz = d.pos[i].z + d.pos_lo[i].z;
+		float ux = v.x + f.x * h, uy = v.y + f.y * h, uz = v.z + f.z * h;
+		d.vel[i] = Float4(ux, uy, uz, m);
+		s[0] += m * ux; s[1] += m * uy; s[2] += m * uz; s[3] += f.w;
+		s[4] += m * (ry * uz - rz * uy); s[5] += m * (rz * ux - rx * uz); s[6] += m * (rx * uy - ry * ux); s[7] += -m * rx * ry;
+		s[8] += rx; s[9] += ry; s[10] += rz; s[11] += -m * ry * rz;
+		s[12] += m * (ry * ry + rz * rz); s[13] += m * (rx * rx + rz * rz); s[14] += m * (rx * rx + ry * ry); s[15] += -m * rx * rz;
+	}
+	for (int k = 0; k < 4; k++) d.partial[group_x * 4 + k] = Float4(s[k * 4], s[k * 4 + 1], s[k * 4 + 2], s[k * 4 + 3]);
+	return S_OK;
+}
+
+HRESULT Correct(const HostShader& shader, const HostContext& context, int group_x, int group_y, int group_z)
+{
+	Integration d(shader, context);
+	if (!d.Bound()) return E_FAIL;
+	const unsigned groups = d.c->groups;
+	float4 s[4] = { };
+	for (unsigned g = 0; g < groups; g++)
+		for (int k = 0; k < 4; k++) s[k] += d.partial[g * 4 + k];
+	float n = (float)d.c->ions, P[3] = { s[0].x / n, s[0].y / n, s[0].z / n }, R[3] = { s[2].x, s[2].y, s[2].z };
+	float L[3] = { s[1].x - (R[1] * P[2] - R[2] * P[1]), s[1].y - (R[2] * P[0] - R[0] * P[2]), s[1].z - (R[0] * P[1] - R[1] * P[0]) };
+	float xx = s[3].x, yy = s[3].y, zz = s[3].z, xy = s[1].w, yz = s[2].w, xz = s[3].w;
+	float c0 = yy * zz - yz * yz, c1 = xz * yz - xy * zz, c2 = xy * yz - yy * xz, det = xx * c0 + xy * c1 + xz * c2;
+	float inv[3][3] = {
+		{ c0 / det, c1 / det, c2 / det },
+		{ c1 / det, (xx * zz - xz * xz) / det, (xy * xz - xx * yz) / det },
+		{ c2 / det, (xy * xz - xx * yz) / det, (xx * yy - xy * xy) / det } };
+	float w[3];
+	for (int k = 0; k < 3; k++) w[k] = inv[k][0] * L[0] + inv[k][1] * L[1] + inv[k][2] * L[2];
+	d.partial[groups * 4 + 0] = Float4(P[0], P[1], P[2], 0);
+	d.partial[groups * 4 + 1] = Float4(w[0], w[1], w[2], 0);
+	d.history[d.c->slot] = Float4(0, 0.5f * s[0].w, 0, 0);
+	return S_OK;
+}
+
+HRESULT Kinetic(const HostShader& shader, const HostContext& context, int group_x, int group_y, int group_z)
+{
+	Integration d(shader, context);
+	if (!d.Bound()) return E_FAIL;
+	const float4 P = d.partial[d.c->groups * 4 + 0], w = d.partial[d.c->groups * 4 + 1];
+	float mvv = 0;
+	for (unsigned i = d.Begin(group_x), end = d.End(group_x); i < end; i++)
+	{
+		float4 v = d.vel[i];
+		float rx = d.pos[i].x + d.pos_lo[i].x, ry = d.pos[i].y + d.pos_lo[i].y, rz = d.pos[i].z + d.pos_lo[i].z;
+		float ux = v.x - P.x / v.w - (w.y * rz - w.z * ry);
+		float uy = v.y - P.y / v.w - (w.z * rx - w.x * rz);
+		float uz = v.z - P.z / v.w - (w.x * ry - w.y * rx);
+		d.vel[i] = Float4(ux, uy, uz, v.w);
+		mvv += v.w * (ux * ux + uy * uy + uz * uz);
+	}
+	d.partial[group_x * 4] = Float4(mvv, 0, 0, 0);
+	return S_OK;
+}
+
+HRESULT Berendsen(const HostShader& shader, const HostContext& context, int group_x, int group_y, int group_z)
+{
+	Integration d(shader, context);
+	if (!d.Bound()) return E_FAIL;
+	const unsigned groups = d.c->groups;
+	float mvv = 0;
+	for (unsigned g = 0; g < groups; g++) mvv += d.partial[g * 4].x;
+	float T_system = mvv / (Kb * 3 * d.c->ions);
+	d.partial[groups * 4 + 2] = Float4(sqrtf(1 + (d.c->T / T_system - 1) / d.c->tau), T_system, 0, 0);
+	d.history[d.c->slot].x = T_system;
+	return S_OK;
+}
+
+static inline float Sign(float a) { return a > 0 ? 1.0f : a < 0 ? -1.0f : 0.0f; }
+
+HRESULT Drift(const HostShader& shader, const HostContext& context, int group_x, int group_y, int group_z)
+{
+	Integration d(shader, context);
+	if (!d.Bound()) return E_FAIL;
+	const float dt = d.c->dt, scale = d.partial[d.c->groups * 4 + 2].x;
+	for (unsigned i = d.Begin(group_x), end = d.End(group_x); i < end; i++)
+	{
+		float4 v = d.vel[i], hi = d.pos[i], lo = d.pos_lo[i];
+		float u[3] = { v.x * scale, v.y * scale, v.z * scale }, h[3] = { hi.x, hi.y, hi.z }, l[3] = { lo.x, lo.y, lo.z }, r[3];
+		for (int k = 0; k < 3; k++)
+		{
+			float dk = l[k] + u[k] * dt;
+			r[k] = h[k] + dk; l[k] = dk - (r[k] - h[k]);
+		}
+		if (r[0] * r[0] + r[1] * r[1] + r[2] * r[2] > d.c->evaporation_r2) // RevertEvaporatedParticles
+			for (int k = 0; k < 3; k++) u[k] = -Sign(r[k]) * fabsf(u[k]);
+		d.vel[i] = Float4(u[0], u[1], u[2], v.w);
+		d.pos[i] = Float4(r[0], r[1], r[2], hi.w);
+		d.pos_lo[i] = Float4(l[0], l[1], l[2], 0);
+	}
+	return S_OK;
+}
+
+struct HostKernelEntry { const char *kernels, *entry_point; HostKernel kernel; };
+const HostKernelEntry host_kernels[] = {
+	{ "IBC-B", "ForceNxN", PairsNxN<Buckingham, false> },
+	{ "IBC-B", "EnergyNxN", PairsNxN<Buckingham, true> },
+	{ "IBC-B", "Sum", Sum },
+	{ "IBC-BM", "ForceNxN", PairsNxN<BuckinghamMorse, false> },
+	{ "IBC-BM", "EnergyNxN", PairsNxN<BuckinghamMorse, true> },
+	{ "IBC-BM", "Sum", Sum },
+	{ "IBC-B4", "ForceNxN", PairsNxN<Buckingham4, false> },
+	{ "IBC-B4", "EnergyNxN", PairsNxN<Buckingham4, true> },
+	{ "IBC-B4", "Sum", Sum },
+	{ "IBC-T", "ForceNxN", PairsNxN<Tabulated, false> },
+	{ "IBC-T", "EnergyNxN", PairsNxN<Tabulated, true> },
+	{ "IBC-T", "Sum", Sum },
+	{ "MD-VV", "Kick", Kick },
+	{ "MD-VV", "Correct", Correct },
+	{ "MD-VV", "Kinetic", Kinetic },
+	{ "MD-VV", "Berendsen", Berendsen },
+	{ "MD-VV", "Drift", Drift },
+};
+
+HostKernel FindHostKernel(const std::string& kernels, const std::string& entry_point)
+{
+	for (size_t i = 0; i < sizeof(host_kernels) / sizeof(host_kernels[0]); i++)
+		if (kernels == host_kernels[i].kernels && entry_point == host_kernels[i].entry_point) return host_kernels[i].kernel;
+	return NULL;
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include "stdafx.h"
+#ifndef DX11ONE_HOST
+#include <algorithm>
 
 long Device::ID = 1001001;
 long Context::ID = 1001002;
@@ -6,89 +8,252 @@ long Shader::ID = 1001003;
 long Buffer::ID = 1001004;
 long Texture2D::ID = 1001005;
 
-ID3D11Device* _device = NULL;
-ID3D11DeviceContext* _context = NULL;
-ID3D11ShaderResourceView** SRVs = NULL;
-ID3D11UnorderedAccessView** UAVs = NULL;
-ID3D11Buffer** CBs = NULL;
-int SRV_count = -1, UAV_count = -1, CB_count = -1;
-
-ID3D11ShaderResourceView** GetSRVs(int count, Buffer* buffers)
+#ifndef DX11ONE_NO_TRACE
+// GPU time of DispatchShader while trace events are recorded: a ring of timestamp pairs inside disjoint queries. Slots are
+// resolved without flushing at the next dispatches; when the ring is full of pending slots a dispatch goes untimed.
+class DispatchTimer
 {
-	if (SRV_count < count)
+public:
+	DispatchTimer(ID3D11Device* device) : next(0)
 	{
-		free(SRVs);
-		SRVs = (ID3D11ShaderResourceView**)malloc(count * sizeof(ID3D11ShaderResourceView*));
-		SRV_count = count;
+		D3D11_QUERY_DESC disjoint = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 }, timestamp = { D3D11_QUERY_TIMESTAMP, 0 };
+		for (int k = 0; k < SLOTS; k++)
+		{
+			Slot& s = slots[k];
+			s.disjoint = NULL; s.begin = NULL; s.end = NULL; s.pending = false;
+			if (FAILED(device->CreateQuery(&disjoint, &s.disjoint)) || FAILED(device->CreateQuery(&timestamp, &s.begin)) ||
+				FAILED(device->CreateQuery(&timestamp, &s.end))) s.pending = true; // never used
+		}
 	}
-	if (buffers == NULL) { memset(SRVs, 0, count * sizeof(ID3D11ShaderResourceView*)); return SRVs; }
-	for (int i = 0; i < count; i++)
+	~DispatchTimer()
 	{
-		if (buffers[i].id != buffers[i].ID || buffers[i].p_SRV == NULL) return NULL;
-		SRVs[i] = buffers[i].p_SRV;
+		for (int k = 0; k < SLOTS; k++)
+		{
+			if (slots[k].disjoint != NULL) slots[k].disjoint->Release();
+			if (slots[k].begin != NULL) slots[k].begin->Release();
+			if (slots[k].end != NULL) slots[k].end->Release();
+		}
 	}
-	return SRVs;
-}
-ID3D11ShaderResourceView** GetSRVs(int r_count, Buffer* r_buffers, int t_count, Texture2D* textures)
-{
-	int count = r_count + t_count;
-	if (SRV_count < count)
+	// The slot of the dispatch, -1 if it goes untimed
+	int Begin(ID3D11DeviceContext* context, long long cpu_start)
 	{
-		free(SRVs);
-		SRVs = (ID3D11ShaderResourceView**)malloc(count * sizeof(ID3D11ShaderResourceView*));
-		SRV_count = count;
+		Resolve(context);
+		Slot& s = slots[next];
+		if (s.pending) return -1;
+		context->Begin(s.disjoint);
+		context->End(s.begin);
+		s.cpu_start = cpu_start;
+		return next;
 	}
-	if (r_buffers == NULL && textures == NULL) { memset(SRVs, 0, count * sizeof(ID3D11ShaderResourceView*)); return SRVs; }
-	for (int i = 0; i < r_count; i++)
+	void End(ID3D11DeviceContext* context, int slot)
 	{
-		if (r_buffers[i].id != r_buffers[i].ID || r_buffers[i].p_SRV == NULL) return NULL;
-		SRVs[i] = r_buffers[i].p_SRV;
+		context->End(slots[slot].end);
+		context->End(slots[slot].disjoint);
+		slots[slot].pending = true;
+		next = (next + 1) % SLOTS;
 	}
-	for (int i = 0; i < t_count; i++)
+	void Resolve(ID3D11DeviceContext* context)
 	{
-		if (textures[i].id != textures[i].ID || textures[i].p_SRV == NULL) return NULL;
-		SRVs[r_count + i] = textures[i].p_SRV;
+		for (int k = 0; k < SLOTS; k++)
+		{
+			Slot& s = slots[k];
+			D3D11_QUERY_DATA_TIMESTAMP_DISJOINT d;
+			UINT64 t0, t1;
+			if (!s.pending || s.disjoint == NULL || context->GetData(s.disjoint, &d, sizeof(d), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) continue;
+			if (context->GetData(s.begin, &t0, sizeof(t0), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+				context->GetData(s.end, &t1, sizeof(t1), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) continue;
+			s.pending = false;
+			if (!d.Disjoint && d.Frequency > 0 && t1 >= t0) TraceGPU(CALL_DispatchShader, s.cpu_start, (long long)((t1 - t0) * 1e9 / d.Frequency));
+		}
 	}
-	return SRVs;
-}
-ID3D11UnorderedAccessView** GetUAVs(int count, Buffer* buffers)
+private:
+	static const int SLOTS = 16;
+	struct Slot { ID3D11Query *disjoint, *begin, *end; long long cpu_start; bool pending; } slots[SLOTS];
+	int next;
+};
+#endif
+
+// A context of CreateDevice: its device, the scratch arrays of the views bound by the Set* calls (as long as the most
+// bound so far, UnbindResources clears them all), the readback ring and the dispatch timer. Contexts are independent of
+// each other; a context is used by one thread at a time.
+struct ContextState
 {
-	if (UAV_count < count)
+	ContextState(ID3D11Device* device) : device(device), readback(NULL)
 	{
-		free(UAVs);
-		UAVs = (ID3D11UnorderedAccessView**)malloc(count * sizeof(ID3D11UnorderedAccessView*));
-		UAV_count = count;
+#ifndef DX11ONE_NO_TRACE
+		timer = NULL;
+#endif
 	}
-	if (buffers == NULL) { memset(UAVs, 0, count * sizeof(ID3D11UnorderedAccessView*)); return UAVs; }
-	for (int i = 0; i < count; i++)
+	~ContextState()
 	{
-		if (buffers[i].id != buffers[i].ID || buffers[i].p_UAV == NULL) return NULL;
-		UAVs[i] = buffers[i].p_UAV;
+		delete readback;
+#ifndef DX11ONE_NO_TRACE
+		delete timer;
+#endif
 	}
-	return UAVs;
+	ID3D11Device* device;
+	std::vector<ID3D11ShaderResourceView*> srvs;
+	std::vector<ID3D11UnorderedAccessView*> uavs;
+	std::vector<ID3D11Buffer*> cbs;
+	ReadbackRing* readback;
+#ifndef DX11ONE_NO_TRACE
+	DispatchTimer* timer;
+#endif
+};
+std::mutex states_lock;
+std::map<ID3D11DeviceContext*, ContextState*> states;
+ResourcePool<Buffer> buffer_pool;
+ResourcePool<Texture2D> texture_pool;
+// A handle of a resource that has not been released since it was made or taken from the pool (ResourcePool.h)
+static bool Live(const Buffer& b) { return b.id == b.ID && b.p_buffer != NULL && buffer_pool.Live(b.p_buffer, b.serial); }
+static bool Live(const Texture2D& t) { return t.id == t.ID && t.p_texture != NULL && texture_pool.Live(t.p_texture, t.serial); }
+
+ContextState* State(ID3D11DeviceContext* context)
+{
+	std::lock_guard<std::mutex> guard(states_lock);
+	std::map<ID3D11DeviceContext*, ContextState*>::iterator i = states.find(context);
+	return i == states.end() ? NULL : i->second;
 }
-ID3D11Buffer** GetCBs(int count, Buffer* buffers)
+bool Registered(ID3D11Device* device) // a device of CreateDevice not released yet
 {
-	if (CB_count < count)
+	std::lock_guard<std::mutex> guard(states_lock);
+	for (std::map<ID3D11DeviceContext*, ContextState*>::iterator i = states.begin(); i != states.end(); ++i)
+		if (i->second->device == device) return true;
+	return false;
+}
+
+int FormatSize(DXGI_FORMAT format) // bytes per texel of the formats in DirectCompute.ResourceFormat
+{
+	switch (format)
 	{
-		free(CBs);
-		CBs = (ID3D11Buffer**)malloc(count * sizeof(ID3D11Buffer*));
-		CB_count = count;
+		case DXGI_FORMAT_R32G32B32A32_TYPELESS: case DXGI_FORMAT_R32G32B32A32_FLOAT: case DXGI_FORMAT_R32G32B32A32_UINT: case DXGI_FORMAT_R32G32B32A32_SINT: return 16;
+		case DXGI_FORMAT_R32G32B32_TYPELESS: case DXGI_FORMAT_R32G32B32_FLOAT: case DXGI_FORMAT_R32G32B32_UINT: case DXGI_FORMAT_R32G32B32_SINT: return 12;
+		case DXGI_FORMAT_R32G32_TYPELESS: case DXGI_FORMAT_R32G32_FLOAT: case DXGI_FORMAT_R32G32_UINT: case DXGI_FORMAT_R32G32_SINT: return 8;
+		case DXGI_FORMAT_R32_TYPELESS: case DXGI_FORMAT_D32_FLOAT: case DXGI_FORMAT_R32_FLOAT: case DXGI_FORMAT_R32_UINT: case DXGI_FORMAT_R32_SINT: return 4;
+		default: return 0;
 	}
-	if (buffers == NULL) { memset(CBs, 0, count * sizeof(ID3D11Buffer*)); return CBs; }
+}
+
+// The views of the handles in the scratch array of a context (handles NULL: unbinds the slots), false if one is invalid
+template <class View> View** Scratch(std::vector<View*>& scratch, int count)
+{
+	if ((int)scratch.size() < count) scratch.resize(count, NULL);
+	return &scratch[0];
+}
+template <class View, class Handle> bool Views(View** slots, Handle* handles, int count, View* Handle::*view)
+{
 	for (int i = 0; i < count; i++)
 	{
-		if (buffers[i].id != buffers[i].ID || buffers[i].p_buffer == NULL) return NULL;
-		CBs[i] = buffers[i].p_buffer;
+		if (handles == NULL) { slots[i] = NULL; continue; }
+		if (!Live(handles[i]) || handles[i].*view == NULL) return false;
+		slots[i] = handles[i].*view;
 	}
-	return CBs;
+	return true;
+}
+
+static PoolKey Key(ID3D11Device* device, const D3D11_BUFFER_DESC& d, bool srv, bool uav)
+{
+	PoolKey key = { device, 1, (int)d.Usage, (int)d.BindFlags, (int)d.CPUAccessFlags, (int)d.ByteWidth, 1, (int)d.StructureByteStride, (srv ? 1 : 0) | (uav ? 2 : 0) };
+	return key;
+}
+static PoolKey Key(ID3D11Device* device, const D3D11_TEXTURE2D_DESC& d, bool srv, bool uav)
+{
+	PoolKey key = { device, 2, (int)d.Usage, (int)d.BindFlags, (int)d.CPUAccessFlags, (int)d.Width, (int)d.Height, (int)d.Format, (srv ? 1 : 0) | (uav ? 2 : 0) };
+	return key;
+}
+
+// A pooled resource taken as a new one: the initial data or zeros, written through the immediate context of the device
+// (dynamic and staging buffers are always written before they are read)
+static bool TakeBuffer(ID3D11Device* device, const D3D11_BUFFER_DESC& desc, bool srv, bool uav, void* init_data, Buffer* buffer)
+{
+	if (!buffer_pool.Take(Key(device, desc, srv, uav), buffer)) return false;
+	if (desc.Usage != D3D11_USAGE_DEFAULT) return true;
+	std::vector<char> zeros(init_data == NULL ? desc.ByteWidth : 0);
+	ID3D11DeviceContext* context;
+	device->GetImmediateContext(&context);
+	context->UpdateSubresource(buffer->p_buffer, 0, NULL, init_data != NULL ? init_data : &zeros[0], 0, 0);
+	context->Release();
+	return true;
+}
+static bool TakeTexture(ID3D11Device* device, const D3D11_TEXTURE2D_DESC& desc, bool uav, void* init_data, Texture2D* t)
+{
+	if (!texture_pool.Take(Key(device, desc, true, uav), t)) return false;
+	int pitch = desc.Width * FormatSize(desc.Format);
+	std::vector<char> zeros(init_data == NULL ? (size_t)pitch * desc.Height : 0);
+	const char* source = init_data != NULL ? (const char*)init_data : &zeros[0];
+	ID3D11DeviceContext* context;
+	device->GetImmediateContext(&context);
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	if (desc.Usage == D3D11_USAGE_DEFAULT) context->UpdateSubresource(t->p_texture, 0, NULL, source, pitch, 0);
+	else if (!FAILED(context->Map(t->p_texture, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource)))
+	{
+		for (UINT i = 0; i < desc.Height; i++) memcpy((char*)mappedResource.pData + i * mappedResource.RowPitch, source + i * pitch, pitch);
+		context->Unmap(t->p_texture, 0);
+	}
+	context->Release();
+	return true;
+}
+
+// A released resource goes to the pool of its device, unless the device is gone or the pool is full
+static bool Recycle(const Buffer& b)
+{
+	if (b.id != b.ID || b.p_buffer == NULL) return false;
+	ID3D11Device* device;
+	b.p_buffer->GetDevice(&device);
+	device->Release(); // only a key
+	if (!Registered(device)) return false;
+	D3D11_BUFFER_DESC desc;
+	b.p_buffer->GetDesc(&desc);
+	return buffer_pool.Give(Key(device, desc, b.p_SRV != NULL, b.p_UAV != NULL), desc.ByteWidth, b, b.p_buffer);
+}
+static bool Recycle(const Texture2D& t)
+{
+	if (t.id != t.ID || t.p_texture == NULL) return false;
+	ID3D11Device* device;
+	t.p_texture->GetDevice(&device);
+	device->Release();
+	if (!Registered(device)) return false;
+	D3D11_TEXTURE2D_DESC desc;
+	t.p_texture->GetDesc(&desc);
+	return texture_pool.Give(Key(device, desc, t.p_SRV != NULL, t.p_UAV != NULL), (long long)desc.Width * desc.Height * FormatSize(desc.Format), t, t.p_texture);
+}
+
+static void FreeBuffer(Buffer& b)
+{
+	if (b.p_SRV != NULL) b.p_SRV->Release();
+	if (b.p_UAV != NULL) b.p_UAV->Release();
+	if (b.p_buffer != NULL) { buffer_pool.Forget(b.p_buffer); b.p_buffer->Release(); }
+	b.p_SRV = NULL; b.p_UAV = NULL; b.p_buffer = NULL; b.id = -1;
+}
+static void FreeTexture(Texture2D& t)
+{
+	if (t.p_texture != NULL) { texture_pool.Forget(t.p_texture); t.p_texture->Release(); }
+	if (t.p_UAV != NULL) t.p_UAV->Release();
+	if (t.p_SRV != NULL) t.p_SRV->Release();
+	t.p_texture = NULL; t.p_UAV = NULL; t.p_SRV = NULL; t.id = -1;
+}
+static void FreePooled(ID3D11Device* device) // the idle resources of the device, NULL: of every device
+{
+	std::vector<Buffer> buffers;
+	std::vector<Texture2D> textures;
+	buffer_pool.Drain(device, &buffers);
+	texture_pool.Drain(device, &textures);
+	for (size_t k = 0; k < buffers.size(); k++) FreeBuffer(buffers[k]);
+	for (size_t k = 0; k < textures.size(); k++) FreeTexture(textures[k]);
 }
 
 HRESULT DX11W_API CreateDevice(D3D_DRIVER_TYPE driver_type, D3D_FEATURE_LEVEL level_wanted, Device* device, Context* context)
 {
+	TRACE(CreateDevice, 0);
 	if (device == NULL || context == NULL) return E_FAIL;
-	if (context->id == context->ID && context->ptr != NULL) { context->ptr->Release(); _context = NULL; }
-	if (device->id == device->ID && device->ptr != NULL) { device->ptr->Release(); _device = NULL; }
+	if (context->id == context->ID && context->ptr != NULL)
+	{
+		std::lock_guard<std::mutex> guard(states_lock);
+		std::map<ID3D11DeviceContext*, ContextState*>::iterator i = states.find(context->ptr);
+		if (i != states.end()) { delete i->second; states.erase(i); }
+		context->ptr->Release();
+	}
+	if (device->id == device->ID && device->ptr != NULL) { FreePooled(device->ptr); device->ptr->Release(); }
 	*device = Device(); *context = Context();
 	D3D_FEATURE_LEVEL levels_wanted[] = { level_wanted }; int num_levels_wanted = 1;
 	D3D_FEATURE_LEVEL FeatureLevel;
@@ -111,14 +276,37 @@ HRESULT DX11W_API CreateDevice(D3D_DRIVER_TYPE driver_type, D3D_FEATURE_LEVEL le
 	}
 	else
 	{
-		_device = device->ptr;
-		_context = context->ptr;
+		std::lock_guard<std::mutex> guard(states_lock);
+		states[context->ptr] = new ContextState(device->ptr);
 	}
 	return hr;
 }
 
+HRESULT DX11W_API GetDeviceName(Device device, char* name, int length)
+{
+	TRACE(GetDeviceName, 0);
+	if (device.id != device.ID || device.ptr == NULL || name == NULL || length <= 0) return E_FAIL;
+	IDXGIDevice* dxgi = NULL;
+	IDXGIAdapter* adapter = NULL;
+	DXGI_ADAPTER_DESC desc;
+	HRESULT hr = device.ptr->QueryInterface(__uuidof(IDXGIDevice), (void**)&dxgi);
+	if (!FAILED(hr)) hr = dxgi->GetAdapter(&adapter);
+	if (!FAILED(hr)) hr = adapter->GetDesc(&desc);
+	if (!FAILED(hr))
+	{
+		char description[128];
+		size_t converted;
+		wcstombs_s(&converted, description, sizeof(description), desc.Description, _TRUNCATE);
+		_snprintf_s(name, length, _TRUNCATE, "%s %04X:%04X", description, desc.VendorId, desc.DeviceId);
+	}
+	if (adapter != NULL) adapter->Release();
+	if (dxgi != NULL) dxgi->Release();
+	return hr;
+}
+
 HRESULT DX11W_API CreateAndCompileShader(Device device, LPCSTR filename, LPCSTR entry_point, LPCSTR shader_profile, unsigned int flags, Shader* shader)
 {
+	TRACE(CreateAndCompileShader, 0);
 	if (shader == NULL) return E_FAIL;
 	if (shader->id == shader->ID) ReleaseShader(*shader);
 	*shader = Shader();
@@ -137,6 +325,7 @@ HRESULT DX11W_API CreateAndCompileShader(Device device, LPCSTR filename, LPCSTR
 
 HRESULT DX11W_API CompileShader(Device device, LPCSTR shader_source, int shader_length, LPCSTR entry_point, LPCSTR shader_profile, unsigned int flags, Shader* shader, const char **errors)
 {
+	TRACE(CompileShader, 0);
 	if (shader == NULL) return E_FAIL;
 	if (shader->id == shader->ID) ReleaseShader(*shader);
 	*shader = Shader();
@@ -149,9 +338,77 @@ HRESULT DX11W_API CompileShader(Device device, LPCSTR shader_source, int shader_
 	return hr;
 }
 
+// D3DCompile as the compiler of the cache: the blobs of the last call of a thread hold its outputs
+static HRESULT DX11W_CALLBACK D3DCompiler(const char* source, int length, const char* entry_point, const char* profile, unsigned int flags,
+	const void** bytecode, int* bytecode_length, const char** errors)
+{
+	static thread_local ID3D10Blob* code = NULL;
+	static thread_local ID3D10Blob* messages = NULL;
+	if (code != NULL) { code->Release(); code = NULL; }
+	if (messages != NULL) { messages->Release(); messages = NULL; }
+	HRESULT hr = D3DCompile(source, length, source, NULL, NULL, entry_point, profile, flags, NULL, &code, &messages);
+	*errors = messages == NULL ? NULL : (const char*)messages->GetBufferPointer();
+	if (FAILED(hr)) return hr;
+	*bytecode = code->GetBufferPointer();
+	*bytecode_length = (int)code->GetBufferSize();
+	return hr;
+}
+
+// The version of the D3DCompiler DLL loaded, so that cached bytecode of an older compiler is not reused after an update:
+// the file version of its resources, or its size and write time if it has none
+static std::string CompilerVersion()
+{
+	char path[MAX_PATH], text[128];
+	HMODULE module = GetModuleHandleA(D3DCOMPILER_DLL_A);
+	if (module == NULL || GetModuleFileNameA(module, path, MAX_PATH) == 0) return D3DCOMPILER_DLL_A;
+	DWORD handle = 0, size = GetFileVersionInfoSizeA(path, &handle);
+	std::vector<char> info(size);
+	VS_FIXEDFILEINFO* fixed = NULL; UINT length = 0;
+	if (size > 0 && GetFileVersionInfoA(path, 0, size, &info[0]) && VerQueryValueA(&info[0], "\\", (void**)&fixed, &length) && fixed != NULL)
+		snprintf(text, sizeof(text), " %u.%u.%u.%u", HIWORD(fixed->dwFileVersionMS), LOWORD(fixed->dwFileVersionMS), HIWORD(fixed->dwFileVersionLS), LOWORD(fixed->dwFileVersionLS));
+	else
+	{
+		WIN32_FILE_ATTRIBUTE_DATA file;
+		if (!GetFileAttributesExA(path, GetFileExInfoStandard, &file)) return D3DCOMPILER_DLL_A;
+		snprintf(text, sizeof(text), " size %lu:%lu time %lu:%lu", file.nFileSizeHigh, file.nFileSizeLow, file.ftLastWriteTime.dwHighDateTime, file.ftLastWriteTime.dwLowDateTime);
+	}
+	return std::string(D3DCOMPILER_DLL_A) + text;
+}
+
+ShaderCompiler DefaultShaderCompiler(const char** version)
+{
+	static const std::string compiler_version = CompilerVersion();
+	*version = compiler_version.c_str();
+	return D3DCompiler;
+}
+
+// The messages *errors of LoadOrCompileShader points to, valid until the next call on the thread
+static thread_local std::string cache_errors;
+
+HRESULT DX11W_API LoadOrCompileShader(Device device, LPCSTR shader_source, int shader_length, LPCSTR entry_point, LPCSTR shader_profile, unsigned int flags, Shader* shader, const char **errors)
+{
+	TRACE(LoadOrCompileShader, 0);
+	if (shader == NULL) return E_FAIL;
+	if (shader->id == shader->ID) ReleaseShader(*shader);
+	*shader = Shader();
+	if (device.id != device.ID) { shader->id = -1; return E_FAIL; }
+	std::string bytecode;
+	HRESULT hr = TheShaderCache().Get(shader_source, shader_length, entry_point, shader_profile, flags, &bytecode, &cache_errors);
+	if (errors != NULL) *errors = cache_errors.c_str();
+	if (!FAILED(hr)) hr = D3DCreateBlob(bytecode.size(), &(shader->blob));
+	if (!FAILED(hr))
+	{
+		memcpy(shader->blob->GetBufferPointer(), bytecode.data(), bytecode.size());
+		hr = device.ptr->CreateComputeShader(shader->blob->GetBufferPointer(), shader->blob->GetBufferSize(), NULL, &(shader->ptr));
+	}
+	if (FAILED(hr)) shader->id = -1; // no "else", intentionally
+	return hr;
+}
+
 
 HRESULT DX11W_API CreateRWBuffer(Device device, int element_size, int element_count, void *init_data, Buffer* buffer)
 {
+	TRACE(CreateRWBuffer, (long long)element_size * element_count * (init_data != NULL));
 	if (buffer == NULL) return E_FAIL;
 	if (buffer->id == buffer->ID) ReleaseBuffer(*buffer);
 	*buffer = Buffer();
@@ -166,6 +423,7 @@ HRESULT DX11W_API CreateRWBuffer(Device device, int element_size, int element_co
 	sbDesc.MiscFlags			=	D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
 	sbDesc.StructureByteStride	=	element_size;
 	sbDesc.ByteWidth			=	element_size * element_count;
+	if (TakeBuffer(device.ptr, sbDesc, true, true, init_data, buffer)) return S_OK;
 	if (init_data == NULL)
 	{
 		hr = device.ptr->CreateBuffer(&sbDesc, NULL, &(buffer->p_buffer));
@@ -200,6 +458,7 @@ HRESULT DX11W_API CreateRWBuffer(Device device, int element_size, int element_co
 
 HRESULT DX11W_API CreateRBuffer(Device device, int element_size, int element_count, void *init_data, Buffer* buffer)
 {
+	TRACE(CreateRBuffer, (long long)element_size * element_count * (init_data != NULL));
 	if (buffer == NULL) return E_FAIL;
 	if (buffer->id == buffer->ID) ReleaseBuffer(*buffer);
 	*buffer = Buffer();
@@ -214,6 +473,7 @@ HRESULT DX11W_API CreateRBuffer(Device device, int element_size, int element_cou
 	sbDesc.MiscFlags			=	D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
 	sbDesc.StructureByteStride	=	element_size;
 	sbDesc.ByteWidth			=	element_size * element_count;
+	if (TakeBuffer(device.ptr, sbDesc, true, false, init_data, buffer)) return S_OK;
 	if (init_data == NULL)
 	{
 		hr = device.ptr->CreateBuffer(&sbDesc, NULL, &(buffer->p_buffer));
@@ -239,6 +499,7 @@ HRESULT DX11W_API CreateRBuffer(Device device, int element_size, int element_cou
 
 HRESULT DX11W_API CreateInputBuffer(Device device, int element_size, int element_count, Buffer* buffer)
 {
+	TRACE(CreateInputBuffer, 0);
 	if (buffer == NULL) return E_FAIL;
 	if (buffer->id == buffer->ID) ReleaseBuffer(*buffer);
 	*buffer = Buffer();
@@ -253,6 +514,7 @@ HRESULT DX11W_API CreateInputBuffer(Device device, int element_size, int element
 	sbDesc.MiscFlags			=	D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
 	sbDesc.StructureByteStride	=	element_size;
 	sbDesc.ByteWidth			=	element_size * element_count;
+	if (TakeBuffer(device.ptr, sbDesc, false, false, NULL, buffer)) return S_OK;
 
 	hr = device.ptr->CreateBuffer(&sbDesc, NULL, &(buffer->p_buffer));
 	if (FAILED(hr)) buffer->id = -1;
@@ -262,6 +524,7 @@ HRESULT DX11W_API CreateInputBuffer(Device device, int element_size, int element
 
 HRESULT DX11W_API CreateStagingBuffer(Device device, int element_size, int element_count, Buffer* buffer)
 {
+	TRACE(CreateStagingBuffer, 0);
 	if (buffer == NULL) return E_FAIL;
 	if (buffer->id == buffer->ID) ReleaseBuffer(*buffer);
 	*buffer = Buffer();
@@ -275,6 +538,7 @@ HRESULT DX11W_API CreateStagingBuffer(Device device, int element_size, int eleme
 	stagingBufferDesc.MiscFlags				= D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
 	stagingBufferDesc.StructureByteStride	= element_size;
 	stagingBufferDesc.ByteWidth				= element_size * element_count;
+	if (TakeBuffer(device.ptr, stagingBufferDesc, false, false, NULL, buffer)) return S_OK;
 
 	HRESULT hr = device.ptr->CreateBuffer(&stagingBufferDesc, NULL, &(buffer->p_buffer));
 	if (FAILED(hr)) buffer->id = -1;
@@ -284,6 +548,7 @@ HRESULT DX11W_API CreateStagingBuffer(Device device, int element_size, int eleme
 
 HRESULT DX11W_API CreateConstantBuffer(Device device, int length, Buffer* buffer)
 {
+	TRACE(CreateConstantBuffer, 0);
 	if (buffer == NULL) return E_FAIL;
 	if (buffer->id == buffer->ID) ReleaseBuffer(*buffer);
 	*buffer = Buffer();
@@ -293,7 +558,9 @@ HRESULT DX11W_API CreateConstantBuffer(Device device, int length, Buffer* buffer
 	cbDesc.Usage			=	D3D11_USAGE_DYNAMIC;
 	cbDesc.CPUAccessFlags	=	D3D11_CPU_ACCESS_WRITE; // CPU writable, should be updated per frame
 	cbDesc.MiscFlags		=	0;
+	cbDesc.StructureByteStride	=	0;
 	cbDesc.ByteWidth		=	length;
+	if (TakeBuffer(device.ptr, cbDesc, false, false, NULL, buffer)) return S_OK;
 
 	HRESULT hr = device.ptr->CreateBuffer(&cbDesc, NULL, &(buffer->p_buffer));
 	if (FAILED(hr)) buffer->id = -1;
@@ -303,6 +570,7 @@ HRESULT DX11W_API CreateConstantBuffer(Device device, int length, Buffer* buffer
 
 HRESULT DX11W_API CreateInputTexture2D(Device device, int width, int height, DXGI_FORMAT format, void *init_data, Texture2D* t)
 {
+	TRACE(CreateInputTexture2D, 0);
 	if (t == NULL) return E_FAIL;
 	if (t->id == t->ID) ReleaseTexture(*t);
 	*t = Texture2D();
@@ -320,6 +588,7 @@ HRESULT DX11W_API CreateInputTexture2D(Device device, int width, int height, DXG
 	desc2D.MiscFlags = 0;
     desc2D.SampleDesc.Count = 1;
     desc2D.SampleDesc.Quality = 0;
+	if (TakeTexture(device.ptr, desc2D, false, init_data, t)) return S_OK;
 
 	HRESULT hr = S_OK;
 	if (init_data == NULL)
@@ -355,10 +624,52 @@ HRESULT DX11W_API CreateInputTexture2D(Device device, int width, int height, DXG
 	return hr;
 }
 
+HRESULT DX11W_API CreateRWTexture2D(Device device, int width, int height, DXGI_FORMAT format, void *init_data, Texture2D* t)
+{
+	TRACE(CreateRWTexture2D, 0);
+	if (t == NULL) return E_FAIL;
+	if (t->id == t->ID) ReleaseTexture(*t);
+	*t = Texture2D();
+	if (device.id != device.ID || device.ptr == NULL) { t->id = -1; return E_FAIL; }
+	D3D11_TEXTURE2D_DESC desc2D;
+	ZeroMemory(&desc2D, sizeof(D3D11_TEXTURE2D_DESC));
+	desc2D.ArraySize = 1;
+	desc2D.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	desc2D.CPUAccessFlags = 0;
+	desc2D.Usage = D3D11_USAGE_DEFAULT; // stays in device memory, written by UpdateSubresource (WriteToTexture2D)
+	desc2D.Format = format;
+	desc2D.Width = width;
+	desc2D.Height = height;
+	desc2D.MipLevels = 1;
+	desc2D.SampleDesc.Count = 1;
+	if (TakeTexture(device.ptr, desc2D, true, init_data, t)) return S_OK;
+
+	D3D11_SUBRESOURCE_DATA InitData; InitData.pSysMem = init_data; InitData.SysMemPitch = width * FormatSize(format); InitData.SysMemSlicePitch = 0;
+	HRESULT hr = device.ptr->CreateTexture2D(&desc2D, init_data == NULL ? NULL : &InitData, &(t->p_texture));
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC descRV;
+	ZeroMemory(&descRV, sizeof(D3D11_SHADER_RESOURCE_VIEW_DESC));
+	descRV.Format = format;
+	descRV.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	descRV.Texture2D.MipLevels = 1;
+	if (!FAILED(hr)) hr = device.ptr->CreateShaderResourceView(t->p_texture, &descRV, &(t->p_SRV));
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC descUAV;
+	ZeroMemory(&descUAV, sizeof(D3D11_UNORDERED_ACCESS_VIEW_DESC));
+	descUAV.Format = format;
+	descUAV.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+	descUAV.Texture2D.MipSlice = 0;
+	if (!FAILED(hr)) hr = device.ptr->CreateUnorderedAccessView(t->p_texture, &descUAV, &(t->p_UAV));
+
+	if (FAILED(hr)) t->id = -1;
+	return hr;
+}
+
 
 HRESULT DX11W_API WriteToBuffer(Context context, Buffer destination, void* source, int length)
 {
-	if (context.id != context.ID || destination.id != destination.ID || source == NULL) return E_FAIL;
+	TRACE(WriteToBuffer, length);
+	if (context.id != context.ID || !Live(destination) || source == NULL) return E_FAIL;
 
 	D3D11_MAPPED_SUBRESOURCE mappedResource;
 	HRESULT hr = context.ptr->Map(destination.p_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
@@ -370,8 +681,17 @@ HRESULT DX11W_API WriteToBuffer(Context context, Buffer destination, void* sourc
 
 HRESULT DX11W_API WriteToTexture2D(Context context, Texture2D texture, void* source, int width, int height, int element_size)
 {
-	if (context.id != context.ID || texture.id != texture.ID || source == NULL) return E_FAIL;
+	TRACE(WriteToTexture2D, (long long)width * height * element_size);
+	if (context.id != context.ID || !Live(texture) || source == NULL) return E_FAIL;
 
+	D3D11_TEXTURE2D_DESC desc2D;
+	texture.p_texture->GetDesc(&desc2D);
+	if (desc2D.Usage == D3D11_USAGE_DEFAULT) // CreateRWTexture2D: not mappable
+	{
+		D3D11_BOX box = { 0, 0, 0, (UINT)width, (UINT)height, 1 };
+		context.ptr->UpdateSubresource(texture.p_texture, 0, &box, source, width * element_size, 0);
+		return S_OK;
+	}
 	D3D11_MAPPED_SUBRESOURCE mappedResource;
 	HRESULT hr = context.ptr->Map(texture.p_texture, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
 	if (FAILED(hr)) return hr;
@@ -391,58 +711,138 @@ HRESULT DX11W_API WriteToTexture2D(Context context, Texture2D texture, void* sou
 	return S_OK;
 }
 
+HRESULT DX11W_API ReadTexture2D(Context context, Texture2D texture, void* destination, int width, int height, int element_size)
+{
+	TRACE(ReadTexture2D, (long long)width * height * element_size);
+	if (context.id != context.ID || !Live(texture) || destination == NULL) return E_FAIL;
+
+	// A staging copy per call: the state is read back only at output steps
+	ID3D11Device* device;
+	ID3D11Texture2D* staging = NULL;
+	D3D11_TEXTURE2D_DESC desc2D;
+	texture.p_texture->GetDesc(&desc2D);
+	desc2D.BindFlags = 0;
+	desc2D.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc2D.Usage = D3D11_USAGE_STAGING;
+	desc2D.MiscFlags = 0;
+	context.ptr->GetDevice(&device);
+	HRESULT hr = device->CreateTexture2D(&desc2D, NULL, &staging);
+	device->Release();
+	if (FAILED(hr)) return hr;
+	context.ptr->CopyResource(staging, texture.p_texture);
+
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	hr = context.ptr->Map(staging, 0, D3D11_MAP_READ, 0, &mappedResource);
+	if (!FAILED(hr))
+	{
+		int pitch = width * element_size;
+		for (int i = 0; i < height; ++i)
+			memcpy((char*)destination + i * pitch, (char*)mappedResource.pData + i * mappedResource.RowPitch, pitch);
+		context.ptr->Unmap(staging, 0);
+	}
+	staging->Release();
+	return hr;
+}
+
 HRESULT DX11W_API CopyBuffer(Context context, Buffer destination, Buffer source)
 {
-	if (context.id != context.ID || destination.id != destination.ID || source.id != source.ID) return E_FAIL;
+	TRACE(CopyBuffer, 0);
+	if (context.id != context.ID || !Live(destination) || !Live(source)) return E_FAIL;
+#ifndef DX11ONE_NO_TRACE
+	D3D11_BUFFER_DESC desc;
+	source.p_buffer->GetDesc(&desc);
+	TRACE_BYTES(desc.ByteWidth);
+#endif
 	context.ptr->CopyResource(destination.p_buffer, source.p_buffer);
 	return S_OK;
 }
 
 HRESULT DX11W_API SetRBuffers(Context context, Buffer *r_buffers, int count)
 {
-	if (context.id == context.ID)
+	TRACE(SetRBuffers, 0);
+	ContextState* state = context.id == context.ID ? State(context.ptr) : NULL;
+	if (state == NULL) return E_FAIL;
+	if (count > 0)
 	{
-		if (count > 0) context.ptr->CSSetShaderResources(0, count, GetSRVs(count, r_buffers));
-		return S_OK;
+		ID3D11ShaderResourceView** views = Scratch(state->srvs, count);
+		context.ptr->CSSetShaderResources(0, count, Views(views, r_buffers, count, &Buffer::p_SRV) ? views : NULL);
 	}
-	return E_FAIL;
+	return S_OK;
 }
 HRESULT DX11W_API SetRBuffersAndTextures(Context context, Buffer *r_buffers, int r_count, Texture2D *textures, int t_count)
 {
-	if (context.id == context.ID)
+	TRACE(SetRBuffersAndTextures, 0);
+	ContextState* state = context.id == context.ID ? State(context.ptr) : NULL;
+	if (state == NULL) return E_FAIL;
+	int count = r_count + t_count;
+	if (count > 0)
 	{
-		int count = r_count + t_count;
-		if (count > 0) context.ptr->CSSetShaderResources(0, count, GetSRVs(r_count, r_buffers, t_count, textures));
-		return S_OK;
+		ID3D11ShaderResourceView** views = Scratch(state->srvs, count);
+		bool valid = Views(views, r_buffers, r_count, &Buffer::p_SRV) && Views(views + r_count, textures, t_count, &Texture2D::p_SRV);
+		context.ptr->CSSetShaderResources(0, count, valid ? views : NULL);
 	}
-	return E_FAIL;
+	return S_OK;
 }
 HRESULT DX11W_API SetCBuffers(Context context, Buffer *c_buffers, int count)
 {
-	if (context.id == context.ID)
+	TRACE(SetCBuffers, 0);
+	ContextState* state = context.id == context.ID ? State(context.ptr) : NULL;
+	if (state == NULL) return E_FAIL;
+	if (count > 0)
 	{
-		if (count > 0) context.ptr->CSSetConstantBuffers(0, count, GetCBs(count, c_buffers));
-		return S_OK;
+		ID3D11Buffer** buffers = Scratch(state->cbs, count);
+		context.ptr->CSSetConstantBuffers(0, count, Views(buffers, c_buffers, count, &Buffer::p_buffer) ? buffers : NULL);
 	}
-	return E_FAIL;
+	return S_OK;
 }
 HRESULT DX11W_API SetRWBuffers(Context context, Buffer *rw_buffers, int count)
 {
-	if (context.id == context.ID)
+	TRACE(SetRWBuffers, 0);
+	ContextState* state = context.id == context.ID ? State(context.ptr) : NULL;
+	if (state == NULL) return E_FAIL;
+	UINT init_counts = 0;
+	if (count > 0)
 	{
-		UINT init_counts = 0;
-		if (count > 0) context.ptr->CSSetUnorderedAccessViews(0, count, GetUAVs(count, rw_buffers), &init_counts);
-		return S_OK;
+		ID3D11UnorderedAccessView** views = Scratch(state->uavs, count);
+		context.ptr->CSSetUnorderedAccessViews(0, count, Views(views, rw_buffers, count, &Buffer::p_UAV) ? views : NULL, &init_counts);
 	}
-	return E_FAIL;
+	return S_OK;
+}
+HRESULT DX11W_API SetRWBuffersAndTextures(Context context, Buffer *rw_buffers, int rw_count, Texture2D *textures, int t_count)
+{
+	TRACE(SetRWBuffersAndTextures, 0);
+	ContextState* state = context.id == context.ID ? State(context.ptr) : NULL;
+	if (state == NULL) return E_FAIL;
+	UINT init_counts = 0;
+	int count = rw_count + t_count;
+	if (count > 0)
+	{
+		ID3D11UnorderedAccessView** views = Scratch(state->uavs, count);
+		bool valid = Views(views, rw_buffers, rw_count, &Buffer::p_UAV) && Views(views + rw_count, textures, t_count, &Texture2D::p_UAV);
+		context.ptr->CSSetUnorderedAccessViews(0, count, valid ? views : NULL, &init_counts);
+	}
+	return S_OK;
 }
 
 HRESULT DX11W_API DispatchShader(Context context, Shader shader, int thread_group_x, int thread_group_y, int thread_group_z)
 {
+	TRACE(DispatchShader, 0);
 	if (context.id == context.ID && shader.id == shader.ID)
 	{
 		context.ptr->CSSetShader(shader.ptr, NULL, 0);
+#ifndef DX11ONE_NO_TRACE
+		int slot = -1;
+		ContextState* state = TraceEvents() ? State(context.ptr) : NULL;
+		if (state != NULL)
+		{
+			if (state->timer == NULL) state->timer = new DispatchTimer(state->device);
+			slot = state->timer->Begin(context.ptr, trace_scope.start);
+		}
+		context.ptr->Dispatch(thread_group_x, thread_group_y, thread_group_z);
+		if (slot >= 0) state->timer->End(context.ptr, slot);
+#else
 		context.ptr->Dispatch(thread_group_x, thread_group_y, thread_group_z);
+#endif
 		return S_OK;
 	}
 	return E_FAIL;
@@ -450,7 +850,8 @@ HRESULT DX11W_API DispatchShader(Context context, Shader shader, int thread_grou
 
 HRESULT DX11W_API GetResults(Context context, Buffer staging_buffer, Buffer buffer, void *destination, int length)
 {
-	if (context.id == context.ID && staging_buffer.id == staging_buffer.ID && buffer.id == buffer.ID && destination != NULL && length > 0)
+	TRACE(GetResults, length);
+	if (context.id == context.ID && Live(staging_buffer) && Live(buffer) && destination != NULL && length > 0)
 	{
 		context.ptr->CopyResource(staging_buffer.p_buffer, buffer.p_buffer);
 		D3D11_MAPPED_SUBRESOURCE mappedResource;
@@ -462,31 +863,119 @@ HRESULT DX11W_API GetResults(Context context, Buffer staging_buffer, Buffer buff
 	return E_FAIL;
 }
 
-HRESULT DX11W_API UnbindResources(Context context)
+// Readback staging: a staging buffer and an event query per slot, the query is ended right after the copy
+class D3D11Staging : public ReadbackStaging
 {
-	if (context.id == context.ID)
+public:
+	D3D11Staging(ID3D11DeviceContext* context) : context(context), buffers(READBACK_MAX_SLOTS, NULL), queries(READBACK_MAX_SLOTS, NULL), lengths(READBACK_MAX_SLOTS, 0) { }
+	~D3D11Staging()
+	{
+		for (int i = 0; i < READBACK_MAX_SLOTS; i++)
+		{
+			if (buffers[i] != NULL) buffers[i]->Release();
+			if (queries[i] != NULL) queries[i]->Release();
+		}
+	}
+	HRESULT Reserve(int slot, int length)
+	{
+		if (buffers[slot] != NULL && lengths[slot] >= length) return S_OK;
+		if (buffers[slot] != NULL) { buffers[slot]->Release(); buffers[slot] = NULL; lengths[slot] = 0; }
+		ID3D11Device* device;
+		context->GetDevice(&device);
+		D3D11_BUFFER_DESC desc;
+		ZeroMemory(&desc, sizeof(desc));
+		desc.ByteWidth = length;
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		HRESULT hr = device->CreateBuffer(&desc, NULL, &buffers[slot]);
+		if (!FAILED(hr) && queries[slot] == NULL)
+		{
+			D3D11_QUERY_DESC query = { D3D11_QUERY_EVENT, 0 };
+			hr = device->CreateQuery(&query, &queries[slot]);
+		}
+		device->Release();
+		if (!FAILED(hr)) lengths[slot] = length;
+		return hr;
+	}
+	HRESULT Copy(int slot, Buffer source, int length)
 	{
-		UINT initCounts = 0;
-		if (SRV_count > 0) context.ptr->CSSetShaderResources(0, SRV_count, GetSRVs(SRV_count, NULL));
-		// After a dispatch, if using CS 4.x hardware, be sure to unbind it, since only a single UAV can be bound to a pipeline. (Set to NULL to unbind)
-		if (UAV_count > 0) context.ptr->CSSetUnorderedAccessViews(0, UAV_count, GetUAVs(UAV_count, NULL), &initCounts);
-		if (CB_count > 0) context.ptr->CSSetConstantBuffers(0, CB_count, GetCBs(CB_count, NULL));
+		if (!Live(source)) return E_FAIL;
+		D3D11_BUFFER_DESC desc;
+		source.p_buffer->GetDesc(&desc);
+		if ((UINT)length > desc.ByteWidth) return E_INVALIDARG;
+		D3D11_BOX box = { 0, 0, 0, (UINT)length, 1, 1 };
+		context->CopySubresourceRegion(buffers[slot], 0, 0, 0, 0, source.p_buffer, 0, &box);
+		context->End(queries[slot]);
 		return S_OK;
 	}
-	return E_FAIL;
+	HRESULT Poll(int slot) { return context->GetData(queries[slot], NULL, 0, 0); } // flushes the commands, S_FALSE while in flight
+	HRESULT Read(int slot, void* destination, int length)
+	{
+		D3D11_MAPPED_SUBRESOURCE mappedResource;
+		HRESULT hr = context->Map(buffers[slot], 0, D3D11_MAP_READ, 0, &mappedResource);
+		if (FAILED(hr)) return hr;
+		memcpy(destination, mappedResource.pData, length);
+		context->Unmap(buffers[slot], 0);
+		return S_OK;
+	}
+
+private:
+	ID3D11DeviceContext* context;
+	std::vector<ID3D11Buffer*> buffers;
+	std::vector<ID3D11Query*> queries;
+	std::vector<int> lengths;
+};
+
+HRESULT DX11W_API BeginReadback(Context context, Buffer buffer, int length, int* readback)
+{
+	TRACE(BeginReadback, length);
+	ContextState* state = context.id == context.ID ? State(context.ptr) : NULL;
+	if (state == NULL) return E_FAIL;
+	if (state->readback == NULL) state->readback = new ReadbackRing(new D3D11Staging(context.ptr));
+	return state->readback->Begin(buffer, length, readback);
+}
+HRESULT DX11W_API TryEndReadback(Context context, int readback, void* destination, int length)
+{
+	TRACE(TryEndReadback, length);
+	ContextState* state = context.id == context.ID ? State(context.ptr) : NULL;
+	if (state == NULL || state->readback == NULL) return E_FAIL;
+	return state->readback->TryEnd(readback, destination, length);
+}
+HRESULT DX11W_API WaitReadback(Context context, int readback, void* destination, int length)
+{
+	TRACE(WaitReadback, length);
+	ContextState* state = context.id == context.ID ? State(context.ptr) : NULL;
+	if (state == NULL || state->readback == NULL) return E_FAIL;
+	return state->readback->Wait(readback, destination, length);
+}
+
+HRESULT DX11W_API UnbindResources(Context context)
+{
+	TRACE(UnbindResources, 0);
+	ContextState* state = context.id == context.ID ? State(context.ptr) : NULL;
+	if (state == NULL) return E_FAIL;
+	UINT initCounts = 0;
+	std::fill(state->srvs.begin(), state->srvs.end(), (ID3D11ShaderResourceView*)NULL);
+	std::fill(state->uavs.begin(), state->uavs.end(), (ID3D11UnorderedAccessView*)NULL);
+	std::fill(state->cbs.begin(), state->cbs.end(), (ID3D11Buffer*)NULL);
+	if (!state->srvs.empty()) context.ptr->CSSetShaderResources(0, (UINT)state->srvs.size(), &state->srvs[0]);
+	// After a dispatch, if using CS 4.x hardware, be sure to unbind it, since only a single UAV can be bound to a pipeline. (Set to NULL to unbind)
+	if (!state->uavs.empty()) context.ptr->CSSetUnorderedAccessViews(0, (UINT)state->uavs.size(), &state->uavs[0], &initCounts);
+	if (!state->cbs.empty()) context.ptr->CSSetConstantBuffers(0, (UINT)state->cbs.size(), &state->cbs[0]);
+	return S_OK;
 }
 
 HRESULT DX11W_API ReleaseBuffer(Buffer b)
 {
-	if (b.p_SRV != NULL) b.p_SRV->Release();
-	if (b.p_UAV != NULL) b.p_UAV->Release();
-	if (b.p_buffer != NULL) b.p_buffer->Release();
-	b.p_SRV = NULL; b.p_UAV = NULL; b.p_buffer = NULL; b.id = -1;
+	TRACE(ReleaseBuffer, 0);
+	if (b.id == b.ID && b.p_buffer != NULL && !Live(b)) return E_FAIL; // a copy of a handle released before
+	if (!Recycle(b)) FreeBuffer(b);
 	return S_OK;
 }
 
 HRESULT DX11W_API ReleaseShader(Shader s)
 {
+	TRACE(ReleaseShader, 0);
 	if (s.blob != NULL) s.blob->Release();
 	if (s.ptr != NULL) s.ptr->Release();
 	s.blob = NULL; s.ptr = NULL; s.id = -1;
@@ -495,24 +984,51 @@ HRESULT DX11W_API ReleaseShader(Shader s)
 
 HRESULT DX11W_API ReleaseTexture(Texture2D t)
 {
-	if (t.p_texture != NULL) t.p_texture->Release();
-	if (t.p_UAV != NULL) t.p_UAV->Release();
-	if (t.p_SRV != NULL) t.p_SRV->Release();
-	t.p_texture = NULL; t.p_UAV = NULL; t.p_SRV = NULL; t.id = -1;
+	TRACE(ReleaseTexture, 0);
+	if (t.id == t.ID && t.p_texture != NULL && !Live(t)) return E_FAIL;
+	if (!Recycle(t)) FreeTexture(t);
 	return S_OK;
 }
 
 HRESULT DX11W_API Dispose()
 {
-	if (SRV_count > 0) free(SRVs); SRVs = NULL; SRV_count = -1;
-	if (UAV_count > 0) free(UAVs); UAVs = NULL; UAV_count = -1;
-	if (CB_count > 0) free(CBs); CBs = NULL; CB_count = -1;
-	if (_context != NULL) _context->Release();
-	if (_device != NULL) _device->Release();
+	TRACE(Dispose, 0);
+	FreePooled(NULL);
+	std::lock_guard<std::mutex> guard(states_lock);
+	for (std::map<ID3D11DeviceContext*, ContextState*>::iterator i = states.begin(); i != states.end(); ++i)
+	{
+		ID3D11Device* device = i->second->device;
+		delete i->second;
+		i->first->Release();
+		device->Release();
+	}
+	states.clear();
+	return S_OK;
+}
+
+HRESULT DX11W_API SetResourcePool(long long idle_bytes)
+{
+	TRACE(SetResourcePool, 0);
+	std::vector<Buffer> buffers;
+	std::vector<Texture2D> textures;
+	buffer_pool.SetBudget(idle_bytes, &buffers);
+	texture_pool.SetBudget(idle_bytes, &textures);
+	for (size_t k = 0; k < buffers.size(); k++) FreeBuffer(buffers[k]);
+	for (size_t k = 0; k < textures.size(); k++) FreeTexture(textures[k]);
+	return S_OK;
+}
+
+HRESULT DX11W_API GetResourcePoolStats(ResourcePoolStats* stats)
+{
+	TRACE(GetResourcePoolStats, 0);
+	if (stats == NULL) return E_INVALIDARG;
+	memset(stats, 0, sizeof(*stats));
+	buffer_pool.AddStats(stats);
+	texture_pool.AddStats(stats);
 	return S_OK;
 }
 
-const char* error_text[12] = {
+static const char* error_text[13] = {
 	"Unknown error code.",
 	"D3D11_ERROR_FILE_NOT_FOUND - The file was not found.",
 	"D3D11_ERROR_TOO_MANY_UNIQUE_STATE_OBJECTS - There are too many unique instances of a particular type of state object.",
@@ -524,7 +1040,8 @@ const char* error_text[12] = {
 	"E_INVALIDARG - An invalid parameter was passed to the returning function.",
 	"E_OUTOFMEMORY - Could not allocate sufficient memory to complete the call.",
 	"S_FALSE - Alternate success value, indicating a successful but nonstandard completion (the precise meaning depends on context).",
-	"S_OK - No error occurred."
+	"S_OK - No error occurred.",
+	"E_PENDING - The data necessary to complete this operation is not yet available."
 };
 void DX11W_API DecodeError(HRESULT hr, const char **output)
 {
@@ -552,6 +1069,9 @@ void DX11W_API DecodeError(HRESULT hr, const char **output)
 			*output = error_text[10]; break;
 		case S_OK:
 			*output = error_text[11]; break;
+		case E_PENDING:
+			*output = error_text[12]; break;
 		default: *output = error_text[0]; break;
 	}
 }
+#endif
@@ -2,6 +2,15 @@
 #define _ONE_H_
 
 #include <stdio.h>
+
+// Without D3D11 (Linux batch nodes) the same exported functions are implemented by the host backend (Host.h):
+// g++ -std=c++11 -O3 -fPIC -shared -o libDX11One.so One.cpp Host.cpp HostKernels.cpp Readback.cpp ShaderCache.cpp ThreadPool.cpp Trace.cpp -lpthread
+// The tests in Tests/ run on it, each file starts with the line that builds and runs it.
+#if !defined(_WIN32) && !defined(DX11ONE_HOST)
+#define DX11ONE_HOST
+#endif
+
+#ifndef DX11ONE_HOST
 #include <d3dx11.h>
 #include <d3dCompiler.h>
 #include <D3DX10Math.h>
@@ -11,14 +20,32 @@
 struct Device { static long ID; long id; ID3D11Device* ptr; Device() { id = Device::ID; ptr = NULL; } };
 struct Context { static long ID; long id; ID3D11DeviceContext* ptr; Context() { id = Context::ID; ptr = NULL; } };
 struct Shader { static long ID; long id; ID3D10Blob* blob; ID3D11ComputeShader* ptr; Shader() { id = Shader::ID; blob = NULL; ptr = NULL; } };
-struct Buffer { static long ID; long id; ID3D11Buffer *p_buffer; ID3D11UnorderedAccessView *p_UAV; ID3D11ShaderResourceView *p_SRV; Buffer() { id = Buffer::ID; p_buffer = NULL; p_UAV = NULL; p_SRV = NULL; } };
-struct Texture2D { static long ID; long id; ID3D11Texture2D *p_texture; ID3D11UnorderedAccessView *p_UAV; ID3D11ShaderResourceView *p_SRV; Texture2D() { id = Texture2D::ID; p_texture = NULL; p_UAV = NULL; p_SRV = NULL; } };
+struct Buffer { static long ID; long id, serial; ID3D11Buffer *p_buffer; ID3D11UnorderedAccessView *p_UAV; ID3D11ShaderResourceView *p_SRV; Buffer() { id = Buffer::ID; serial = 0; p_buffer = NULL; p_UAV = NULL; p_SRV = NULL; } };
+struct Texture2D { static long ID; long id, serial; ID3D11Texture2D *p_texture; ID3D11UnorderedAccessView *p_UAV; ID3D11ShaderResourceView *p_SRV; Texture2D() { id = Texture2D::ID; serial = 0; p_texture = NULL; p_UAV = NULL; p_SRV = NULL; } };
 
 #define DX11W_API __declspec(dllexport) _stdcall
+#else
+#include "Host.h"
+#endif
+
+#include "Trace.h"
+#include "ShaderCache.h"
+#include "ResourcePool.h"
+
 // External functions:
 extern "C" HRESULT DX11W_API CreateDevice(D3D_DRIVER_TYPE driver_type, D3D_FEATURE_LEVEL level_wanted, Device* device, Context* context);
+// Name of the adapter and its PCI vendor:device ids (the host backend: "Host x<threads>"), a key of the tuning database
+extern "C" HRESULT DX11W_API GetDeviceName(Device device, char* name, int length);
 extern "C" HRESULT DX11W_API CreateAndCompileShader(Device device, LPCSTR filename, LPCSTR entry_point, LPCSTR shader_profile, unsigned int flags, Shader* shader);
+// *errors: the messages of the compiler, valid until the next compile on the calling thread
 extern "C" HRESULT DX11W_API CompileShader(Device device, LPCSTR shader_source, int shader_length, LPCSTR entry_point, LPCSTR shader_profile, unsigned int flags, Shader* shader, const char **errors);
+// CompileShader through the cache of bytecode (ShaderCache.h): the compiler runs only for sources it has not seen
+extern "C" HRESULT DX11W_API LoadOrCompileShader(Device device, LPCSTR shader_source, int shader_length, LPCSTR entry_point, LPCSTR shader_profile, unsigned int flags, Shader* shader, const char **errors);
+// The directory of the store (NULL or "": memory only) and the bytes kept in memory
+extern "C" HRESULT DX11W_API SetShaderCache(const char* directory, long long memory_capacity);
+// The compiler of the cache and its version, a part of the keys; NULL: the compiler of the backend
+extern "C" HRESULT DX11W_API SetShaderCompiler(ShaderCompiler compiler, const char* version);
+extern "C" HRESULT DX11W_API GetShaderCacheStats(ShaderCacheStats* stats);
 
 extern "C" HRESULT DX11W_API CreateRWBuffer(Device device, int element_size, int element_count, void *init_data, Buffer* buffer);
 extern "C" HRESULT DX11W_API CreateRBuffer(Device device, int element_size, int element_count, void *init_data, Buffer* buffer);
@@ -26,26 +53,48 @@ extern "C" HRESULT DX11W_API CreateInputBuffer(Device device, int element_size,
 extern "C" HRESULT DX11W_API CreateStagingBuffer(Device device, int element_size, int element_count, Buffer* buffer);
 extern "C" HRESULT DX11W_API CreateConstantBuffer(Device device, int length, Buffer* buffer);
 extern "C" HRESULT DX11W_API CreateInputTexture2D(Device device, int width, int height, DXGI_FORMAT format, void *init_data, Texture2D* t);
+// Device-resident texture: readable (SRV) and writable (UAV) by shaders, WriteToTexture2D and ReadTexture2D copy it
+extern "C" HRESULT DX11W_API CreateRWTexture2D(Device device, int width, int height, DXGI_FORMAT format, void *init_data, Texture2D* t);
 
 extern "C" HRESULT DX11W_API WriteToBuffer(Context context, Buffer destination, void* source, int length);
 extern "C" HRESULT DX11W_API WriteToTexture2D(Context context, Texture2D texture, void* source, int width, int height, int element_size);
 extern "C" HRESULT DX11W_API CopyBuffer(Context context, Buffer destination, Buffer source);
 extern "C" HRESULT DX11W_API GetResults(Context context, Buffer staging_buffer, Buffer buffer, void *destination, int length);
+extern "C" HRESULT DX11W_API ReadTexture2D(Context context, Texture2D texture, void* destination, int width, int height, int element_size);
+// Asynchronous readback through a ring of staging buffers (Readback.h): BeginReadback queues the copy of the first length
+// bytes and returns a handle, TryEndReadback returns S_FALSE while it is in flight, WaitReadback blocks
+extern "C" HRESULT DX11W_API BeginReadback(Context context, Buffer buffer, int length, int* readback);
+extern "C" HRESULT DX11W_API TryEndReadback(Context context, int readback, void* destination, int length);
+extern "C" HRESULT DX11W_API WaitReadback(Context context, int readback, void* destination, int length);
 
 extern "C" HRESULT DX11W_API SetRBuffers(Context context, Buffer *r_buffers, int count);
 extern "C" HRESULT DX11W_API SetRBuffersAndTextures(Context context, Buffer *r_buffers, int r_count, Texture2D *textures, int t_count);
 extern "C" HRESULT DX11W_API SetCBuffers(Context context, Buffer *c_buffers, int count);
 extern "C" HRESULT DX11W_API SetRWBuffers(Context context, Buffer *rw_buffers, int count);
+extern "C" HRESULT DX11W_API SetRWBuffersAndTextures(Context context, Buffer *rw_buffers, int rw_count, Texture2D *textures, int t_count);
 extern "C" HRESULT DX11W_API DispatchShader(Context context, Shader shader, int thread_group_x, int thread_group_y, int thread_group_z);
 extern "C" HRESULT DX11W_API UnbindResources(Context context);
 
 extern "C" HRESULT DX11W_API ReleaseBuffer(Buffer b);
 extern "C" HRESULT DX11W_API ReleaseShader(Shader b);
 extern "C" HRESULT DX11W_API ReleaseTexture(Texture2D t);
+// Frees every device and context of CreateDevice and the idle resources of the pools
 extern "C" HRESULT DX11W_API Dispose();
+// Released buffers and textures are kept for reuse (ResourcePool.h) up to idle_bytes per pool, 0 frees them at once
+extern "C" HRESULT DX11W_API SetResourcePool(long long idle_bytes);
+extern "C" HRESULT DX11W_API GetResourcePoolStats(ResourcePoolStats* stats);
 
 extern "C" void DX11W_API DecodeError(HRESULT hr, const char **output);
 
+// Instrumentation (Trace.h): the counters of min(count, CALL_COUNT) functions in TraceCall order, S_FALSE if count > CALL_COUNT
+extern "C" HRESULT DX11W_API GetStats(CallStats* stats, int count);
+extern "C" HRESULT DX11W_API GetCallName(int call, const char **name);
+extern "C" HRESULT DX11W_API ResetStats();
+// Keeps the last capacity calls for WriteTrace, 0 stops recording them (the counters keep running)
+extern "C" HRESULT DX11W_API SetTraceEvents(int capacity);
+// Chrome trace event JSON of the recorded calls
+extern "C" HRESULT DX11W_API WriteTrace(const char* filename);
+
 // CPU/GPU communication:
 
 // gD3DContext->CopyResource() copies between two resources.
@@ -0,0 +1,65 @@
+#include "stdafx.h"
+#ifndef _WIN32
+#include <sched.h>
+#define Sleep(ms) sched_yield()
+#endif
+
+// Handles are serial * READBACK_MAX_SLOTS + slot, so a handle of an ended readback does not match a reused slot
+
+ReadbackRing::ReadbackRing(ReadbackStaging* staging, int slots) : staging(staging), next(0), serial(0)
+{
+	Slot free = { 0, 0 };
+	this->slots.assign(slots < 1 ? 1 : slots > READBACK_MAX_SLOTS ? READBACK_MAX_SLOTS : slots, free);
+}
+
+int ReadbackRing::InFlight() const
+{
+	int count = 0;
+	for (size_t i = 0; i < slots.size(); i++) if (slots[i].serial != 0) count++;
+	return count;
+}
+
+int ReadbackRing::Find(int readback) const
+{
+	int slot = readback % READBACK_MAX_SLOTS, s = readback / READBACK_MAX_SLOTS;
+	if (readback <= 0 || slot >= (int)slots.size() || slots[slot].serial != s) return -1;
+	return slot;
+}
+
+HRESULT ReadbackRing::Begin(Buffer source, int length, int* readback)
+{
+	if (readback == NULL) return E_FAIL;
+	*readback = 0;
+	if (length <= 0) return E_INVALIDARG;
+	int n = (int)slots.size(), slot = -1;
+	for (int i = 0; i < n && slot < 0; i++) // oldest free slot first, so the staging memory is used round-robin
+		if (slots[(next + i) % n].serial == 0) slot = (next + i) % n;
+	if (slot < 0) return E_PENDING;
+
+	HRESULT hr = staging->Reserve(slot, length);
+	if (!FAILED(hr)) hr = staging->Copy(slot, source, length);
+	if (FAILED(hr)) return hr;
+	if (++serial >= 0x7fffffff / READBACK_MAX_SLOTS) serial = 1;
+	slots[slot].serial = serial; slots[slot].length = length;
+	next = (slot + 1) % n;
+	*readback = serial * READBACK_MAX_SLOTS + slot;
+	return S_OK;
+}
+
+HRESULT ReadbackRing::TryEnd(int readback, void* destination, int length)
+{
+	int slot = Find(readback);
+	if (slot < 0 || destination == NULL || length <= 0 || length > slots[slot].length) return E_INVALIDARG;
+	HRESULT hr = staging->Poll(slot);
+	if (hr != S_OK) return hr;
+	hr = staging->Read(slot, destination, length);
+	slots[slot].serial = 0; // a failed read ends the readback too, the data would not come later
+	return hr;
+}
+
+HRESULT ReadbackRing::Wait(int readback, void* destination, int length)
+{
+	HRESULT hr;
+	while ((hr = TryEnd(readback, destination, length)) == S_FALSE) Sleep(0);
+	return hr;
+}
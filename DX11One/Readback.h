@@ -0,0 +1,44 @@
+#ifndef _READBACK_H_
+#define _READBACK_H_
+
+#include <vector>
+
+// Asynchronous readback of buffers for BeginReadback/TryEndReadback/WaitReadback. BeginReadback starts a copy into a
+// free slot of a ring of staging memory and returns a handle; TryEndReadback gives S_FALSE while the copy is in flight
+// and copies the data out and frees the slot when it is done, WaitReadback waits for it. The slots and handles are
+// managed here, the copies and their completion are behind ReadbackStaging: staging buffers and event queries of
+// D3D11 (One.cpp) or host memory (Host.cpp).
+class ReadbackStaging
+{
+public:
+	virtual ~ReadbackStaging() { }
+	virtual HRESULT Reserve(int slot, int length) = 0; // staging memory of the slot for length bytes, slot is free
+	virtual HRESULT Copy(int slot, Buffer source, int length) = 0; // starts the copy of the first length bytes
+	virtual HRESULT Poll(int slot) = 0; // S_OK: copied, S_FALSE: in flight
+	virtual HRESULT Read(int slot, void* destination, int length) = 0; // after Poll has returned S_OK
+};
+
+#define READBACK_SLOTS 3 // a step in flight, one being read and a spare one
+#define READBACK_MAX_SLOTS 16
+
+class ReadbackRing
+{
+public:
+	ReadbackRing(ReadbackStaging* staging, int slots = READBACK_SLOTS); // takes the ownership of staging
+	~ReadbackRing() { delete staging; }
+
+	HRESULT Begin(Buffer source, int length, int* readback); // E_PENDING: every slot is in flight, end one first
+	HRESULT TryEnd(int readback, void* destination, int length); // S_FALSE: in flight, E_INVALIDARG: unknown handle
+	HRESULT Wait(int readback, void* destination, int length);
+	int InFlight() const;
+
+private:
+	struct Slot { int serial, length; }; // serial 0: free
+	int Find(int readback) const; // slot of a handle in flight or -1
+
+	ReadbackStaging* staging;
+	std::vector<Slot> slots;
+	int next, serial;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef _RESOURCE_POOL_H_
+#define _RESOURCE_POOL_H_
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Released buffers and textures kept for the next Create* of the same kind: ReleaseBuffer and ReleaseTexture give the
+// resource and its views to the pool of their device, a Create* with the same key takes them back instead of creating
+// new ones and only writes the initial data (zeros without it, as a new resource). ForceDX11_IBC.Init releases and
+// creates the same set of buffers for every tiling trial and every run, so after the first one Init allocates nothing.
+// The key is everything that makes two resources interchangeable: the device, dimension, usage, bind and CPU access
+// flags, the exact size (CopyResource needs equal sizes and the views cover the whole resource) and the views made.
+// The idle resources of a pool are limited to a budget of bytes, past it a release frees the resource.
+// A handle is a copy held by the caller, so the one released stays with it: the pool keeps the serial of every resource
+// it has held, a take gives the resource a new one (in the handle) and a release retires it. Live fails the copies of
+// a handle once it is released, before and after the resource has a new owner; a resource never pooled has serial 0.
+#define RESOURCE_POOL_BYTES (256LL << 20)
+
+struct PoolKey
+{
+	const void* device;
+	int dimension, usage, bind, access, width, height, format, views; // buffers: width in bytes, format the stride
+	bool operator<(const PoolKey& k) const
+	{
+		if (device != k.device) return device < k.device;
+		const int *a = &dimension, *b = &k.dimension;
+		for (int i = 0; i < 8; i++) if (a[i] != b[i]) return a[i] < b[i];
+		return false;
+	}
+};
+
+// Counters of both pools, the same layout as ResourcePoolStats in DirectCompute.cs
+struct ResourcePoolStats { long long hits, misses, idle_bytes, idle_resources; };
+
+template <class Handle> class ResourcePool
+{
+public:
+	ResourcePool() : budget(RESOURCE_POOL_BYTES), idle(0), count(0), hits(0), misses(0), last_serial(0) { }
+
+	void SetBudget(long long bytes, std::vector<Handle>* evicted) // evicted: to be freed by the caller
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		budget = bytes < 0 ? 0 : bytes;
+		for (typename Idle::iterator i = free.begin(); i != free.end() && idle > budget; ++i)
+			while (!i->second.empty() && idle > budget) { evicted->push_back(i->second.back().handle); Remove(i->second, true); }
+	}
+	bool Take(const PoolKey& key, Handle* handle)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		typename Idle::iterator i = free.find(key);
+		if (i == free.end() || i->second.empty()) { misses++; return false; }
+		*handle = i->second.back().handle;
+		const void* resource = i->second.back().resource;
+		Remove(i->second, false);
+		last_serial = last_serial == 0x7fffffff ? 1 : last_serial + 1;
+		handle->serial = serials[resource] = last_serial;
+		hits++;
+		return true;
+	}
+	// false: over the budget, the caller frees the resource; a handle that is not Live is left alone (true)
+	bool Give(const PoolKey& key, long long bytes, const Handle& handle, const void* resource)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!Current(resource, handle.serial)) return true; // released twice, or a copy of a handle released before
+		if (idle + bytes > budget) { serials.erase(resource); return false; }
+		Entry e = { handle, resource, bytes };
+		free[key].push_back(e);
+		serials[resource] = -1; // idle: no handle matches
+		idle += bytes; count++;
+		return true;
+	}
+	// A resource freed by the caller without Give, its address may come back as a new resource (serial 0)
+	void Forget(const void* resource)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		serials.erase(resource);
+	}
+	// The handle with this serial is the owner of the resource
+	bool Live(const void* resource, int serial)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return Current(resource, serial);
+	}
+	void Drain(const void* device, std::vector<Handle>* drained) // device NULL: all of them
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (typename Idle::iterator i = free.begin(); i != free.end(); ++i)
+			if (device == NULL || i->first.device == device)
+				while (!i->second.empty()) { drained->push_back(i->second.back().handle); Remove(i->second, true); }
+	}
+	void AddStats(ResourcePoolStats* stats)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stats->hits += hits; stats->misses += misses; stats->idle_bytes += idle; stats->idle_resources += count;
+	}
+
+private:
+	struct Entry { Handle handle; const void* resource; long long bytes; };
+	typedef std::map<PoolKey, std::vector<Entry> > Idle;
+	void Remove(std::vector<Entry>& entries, bool freed) // freed: the caller frees the resource
+	{
+		if (freed) serials.erase(entries.back().resource);
+		idle -= entries.back().bytes; count--; entries.pop_back();
+	}
+	bool Current(const void* resource, int serial) const
+	{
+		std::map<const void*, int>::const_iterator i = serials.find(resource);
+		return (i == serials.end() ? 0 : i->second) == serial;
+	}
+
+	std::mutex lock;
+	Idle free;
+	std::map<const void*, int> serials; // of the resources taken from the pool or idle in it
+	long long budget, idle, count, hits, misses;
+	int last_serial;
+};
+
+#endif
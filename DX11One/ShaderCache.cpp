@@ -0,0 +1,228 @@
+#include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Header of a file of the store, followed by length bytes of bytecode
+struct StoreHeader { char magic[4]; unsigned int format; unsigned long long length, checksum; };
+static const char store_magic[4] = { 'D', 'X', 'S', 'C' };
+#define STORE_FORMAT 1
+
+// Two 64-bit hashes of the bytes: FNV-1a and a multiply-rotate one, independent enough for a 128-bit key
+struct Hasher
+{
+	unsigned long long a, b;
+	Hasher() : a(0xcbf29ce484222325ULL), b(0x9e3779b97f4a7c15ULL) { }
+	void Add(const void* data, size_t length)
+	{
+		const unsigned char* p = (const unsigned char*)data;
+		for (size_t i = 0; i < length; i++)
+		{
+			a = (a ^ p[i]) * 0x100000001b3ULL;
+			b = (b ^ p[i]) * 0xff51afd7ed558ccdULL; b ^= b >> 29;
+		}
+	}
+	void Add(const char* s) // with its length, so that the fields cannot run into each other
+	{
+		unsigned long long length = s == NULL ? 0 : strlen(s);
+		Add(&length, sizeof(length));
+		Add(s, (size_t)length);
+	}
+};
+
+static unsigned long long Checksum(const std::string& bytes)
+{
+	Hasher h;
+	h.Add(bytes.data(), bytes.size());
+	return h.a ^ h.b;
+}
+
+ShaderCache::ShaderCache(ShaderCompiler compiler, const char* version) : compiler(compiler), version(version), capacity(SHADER_CACHE_MEMORY), used(0)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void ShaderCache::SetStore(const char* directory, long long memory_capacity)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	this->directory = directory == NULL ? std::string() : directory;
+	while (!this->directory.empty() && (this->directory.back() == '/' || this->directory.back() == '\\')) this->directory.pop_back();
+	if (!this->directory.empty())
+	{
+#ifdef _WIN32
+		_mkdir(this->directory.c_str()); // one level, an existing directory is fine
+#else
+		mkdir(this->directory.c_str(), 0777);
+#endif
+	}
+	capacity = memory_capacity < 0 ? 0 : memory_capacity;
+	while (used > capacity) { used -= entries.back().second.size(); index.erase(entries.back().first); entries.pop_back(); }
+}
+
+void ShaderCache::SetCompiler(ShaderCompiler compiler, const char* version)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	this->compiler = compiler;
+	this->version = version == NULL ? std::string() : version;
+}
+
+ShaderCacheStats ShaderCache::Stats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return stats;
+}
+
+ShaderCache::Key ShaderCache::Hash(const char* source, int length, const char* entry_point, const char* profile, unsigned int flags) const
+{
+	Hasher h;
+	unsigned long long n = length;
+	h.Add(&n, sizeof(n));
+	h.Add(source, (size_t)length);
+	h.Add(entry_point);
+	h.Add(profile);
+	h.Add(&flags, sizeof(flags));
+	h.Add(version.c_str());
+	Key key = { { h.a, h.b } };
+	return key;
+}
+
+std::string ShaderCache::Path(const Key& key) const
+{
+	char name[40];
+	snprintf(name, sizeof(name), "%016llx%016llx.cso", key.h[0], key.h[1]);
+	return directory + "/" + name;
+}
+
+bool ShaderCache::Load(const Key& key, std::string* bytecode) const
+{
+	FILE* f = fopen(Path(key).c_str(), "rb");
+	if (f == NULL) return false;
+	StoreHeader header;
+	bool ok = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, store_magic, 4) == 0 && header.format == STORE_FORMAT
+		&& header.length > 0 && header.length < (1ULL << 30);
+	if (ok)
+	{
+		bytecode->resize((size_t)header.length);
+		ok = fread(&(*bytecode)[0], 1, bytecode->size(), f) == bytecode->size() && Checksum(*bytecode) == header.checksum;
+	}
+	fclose(f);
+	return ok;
+}
+
+bool ShaderCache::Store(const Key& key, const std::string& bytecode) const
+{
+	static std::atomic<unsigned int> serial(0);
+	std::string path = Path(key);
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%d.%u.%u.tmp", (int)getpid(), (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id()), serial++);
+	std::string temporary = path + suffix;
+
+	FILE* f = fopen(temporary.c_str(), "wb");
+	if (f == NULL) return false;
+	StoreHeader header;
+	memcpy(header.magic, store_magic, 4);
+	header.format = STORE_FORMAT;
+	header.length = bytecode.size();
+	header.checksum = Checksum(bytecode);
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(bytecode.data(), 1, bytecode.size(), f) == bytecode.size();
+	ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+	ok = ok && MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	ok = ok && rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+	if (!ok) remove(temporary.c_str());
+	return ok;
+}
+
+void ShaderCache::Insert(const Key& key, const std::string& bytecode)
+{
+	if ((long long)bytecode.size() > capacity || index.count(key) > 0) return;
+	entries.push_front(std::make_pair(key, bytecode));
+	index[key] = entries.begin();
+	used += bytecode.size();
+	while (used > capacity) { used -= entries.back().second.size(); index.erase(entries.back().first); entries.pop_back(); }
+}
+
+HRESULT ShaderCache::Get(const char* source, int length, const char* entry_point, const char* profile, unsigned int flags, std::string* bytecode, std::string* errors)
+{
+	if (source == NULL || length < 0 || entry_point == NULL || bytecode == NULL) return E_INVALIDARG;
+	if (errors != NULL) errors->clear();
+	ShaderCompiler compile;
+	std::string directory;
+	Key key;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		key = Hash(source, length, entry_point, profile, flags);
+		std::map<Key, Entries::iterator>::iterator i = index.find(key);
+		if (i != index.end())
+		{
+			entries.splice(entries.begin(), entries, i->second);
+			*bytecode = entries.front().second;
+			stats.memory_hits++;
+			return S_OK;
+		}
+		compile = compiler;
+		directory = this->directory;
+	}
+
+	// The store and the compiler run outside the lock: other threads keep hitting the memory meanwhile
+	bool loaded = !directory.empty() && Load(key, bytecode);
+	bool stored = false;
+	if (!loaded)
+	{
+		if (compile == NULL) return E_FAIL;
+		const void* code = NULL; int code_length = 0; const char* messages = NULL;
+		HRESULT hr = compile(source, length, entry_point, profile, flags, &code, &code_length, &messages);
+		if (errors != NULL && messages != NULL) *errors = messages;
+		if (FAILED(hr)) return hr;
+		if (code == NULL || code_length <= 0) return E_FAIL;
+		bytecode->assign((const char*)code, code_length);
+		stored = !directory.empty() && Store(key, *bytecode);
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (loaded) stats.disk_hits++; else stats.compiles++;
+	if (stored) stats.disk_writes++;
+	Insert(key, *bytecode);
+	return S_OK;
+}
+
+ShaderCache& TheShaderCache()
+{
+	static const char* version = "";
+	static ShaderCompiler compiler = DefaultShaderCompiler(&version);
+	static ShaderCache cache(compiler, version);
+	return cache;
+}
+
+HRESULT DX11W_API SetShaderCache(const char* directory, long long memory_capacity)
+{
+	TRACE(SetShaderCache, 0);
+	TheShaderCache().SetStore(directory, memory_capacity);
+	return S_OK;
+}
+
+HRESULT DX11W_API SetShaderCompiler(ShaderCompiler compiler, const char* version)
+{
+	TRACE(SetShaderCompiler, 0);
+	if (compiler == NULL) compiler = DefaultShaderCompiler(&version); // back to the compiler of the backend
+	TheShaderCache().SetCompiler(compiler, version);
+	return S_OK;
+}
+
+HRESULT DX11W_API GetShaderCacheStats(ShaderCacheStats* stats)
+{
+	TRACE(GetShaderCacheStats, 0);
+	if (stats == NULL) return E_INVALIDARG;
+	*stats = TheShaderCache().Stats();
+	return S_OK;
+}
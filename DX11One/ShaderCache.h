@@ -0,0 +1,62 @@
+#ifndef _SHADER_CACHE_H_
+#define _SHADER_CACHE_H_
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Compiled shaders by content for LoadOrCompileShader: the key is a 128-bit hash of the source (with the #define lines
+// the managed side prepends), entry point, profile, flags and the version of the compiler, the value the bytecode.
+// A lookup tries a LRU in memory, then the directory of the store (a file <key>.cso per shader), and calls the
+// compiler only when both miss; the bytecode then goes to both. Files are written to a temporary name and renamed,
+// so a reader sees a whole file or none, and carry a checksum of the bytecode: a damaged file is a miss.
+// The compiler is pluggable (SetShaderCompiler): D3DCompile (One.cpp), the lookup of the native kernel (Host.cpp) or a
+// stub of a test. Its outputs only need to stay valid until its next call on the same thread.
+#ifdef _WIN32
+#define DX11W_CALLBACK __stdcall
+#else
+#define DX11W_CALLBACK
+#endif
+typedef HRESULT (DX11W_CALLBACK *ShaderCompiler)(const char* source, int length, const char* entry_point, const char* profile, unsigned int flags,
+	const void** bytecode, int* bytecode_length, const char** errors);
+
+#define SHADER_CACHE_MEMORY (64 << 20) // bytes of bytecode kept in memory by default
+
+// Counters of the lookups, the same layout as ShaderCacheStats in DirectCompute.cs
+struct ShaderCacheStats { long long memory_hits, disk_hits, compiles, disk_writes; };
+
+class ShaderCache
+{
+public:
+	ShaderCache(ShaderCompiler compiler, const char* version);
+
+	void SetStore(const char* directory, long long memory_capacity); // directory NULL or "": memory only
+	void SetCompiler(ShaderCompiler compiler, const char* version);
+	ShaderCacheStats Stats();
+	// The bytecode of the shader; errors of the compiler if it fails
+	HRESULT Get(const char* source, int length, const char* entry_point, const char* profile, unsigned int flags, std::string* bytecode, std::string* errors);
+
+private:
+	struct Key { unsigned long long h[2]; bool operator<(const Key& k) const { return h[0] != k.h[0] ? h[0] < k.h[0] : h[1] < k.h[1]; } };
+	typedef std::list<std::pair<Key, std::string> > Entries; // the most recently used first
+
+	Key Hash(const char* source, int length, const char* entry_point, const char* profile, unsigned int flags) const;
+	std::string Path(const Key& key) const;
+	bool Load(const Key& key, std::string* bytecode) const;
+	bool Store(const Key& key, const std::string& bytecode) const;
+	void Insert(const Key& key, const std::string& bytecode); // in the LRU, under the lock
+
+	std::mutex lock;
+	ShaderCompiler compiler;
+	std::string version, directory;
+	long long capacity, used;
+	Entries entries;
+	std::map<Key, Entries::iterator> index;
+	ShaderCacheStats stats;
+};
+
+ShaderCache& TheShaderCache(); // of the backend, with its default compiler
+ShaderCompiler DefaultShaderCompiler(const char** version); // of the backend (One.cpp, Host.cpp) and its version
+
+#endif
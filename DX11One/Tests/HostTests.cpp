@@ -0,0 +1,119 @@
+// Tests of the checks of the host backend exports: contexts that are not (or no longer) ones of CreateDevice,
+// dispatches of kernels with unbound slots, which fail instead of doing nothing, and copies of released handles of
+// pooled resources, which fail instead of aliasing the next owner.
+// g++ -std=c++11 -I.. -o HostTests HostTests.cpp ../*.cpp -lpthread && ./HostTests
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string>
+#include "Check.h"
+
+static void Contexts()
+{
+	Device device; Context context;
+	CHECK(CreateDevice(D3D_DRIVER_TYPE_HARDWARE, D3D_FEATURE_LEVEL_11_0, &device, &context) == S_OK);
+	int values[16] = { }, out[16];
+	Buffer buffer;
+	CHECK(CreateRWBuffer(device, sizeof(int), 16, values, &buffer) == S_OK);
+
+	Context none; // the id of a context, no context behind it
+	int h = 0;
+	CHECK(BeginReadback(none, buffer, sizeof(values), &h) == E_FAIL);
+	CHECK(TryEndReadback(none, 1, out, sizeof(out)) == E_FAIL);
+	CHECK(WaitReadback(none, 1, out, sizeof(out)) == E_FAIL);
+	CHECK(WriteToBuffer(none, buffer, values, sizeof(values)) == E_FAIL);
+	CHECK(SetRWBuffers(none, &buffer, 1) == E_FAIL);
+	CHECK(UnbindResources(none) == E_FAIL);
+	CHECK(TryEndReadback(context, 1, out, sizeof(out)) == E_FAIL); // no BeginReadback on it yet
+	CHECK(WaitReadback(context, 1, out, sizeof(out)) == E_FAIL);
+
+	Buffer empty; // the id of a buffer, no memory behind it
+	CHECK(WriteToBuffer(context, empty, values, sizeof(values)) == E_FAIL);
+	CHECK(GetResults(context, empty, empty, out, sizeof(out)) == E_FAIL);
+	CHECK(CopyBuffer(context, empty, buffer) == E_FAIL);
+
+	CHECK(BeginReadback(context, buffer, sizeof(values), &h) == S_OK);
+	CHECK(WaitReadback(context, h, out, sizeof(out)) == S_OK);
+	ReleaseBuffer(buffer);
+	Dispose();
+	CHECK(BeginReadback(context, buffer, sizeof(values), &h) == E_FAIL); // freed by Dispose
+	CHECK(WaitReadback(context, h, out, sizeof(out)) == E_FAIL);
+	CHECK(UnbindResources(context) == E_FAIL);
+}
+
+static void UnboundSlots()
+{
+	Device device; Context context;
+	CHECK(CreateDevice(D3D_DRIVER_TYPE_HARDWARE, D3D_FEATURE_LEVEL_11_0, &device, &context) == S_OK);
+	std::string source = "#define n 64\n#define threads 16\n#define host_kernels IBC-B\n";
+	const char* errors = NULL;
+	Shader sum, force;
+	CHECK(LoadOrCompileShader(device, source.c_str(), (int)source.size(), "Sum", "cs_5_0", 0, &sum, &errors) == S_OK);
+	CHECK(LoadOrCompileShader(device, source.c_str(), (int)source.size(), "ForceNxN", "cs_5_0", 0, &force, &errors) == S_OK);
+	unsigned tiling[4] = { 1, 1, 64, 1 };
+	Buffer constants, rw;
+	CHECK(CreateConstantBuffer(device, sizeof(tiling), &constants) == S_OK);
+	CHECK(WriteToBuffer(context, constants, tiling, sizeof(tiling)) == S_OK);
+	CHECK(CreateRWBuffer(device, 16, 64, NULL, &rw) == S_OK);
+
+	CHECK(DispatchShader(context, sum, 1, 1, 1) == E_FAIL); // nothing bound
+	CHECK(SetCBuffers(context, &constants, 1) == S_OK);
+	CHECK(DispatchShader(context, sum, 1, 1, 1) == E_FAIL); // no UAV 0
+	CHECK(SetRWBuffers(context, &rw, 1) == S_OK);
+	CHECK(DispatchShader(context, sum, 1, 1, 1) == S_OK);
+	CHECK(DispatchShader(context, force, 1, 1, 1) == E_FAIL); // no pos, type, coefs
+	CHECK(DispatchShader(context, sum, 0, 1, 1) == S_OK); // no groups run, nothing to fail
+	CHECK(UnbindResources(context) == S_OK);
+	CHECK(DispatchShader(context, sum, 1, 1, 1) == E_FAIL);
+
+	ReleaseShader(sum); ReleaseShader(force);
+	ReleaseBuffer(constants); ReleaseBuffer(rw);
+	Dispose();
+}
+
+static void PooledHandles()
+{
+	Device device; Context context;
+	CHECK(CreateDevice(D3D_DRIVER_TYPE_HARDWARE, D3D_FEATURE_LEVEL_11_0, &device, &context) == S_OK);
+	CHECK(SetResourcePool(1 << 20) == S_OK);
+	int values[16] = { 1 }, out[16];
+	ResourcePoolStats before, after;
+	CHECK(GetResourcePoolStats(&before) == S_OK);
+
+	Buffer old, reused;
+	CHECK(CreateRWBuffer(device, sizeof(int), 16, values, &old) == S_OK);
+	Buffer copy = old;
+	CHECK(ReleaseBuffer(old) == S_OK);
+	CHECK(WriteToBuffer(context, copy, values, sizeof(values)) == E_FAIL); // idle in the pool
+	CHECK(CreateRWBuffer(device, sizeof(int), 16, NULL, &reused) == S_OK);
+	CHECK(GetResourcePoolStats(&after) == S_OK && after.hits - before.hits == 1);
+	CHECK(reused.p_buffer == copy.p_buffer && reused.serial != copy.serial);
+	CHECK(WriteToBuffer(context, copy, values, sizeof(values)) == E_FAIL); // owned by reused now
+	CHECK(SetRWBuffers(context, &copy, 1) == E_FAIL);
+	CHECK(GetResults(context, copy, copy, out, sizeof(out)) == E_FAIL);
+	CHECK(ReleaseBuffer(copy) == E_FAIL);
+	CHECK(GetResults(context, reused, reused, out, sizeof(out)) == S_OK && out[0] == 0); // not released by the copy
+	CHECK(WriteToBuffer(context, reused, values, sizeof(values)) == S_OK);
+	CHECK(ReleaseBuffer(reused) == S_OK);
+	CHECK(ReleaseBuffer(reused) == E_FAIL); // twice
+
+	Texture2D texture, again;
+	CHECK(CreateInputTexture2D(device, 4, 4, DXGI_FORMAT_R32_UINT, values, &texture) == S_OK);
+	Texture2D stale = texture;
+	CHECK(ReleaseTexture(texture) == S_OK);
+	CHECK(CreateInputTexture2D(device, 4, 4, DXGI_FORMAT_R32_UINT, NULL, &again) == S_OK && again.p_texture == stale.p_texture);
+	CHECK(WriteToTexture2D(context, stale, values, 4, 4, sizeof(int)) == E_FAIL);
+	CHECK(SetRBuffersAndTextures(context, NULL, 0, &stale, 1) == E_FAIL);
+	CHECK(ReleaseTexture(stale) == E_FAIL);
+	CHECK(ReadTexture2D(context, again, out, 4, 4, sizeof(int)) == S_OK && out[0] == 0);
+	CHECK(ReleaseTexture(again) == S_OK);
+	Dispose();
+}
+
+int main()
+{
+	RUN(Contexts);
+	RUN(UnboundSlots);
+	RUN(PooledHandles);
+	return Failures();
+}
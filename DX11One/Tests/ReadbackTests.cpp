@@ -0,0 +1,191 @@
+// Tests of ReadbackRing (Readback.h): the handles, the reuse of the slots and readbacks that complete out of order, on a
+// staging whose copies complete when the test says so; then the ring behind BeginReadback of the host backend.
+// g++ -std=c++11 -I.. -o ReadbackTests ReadbackTests.cpp ../*.cpp -lpthread && ./ReadbackTests
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <vector>
+#include "Check.h"
+
+// A copy fills the staging of its slot with the number of the copy (1, 2, ...) and is in flight until Complete
+class TestStaging : public ReadbackStaging
+{
+public:
+	TestStaging() : data(READBACK_MAX_SLOTS), done(READBACK_MAX_SLOTS, false), copies(0), last_slot(-1), fail_copy(false), fail_read(false) { }
+	HRESULT Reserve(int slot, int length)
+	{
+		if ((int)data[slot].size() < length) data[slot].resize(length);
+		return S_OK;
+	}
+	HRESULT Copy(int slot, Buffer source, int length)
+	{
+		if (fail_copy) return E_FAIL;
+		memset(&data[slot][0], ++copies, length);
+		done[slot] = false;
+		last_slot = slot;
+		return S_OK;
+	}
+	HRESULT Poll(int slot) { return done[slot] ? S_OK : S_FALSE; }
+	HRESULT Read(int slot, void* destination, int length)
+	{
+		if (fail_read) return E_FAIL;
+		memcpy(destination, &data[slot][0], length);
+		return S_OK;
+	}
+	void Complete(int slot) { done[slot] = true; }
+
+	std::vector<std::vector<char> > data;
+	std::vector<bool> done;
+	int copies, last_slot;
+	bool fail_copy, fail_read;
+};
+
+static bool Filled(const char* data, int length, int value)
+{
+	for (int i = 0; i < length; i++) if (data[i] != (char)value) return false;
+	return true;
+}
+
+static void Handles()
+{
+	TestStaging* staging = new TestStaging();
+	ReadbackRing ring(staging);
+	char out[16];
+	int a = 0, b = 0, c = 0, d = 0;
+	CHECK(ring.Begin(Buffer(), 16, NULL) == E_FAIL);
+	CHECK(ring.Begin(Buffer(), 0, &a) == E_INVALIDARG && a == 0);
+	CHECK(ring.Begin(Buffer(), 16, &a) == S_OK && a > 0);
+	int slot_a = staging->last_slot;
+	CHECK(ring.Begin(Buffer(), 16, &b) == S_OK && b > 0 && b != a);
+	staging->Complete(slot_a);
+	CHECK(ring.TryEnd(a, out, 16) == S_OK && Filled(out, 16, 1));
+	CHECK(ring.TryEnd(a, out, 16) == E_INVALIDARG); // ended
+
+	// The slot of a is taken again by a new readback: the old handle must not match it
+	CHECK(ring.Begin(Buffer(), 16, &c) == S_OK && staging->last_slot != slot_a); // the free slots go round-robin
+	CHECK(ring.Begin(Buffer(), 16, &d) == S_OK && staging->last_slot == slot_a && d != a);
+	CHECK(ring.TryEnd(a, out, 16) == E_INVALIDARG);
+	CHECK(ring.TryEnd(0, out, 16) == E_INVALIDARG);
+	CHECK(ring.TryEnd(-1, out, 16) == E_INVALIDARG);
+	CHECK(ring.TryEnd(d + READBACK_MAX_SLOTS, out, 16) == E_INVALIDARG);
+	CHECK(ring.TryEnd(d, NULL, 16) == E_INVALIDARG);
+	CHECK(ring.TryEnd(b, out, 16) == S_FALSE);
+}
+
+static void Reuse()
+{
+	TestStaging* staging = new TestStaging();
+	ReadbackRing ring(staging, 3);
+	char out[8];
+	int h[4];
+
+	// One readback at a time goes round the slots
+	for (int k = 0; k < 4; k++)
+	{
+		CHECK(ring.Begin(Buffer(), 8, &h[k]) == S_OK && staging->last_slot == k % 3);
+		staging->Complete(staging->last_slot);
+		CHECK(ring.TryEnd(h[k], out, 8) == S_OK && Filled(out, 8, k + 1));
+	}
+	CHECK(ring.InFlight() == 0);
+
+	// Full: E_PENDING leaves no handle and copies nothing, ending any readback frees its slot for the next one
+	for (int k = 0; k < 3; k++) CHECK(ring.Begin(Buffer(), 8, &h[k]) == S_OK);
+	int slot_1 = (staging->last_slot + 2) % 3, copies = staging->copies;
+	CHECK(ring.InFlight() == 3);
+	CHECK(ring.Begin(Buffer(), 8, &h[3]) == E_PENDING && h[3] == 0 && staging->copies == copies);
+	staging->Complete(slot_1);
+	CHECK(ring.TryEnd(h[1], out, 8) == S_OK && ring.InFlight() == 2);
+	CHECK(ring.Begin(Buffer(), 8, &h[3]) == S_OK && staging->last_slot == slot_1 && ring.InFlight() == 3);
+}
+
+static void OutOfOrder()
+{
+	TestStaging* staging = new TestStaging();
+	ReadbackRing ring(staging, 3);
+	char out[32];
+	int h[3], slot[3];
+	for (int k = 0; k < 3; k++) { ring.Begin(Buffer(), 32, &h[k]); slot[k] = staging->last_slot; }
+
+	staging->Complete(slot[2]);
+	CHECK(ring.TryEnd(h[0], out, 32) == S_FALSE);
+	CHECK(ring.TryEnd(h[1], out, 32) == S_FALSE);
+	CHECK(ring.TryEnd(h[2], out, 32) == S_OK && Filled(out, 32, 3));
+	staging->Complete(slot[0]);
+	CHECK(ring.TryEnd(h[1], out, 32) == S_FALSE);
+	CHECK(ring.TryEnd(h[0], out, 32) == S_OK && Filled(out, 32, 1));
+	staging->Complete(slot[1]);
+	CHECK(ring.Wait(h[1], out, 32) == S_OK && Filled(out, 32, 2));
+	CHECK(ring.InFlight() == 0);
+}
+
+static void Lengths()
+{
+	TestStaging* staging = new TestStaging();
+	ReadbackRing ring(staging);
+	char out[64];
+	int h = 0;
+	ring.Begin(Buffer(), 32, &h);
+	staging->Complete(staging->last_slot);
+	CHECK(ring.TryEnd(h, out, 33) == E_INVALIDARG); // more than was copied, the readback stays
+	CHECK(ring.TryEnd(h, out, 0) == E_INVALIDARG);
+	CHECK(ring.InFlight() == 1);
+	out[16] = 0;
+	CHECK(ring.TryEnd(h, out, 16) == S_OK && Filled(out, 16, 1) && out[16] == 0);
+}
+
+static void FailedCopies()
+{
+	TestStaging* staging = new TestStaging();
+	ReadbackRing ring(staging, 2);
+	char out[8];
+	int h = 0;
+	staging->fail_copy = true;
+	CHECK(ring.Begin(Buffer(), 8, &h) == E_FAIL && h == 0 && ring.InFlight() == 0);
+	staging->fail_copy = false;
+
+	// A failed read ends the readback: the data would not come later
+	CHECK(ring.Begin(Buffer(), 8, &h) == S_OK);
+	staging->Complete(staging->last_slot);
+	staging->fail_read = true;
+	CHECK(ring.TryEnd(h, out, 8) == E_FAIL && ring.InFlight() == 0);
+	staging->fail_read = false;
+	CHECK(ring.TryEnd(h, out, 8) == E_INVALIDARG);
+}
+
+static void HostBackend()
+{
+	setenv("DX11ONE_READBACK_LATENCY", "2", 1); // read by the staging of the first BeginReadback of a context
+	Device device; Context context;
+	CHECK(CreateDevice(D3D_DRIVER_TYPE_HARDWARE, D3D_FEATURE_LEVEL_11_0, &device, &context) == S_OK);
+	int values[64], out[64] = { };
+	for (int i = 0; i < 64; i++) values[i] = i * 7;
+	Buffer buffer;
+	CHECK(CreateRWBuffer(device, sizeof(int), 64, values, &buffer) == S_OK);
+
+	int h = 0, g = 0;
+	CHECK(BeginReadback(context, buffer, sizeof(values), &h) == S_OK);
+	CHECK(TryEndReadback(context, h, out, sizeof(out)) == S_FALSE);
+	CHECK(TryEndReadback(context, h, out, sizeof(out)) == S_FALSE);
+	CHECK(TryEndReadback(context, h, out, sizeof(out)) == S_OK && memcmp(out, values, sizeof(values)) == 0);
+	CHECK(TryEndReadback(context, h, out, sizeof(out)) == E_INVALIDARG);
+
+	values[5] = -1;
+	CHECK(WriteToBuffer(context, buffer, values, sizeof(values)) == S_OK);
+	CHECK(BeginReadback(context, buffer, sizeof(values), &g) == S_OK && g != h);
+	CHECK(WaitReadback(context, g, out, sizeof(out)) == S_OK && out[5] == -1);
+	CHECK(BeginReadback(context, buffer, sizeof(values) + 4, &h) == E_INVALIDARG); // beyond the buffer
+
+	ReleaseBuffer(buffer);
+	Dispose();
+}
+
+int main()
+{
+	RUN(Handles);
+	RUN(Reuse);
+	RUN(OutOfOrder);
+	RUN(Lengths);
+	RUN(FailedCopies);
+	RUN(HostBackend);
+	return Failures();
+}
@@ -0,0 +1,181 @@
+// Tests of ShaderCache (ShaderCache.h) with a stub compiler: what makes a key, the LRU in memory, the store on disk
+// (reuse by another cache, damaged files), failed compiles, and the exports of the cache on the host backend.
+// g++ -std=c++11 -I.. -o ShaderCacheTests ShaderCacheTests.cpp ../*.cpp -lpthread && ./ShaderCacheTests
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "Check.h"
+
+// The "bytecode" is the source itself; a source with "error" in it fails with the messages "stub: error"
+static std::atomic<int> compiles(0);
+static HRESULT DX11W_CALLBACK StubCompiler(const char* source, int length, const char* entry_point, const char* profile, unsigned int flags,
+	const void** bytecode, int* bytecode_length, const char** errors)
+{
+	compiles++;
+	if (std::string(source, length).find("error") != std::string::npos) { *errors = "stub: error"; return E_FAIL; }
+	*errors = NULL;
+	*bytecode = source; *bytecode_length = length;
+	return S_OK;
+}
+
+static HRESULT Get(ShaderCache& cache, const std::string& source, const char* entry_point = "Main", const char* profile = "cs_5_0", unsigned int flags = 0, std::string* errors = NULL)
+{
+	std::string bytecode;
+	HRESULT hr = cache.Get(source.c_str(), (int)source.size(), entry_point, profile, flags, &bytecode, errors);
+	return FAILED(hr) || bytecode == source ? hr : S_FALSE; // S_FALSE: the bytecode is not the source
+}
+
+static std::string TemporaryDirectory()
+{
+	char path[] = "/tmp/ShaderCacheTestsXXXXXX";
+	return mkdtemp(path) == NULL ? std::string() : std::string(path);
+}
+
+static void Keys()
+{
+	ShaderCache cache(StubCompiler, "stub 1");
+	compiles = 0;
+	CHECK(Get(cache, "#define n 4\nsource") == S_OK && compiles == 1);
+	CHECK(Get(cache, "#define n 4\nsource") == S_OK && compiles == 1);
+	CHECK(Get(cache, "#define n 8\nsource") == S_OK && compiles == 2); // the prepended defines are a part of the source
+	CHECK(Get(cache, "#define n 4\nsource", "Other") == S_OK && compiles == 3);
+	CHECK(Get(cache, "#define n 4\nsource", "Main", "cs_4_0") == S_OK && compiles == 4);
+	CHECK(Get(cache, "#define n 4\nsource", "Main", "cs_5_0", 1) == S_OK && compiles == 5);
+	CHECK(Get(cache, "#define n 4\nsource", "Mai", "ncs_5_0") == S_OK && compiles == 6); // fields do not run into each other
+	ShaderCacheStats stats = cache.Stats();
+	CHECK(stats.memory_hits == 1 && stats.compiles == 6 && stats.disk_hits == 0 && stats.disk_writes == 0);
+
+	// Another compiler version misses everything compiled before it, going back hits again
+	cache.SetCompiler(StubCompiler, "stub 2");
+	CHECK(Get(cache, "#define n 4\nsource") == S_OK && compiles == 7);
+	cache.SetCompiler(StubCompiler, "stub 1");
+	CHECK(Get(cache, "#define n 4\nsource") == S_OK && compiles == 7);
+}
+
+static void FailedCompiles()
+{
+	ShaderCache cache(StubCompiler, "stub 1");
+	compiles = 0;
+	std::string errors = "old";
+	CHECK(Get(cache, "an error", "Main", "cs_5_0", 0, &errors) == E_FAIL && errors == "stub: error");
+	CHECK(Get(cache, "an error", "Main", "cs_5_0", 0, &errors) == E_FAIL && compiles == 2); // not cached
+	CHECK(Get(cache, "fine", "Main", "cs_5_0", 0, &errors) == S_OK && errors.empty());
+	CHECK(cache.Stats().compiles == 1);
+	CHECK(cache.Get(NULL, 0, "Main", "cs_5_0", 0, &errors, NULL) == E_INVALIDARG);
+
+	ShaderCache none(NULL, "");
+	CHECK(Get(none, "fine") == E_FAIL);
+}
+
+static void Memory()
+{
+	ShaderCache cache(StubCompiler, "stub 1");
+	std::string a(100, 'a'), b(100, 'b'), c(100, 'c');
+	cache.SetStore(NULL, 250); // two of them
+	compiles = 0;
+	Get(cache, a); Get(cache, b);
+	CHECK(Get(cache, a) == S_OK && compiles == 2); // a is now the most recent
+	CHECK(Get(cache, c) == S_OK && compiles == 3); // evicts b
+	CHECK(Get(cache, a) == S_OK && compiles == 3);
+	CHECK(Get(cache, b) == S_OK && compiles == 4);
+	cache.SetStore(NULL, 50); // nothing fits any more
+	CHECK(Get(cache, b) == S_OK && compiles == 5);
+	CHECK(Get(cache, b) == S_OK && compiles == 6);
+}
+
+static void Store()
+{
+	std::string directory = TemporaryDirectory();
+	CHECK(!directory.empty());
+	compiles = 0;
+	{
+		ShaderCache cache(StubCompiler, "stub 1");
+		cache.SetStore(directory.c_str(), SHADER_CACHE_MEMORY);
+		CHECK(Get(cache, "stored") == S_OK && compiles == 1 && cache.Stats().disk_writes == 1);
+	}
+
+	// A new cache (a new process) finds the bytecode on disk; a damaged file (a byte of the bytecode after the 24 bytes
+	// of StoreHeader) is a miss and is written again
+	ShaderCache cache(StubCompiler, "stub 1");
+	cache.SetStore((directory + "/").c_str(), 0);
+	CHECK(Get(cache, "stored") == S_OK && compiles == 1 && cache.Stats().disk_hits == 1);
+	std::string command = "for f in " + directory + "/*.cso; do printf x | dd of=$f bs=1 seek=26 conv=notrunc 2>/dev/null; done";
+	CHECK(system(command.c_str()) == 0);
+	CHECK(Get(cache, "stored") == S_OK && compiles == 2 && cache.Stats().disk_writes == 1);
+	CHECK(Get(cache, "stored") == S_OK && compiles == 2 && cache.Stats().disk_hits == 2);
+
+	// Another compiler version has keys of its own on disk too
+	cache.SetCompiler(StubCompiler, "stub 2");
+	CHECK(Get(cache, "stored") == S_OK && compiles == 3);
+	CHECK(system(("ls " + directory + " | grep -c 'cso$' | grep -q '^2$'").c_str()) == 0); // and no temporary files left
+	CHECK(system(("rm -r " + directory).c_str()) == 0);
+}
+
+static void Threads()
+{
+	ShaderCache cache(StubCompiler, "stub 1");
+	compiles = 0;
+	std::atomic<int> wrong(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 8; t++)
+		threads.push_back(std::thread([&]() {
+			for (int i = 0; i < 1000; i++)
+				if (Get(cache, "shader " + std::to_string(i % 10)) != S_OK) wrong++;
+		}));
+	for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+	ShaderCacheStats stats = cache.Stats();
+	CHECK(wrong == 0);
+	CHECK(stats.compiles + stats.memory_hits == 8000 && stats.compiles >= 10 && stats.compiles == compiles);
+}
+
+// SetShaderCompiler, LoadOrCompileShader and GetShaderCacheStats of the host backend, whose shaders need their kernels
+static void Exports()
+{
+	Device device; Context context;
+	CHECK(CreateDevice(D3D_DRIVER_TYPE_HARDWARE, D3D_FEATURE_LEVEL_11_0, &device, &context) == S_OK);
+	CHECK(SetShaderCache(NULL, SHADER_CACHE_MEMORY) == S_OK);
+	CHECK(SetShaderCompiler(StubCompiler, "stub exports") == S_OK);
+	ShaderCacheStats before, after;
+	CHECK(GetShaderCacheStats(&before) == S_OK && GetShaderCacheStats(NULL) == E_INVALIDARG);
+	std::string source = "#define n 64\n#define host_kernels IBC-B\n";
+	const char* errors = NULL;
+	compiles = 0;
+	for (int k = 0; k < 2; k++)
+	{
+		Shader shader; // a released handle is not passed again: ReleaseShader cannot reset the copy of the caller
+		CHECK(LoadOrCompileShader(device, source.c_str(), (int)source.size(), "Sum", "cs_5_0", 0, &shader, &errors) == S_OK);
+		ReleaseShader(shader);
+	}
+	CHECK(GetShaderCacheStats(&after) == S_OK && after.compiles - before.compiles == 1 && after.memory_hits - before.memory_hits == 1 && compiles == 1);
+	Shader shader;
+	CHECK(LoadOrCompileShader(device, "error", 5, "Sum", "cs_5_0", 0, &shader, &errors) == E_FAIL && std::string(errors) == "stub: error");
+
+	// NULL: back to the compiler of the backend, the native kernel lookup, under its own version
+	CHECK(SetShaderCompiler(NULL, NULL) == S_OK);
+	CHECK(LoadOrCompileShader(device, source.c_str(), (int)source.size(), "NoSuchKernel", "cs_5_0", 0, &shader, &errors) == E_FAIL && errors != NULL && errors[0] != 0);
+	CHECK(compiles == 2);
+
+	// The exports of the cache are traced like the others (GetStats)
+	CallStats stats[CALL_COUNT];
+	CHECK(GetStats(stats, CALL_COUNT) == S_OK);
+	CHECK(stats[CALL_SetShaderCache].calls >= 1 && stats[CALL_SetShaderCompiler].calls >= 2 && stats[CALL_GetShaderCacheStats].calls >= 3);
+	const char* name = NULL;
+	CHECK(GetCallName(CALL_GetShaderCacheStats, &name) == S_OK && std::string(name) == "GetShaderCacheStats");
+	Dispose();
+}
+
+int main()
+{
+	RUN(Keys);
+	RUN(FailedCompiles);
+	RUN(Memory);
+	RUN(Store);
+	RUN(Threads);
+	RUN(Exports);
+	return Failures();
+}
@@ -0,0 +1,76 @@
+// Tests of the tracing (Trace.h): the ring of events resized and written while other threads make traced calls, and
+// the events that WriteTrace saves.
+// g++ -std=c++11 -I.. -o TraceTests TraceTests.cpp ../*.cpp -lpthread && ./TraceTests
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Check.h"
+
+static int Count(const std::string& filename, const std::string& what)
+{
+	FILE* f = fopen(filename.c_str(), "r");
+	if (f == NULL) return -1;
+	std::string text;
+	char buffer[4096];
+	for (size_t n; (n = fread(buffer, 1, sizeof(buffer), f)) > 0; ) text.append(buffer, n);
+	fclose(f);
+	int count = 0;
+	for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) count++;
+	return count;
+}
+
+// Traced calls on 4 threads while the ring changes its capacity and is written (ASan and TSan find a ring freed under
+// a writer or torn events)
+static void Resize()
+{
+	Device device;
+	Context context;
+	CHECK(CreateDevice(D3D_DRIVER_TYPE_HARDWARE, D3D_FEATURE_LEVEL_11_0, &device, &context) == S_OK);
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++)
+		threads.push_back(std::thread([&stop, device]() { char name[64]; while (!stop) GetDeviceName(device, name, sizeof(name)); }));
+	const std::string filename = "/tmp/TraceTests.json";
+	for (int k = 0; k < 200; k++)
+	{
+		CHECK(SetTraceEvents(k % 3 == 0 ? 0 : 1 + k * 7 % 97) == S_OK);
+		if (k % 10 == 0) CHECK(WriteTrace(filename.c_str()) == S_OK);
+	}
+	stop = true;
+	for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+	CHECK(SetTraceEvents(0) == S_OK);
+	Dispose();
+	remove(filename.c_str());
+}
+
+// The ring keeps the last capacity calls, and nothing once it is off
+static void Events()
+{
+	const std::string filename = "/tmp/TraceTests.json";
+	Device device;
+	Context context;
+	CHECK(CreateDevice(D3D_DRIVER_TYPE_HARDWARE, D3D_FEATURE_LEVEL_11_0, &device, &context) == S_OK);
+	char name[64];
+	CHECK(SetTraceEvents(3) == S_OK);
+	for (int k = 0; k < 5; k++) CHECK(GetDeviceName(device, name, sizeof(name)) == S_OK);
+	CHECK(WriteTrace(filename.c_str()) == S_OK);
+	CHECK(Count(filename, "\"name\":\"GetDeviceName\"") == 3);
+	CHECK(SetTraceEvents(0) == S_OK);
+	CHECK(GetDeviceName(device, name, sizeof(name)) == S_OK);
+	CHECK(WriteTrace(filename.c_str()) == S_OK);
+	CHECK(Count(filename, "\"name\":\"GetDeviceName\"") == 0);
+	CHECK(SetTraceEvents(-1) == E_INVALIDARG);
+	Dispose();
+	remove(filename.c_str());
+}
+
+int main()
+{
+	RUN(Resize);
+	RUN(Events);
+	return Failures();
+}
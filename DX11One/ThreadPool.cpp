@@ -0,0 +1,65 @@
+#include "stdafx.h"
+#ifdef DX11ONE_HOST
+
+namespace DX11One {
+
+ThreadPool::ThreadPool(int threads) : job(NULL), next(0), total(0), active(0), generation(0), stop(false)
+{
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	for (int i = 1; i < threads; i++) workers.push_back(std::thread(&ThreadPool::Work, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	started.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+void ThreadPool::Run(int count, const std::function<void(int index, int worker)>& f)
+{
+	if (count <= 0) return;
+	if (workers.empty() || count == 1) { for (int i = 0; i < count; i++) f(i, 0); return; }
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &f; total = count; next = 0;
+		active = (int)workers.size();
+		generation++;
+	}
+	started.notify_all();
+	Execute(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this] { return active == 0; });
+	job = NULL;
+}
+
+void ThreadPool::Execute(int worker)
+{
+	for (int i = next++; i < total; i = next++) (*job)(i, worker);
+}
+
+void ThreadPool::Work(int worker)
+{
+	long seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			started.wait(lock, [&] { return stop || generation != seen; });
+			if (stop) return;
+			seen = generation;
+		}
+		Execute(worker);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--active == 0) finished.notify_one();
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads. Run(count, f) calls f(index, worker) for every index in [0, count) on all workers
+// (the calling thread is worker 0) and returns when every call is finished. Run is not reentrant.
+// In a namespace of its own: CPUOne has another ThreadPool, and both libraries can be loaded in one process.
+namespace DX11One {
+class ThreadPool
+{
+public:
+	ThreadPool(int threads); // threads <= 0: one worker per hardware thread
+	~ThreadPool();
+
+	int Threads() const { return (int)workers.size() + 1; }
+	void Run(int count, const std::function<void(int index, int worker)>& f);
+
+private:
+	void Work(int worker);
+	void Execute(int worker);
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable started, finished;
+	const std::function<void(int, int)>* job;
+	std::atomic<int> next;
+	int total, active;
+	long generation;
+	bool stop;
+};
+}
+using DX11One::ThreadPool;
+
+#endif
@@ -0,0 +1,130 @@
+#include "stdafx.h"
+#ifndef DX11ONE_NO_TRACE
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#define TRACE_CALL_NAME(name) #name,
+static const char* call_names[CALL_COUNT] = { TRACE_CALLS(TRACE_CALL_NAME) };
+
+// Counters: calls, bytes, wall_ns, gpu_ns per function
+static std::atomic<long long> counters[CALL_COUNT][4];
+
+// Ring of events: the writer takes the next index, so the ring keeps the last capacity events. The ring, head and the
+// events are guarded by events_lock, SetTraceEvents reallocates the ring while other threads may be pushing
+struct TraceEvent { long long start, duration, bytes; int call, track; }; // track 0: GPU, else the calling thread
+static std::mutex events_lock;
+static std::vector<TraceEvent> events;
+static unsigned long long head = 0;
+static std::atomic<bool> recording(false);
+static std::atomic<int> tracks(0);
+static const long long epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+long long TraceClock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() - epoch;
+}
+
+bool TraceEvents() { return recording.load(std::memory_order_relaxed); }
+
+static void Push(TraceCall call, int track, long long start, long long duration, long long bytes)
+{
+	TraceEvent e = { start, duration, bytes, (int)call, track };
+	std::lock_guard<std::mutex> lock(events_lock);
+	if (events.empty()) return; // turned off after the caller saw it on
+	events[(size_t)(head++ % events.size())] = e;
+}
+
+void TraceRecord(TraceCall call, long long start, long long duration, long long bytes)
+{
+	std::atomic<long long>* c = counters[call];
+	c[0].fetch_add(1, std::memory_order_relaxed);
+	if (bytes != 0) c[1].fetch_add(bytes, std::memory_order_relaxed);
+	c[2].fetch_add(duration, std::memory_order_relaxed);
+	if (!TraceEvents()) return;
+	static thread_local int track = 0;
+	if (track == 0) track = tracks.fetch_add(1) + 1;
+	Push(call, track, start, duration, bytes);
+}
+
+void TraceGPU(TraceCall call, long long cpu_start, long long gpu_ns)
+{
+	counters[call][3].fetch_add(gpu_ns, std::memory_order_relaxed);
+	if (TraceEvents()) Push(call, 0, cpu_start, gpu_ns, 0);
+}
+
+HRESULT DX11W_API GetStats(CallStats* stats, int count)
+{
+	if (stats == NULL || count < 0) return E_INVALIDARG;
+	for (int k = 0; k < count && k < CALL_COUNT; k++)
+	{
+		stats[k].calls = counters[k][0].load(std::memory_order_relaxed);
+		stats[k].bytes = counters[k][1].load(std::memory_order_relaxed);
+		stats[k].wall_ns = counters[k][2].load(std::memory_order_relaxed);
+		stats[k].gpu_ns = counters[k][3].load(std::memory_order_relaxed);
+	}
+	return count > CALL_COUNT ? S_FALSE : S_OK;
+}
+
+HRESULT DX11W_API GetCallName(int call, const char** name)
+{
+	if (call < 0 || call >= CALL_COUNT || name == NULL) return E_INVALIDARG;
+	*name = call_names[call];
+	return S_OK;
+}
+
+HRESULT DX11W_API ResetStats()
+{
+	for (int k = 0; k < CALL_COUNT; k++)
+		for (int m = 0; m < 4; m++) counters[k][m].store(0, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(events_lock);
+	head = 0;
+	return S_OK;
+}
+
+HRESULT DX11W_API SetTraceEvents(int capacity)
+{
+	if (capacity < 0) return E_INVALIDARG;
+	std::lock_guard<std::mutex> lock(events_lock);
+	recording.store(false);
+	events.assign(capacity, TraceEvent());
+	head = 0;
+	recording.store(capacity > 0);
+	return S_OK;
+}
+
+HRESULT DX11W_API WriteTrace(const char* filename)
+{
+	if (filename == NULL) return E_INVALIDARG;
+	FILE* f = fopen(filename, "w");
+	if (f == NULL) return E_FAIL;
+	std::vector<TraceEvent> ring; // a copy, the calls go on while the file is written
+	unsigned long long end;
+	{
+		std::lock_guard<std::mutex> lock(events_lock);
+		ring = events;
+		end = head;
+	}
+	const unsigned long long size = ring.size(), begin = end > size ? end - size : 0;
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}");
+	for (int t = 1; t <= tracks.load(); t++)
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}", t, t);
+	for (unsigned long long i = begin; i < end; i++)
+	{
+		const TraceEvent& e = ring[(size_t)(i % size)];
+		fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"DX11One\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%lld}}",
+			call_names[e.call], e.track, e.start * 1e-3, e.duration * 1e-3, e.bytes);
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	return S_OK;
+}
+#else
+HRESULT DX11W_API GetStats(CallStats* stats, int count) { return E_NOTIMPL; }
+HRESULT DX11W_API GetCallName(int call, const char** name) { return E_NOTIMPL; }
+HRESULT DX11W_API ResetStats() { return E_NOTIMPL; }
+HRESULT DX11W_API SetTraceEvents(int capacity) { return E_NOTIMPL; }
+HRESULT DX11W_API WriteTrace(const char* filename) { return E_NOTIMPL; }
+#endif
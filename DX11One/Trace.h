@@ -0,0 +1,51 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+// Instrumentation of the exported functions. Every call adds to the counters of its function: calls, bytes moved
+// between host and device memory, wall time, and the GPU time of DispatchShader measured by timestamp queries (D3D11
+// only, while events are recorded). SetTraceEvents(capacity) also keeps the last capacity calls in a ring of events,
+// WriteTrace saves them as Chrome trace JSON (chrome://tracing, ui.perfetto.dev): a track per calling thread and a
+// "GPU" track for the timed dispatches. GetStats returns the counters by TraceCall, GetCallName the names.
+// A call costs two reads of the steady clock and four relaxed atomic adds (a locked store into the ring while it is
+// on). SetTraceEvents and WriteTrace may run concurrently with the calls. Define DX11ONE_NO_TRACE to compile all of it
+// out: the macros become empty and the entry points return E_NOTIMPL.
+
+#define TRACE_CALLS(X) \
+	X(CreateDevice) X(GetDeviceName) X(CreateAndCompileShader) X(CompileShader) X(LoadOrCompileShader) \
+	X(CreateRWBuffer) X(CreateRBuffer) X(CreateInputBuffer) X(CreateStagingBuffer) X(CreateConstantBuffer) \
+	X(CreateInputTexture2D) X(CreateRWTexture2D) \
+	X(WriteToBuffer) X(WriteToTexture2D) X(CopyBuffer) X(GetResults) X(ReadTexture2D) \
+	X(BeginReadback) X(TryEndReadback) X(WaitReadback) \
+	X(SetRBuffers) X(SetRBuffersAndTextures) X(SetCBuffers) X(SetRWBuffers) X(SetRWBuffersAndTextures) \
+	X(DispatchShader) X(UnbindResources) \
+	X(ReleaseBuffer) X(ReleaseShader) X(ReleaseTexture) X(Dispose) \
+	X(SetShaderCache) X(SetShaderCompiler) X(GetShaderCacheStats) X(SetResourcePool) X(GetResourcePoolStats)
+#define TRACE_CALL_ENUM(name) CALL_##name,
+enum TraceCall { TRACE_CALLS(TRACE_CALL_ENUM) CALL_COUNT };
+
+// Counters of a function, the same layout as CallStats in DirectCompute.cs
+struct CallStats { long long calls, bytes, wall_ns, gpu_ns; };
+
+#ifndef DX11ONE_NO_TRACE
+long long TraceClock(); // ns of the steady clock
+bool TraceEvents(); // the ring is on
+void TraceRecord(TraceCall call, long long start, long long duration, long long bytes);
+void TraceGPU(TraceCall call, long long cpu_start, long long gpu_ns); // a GPU interval, resolved after its call
+
+class TraceScope
+{
+public:
+	TraceScope(TraceCall call, long long bytes) : bytes(bytes), call(call), start(TraceClock()) { }
+	~TraceScope() { TraceRecord(call, start, TraceClock() - start, bytes); }
+	long long bytes;
+	TraceCall call;
+	long long start;
+};
+#define TRACE(name, bytes) TraceScope trace_scope(CALL_##name, bytes)
+#define TRACE_BYTES(b) (trace_scope.bytes = (b))
+#else
+#define TRACE(name, bytes)
+#define TRACE_BYTES(b)
+#endif
+
+#endif
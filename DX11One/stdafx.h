@@ -10,8 +10,11 @@
 #include "targetver.h"
 
 // TODO: reference additional headers your program requires here
+#if defined(_WIN32) && !defined(DX11ONE_HOST)
 #include <d3dx11.h>
 #include <d3dCompiler.h>
 #include <D3DX10Math.h>
+#endif
 
 #include "One.h"
+#include "Readback.h"
@@ -0,0 +1,337 @@
+using System;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+using M.Tools;
+
+namespace CPUOne
+{
+    struct CPU_Engine
+    {
+        int id, serial;
+        IntPtr ptr;
+        CPU_Engine(int something) { id = -1; serial = 0; ptr = IntPtr.Zero; }
+    }
+    struct CPU_Analysis
+    {
+        int id, serial;
+        IntPtr ptr;
+    }
+    struct CPU_Partition
+    {
+        int id, serial;
+        IntPtr ptr;
+    }
+    struct CPU_Ensemble
+    {
+        int id, serial;
+        IntPtr ptr;
+    }
+
+    // Precision of the engines, the values of Precision in CPUOne\Engine.h: Mixed computes the pair terms in float and
+    // adds them up with Kahan sums, near the Double forces and energies at about the Single speed
+    public enum EnginePrecision { Double, Single, Mixed }
+
+    // Parameters of Analysis.Analyze, the same layout as AnalysisParameters in CPUOne\Analysis.h
+    [StructLayout(LayoutKind.Sequential)]
+    public struct AnalysisParameters
+    {
+        public double rfr_radius, period, border; // A
+        public int rfr_intervals, layers;
+    }
+
+    internal unsafe class OneDLL
+    {
+        public const string dll_filename = "CPUOne.dll";
+
+        [DllImport(dll_filename, EntryPoint = "CreateEngine")]
+        internal static extern int CreateEngine(string form, int precision, double cutoff, CPU_Engine* engine);
+        [DllImport(dll_filename, EntryPoint = "InitEngine")]
+        internal static extern int InitEngine(CPU_Engine engine, int* type, double* coefs, int types, int ions);
+        [DllImport(dll_filename, EntryPoint = "SetEngineThreads")]
+        internal static extern int SetEngineThreads(CPU_Engine engine, int threads);
+        [DllImport(dll_filename, EntryPoint = "SetEngineTileSize")]
+        internal static extern int SetEngineTileSize(CPU_Engine engine, int tile);
+        [DllImport(dll_filename, EntryPoint = "SetNeighborSkin")]
+        internal static extern int SetNeighborSkin(CPU_Engine engine, double skin);
+        [DllImport(dll_filename, EntryPoint = "GetNeighborListStats")]
+        internal static extern int GetNeighborListStats(CPU_Engine engine, out int builds, out long neighbors);
+        [DllImport(dll_filename, EntryPoint = "SetPotentialTable")]
+        internal static extern int SetPotentialTable(CPU_Engine engine, double* table, int types, int intervals, double r2_min, double scale);
+        [DllImport(dll_filename, EntryPoint = "SetCoulombTree")]
+        internal static extern int SetCoulombTree(CPU_Engine engine, double theta, int order);
+        [DllImport(dll_filename, EntryPoint = "GetCoulombTreeError")]
+        internal static extern int GetCoulombTreeError(CPU_Engine engine, int samples, out double rms, out double max);
+        [DllImport(dll_filename, EntryPoint = "SetPositions")]
+        internal static extern int SetPositions(CPU_Engine engine, Double3* pos, int ions);
+        [DllImport(dll_filename, EntryPoint = "ComputeForce")]
+        internal static extern int ComputeForce(CPU_Engine engine, Double3* acc);
+        [DllImport(dll_filename, EntryPoint = "ComputeEnergy")]
+        internal static extern int ComputeEnergy(CPU_Engine engine, Double3* acc, double* energy);
+        [DllImport(dll_filename, EntryPoint = "ComputeForcePart")]
+        internal static extern int ComputeForcePart(CPU_Engine engine, int part, Double3* acc, double* energy);
+        [DllImport(dll_filename, EntryPoint = "InitDynamics")]
+        internal static extern int InitDynamics(CPU_Engine engine, Double3* pos, Double3* vel, double* mass);
+        [DllImport(dll_filename, EntryPoint = "StepDynamics")]
+        internal static extern int StepDynamics(CPU_Engine engine, IDGPU.DynamicsParameters* parameters, int steps, double* temperatures, double* energies);
+        [DllImport(dll_filename, EntryPoint = "GetDynamics")]
+        internal static extern int GetDynamics(CPU_Engine engine, Double3* pos, Double3* vel);
+        [DllImport(dll_filename, EntryPoint = "GetInstructionSet")]
+        internal static extern int GetInstructionSet(CPU_Engine engine, out sbyte* name);
+        [DllImport(dll_filename, EntryPoint = "ReleaseEngine")]
+        internal static extern int ReleaseEngine(CPU_Engine engine);
+        [DllImport(dll_filename, EntryPoint = "CreateAnalysis")]
+        internal static extern int CreateAnalysis(int* type, int types, int ions, int threads, CPU_Analysis* analysis);
+        [DllImport(dll_filename, EntryPoint = "Analyze")]
+        internal static extern int Analyze(CPU_Analysis analysis, Double3* pos, Double3* origin, AnalysisParameters* parameters,
+            int* rfr, int* layer_count, double* layer_dist, int* bilayer_count, double* bilayer_dist);
+        [DllImport(dll_filename, EntryPoint = "PairHistogram")]
+        internal static extern int PairHistogram(CPU_Analysis analysis, Double3* pos, double r_max, double core, int bins, int* histogram, int* centers);
+        [DllImport(dll_filename, EntryPoint = "ReleaseAnalysis")]
+        internal static extern int ReleaseAnalysis(CPU_Analysis analysis);
+        [DllImport(dll_filename, EntryPoint = "CreatePartition")]
+        internal static extern int CreatePartition(string address, int workers, int max_ions, double timeout, CPU_Partition* partition);
+        [DllImport(dll_filename, EntryPoint = "InitPartition")]
+        internal static extern int InitPartition(CPU_Partition partition, string form, int precision, double cutoff, int* type, double* coefs, int types, int ions);
+        [DllImport(dll_filename, EntryPoint = "PartitionForce")]
+        internal static extern int PartitionForce(CPU_Partition partition, Double3* pos, Double3* acc);
+        [DllImport(dll_filename, EntryPoint = "PartitionEnergy")]
+        internal static extern int PartitionEnergy(CPU_Partition partition, Double3* pos, Double3* acc, double* energy);
+        [DllImport(dll_filename, EntryPoint = "GetPartitionRows")]
+        internal static extern int GetPartitionRows(CPU_Partition partition, int* bounds, double* seconds);
+        [DllImport(dll_filename, EntryPoint = "ReleasePartition")]
+        internal static extern int ReleasePartition(CPU_Partition partition);
+        [DllImport(dll_filename, EntryPoint = "CreateEnsemble")]
+        internal static extern int CreateEnsemble(int precision, double cutoff, int threads, CPU_Ensemble* ensemble);
+        [DllImport(dll_filename, EntryPoint = "InitEnsembleSystem")]
+        internal static extern int InitEnsembleSystem(CPU_Ensemble ensemble, int system, string form, int* type, double* coefs, int types, int ions);
+        [DllImport(dll_filename, EntryPoint = "SetSystemPositions")]
+        internal static extern int SetSystemPositions(CPU_Ensemble ensemble, int system, Double3* pos);
+        [DllImport(dll_filename, EntryPoint = "ComputeEnsemble")]
+        internal static extern int ComputeEnsemble(CPU_Ensemble ensemble, double* energies);
+        [DllImport(dll_filename, EntryPoint = "GetSystemForces")]
+        internal static extern int GetSystemForces(CPU_Ensemble ensemble, int system, Double3* acc);
+        [DllImport(dll_filename, EntryPoint = "ReleaseEnsemble")]
+        internal static extern int ReleaseEnsemble(CPU_Ensemble ensemble);
+
+        [DllImport(dll_filename, EntryPoint = "DecodeError")]
+        internal static extern int DecodeError(int hresult, out sbyte* output);
+
+        internal static void Check(int hresult)
+        {
+            if (hresult < 0)
+            {
+                StackTrace trace = new StackTrace(true);
+                StackFrame frame1 = trace.GetFrame(1);
+                StackFrame frame2 = trace.GetFrame(2);
+                sbyte* bytes;
+                DecodeError(hresult, out bytes);
+                string error_message = new string(bytes);
+                throw new InvalidOperationException(String.Format("Error 0x{0:X8} in '{1}() -> {2}()' in {3}:line {4}\r\nmessage: {5}",
+                    hresult, frame2.GetMethod().Name, frame1.GetMethod().Name, frame2.GetFileName(), frame2.GetFileLineNumber(), error_message));
+            }
+        }
+    }
+
+    // All-pairs force engine of CPUOne.dll: SIMD kernels (scalar, AVX2 or AVX-512 - the best one the CPU supports)
+    public unsafe class ForceEngine
+    {
+        public ForceEngine(string form, EnginePrecision precision, double cutoff)
+        {
+            fixed (CPU_Engine* pe = &engine)
+                OneDLL.Check(OneDLL.CreateEngine(form, (int)precision, cutoff, pe));
+        }
+        public void Dispose() { OneDLL.ReleaseEngine(engine); engine = new CPU_Engine(); }
+
+        public string InstructionSet
+        {
+            get
+            {
+                sbyte* name;
+                OneDLL.Check(OneDLL.GetInstructionSet(engine, out name));
+                return new string(name);
+            }
+        }
+        public int Threads { set { OneDLL.Check(OneDLL.SetEngineThreads(engine, value)); } } // <= 0: all hardware threads
+        public int TileSize { set { OneDLL.Check(OneDLL.SetEngineTileSize(engine, value)); } } // before Init, 0: by the number of ions
+        public double NeighborSkin { set { OneDLL.Check(OneDLL.SetNeighborSkin(engine, value)); } } // <= 0: no neighbor lists
+        public void GetNeighborListStats(out int builds, out long neighbors) { OneDLL.Check(OneDLL.GetNeighborListStats(engine, out builds, out neighbors)); }
+        // Cut terms from the splines of IDGPU.PotentialTable, before Init
+        public void SetPotentialTable(IDGPU.PotentialTable table)
+        {
+            fixed (double* p = table.Coefs) OneDLL.Check(OneDLL.SetPotentialTable(engine, p, table.Types, table.Intervals, table.R2Min, table.Scale));
+        }
+        // Barnes-Hut tree for Coulomb and the uncut dispersion, theta <= 0: none; order 0..2 (monopole .. quadrupole)
+        public void SetCoulombTree(double theta, int order) { OneDLL.Check(OneDLL.SetCoulombTree(engine, theta, order)); }
+        // Force error of the tree at the current positions against the exact all-pairs sum over every (ions / samples)-th ion
+        public void GetCoulombTreeError(int samples, out double rms, out double max) { OneDLL.Check(OneDLL.GetCoulombTreeError(engine, samples, out rms, out max)); }
+        public void Init(int[] type, double[] coefs, int types, int ions)
+        {
+            fixed (int* pt = type)
+            fixed (double* pc = coefs)
+                OneDLL.Check(OneDLL.InitEngine(engine, pt, pc, types, ions));
+        }
+        public void SetPositions(Double3[] pos, int ions)
+        {
+            fixed (Double3* p = pos) OneDLL.Check(OneDLL.SetPositions(engine, p, ions));
+        }
+        public void Force(Double3[] acc)
+        {
+            fixed (Double3* p = acc) OneDLL.Check(OneDLL.ComputeForce(engine, p));
+        }
+        public double Energy(Double3[] acc)
+        {
+            double energy;
+            fixed (Double3* p = acc) OneDLL.Check(OneDLL.ComputeEnergy(engine, p, &energy));
+            return energy;
+        }
+        // The short- or the long-range part of Force only (r-RESPA), with its energy if energy, else 0
+        public double Force(IDGPU.ForcePart part, Double3[] acc, bool energy)
+        {
+            double U = 0;
+            fixed (Double3* p = acc) OneDLL.Check(OneDLL.ComputeForcePart(engine, (int)part, p, energy ? &U : null));
+            return U;
+        }
+        // MD steps on the engine side (see IDGPU.IDynamics), after Init
+        public void InitDynamics(Double3[] pos, Double3[] vel, double[] mass)
+        {
+            fixed (Double3* pp = pos)
+            fixed (Double3* pv = vel)
+            fixed (double* pm = mass)
+                OneDLL.Check(OneDLL.InitDynamics(engine, pp, pv, pm));
+        }
+        public void StepDynamics(IDGPU.DynamicsParameters p, int steps, double[] temperatures, double[] energies)
+        {
+            fixed (double* pt = temperatures)
+            fixed (double* pe = energies)
+                OneDLL.Check(OneDLL.StepDynamics(engine, &p, steps, pt, pe));
+        }
+        public void GetDynamics(Double3[] pos, Double3[] vel)
+        {
+            fixed (Double3* pp = pos)
+            fixed (Double3* pv = vel)
+                OneDLL.Check(OneDLL.GetDynamics(engine, pp, pv));
+        }
+
+        private CPU_Engine engine;
+    }
+
+    // Per-ion sweep of MDIBC.ComputeDensity and ComputeCKC on all cores: the RFR histogram (rfr_intervals per type) and,
+    // if layer_count is not null, the sums of the sphere layers ([origin layer][current layer][type]) and of the bilayer
+    // ([bulk, surface][type]) in flat arrays
+    public unsafe class Analysis : IDisposable
+    {
+        public Analysis(int[] type, int types, int threads = 0)
+        {
+            fixed (int* pt = type)
+            fixed (CPU_Analysis* pa = &analysis)
+                OneDLL.Check(OneDLL.CreateAnalysis(pt, types, type.Length, threads, pa));
+        }
+        public void Dispose() { OneDLL.ReleaseAnalysis(analysis); analysis = new CPU_Analysis(); }
+
+        public void Analyze(Double3[] pos, Double3[] origin, AnalysisParameters p, int[] rfr, int[] layer_count, double[] layer_dist, int[] bilayer_count, double[] bilayer_dist)
+        {
+            fixed (Double3* pp = pos)
+            fixed (Double3* po = origin)
+            fixed (int* pr = rfr)
+            fixed (int* plc = layer_count)
+            fixed (double* pld = layer_dist)
+            fixed (int* pbc = bilayer_count)
+            fixed (double* pbd = bilayer_dist)
+                OneDLL.Check(OneDLL.Analyze(analysis, pp, po, &p, pr, plc, pld, pbc, pbd));
+        }
+        // Pairs closer than r_max around the ions with |r| < core: histogram [center type][partner type][bin], centers per type
+        public void PairHistogram(Double3[] pos, double r_max, double core, int bins, int[] histogram, int[] centers)
+        {
+            fixed (Double3* pp = pos)
+            fixed (int* ph = histogram)
+            fixed (int* pc = centers)
+                OneDLL.Check(OneDLL.PairHistogram(analysis, pp, r_max, core, bins, ph, pc));
+        }
+
+        private CPU_Analysis analysis;
+    }
+
+    // All-pairs forces split by rows over worker processes (PartitionWorker at address "shm:name" or "tcp:host:port",
+    // see CPUOne\Partition.h); the constructor waits up to timeout seconds for the workers, max_ions bounds Init
+    public unsafe class Partition : IDisposable
+    {
+        public Partition(string address, int workers, int max_ions, double timeout)
+        {
+            this.workers = workers;
+            fixed (CPU_Partition* pp = &partition)
+                OneDLL.Check(OneDLL.CreatePartition(address, workers, max_ions, timeout, pp));
+        }
+        public void Dispose() { OneDLL.ReleasePartition(partition); partition = new CPU_Partition(); }
+
+        public int Workers { get { return workers; } }
+        public void Init(string form, EnginePrecision precision, double cutoff, int[] type, double[] coefs, int types, int ions)
+        {
+            fixed (int* pt = type)
+            fixed (double* pc = coefs)
+                OneDLL.Check(OneDLL.InitPartition(partition, form, (int)precision, cutoff, pt, pc, types, ions));
+        }
+        public void Force(Double3[] pos, Double3[] acc)
+        {
+            fixed (Double3* pp = pos)
+            fixed (Double3* pa = acc)
+                OneDLL.Check(OneDLL.PartitionForce(partition, pp, pa));
+        }
+        public double Energy(Double3[] pos, Double3[] acc)
+        {
+            double energy;
+            fixed (Double3* pp = pos)
+            fixed (Double3* pa = acc)
+                OneDLL.Check(OneDLL.PartitionEnergy(partition, pp, pa, &energy));
+            return energy;
+        }
+        // Rows [bounds[w], bounds[w + 1]) of worker w and its compute time in the last call
+        public void GetRows(int[] bounds, double[] seconds)
+        {
+            fixed (int* pb = bounds)
+            fixed (double* ps = seconds)
+                OneDLL.Check(OneDLL.GetPartitionRows(partition, pb, ps));
+        }
+
+        private CPU_Partition partition;
+        private int workers;
+    }
+
+    // Independent systems computed by one parallel job, bitwise the same forces as an Engine per system (all terms, see
+    // CPUOne\Ensemble.h). InitSystem with system == Systems adds one; Compute takes the positions set since the last call.
+    public unsafe class Ensemble : IDisposable
+    {
+        public Ensemble(EnginePrecision precision, double cutoff, int threads = 0)
+        {
+            fixed (CPU_Ensemble* pe = &ensemble)
+                OneDLL.Check(OneDLL.CreateEnsemble((int)precision, cutoff, threads, pe));
+        }
+        public void Dispose() { OneDLL.ReleaseEnsemble(ensemble); ensemble = new CPU_Ensemble(); }
+
+        public int Systems { get { return systems; } }
+        public void InitSystem(int system, string form, int[] type, double[] coefs, int types, int ions)
+        {
+            fixed (int* pt = type)
+            fixed (double* pc = coefs)
+                OneDLL.Check(OneDLL.InitEnsembleSystem(ensemble, system, form, pt, pc, types, ions));
+            if (system == systems) systems++;
+        }
+        public void SetPositions(int system, Double3[] pos)
+        {
+            fixed (Double3* pp = pos)
+                OneDLL.Check(OneDLL.SetSystemPositions(ensemble, system, pp));
+        }
+        public void Compute(double[] energies) // null: the forces only
+        {
+            fixed (double* pe = energies)
+                OneDLL.Check(OneDLL.ComputeEnsemble(ensemble, pe));
+        }
+        public void GetForces(int system, Double3[] acc)
+        {
+            fixed (Double3* pa = acc)
+                OneDLL.Check(OneDLL.GetSystemForces(ensemble, system, pa));
+        }
+
+        private CPU_Ensemble ensemble;
+        private int systems;
+    }
+}
@@ -0,0 +1,286 @@
+﻿using System;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using System.Xml.Linq;
+using M.Tools;
+
+namespace IDGPU
+{
+    // State of MDIBC for autosave and restart. The binary format (.simb, version 1, little endian):
+    //  header of HeaderSize bytes: magic "IDCK", version, header size, ions, edge-cells, step, autosave-step, 0,
+    //  T, timestep (doubles), offsets of the type, pos, origin and vel arrays (longs), material and potentials names
+    //  (ASCII, zero padded to NameSize);
+    //  arrays at multiples of Alignment: type as ions ints, pos, origin and vel as SoA: ions x, then ions y, ions z
+    //  (doubles), every column aligned.
+    // Write goes to a temporary file renamed over the target, so an interrupted autosave keeps the previous file, and
+    // CheckpointWriter writes on a background thread. Mapped reads the arrays in place from a memory-mapped file, after
+    // checking that the offsets of the header lie within it. The XML .sim of older versions is read by ReadSim.
+    public class Checkpoint
+    {
+        public const string Extension = ".simb";
+        public const int Version = 1, HeaderSize = 256, Alignment = 64, NameSize = 64;
+        private const uint Magic = 0x4B434449; // "IDCK"
+        public enum Field { Type, Pos, Origin, Vel }
+
+        public string Material, Potentials;
+        public int EdgeCells, Step, Autosave;
+        public double T, Timestep;
+        public int[] Type;
+        public Double3[] Pos, Origin, Vel;
+
+        public int Ions { get { return Type.Length; } }
+
+        // Layout of a file of the given number of ions
+        public static long Align(long offset) { return (offset + Alignment - 1) / Alignment * Alignment; }
+        public static long ColumnBytes(int ions) { return Align((long)ions * sizeof(double)); }
+        public static long Offset(Field f, int ions) // of the first column
+        {
+            return f == Field.Type ? HeaderSize : HeaderSize + Align((long)ions * sizeof(int)) + ((int)f - 1) * 3 * ColumnBytes(ions);
+        }
+        public static long Length(int ions) { return Offset(Field.Vel, ions) + 3 * ColumnBytes(ions); }
+
+        public unsafe void Write(string filename)
+        {
+            string temporary = filename + ".tmp";
+            int ions = Ions, column = (int)ColumnBytes(ions);
+            var buffer = new byte[Math.Max(HeaderSize, column)];
+            using (var s = new FileStream(temporary, FileMode.Create, FileAccess.Write, FileShare.None, 1 << 16))
+            {
+                // Header
+                using (var w = new BinaryWriter(new MemoryStream(buffer)))
+                {
+                    w.Write(Magic); w.Write(Version); w.Write(HeaderSize); w.Write(ions);
+                    w.Write(EdgeCells); w.Write(Step); w.Write(Autosave); w.Write(0);
+                    w.Write(T); w.Write(Timestep);
+                    foreach (Field f in Enum.GetValues(typeof(Field))) w.Write(Offset(f, ions));
+                    w.Write(Name(Material)); w.Write(Name(Potentials));
+                }
+                s.Write(buffer, 0, HeaderSize);
+
+                // Arrays, a column at a time through the buffer
+                Array.Clear(buffer, 0, buffer.Length);
+                fixed (byte* b = buffer)
+                {
+                    for (int i = 0; i < ions; i++) ((int*)b)[i] = Type[i];
+                    s.Write(buffer, 0, (int)Align(ions * sizeof(int)));
+                    foreach (var v in new[] { Pos, Origin, Vel })
+                        for (int axis = 0; axis < 3; axis++)
+                        {
+                            double* d = (double*)b;
+                            for (int i = 0; i < ions; i++) d[i] = axis == 0 ? v[i].x : axis == 1 ? v[i].y : v[i].z;
+                            s.Write(buffer, 0, column);
+                        }
+                }
+            }
+            if (File.Exists(filename)) File.Replace(temporary, filename, null);
+            else File.Move(temporary, filename);
+        }
+        private static byte[] Name(string name)
+        {
+            var bytes = new byte[NameSize];
+            Encoding.ASCII.GetBytes(name, 0, Math.Min(name.Length, NameSize - 1), bytes, 0);
+            return bytes;
+        }
+
+        // .simb through Mapped, or the XML .sim
+        public static Checkpoint Read(string filename)
+        {
+            if (!String.Equals(Path.GetExtension(filename), Extension, StringComparison.OrdinalIgnoreCase)) return ReadSim(filename);
+            using (var m = new Mapped(filename)) return m.ToCheckpoint();
+        }
+        public static Checkpoint ReadSim(string filename)
+        {
+            var root = XDocument.Load(filename).Root;
+            var ions = root.Element("Ions").Elements().ToArray();
+            var c = new Checkpoint {
+                Material = root.Attribute("material").Value, Potentials = root.Attribute("potentials").Value,
+                EdgeCells = root.Int("edge-cells"), T = root.Double("T"), Timestep = root.Double("timestep"),
+                Autosave = root.Int("autosave-step"), Step = root.Element("Ions").Int("step"),
+                Type = new int[ions.Length], Pos = new Double3[ions.Length], Origin = new Double3[ions.Length], Vel = new Double3[ions.Length] };
+            for (int i = 0; i < ions.Length; i++)
+            {
+                c.Type[i] = ions[i].Int("type");
+                var d = ions[i].Attribute("pos").Value.ToDoubleArray();
+                c.Pos[i] = new Double3(d[0], d[1], d[2]);
+                d = ions[i].Attribute("origin").Value.ToDoubleArray();
+                c.Origin[i] = new Double3(d[0], d[1], d[2]);
+                d = ions[i].Attribute("vel").Value.ToDoubleArray();
+                c.Vel[i] = new Double3(d[0], d[1], d[2]);
+            }
+            return c;
+        }
+        public static string ConvertSim(string filename) // returns the name of the .simb written next to the .sim
+        {
+            string simb = Path.ChangeExtension(filename, Extension);
+            ReadSim(filename).Write(simb);
+            return simb;
+        }
+
+        // Read-only view of a .simb: the header fields and pointers to the arrays in the mapped file
+        public unsafe class Mapped : IDisposable
+        {
+            public Mapped(string filename)
+            {
+                long length = new FileInfo(filename).Length;
+                if (length < HeaderSize) throw new InvalidDataException(filename + " is not a checkpoint"); // an empty file cannot be mapped
+                file = MemoryMappedFile.CreateFromFile(filename, FileMode.Open, null, 0, MemoryMappedFileAccess.Read);
+                try
+                {
+                    view = file.CreateViewAccessor(0, 0, MemoryMappedFileAccess.Read);
+                    view.SafeMemoryMappedViewHandle.AcquirePointer(ref data);
+                    if (*(uint*)data != Magic) throw new InvalidDataException(filename + " is not a checkpoint");
+                    if (*(int*)(data + 4) != Version) throw new InvalidDataException(filename + ": checkpoint version " + *(int*)(data + 4) + " is not supported");
+                    Validate(filename, length);
+                }
+                catch
+                {
+                    Dispose();
+                    throw;
+                }
+            }
+            public void Dispose()
+            {
+                if (data != null) view.SafeMemoryMappedViewHandle.ReleasePointer();
+                data = null;
+                if (view != null) view.Dispose();
+                file.Dispose();
+            }
+
+            // The pointers to the arrays come from the offsets of the header: every array must lie within the file
+            private void Validate(string filename, long length)
+            {
+                int ions = Ions;
+                if (*(int*)(data + 8) != HeaderSize || ions < 0) throw new InvalidDataException(filename + ": the checkpoint header is damaged");
+                foreach (Field f in Enum.GetValues(typeof(Field)))
+                {
+                    long offset = Offset(f), bytes = f == Field.Type ? (long)ions * sizeof(int) : 2 * ColumnBytes(ions) + (long)ions * sizeof(double);
+                    if (offset < HeaderSize || offset % Alignment != 0 || offset > length - bytes)
+                        throw new InvalidDataException(String.Format("{0}: the {1} array of {2} bytes at {3} is outside the checkpoint of {4} bytes (truncated or damaged)",
+                            filename, f, bytes, offset, length));
+                }
+            }
+
+            public int Ions { get { return *(int*)(data + 12); } }
+            public int EdgeCells { get { return *(int*)(data + 16); } }
+            public int Step { get { return *(int*)(data + 20); } }
+            public int Autosave { get { return *(int*)(data + 24); } }
+            public double T { get { return *(double*)(data + 32); } }
+            public double Timestep { get { return *(double*)(data + 40); } }
+            public string Material { get { return Name(80); } }
+            public string Potentials { get { return Name(80 + NameSize); } }
+            public int* Type { get { return (int*)(data + Offset(Field.Type)); } }
+            public double* Column(Field f, int axis) { return (double*)(data + Offset(f) + axis * ColumnBytes(Ions)); }
+
+            public Checkpoint ToCheckpoint()
+            {
+                int n = Ions;
+                var c = new Checkpoint {
+                    Material = Material, Potentials = Potentials, EdgeCells = EdgeCells, T = T, Timestep = Timestep,
+                    Autosave = Autosave, Step = Step, Type = new int[n], Pos = ToDouble3(Field.Pos), Origin = ToDouble3(Field.Origin), Vel = ToDouble3(Field.Vel) };
+                int* type = Type;
+                for (int i = 0; i < n; i++) c.Type[i] = type[i];
+                return c;
+            }
+            private Double3[] ToDouble3(Field f)
+            {
+                double* x = Column(f, 0), y = Column(f, 1), z = Column(f, 2);
+                var v = new Double3[Ions];
+                for (int i = 0; i < v.Length; i++) v[i] = new Double3(x[i], y[i], z[i]);
+                return v;
+            }
+            private long Offset(Field f) { return *(long*)(data + 48 + (int)f * 8); }
+            private string Name(int offset)
+            {
+                int length = 0;
+                while (length < NameSize && data[offset + length] != 0) length++;
+                return new string((sbyte*)data, offset, length, Encoding.ASCII);
+            }
+
+            private MemoryMappedFile file;
+            private MemoryMappedViewAccessor view;
+            private byte* data;
+        }
+    }
+
+    // Save takes a snapshot (arrays of its own, not shared with the simulation) and returns; a background thread writes
+    // it with Checkpoint.Write. Only the latest snapshot waits: one saved while the previous still waits replaces it
+    // (a later autosave supersedes it for a restart) and is counted in Skipped.
+    public class CheckpointWriter : IDisposable
+    {
+        public CheckpointWriter()
+        {
+            thread = new Thread(Run) { IsBackground = true, Name = "Checkpoint", Priority = ThreadPriority.BelowNormal };
+            thread.Start();
+        }
+
+        public int Written { get { return written; } }
+        public int Skipped { get { return skipped; } }
+        public Exception Error { get { return error; } } // of a failed write, thrown by the next Save
+
+        public void Save(Checkpoint snapshot, string filename)
+        {
+            if (error != null) throw new IOException("Checkpoint writer failed", error);
+            lock (sync)
+            {
+                if (pending != null) skipped++;
+                pending = snapshot;
+                pending_filename = filename;
+            }
+            signal.Set();
+        }
+
+        // Writes the snapshot that still waits
+        public void Dispose()
+        {
+            if (thread == null) return;
+            closing = true;
+            signal.Set();
+            thread.Join();
+            thread = null;
+            signal.Close();
+        }
+
+        private void Run()
+        {
+            for (; ; )
+            {
+                bool last = closing; // read before the snapshot: one saved before closing is taken below
+                Checkpoint c;
+                string filename;
+                lock (sync)
+                {
+                    c = pending; filename = pending_filename;
+                    pending = null; pending_filename = null;
+                }
+                if (c != null)
+                {
+                    try
+                    {
+                        c.Write(filename);
+                        written++;
+                    }
+                    catch (Exception e)
+                    {
+                        error = e;
+                    }
+                    continue;
+                }
+                if (last) break;
+                signal.WaitOne();
+            }
+        }
+
+        private object sync = new object();
+        private Checkpoint pending; // under sync
+        private string pending_filename;
+        private Thread thread;
+        private AutoResetEvent signal = new AutoResetEvent(false);
+        private volatile bool closing;
+        private volatile int written;
+        private int skipped; // the simulation thread only
+        private volatile Exception error;
+    }
+}
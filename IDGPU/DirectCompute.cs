@@ -28,18 +28,45 @@ namespace DirectCompute
     }
     public struct DC_Buffer
     {
-        int id;
+        int id, serial; // serial: of the pool (ResourcePool.h), a released handle stays invalid after its resource is reused
         IntPtr p_buffer, p_UAV, p_SRV;
-        DC_Buffer(int something) { id = -1; p_buffer = p_UAV = p_SRV = IntPtr.Zero; }
+        DC_Buffer(int something) { id = -1; serial = 0; p_buffer = p_UAV = p_SRV = IntPtr.Zero; }
         public void Release() { OneDLL.ReleaseBuffer(this); p_buffer = p_UAV = p_SRV = IntPtr.Zero; }
     }
     public struct DC_Texture2D
     {
-        int id;
+        int id, serial;
         IntPtr p_buffer, p_UAV, p_SRV;
-        DC_Texture2D(int something) { id = -1; p_buffer = p_UAV = p_SRV = IntPtr.Zero; }
+        DC_Texture2D(int something) { id = -1; serial = 0; p_buffer = p_UAV = p_SRV = IntPtr.Zero; }
         public void Release() { OneDLL.ReleaseTexture(this); p_buffer = p_UAV = p_SRV = IntPtr.Zero; }
     }
+    // Counters of an exported function of DX11One (Trace.h); gpu_ns is summed for DispatchShader while trace events are recorded
+    public struct CallStats
+    {
+        public long calls, bytes, wall_ns, gpu_ns;
+        public override string ToString()
+        {
+            return String.Format("{0} calls, {1:F3} MB, {2:F3} ms{3}", calls, bytes / 1048576.0, wall_ns * 1e-6, gpu_ns > 0 ? String.Format(", GPU {0:F3} ms", gpu_ns * 1e-6) : "");
+        }
+    }
+    // Lookups of the cache of compiled shaders of DX11One (ShaderCache.h)
+    public struct ShaderCacheStats
+    {
+        public long memory_hits, disk_hits, compiles, disk_writes;
+        public override string ToString()
+        {
+            return String.Format("{0} in memory, {1} on disk, {2} compiled, {3} stored", memory_hits, disk_hits, compiles, disk_writes);
+        }
+    }
+    // Reuse of released buffers and textures by DX11One (ResourcePool.h)
+    public struct ResourcePoolStats
+    {
+        public long hits, misses, idle_bytes, idle_resources;
+        public override string ToString()
+        {
+            return String.Format("{0} reused, {1} created, {2} idle ({3:F3} MB)", hits, misses, idle_resources, idle_bytes / 1048576.0);
+        }
+    }
 
     [Flags]
     public enum ShaderFlags
@@ -157,10 +184,22 @@ namespace DirectCompute
         }
         [DllImport(dll_filename, EntryPoint = "CreateDevice")]
         internal static extern int CreateDevice(D3D_DRIVER_TYPE driver_type, D3D_FEATURE_LEVEL level_wanted, DC_Device* device, DC_Context* context);
+        [DllImport(dll_filename, EntryPoint = "GetDeviceName")]
+        internal static extern int GetDeviceName(DC_Device device, sbyte* name, int length);
         [DllImport(dll_filename, EntryPoint = "CreateAndCompileShader")]
         internal static extern int CreateAndCompileShader(DC_Device device, string filename, string entry_point, string shader_profile, ShaderFlags flags, DC_Shader* shader);
         [DllImport(dll_filename, EntryPoint = "CompileShader")]
         internal static extern int CompileShader(DC_Device device, string filename, int shader_length, string entry_point, string shader_profile, ShaderFlags flags, DC_Shader* shader, out sbyte* errors);
+        [DllImport(dll_filename, EntryPoint = "LoadOrCompileShader")]
+        internal static extern int LoadOrCompileShader(DC_Device device, string filename, int shader_length, string entry_point, string shader_profile, ShaderFlags flags, DC_Shader* shader, out sbyte* errors);
+        [DllImport(dll_filename, EntryPoint = "SetShaderCache")]
+        internal static extern int SetShaderCache(string directory, long memory_capacity);
+        [DllImport(dll_filename, EntryPoint = "GetShaderCacheStats")]
+        internal static extern int GetShaderCacheStats(out ShaderCacheStats stats);
+        [DllImport(dll_filename, EntryPoint = "SetResourcePool")]
+        internal static extern int SetResourcePool(long idle_bytes);
+        [DllImport(dll_filename, EntryPoint = "GetResourcePoolStats")]
+        internal static extern int GetResourcePoolStats(out ResourcePoolStats stats);
 
         [DllImport(dll_filename, EntryPoint = "CreateRWBuffer")]
         internal static extern int CreateRWBuffer(DC_Device device, int element_size, int element_count, void* init_data, DC_Buffer* buffer);
@@ -174,6 +213,8 @@ namespace DirectCompute
         internal static extern int CreateConstantBuffer(DC_Device device, int length, DC_Buffer* buffer);
         [DllImport(dll_filename, EntryPoint = "CreateInputTexture2D")]
         internal static extern int CreateInputTexture2D(DC_Device device, int width, int height, ResourceFormat format, void* init_data, DC_Texture2D* buffer);
+        [DllImport(dll_filename, EntryPoint = "CreateRWTexture2D")]
+        internal static extern int CreateRWTexture2D(DC_Device device, int width, int height, ResourceFormat format, void* init_data, DC_Texture2D* buffer);
 
         [DllImport(dll_filename, EntryPoint = "WriteToBuffer")]
         internal static extern int WriteToBuffer(DC_Context context, DC_Buffer destination, void* source, int length);
@@ -183,6 +224,14 @@ namespace DirectCompute
         internal static extern int CopyBuffer(DC_Context context, DC_Buffer destination, DC_Buffer source);
         [DllImport(dll_filename, EntryPoint = "GetResults")]
         internal static extern int GetResults(DC_Context context, DC_Buffer staging_buffer, DC_Buffer buffer, void* destination, int length);
+        [DllImport(dll_filename, EntryPoint = "BeginReadback")]
+        internal static extern int BeginReadback(DC_Context context, DC_Buffer buffer, int length, out int readback);
+        [DllImport(dll_filename, EntryPoint = "TryEndReadback")]
+        internal static extern int TryEndReadback(DC_Context context, int readback, void* destination, int length);
+        [DllImport(dll_filename, EntryPoint = "WaitReadback")]
+        internal static extern int WaitReadback(DC_Context context, int readback, void* destination, int length);
+        [DllImport(dll_filename, EntryPoint = "ReadTexture2D")]
+        internal static extern int ReadTexture2D(DC_Context context, DC_Texture2D texture, void* destination, int width, int height, int element_size);
 
         [DllImport(dll_filename, EntryPoint = "SetRBuffers")]
         internal static extern int SetRBuffers(DC_Context context, DC_Buffer[] r_buffers, int count);
@@ -192,6 +241,8 @@ namespace DirectCompute
         internal static extern int SetCBuffers(DC_Context context, DC_Buffer[] c_buffers, int count);
         [DllImport(dll_filename, EntryPoint = "SetRWBuffers")]
         internal static extern int SetRWBuffers(DC_Context context, DC_Buffer[] rw_buffers, int count);
+        [DllImport(dll_filename, EntryPoint = "SetRWBuffersAndTextures")]
+        internal static extern int SetRWBuffersAndTextures(DC_Context context, DC_Buffer[] rw_buffers, int rw_count, DC_Texture2D[] textures, int t_count);
         [DllImport(dll_filename, EntryPoint = "DispatchShader")]
         internal static extern int DispatchShader(DC_Context context, DC_Shader shader, int thread_group_x, int thread_group_y, int thread_group_z);
         [DllImport(dll_filename, EntryPoint = "UnbindResources")]
@@ -209,6 +260,17 @@ namespace DirectCompute
         [DllImport(dll_filename, EntryPoint = "DecodeError")]
         internal static extern int DecodeError(int hresult, out sbyte* output);
 
+        [DllImport(dll_filename, EntryPoint = "GetStats")]
+        internal static extern int GetStats([Out] CallStats[] stats, int count);
+        [DllImport(dll_filename, EntryPoint = "GetCallName")]
+        internal static extern int GetCallName(int call, out sbyte* name);
+        [DllImport(dll_filename, EntryPoint = "ResetStats")]
+        internal static extern int ResetStats();
+        [DllImport(dll_filename, EntryPoint = "SetTraceEvents")]
+        internal static extern int SetTraceEvents(int capacity);
+        [DllImport(dll_filename, EntryPoint = "WriteTrace")]
+        internal static extern int WriteTrace(string filename);
+
         internal static void Check(int hresult)
         {
             if (hresult < 0)
@@ -235,6 +297,35 @@ namespace DirectCompute
         }
         public void Dispose() { OneDLL.Dispose(); }
 
+        public string Name // adapter and its vendor:device ids
+        {
+            get
+            {
+                var name = stackalloc sbyte[256];
+                OneDLL.Check(OneDLL.GetDeviceName(device, name, 256));
+                return new string(name);
+            }
+        }
+
+        // Counters of the functions that have been called, by name
+        public Dictionary<string, CallStats> Stats
+        {
+            get
+            {
+                var stats = new CallStats[64];
+                OneDLL.Check(OneDLL.GetStats(stats, stats.Length));
+                var named = new Dictionary<string, CallStats>();
+                sbyte* name;
+                for (int k = 0; k < stats.Length && OneDLL.GetCallName(k, out name) >= 0; k++)
+                    if (stats[k].calls > 0) named[new string(name)] = stats[k];
+                return named;
+            }
+        }
+        public void ResetStats() { OneDLL.Check(OneDLL.ResetStats()); }
+        // Keeps the last calls for WriteTrace (Chrome trace JSON: chrome://tracing, ui.perfetto.dev), 0 stops
+        public int TraceEvents { set { OneDLL.Check(OneDLL.SetTraceEvents(value)); } }
+        public void WriteTrace(string filename) { OneDLL.Check(OneDLL.WriteTrace(filename)); }
+
         public Kernel CreateAndCompileShader(string filename, string entry_point, string shader_profile, ShaderFlags flags)
         {
             DC_Shader shader;
@@ -251,6 +342,16 @@ namespace DirectCompute
             OneDLL.Check(hresult);
             return new Kernel(context, shader);
         }
+        // CompileShader through the cache of bytecode: compiles only sources (with their defines) it has not seen
+        public Kernel LoadOrCompileShader(string source, string entry_point, string shader_profile, ShaderFlags flags)
+        {
+            DC_Shader shader;
+            sbyte* errors_bytes;
+            int hresult = OneDLL.LoadOrCompileShader(device, source, source.Length, entry_point, shader_profile, flags, &shader, out errors_bytes);
+            if (hresult < 0) System.Windows.Forms.MessageBox.Show(new string(errors_bytes));
+            OneDLL.Check(hresult);
+            return new Kernel(context, shader);
+        }
         public DC_Buffer CreateRWBuffer(int element_size, int element_count, void* init_data)
         {
             DC_Buffer buffer;
@@ -288,6 +389,12 @@ namespace DirectCompute
             OneDLL.Check(OneDLL.CreateInputTexture2D(device, w, h, format, init_data, &texture));
             return texture;
         }
+        public DC_Texture2D CreateRWTexture2D(int w, int h, ResourceFormat format, void* init_data)
+        {
+            DC_Texture2D texture;
+            OneDLL.Check(OneDLL.CreateRWTexture2D(device, w, h, format, init_data, &texture));
+            return texture;
+        }
 
 
         public void WriteToBuffer(DC_Buffer destination, void* source, int length_in_bytes)
@@ -311,6 +418,28 @@ namespace DirectCompute
         {
             OneDLL.Check(OneDLL.GetResults(context, staging_buffer, buffer, destination, length));
         }
+        // Asynchronous readback: the copy of the first length bytes of the buffer is queued, the handle is polled by
+        // TryEndReadback (false while in flight) or waited for; a few readbacks can be in flight at once
+        public int BeginReadback(DC_Buffer buffer, int length)
+        {
+            int readback;
+            OneDLL.Check(OneDLL.BeginReadback(context, buffer, length, out readback));
+            return readback;
+        }
+        public bool TryEndReadback(int readback, void* destination, int length)
+        {
+            int hresult = OneDLL.TryEndReadback(context, readback, destination, length);
+            OneDLL.Check(hresult);
+            return hresult == 0;
+        }
+        public void WaitReadback(int readback, void* destination, int length)
+        {
+            OneDLL.Check(OneDLL.WaitReadback(context, readback, destination, length));
+        }
+        public void ReadTexture(DC_Texture2D source, void* destination, int w, int h, int element_size)
+        {
+            OneDLL.Check(OneDLL.ReadTexture2D(context, source, destination, w, h, element_size));
+        }
         public void ReleaseBuffer(DC_Buffer b) { b.Release(); }
         public void UnbindResources()
         {
@@ -345,6 +474,10 @@ namespace DirectCompute
         {
             OneDLL.Check(OneDLL.SetRWBuffers(context, buffers, buffers == null ? 0 : buffers.Length));
         }
+        public void SetRWBuffers(DC_Buffer[] buffers, params DC_Texture2D[] textures)
+        {
+            OneDLL.Check(OneDLL.SetRWBuffersAndTextures(context, buffers, buffers == null ? 0 : buffers.Length, textures, textures == null ? 0 : textures.Length));
+        }
 
         public void Run(int thread_group_x, int thread_group_y, int thread_group_z)
         {
@@ -381,7 +514,7 @@ namespace DirectCompute
                 Kernel s = kernels.ContainsKey(entry_point) ? kernels[entry_point] : null;
                 //if (s != null && parameters == this.parameters) return s; // It is better not to recompile kernel, but it is implicitly binded to texture sizes
                 if (s != null) s.Dispose();
-                kernels[entry_point] = s = device.CompileShader(parameters + source, entry_point, "cs_5_0", flags);
+                kernels[entry_point] = s = device.LoadOrCompileShader(parameters + source, entry_point, "cs_5_0", flags);
                 this.parameters = parameters;
                 return s;
             }
@@ -391,6 +524,24 @@ namespace DirectCompute
         }
 
         public static ShaderFlags flags = ShaderFlags.OPTIMIZATION_LEVEL1; // | ShaderFlags.ENABLE_STRICTNESS;
+        // Directory of the compiled shaders kept between runs ("": memory only) and the megabytes kept in memory
+        public static void SetCache(string directory, int memory_mb)
+        {
+            OneDLL.Check(OneDLL.SetShaderCache(directory, memory_mb * 1048576L));
+        }
+        public static ShaderCacheStats CacheStats
+        {
+            get { ShaderCacheStats stats; OneDLL.Check(OneDLL.GetShaderCacheStats(out stats)); return stats; }
+        }
+        // Megabytes of released buffers and textures kept for the next Init, 0 frees them at once
+        public static void SetPool(int idle_mb)
+        {
+            OneDLL.Check(OneDLL.SetResourcePool(idle_mb * 1048576L));
+        }
+        public static ResourcePoolStats PoolStats
+        {
+            get { ResourcePoolStats stats; OneDLL.Check(OneDLL.GetResourcePoolStats(out stats)); return stats; }
+        }
         public static Device Device
         {
             get { return device ?? (device = new Device(true)); }
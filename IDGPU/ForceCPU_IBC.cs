@@ -19,7 +19,7 @@ namespace IDGPU
             double[] coefs = pp.CoefsDouble8;
             for (int i = 0; i < types * types; i++)
             {
-                int length = coefs.Length / (types * types);
+                const int length = 8; // Buckingham4 appends its spline, read from pp.Terms(0, 0) here
                 this.coefs2D[i] = new double[length];
                 for (int j = 0; j < length; j++)
                     this.coefs2D[i][j] = coefs[i * length + j];
@@ -28,6 +28,7 @@ namespace IDGPU
             {
                 case "Buckingham": force = new Buckingham_Force(); force_energy = new Buckingham_ForceEnergy(); break;
                 case "BuckinghamMorse": force = new BuckinghamMorse_Force(); force_energy = new BuckinghamMorse_ForceEnergy(); break;
+                case "Buckingham4": force = new Buckingham4_Force(pp.Terms(0, 0)); force_energy = new Buckingham4_ForceEnergy(pp.Terms(0, 0)); break;
                 default: throw new NotImplementedException("Unknown potential form: " + pp.Form);
             }
             return 0;
@@ -117,16 +118,20 @@ namespace IDGPU
                 return dU;
             }
         }
+        // O-O (type_ij 0): the Range2/Range3 polynomials of the .spp file below Bounds, the dispersion above
         protected class Buckingham4_Force : Potential
         {
+            public Buckingham4_Force(PairPotentials.PairTerms oo) { this.oo = oo; }
+            private PairPotentials.PairTerms oo;
+
             public override double PairInteraction(ref double U, int type_ij, double[] c, double R)
             {
                 double r = 1 / R, r2 = r * r, dU = c[0] * r2 * r;
                 switch (type_ij)
                 {
                     case 0:
-                        if (R < 2.1) dU -= ((((-27.244726 * 5 * R + 246.43471 * 4) * R - 881.96861 * 3) * R + 1562.2235 * 2) * R - 1372.5306) * r;
-                        else if (R < 2.6) dU -= ((-3.1313949 * 3 * R + 23.077354 * 2) * R - 55.496531) * r;
+                        if (R < oo.Bounds[0]) dU -= oo.Range2.Derivative(R) * r;
+                        else if (R < oo.Bounds[1]) dU -= oo.Range3.Derivative(R) * r;
                         else if (cutoff == 0 || R < cutoff) dU -= 6 * c[3] * r2 * r2 * r2 * r2;
                         break;
                     case 1:
@@ -139,6 +144,9 @@ namespace IDGPU
         }
         protected class Buckingham4_ForceEnergy : Potential
         {
+            public Buckingham4_ForceEnergy(PairPotentials.PairTerms oo) { this.oo = oo; }
+            private PairPotentials.PairTerms oo;
+
             public override double PairInteraction(ref double U, int type_ij, double[] c, double R)
             {
                 double r = 1 / R, r2 = r * r, dU = c[0] * r2 * r;
@@ -146,15 +154,15 @@ namespace IDGPU
                 switch (type_ij)
                 {
                     case 0:
-                        if (R < 2.1)
+                        if (R < oo.Bounds[0])
                         {
-                            dU -= ((((-27.244726 * 5 * R + 246.43471 * 4) * R - 881.96861 * 3) * R + 1562.2235 * 2) * R - 1372.5306) * r;
-                            U += ((((-27.244726 * R + 246.43471) * R - 881.96861) * R + 1562.2235) * R - 1372.5306) * R + 479.95538;
+                            dU -= oo.Range2.Derivative(R) * r;
+                            U += oo.Range2.Eval(R);
                         }
-                        else if (R < 2.6)
+                        else if (R < oo.Bounds[1])
                         {
-                            dU -= ((-3.1313949 * 3 * R + 23.077354 * 2) * R - 55.496531) * r;
-                            U += ((-3.1313949 * R + 23.077354) * R - 55.496531) * R + 42.891691;
+                            dU -= oo.Range3.Derivative(R) * r;
+                            U += oo.Range3.Eval(R);
                         }
                         else if (cutoff == 0 || R < cutoff)
                         {
@@ -0,0 +1,103 @@
+using System;
+using System.Collections.Generic;
+using M.Tools;
+using CPUOne;
+
+namespace IDGPU
+{
+    public class ForceCPU_Native : ITunable, IDynamics, ISplitForce, IDisposable
+    {
+        public static double NeighborSkin = 0; // A, > 0: Born-Mayer, Morse and Buckingham4 O-O terms over Verlet neighbor lists
+        public static double TreeTheta = 0.2; // opening angle of the Coulomb tree, 0 < theta < 1
+        public static int TreeOrder = 2; // 0 monopole, 1 + dipole, 2 + quadrupole
+        public static Action<string> Output; // gets the error report of the tree
+        public static bool MixedPrecision = false; // the float techniques add up their float pair terms with Kahan sums
+        public static EnginePrecision PrecisionOf(bool single_precision)
+        {
+            return !single_precision ? EnginePrecision.Double : MixedPrecision ? EnginePrecision.Mixed : EnginePrecision.Single;
+        }
+
+        public ForceCPU_Native(bool single_precision, bool tree = false) { this.single_precision = single_precision; this.tree = tree; }
+
+        public string Name { get { return "CPU Native IBC" + (tree ? " tree" : "") + (single_precision ? " float" : ""); } }
+        public string InstructionSet { get { return engine == null ? "" : engine.InstructionSet; } }
+
+        // ITunable: the worker threads (unless CPUONE_THREADS says) and the tile of the triangle of pairs
+        public string Device { get { return device; } }
+        public string Form { get { return form; } }
+        public string Precision { get { return single_precision ? (MixedPrecision ? "mixed" : "float") : "double"; } }
+        public TuningParameters Tuning { get; set; }
+        public IEnumerable<TuningParameters> Candidates(int ions)
+        {
+            var threads = new List<int>();
+            for (int t = Environment.ProcessorCount; t >= 1; t /= 2) threads.Add(t);
+            foreach (int t in threads)
+                foreach (int tile in new[] { 32, 64, 128, 256, 512, 1024 })
+                    if (tile <= ions) yield return new TuningParameters { { "threads", t }, { "tile", tile } };
+        }
+        public int Granularity(string parameter) { return parameter == "tile" ? 16 : 0; }
+
+        public void Dispose() { if (engine != null) engine.Dispose(); engine = null; ions = 0; }
+        public void SetPositions(Double3[] pos, Double3[] acc) { this.pos = pos; this.acc = acc; }
+        public int Init(int[] type, PairPotentials pp, int types, int ions)
+        {
+            Dispose();
+            this.ions = ions;
+            engine = new ForceEngine(pp.Form, PrecisionOf(single_precision), ForceCPU_IBC.cutoff);
+            device = String.Format("CPU {0} x{1}", engine.InstructionSet, Environment.ProcessorCount);
+            form = (PotentialTable.Points > 0 ? "Table" : pp.Form) + (tree ? " tree" : "") + (NeighborSkin > 0 ? " lists" : "");
+            var p = Tuning ?? TuningDatabase.Default.Lookup(this, ions);
+            if (p != null)
+            {
+                if (Environment.GetEnvironmentVariable("CPUONE_THREADS") == null) engine.Threads = p.Get("threads", 0);
+                engine.TileSize = p.Get("tile", 0);
+            }
+            engine.NeighborSkin = NeighborSkin;
+            if (tree) engine.SetCoulombTree(TreeTheta, TreeOrder); // charges come from c0 of CoefsDouble8
+            if (PotentialTable.Points > 0) engine.SetPotentialTable(new PotentialTable(pp, types, ForceCPU_IBC.cutoff, PotentialTable.Points));
+            engine.Init(type, pp.CoefsDouble8, types, ions);
+            report_error = tree;
+            return ions;
+        }
+        public void Force()
+        {
+            engine.SetPositions(pos, ions);
+            engine.Force(acc);
+        }
+        public double Energy()
+        {
+            engine.SetPositions(pos, ions);
+            if (report_error) ReportTreeError();
+            return engine.Energy(acc);
+        }
+        public double Force(ForcePart part, bool energy)
+        {
+            engine.SetPositions(pos, ions);
+            return engine.Force(part, acc, energy);
+        }
+        private void ReportTreeError() // at the positions of the engine
+        {
+            report_error = false;
+            double rms, max;
+            int samples = Math.Min(ions, 1000);
+            engine.GetCoulombTreeError(samples, out rms, out max);
+            if (Output != null)
+                Output(String.Format("\r\nCoulomb tree: theta {0}, order {1}, force error vs all-pairs: rms {2:E2}, max {3:E2} of rms force ({4} ions)",
+                    TreeTheta, TreeOrder, rms, max, samples));
+        }
+
+        public void InitDynamics(Double3[] pos, Double3[] vel, double[] mass) { engine.InitDynamics(pos, vel, mass); }
+        public void Step(DynamicsParameters p, int steps, double[] temperatures, double[] energies)
+        {
+            engine.StepDynamics(p, steps, temperatures, energies);
+            if (report_error) ReportTreeError();
+        }
+        public void GetState(Double3[] pos, Double3[] vel) { engine.GetDynamics(pos, vel); }
+
+        private bool single_precision, tree, report_error;
+        private string device, form;
+        private int ions;
+        private Double3[] pos, acc;
+        private ForceEngine engine;
+    }
+}
@@ -2,12 +2,13 @@
 using System.Collections.Generic;
 using System.IO;
 using System.Linq;
+using System.Runtime.InteropServices;
 using M.Tools;
 using DirectCompute;
 
 namespace IDGPU
 {
-    public class ForceDX11_IBC : IForce, IDisposable
+    public class ForceDX11_IBC : ITunable, IDynamics, IDisposable
     {
         public static string parameters_filename;
         public static string ParametersFilename
@@ -27,78 +28,25 @@ namespace IDGPU
                 }
             }
         }
-        public static void OptimizeTiling(double timeout, Crystal c, Action<string> append_text)
-        {
-            float min_time = float.MaxValue;
-            int min_iterations = 3, w = -1, h = -1, min_w = -1, min_h = -1, ions = c.Ions;
-            Double3[] pos = c.Scale(5.5), acc = new Double3[ions];
-            var wh = new int[2];
-            var technique = new ForceDX11_IBC();
-
-            string filename = "tiling " + ions + ".wht", s;
-            if (File.Exists(filename)) File.Delete(filename);
-            File.AppendAllText(filename, "width\theight\ttime\titerations\tFictitious particles\r\n");
-
-            for (w = 4; w <= 256; w += 4)
-            {
-                h = (int)Math.Ceiling((double)ions / w);
-                if (h > 4096) continue;
-                wh[0] = w;
-                wh[1] = h;
-                texture_size[ions] = wh;
-                int total_ions = technique.Init(c.Type, MainForm.potentials.First().Value, 2, ions);
-                technique.SetPositions(pos, acc);
-
-                // Test the next set of parameters
-                int i;
-                var times = new List<float>();
-                var clock = new Clock();
-                float started = clock.ElapsedTime, min_time_w = float.MaxValue;
-                for (i = 0; i < min_iterations || clock.ElapsedTime - started < timeout; i++)
-                {
-                    float time = clock.ElapsedTime;
-                    technique.Force();
-                    times.Add(clock.ElapsedTime - time);
-                    min_time_w = Math.Min(min_time_w, clock.ElapsedTime - time);
-                }
-                // Compare results
-                if (min_time_w < min_time)
-                {
-                    min_w = w;
-                    min_h = h;
-                    min_time = min_time_w;
-                }
-
-                // Write results
-                times.Sort();
-                float median = times[times.Count / 2];
-                s = String.Format("{0}\t{1}\t{2:F6}\t{3:F6}\t{4}\t{5}\r\n", w, h, min_time_w, median, i, total_ions - ions);
-                append_text(s);
-                File.AppendAllText(filename, s);
-
-                technique.Dispose();
-            }
-            // Save optimal parameters
-            wh[0] = w = min_w;
-            wh[1] = h = min_h;
-            texture_size[ions] = wh;
-            s = String.Format("{0} {1} {2} // {3:F6}\r\n", ions, w, h, min_time);
-            append_text(s);
-            filename = Path.ChangeExtension(filename, "nwh");
-            if (File.Exists(filename)) File.Delete(filename);
-            File.WriteAllText(filename, s);
-        }
-
         static ForceDX11_IBC()
         {
             ParametersFilename = "Data\\Radeon6970.nwh";
         }
-        private static SortedDictionary<int, int[]> texture_size;
-        private static void SetTiling(int ions, out int width, out int height, out int threads, out int bj)
+        private static SortedDictionary<int, int[]> texture_size; // of the .nwh files, used if the device has not been tuned
+        public static bool MixedPrecision = false; // Kahan sums of the float pair terms and of the bj slices (compensated of the kernels)
+        private void SetTiling()
         {
-            threads = 64; bj = 10;
-            width = 384;
-            if (texture_size != null)
+            threads = 64; bj = 10; unroll = 2;
+            int width = 384;
+            var p = Tuning ?? TuningDatabase.Default.Lookup(this, ions);
+            if (p != null)
+            {
+                width = p.Get("width", width);
+                threads = p.Get("threads", threads);
+                bj = p.Get("bj", bj);
+                unroll = p.Get("unroll", unroll);
+            }
+            else if (texture_size != null)
             {
                 if (texture_size.ContainsKey(ions)) width = texture_size[ions][0];
                 else
@@ -107,14 +55,59 @@ namespace IDGPU
                     width = size[0]; // select parameters for the nearest number of ions
                 }
             }
-            height = (int)Math.Ceiling((double)ions / width);
-            while (width * height < ions) height++;
+            ww = width;
+            hh = (int)Math.Ceiling((double)ions / width);
+            while (ww * hh < ions) hh++;
+            unroll = ValidUnroll(unroll, ww, run_starts); // a database entry of nearby ions may not fit these types
+        }
+        // The kernels read the type and the coefs once per unroll texels, so unroll has to divide ww and the start of every
+        // run of a type; the largest such one up to the wanted unroll (1 always fits)
+        private static int ValidUnroll(int wanted, int width, int[] starts)
+        {
+            int u = Math.Max(wanted, 1);
+            while (u > 1 && (width % u != 0 || starts.Any(start => start % u != 0))) u--;
+            return u;
+        }
+        // Where the runs of the sorted types start, the fictitious ions (type 1) after the last one included
+        private static int[] RunStarts(int[] type, int ions)
+        {
+            var starts = new List<int>();
+            for (int i = 1; i < ions; i++) if (type[i] != type[i - 1]) starts.Add(i);
+            if (ions > 0 && type[ions - 1] != 1) starts.Add(ions);
+            return starts.ToArray();
         }
 
         public string Name { get { return "GPU DX11 IBC"; } }
 
+        // ITunable: the texture width, threads per group, the split of the rows (bj) and the texels per type read (unroll)
+        public string Device { get { return KernelRepository.Device.Name; } }
+        public string Form { get { return form; } }
+        public string Precision { get { return MixedPrecision ? "mixed" : "float"; } }
+        public TuningParameters Tuning { get; set; }
+        public IEnumerable<TuningParameters> Candidates(int ions)
+        {
+            foreach (int width in new[] { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 })
+            {
+                int height = (ions + width - 1) / width;
+                if (height > 4096 || width > 4 * ions) continue;
+                foreach (int threads in new[] { 32, 64, 128, 256 })
+                    foreach (int bj in new[] { 1, 2, 5, 10, 20, 40 })
+                    {
+                        if (bj > height) continue;
+                        foreach (int unroll in new[] { 1, 2, 4 })
+                        {
+                            // the types are those of the last Init (the Tuner inits first); without them only 1 is safe
+                            if (unroll > 1 && (run_ions != ions || ValidUnroll(unroll, width, run_starts) != unroll)) continue;
+                            yield return new TuningParameters { { "width", width }, { "threads", threads }, { "bj", bj }, { "unroll", unroll } };
+                        }
+                    }
+            }
+        }
+        public int Granularity(string parameter) { return parameter == "width" ? 4 : 0; }
+
         public void Dispose()
         {
+            ReleaseDynamics();
             ions = texels = bi = bj = cycles = threads = -1;
             if (!initialized) return; initialized = false;
             pos_gpu.Release();
@@ -123,6 +116,10 @@ namespace IDGPU
             force_gpu.Release();
             staging_buffer.Release();
             constants_gpu.Release();
+            if (table == null) return;
+            table_gpu.Release();
+            table_constants_gpu.Release();
+            table = null;
         }
 
         public void SetPositions(Double3[] pos, Double3[] acc) { this.pos = pos; this.acc = acc; }
@@ -132,14 +129,23 @@ namespace IDGPU
             device = KernelRepository.Device;
 
             this.ions = ions_ext;
-            SetTiling(ions, out ww, out hh, out threads, out bj);
+            run_starts = RunStarts(type, ions_ext); run_ions = ions_ext;
+            form = PotentialTable.Points > 0 ? "Table" : pp.Form;
+            SetTiling();
             this.texels = ww * hh;
             bi = (int)Math.Ceiling((double)texels / (threads * 4));
             cycles = (int)Math.Ceiling((double)hh / bj);
 
-            string definitions = String.Format("#define n {0}{3}#define threads {1}{3}#define types {2}{3}", texels, threads, types, Environment.NewLine);
+            definitions = String.Format("#define n {0}{4}#define threads {1}{4}#define types {2}{4}#define unroll {3}{4}", texels, threads, types, unroll, Environment.NewLine);
+            if (MixedPrecision) definitions += "#define compensated 1" + Environment.NewLine;
+            if (PotentialTable.Points == 0 && pp.Form == "Buckingham4") definitions += SplineDefinitions(pp.CoefsDouble8);
             string shader_filename = null;
-            switch (pp.Form)
+            if (PotentialTable.Points > 0)
+            {
+                table = new PotentialTable(pp, types, ForceCPU_IBC.cutoff, PotentialTable.Points);
+                shader_filename = "Kernels\\IBC-T.hlsl";
+            }
+            else switch (pp.Form)
             {
                 case "Buckingham": shader_filename = "Kernels\\IBC-B.hlsl"; break;
                 case "BuckinghamMorse": shader_filename = "Kernels\\IBC-BM.hlsl"; break;
@@ -155,8 +161,19 @@ namespace IDGPU
             pos_gpu = device.CreateInputTexture2D(ww, hh, ResourceFormat.R32G32B32A32_FLOAT, (void*)0);
             type_gpu = device.CreateInputTexture2D(ww, hh, ResourceFormat.R32_UINT, (void*)0);
             coefs_gpu = device.CreateInputTexture2D(2, 4, ResourceFormat.R32G32B32A32_FLOAT, (void*)0); // float4 * 8 = float8 * 4
-            float[] coefs_float = Array.ConvertAll(pp.CoefsDouble8, a => (float)a);
+            float[] coefs_float = Array.ConvertAll(table != null ? table.LongRange : pp.CoefsDouble8, a => (float)a);
             fixed (float* ptr = coefs_float) device.WriteToTexture(coefs_gpu, (void*)ptr, 2, 4, sizeof(float) * 4);
+            if (table != null)
+            {
+                // Row k of type pairs: float4 dU and float4 U cubics of the interval i at 2i and 2i + 1
+                int w = 2 * table.Intervals, h = types * types;
+                table_gpu = device.CreateInputTexture2D(w, h, ResourceFormat.R32G32B32A32_FLOAT, (void*)0);
+                float[] table_float = Array.ConvertAll(table.Coefs, a => (float)a);
+                fixed (float* ptr = table_float) device.WriteToTexture(table_gpu, (void*)ptr, w, h, sizeof(float) * 4);
+                float[] grid = new float[] { (float)table.R2Min, (float)table.Scale, table.Intervals - 1, (float)(table.Cutoff * table.Cutoff) };
+                table_constants_gpu = device.CreateConstantBuffer(grid.Length * 4);
+                fixed (float* ptr = grid) device.WriteToBuffer(table_constants_gpu, (void*)ptr, grid.Length * 4);
+            }
 
             // Output buffers
             force_gpu = device.CreateRWBuffer(16, texels * bj, (void*)0);
@@ -178,22 +195,39 @@ namespace IDGPU
             fixed (int* ptr = buffer_in_type) device.WriteToTexture(type_gpu, ptr, ww, hh, sizeof(int));
             return texels;
         }
+        // The O-O spline of Buckingham4 (the last 12 of CoefsDouble8) for IBC-B4.hlsl and the host kernels
+        private static string SplineDefinitions(double[] coefs)
+        {
+            Func<int, int, string> list = (start, count) => String.Join(", ", coefs.Skip(coefs.Length - 12 + start).Take(count).Select(a => ((float)a).ToString("R", System.Globalization.CultureInfo.InvariantCulture)).ToArray());
+            return String.Format("#define spline_range2 {0}{3}#define spline_range3 {1}{3}#define spline_bounds {2}{3}", list(0, 6), list(6, 4), list(10, 2), Environment.NewLine);
+        }
         private unsafe void RunKernel(Kernel kernel_NxN)
         {
             for (int i = 0; i < ions; i++) buffer_in_pos[i] = new Float4(pos[i]);
 
             fixed (Float4* ptr = buffer_in_pos) device.WriteToTexture(pos_gpu, ptr, ww, hh, sizeof(Float4));
 
-            kernel_NxN.SetRBuffers(null, pos_gpu, type_gpu, coefs_gpu);
-            kernel_NxN.SetCBuffers(constants_gpu);
+            DispatchPairs(kernel_NxN);
+            device.GetResults(staging_buffer, force_gpu, buffer_out, sizeof(Float4) * texels);
+            device.UnbindResources();
+        }
+        private void DispatchPairs(Kernel kernel_NxN)
+        {
+            if (table != null)
+            {
+                kernel_NxN.SetRBuffers(null, pos_gpu, type_gpu, coefs_gpu, table_gpu);
+                kernel_NxN.SetCBuffers(constants_gpu, table_constants_gpu);
+            }
+            else
+            {
+                kernel_NxN.SetRBuffers(null, pos_gpu, type_gpu, coefs_gpu);
+                kernel_NxN.SetCBuffers(constants_gpu);
+            }
             kernel_NxN.SetRWBuffers(force_gpu);
             kernel_NxN.Run(bi, bj, 1);
 
             // Reduction of array force_gpu
             if (bj > 1) kernel_sum.Run(null, null, new DC_Buffer[] { force_gpu }, bi, 1, 1);
-
-            device.GetResults(staging_buffer, force_gpu, buffer_out, sizeof(Float4) * texels);
-            device.UnbindResources();
         }
         public void Force()
         {
@@ -221,14 +255,138 @@ namespace IDGPU
             return energy * 0.5;
         }
 
-        private bool initialized = false;
+        // IDynamics: positions, velocities and masses stay on the device (Kernels\MD-VV.hlsl), pos_gpu becomes a RW texture
+        // and a step reads back only the temperature and the energy; GetState reads the state at output steps
+        [StructLayout(LayoutKind.Sequential)]
+        private struct DynamicsConstants // cDynamics
+        {
+            public float dt, T, tau, evaporation_r2;
+            public uint ions, ww, groups, slot;
+        }
+        public unsafe void InitDynamics(Double3[] pos, Double3[] vel, double[] mass)
+        {
+            ReleaseDynamics();
+            const string filename = "Kernels\\MD-VV.hlsl";
+            kernel_kick = KernelRepository.Get(filename, "Kick", definitions);
+            kernel_correct = KernelRepository.Get(filename, "Correct", definitions);
+            kernel_kinetic = KernelRepository.Get(filename, "Kinetic", definitions);
+            kernel_berendsen = KernelRepository.Get(filename, "Berendsen", definitions);
+            kernel_drift = KernelRepository.Get(filename, "Drift", definitions);
+            groups = (ions + threads - 1) / threads;
+
+            // Positions as float + the rounding remainder, velocities with the mass in w
+            var pos_lo = new Float4[texels];
+            var vel_mass = new Float4[texels];
+            for (int i = 0; i < ions; i++)
+            {
+                buffer_in_pos[i] = new Float4(pos[i]);
+                pos_lo[i] = new Float4((float)(pos[i].x - buffer_in_pos[i].x), (float)(pos[i].y - buffer_in_pos[i].y), (float)(pos[i].z - buffer_in_pos[i].z));
+                vel_mass[i] = new Float4(vel[i]) { w = (float)mass[buffer_in_type[i]] };
+            }
+            pos_gpu.Release();
+            fixed (Float4* ptr = buffer_in_pos) pos_gpu = device.CreateRWTexture2D(ww, hh, ResourceFormat.R32G32B32A32_FLOAT, ptr);
+            fixed (Float4* ptr = pos_lo) pos_lo_gpu = device.CreateRWBuffer(16, texels, ptr);
+            fixed (Float4* ptr = vel_mass) vel_gpu = device.CreateRWBuffer(16, texels, ptr);
+            partial_gpu = device.CreateRWBuffer(16, groups * 4 + 3, (void*)0);
+            dynamics_constants_gpu = device.CreateConstantBuffer(sizeof(DynamicsConstants));
+            history_length = 0;
+            dynamics = true;
+        }
+        public unsafe void Step(DynamicsParameters p, int steps, double[] temperatures, double[] energies)
+        {
+            if (!dynamics) throw new InvalidOperationException("InitDynamics has not been called");
+            if (steps > history_length)
+            {
+                if (history_length > 0) { history_gpu.Release(); history_staging.Release(); }
+                history_length = Math.Max(steps, 16);
+                history_gpu = device.CreateRWBuffer(16, history_length, (void*)0);
+                history_staging = device.CreateStagingBuffer(16, history_length);
+                history = new float[4 * history_length];
+            }
+            var c = new DynamicsConstants {
+                dt = (float)p.dt, T = (float)p.T, evaporation_r2 = (float)p.evaporation_r2,
+                ions = (uint)ions, ww = (uint)ww, groups = (uint)groups };
+            var rw = new DC_Buffer[] { vel_gpu, pos_lo_gpu, force_gpu, partial_gpu, history_gpu };
+            for (int k = 0; k < steps; k++)
+            {
+                int step = p.step + 1 + k;
+                DispatchPairs(step % p.energy_interval == 0 ? kernel_energy_NxN : kernel_force_NxN);
+                device.UnbindResources(); // pos_gpu is written below
+
+                c.tau = (float)(step < p.relaxation ? p.tau_relaxation : p.tau);
+                c.slot = (uint)k;
+                device.WriteToBuffer(dynamics_constants_gpu, &c, sizeof(DynamicsConstants));
+                kernel_kick.SetCBuffers(dynamics_constants_gpu);
+                kernel_kick.SetRWBuffers(rw, pos_gpu);
+                kernel_kick.Run(groups, 1, 1);
+                kernel_correct.Run(1, 1, 1);
+                kernel_kinetic.Run(groups, 1, 1);
+                kernel_berendsen.Run(1, 1, 1);
+                kernel_drift.Run(groups, 1, 1);
+                device.UnbindResources();
+            }
+            if (steps == 0) return;
+            device.GetResults(history_staging, history_gpu, history, sizeof(Float4) * steps);
+            for (int k = 0; k < steps; k++)
+            {
+                temperatures[k] = history[k * 4];
+                if ((p.step + 1 + k) % p.energy_interval == 0) energies[k] = history[k * 4 + 1];
+            }
+        }
+        public unsafe void GetState(Double3[] pos, Double3[] vel)
+        {
+            if (!dynamics) throw new InvalidOperationException("InitDynamics has not been called");
+            // Both buffers are copied while the texture is read, one wait for all of them
+            int length = sizeof(Float4) * ions;
+            int pos_readback = pos != null ? device.BeginReadback(pos_lo_gpu, length) : 0;
+            int vel_readback = vel != null ? device.BeginReadback(vel_gpu, length) : 0;
+            if (pos != null)
+            {
+                var pos_lo = new Float4[ions];
+                fixed (Float4* ptr = buffer_in_pos) device.ReadTexture(pos_gpu, ptr, ww, hh, sizeof(Float4));
+                fixed (Float4* ptr = pos_lo) device.WaitReadback(pos_readback, ptr, length);
+                for (int i = 0; i < ions; i++)
+                {
+                    pos[i].x = (double)buffer_in_pos[i].x + pos_lo[i].x;
+                    pos[i].y = (double)buffer_in_pos[i].y + pos_lo[i].y;
+                    pos[i].z = (double)buffer_in_pos[i].z + pos_lo[i].z;
+                }
+            }
+            if (vel != null)
+            {
+                var vel_mass = new Float4[ions];
+                fixed (Float4* ptr = vel_mass) device.WaitReadback(vel_readback, ptr, length);
+                for (int i = 0; i < ions; i++) vel[i] = new Double3(vel_mass[i].x, vel_mass[i].y, vel_mass[i].z);
+            }
+        }
+        private void ReleaseDynamics()
+        {
+            if (!dynamics) return; dynamics = false;
+            pos_lo_gpu.Release();
+            vel_gpu.Release();
+            partial_gpu.Release();
+            dynamics_constants_gpu.Release();
+            if (history_length > 0) { history_gpu.Release(); history_staging.Release(); }
+            history_length = 0;
+        }
+
+        private bool initialized = false, dynamics = false;
         private Device device;
+        private string definitions;
+        private Kernel kernel_kick, kernel_correct, kernel_kinetic, kernel_berendsen, kernel_drift;
+        private DC_Buffer pos_lo_gpu, vel_gpu, partial_gpu, history_gpu, history_staging, dynamics_constants_gpu;
+        private int groups, history_length;
+        private float[] history;
 
         private Kernel kernel_force_NxN, kernel_energy_NxN, kernel_sum;
-        private DC_Texture2D pos_gpu, type_gpu, coefs_gpu;
-        private DC_Buffer force_gpu, staging_buffer, constants_gpu;
+        private DC_Texture2D pos_gpu, type_gpu, coefs_gpu, table_gpu;
+        private DC_Buffer force_gpu, staging_buffer, constants_gpu, table_constants_gpu;
+        private PotentialTable table;
 
-        private int ions, texels, ww, hh, bi, bj, cycles, threads;
+        private int ions, texels, ww, hh, bi, bj, cycles, threads, unroll;
+        private int[] run_starts = new int[0]; // of the types of the last Init, for run_ions ions
+        private int run_ions = -1;
+        private string form;
         private int[] buffer_in_type;
         private Float4[] buffer_in_pos;
         private Double3[] pos, acc;
@@ -0,0 +1,71 @@
+﻿using System;
+using System.Collections.Generic;
+using M.Tools;
+using CPUOne;
+
+namespace IDGPU
+{
+    // Runs of a sweep batched into one CPUOne ensemble (CPUOne\Ensemble.h): MainForm takes "ensemble" consecutive runs
+    // of the configuration with this technique, every run gets a member (Add) as its technique, and every step Compute
+    // evaluates the forces of all of them in one parallel job before their MDIBC.Update. The members do not compute:
+    // Force leaves the forces of the last Compute in acc, Energy returns its energy.
+    public class ForceEnsemble : IDisposable
+    {
+        public static string Name(bool single_precision) { return "CPU Ensemble IBC" + (single_precision ? " float" : ""); }
+
+        public ForceEnsemble(bool single_precision)
+        {
+            this.single_precision = single_precision;
+            ensemble = new Ensemble(ForceCPU_Native.PrecisionOf(single_precision), ForceCPU_IBC.cutoff);
+        }
+        public void Dispose() { if (ensemble != null) ensemble.Dispose(); ensemble = null; }
+
+        public IForce Add()
+        {
+            var m = new Member(this, members.Count);
+            members.Add(m);
+            return m;
+        }
+        // The positions of every member as its MDIBC set them (MDIBC.SetForcePositions); energy: with the energies
+        public void Compute(bool energy)
+        {
+            foreach (var m in members)
+                if (m.pos != null) ensemble.SetPositions(m.system, m.pos);
+            if (energies.Length != members.Count) energies = new double[members.Count];
+            ensemble.Compute(energy ? energies : null);
+            foreach (var m in members)
+                if (m.acc != null) ensemble.GetForces(m.system, m.acc);
+            with_energy = energy;
+        }
+
+        private class Member : IForce
+        {
+            public Member(ForceEnsemble owner, int system) { this.owner = owner; this.system = system; }
+
+            public string Name { get { return ForceEnsemble.Name(owner.single_precision); } }
+            public int Init(int[] type, PairPotentials pp, int types, int ions)
+            {
+                // also from the parallel Update of the runs (MDIBC.Reorder)
+                lock (owner) owner.ensemble.InitSystem(system, pp.Form, type, pp.CoefsDouble8, types, ions);
+                return ions;
+            }
+            public void SetPositions(Double3[] pos, Double3[] acc) { this.pos = pos; this.acc = acc; }
+            public void Force() { }
+            public double Energy()
+            {
+                if (!owner.with_energy) throw new InvalidOperationException("The last ensemble step was computed without energies");
+                return owner.energies[system];
+            }
+            public void Dispose() { }
+
+            public Double3[] pos, acc;
+            public readonly int system;
+            private ForceEnsemble owner;
+        }
+
+        private Ensemble ensemble;
+        private bool single_precision, with_energy;
+        private List<Member> members = new List<Member>();
+        private double[] energies = new double[0];
+    }
+}
@@ -0,0 +1,72 @@
+﻿using System;
+using M.Tools;
+using CPUOne;
+
+namespace IDGPU
+{
+    // All-pairs forces of CPUOne split by rows over PartitionWorker processes on this machine or others
+    // (CPUOne\Partition.h). The workers quit when the partition is released, so it is kept over the runs of the
+    // configuration file and released by Release at the end; its messages hold up to MaxIons (0: the ions of the first run).
+    public class ForcePartitioned : IForce, IDisposable
+    {
+        public static string Address = "shm:idgpu"; // shm:name or tcp:host:port, as given to every PartitionWorker
+        public static int Workers = 2;
+        public static int MaxIons = 0;
+        public static double Timeout = 60; // s to wait for the workers
+        public static Action<string> Output; // gets the rows of every worker when they are cut again
+
+        public ForcePartitioned(bool single_precision) { this.single_precision = single_precision; }
+
+        public string Name { get { return "CPU Partitioned IBC" + (single_precision ? " float" : ""); } }
+
+        public static void Release() { if (partition != null) partition.Dispose(); partition = null; }
+
+        public void Dispose() { ions = 0; }
+        public void SetPositions(Double3[] pos, Double3[] acc) { this.pos = pos; this.acc = acc; }
+        public int Init(int[] type, PairPotentials pp, int types, int ions)
+        {
+            if (partition != null && (address != Address || partition.Workers != Workers)) Release();
+            if (partition == null)
+            {
+                address = Address;
+                partition = new Partition(Address, Workers, Math.Max(MaxIons, ions), Timeout);
+            }
+            partition.Init(pp.Form, ForceCPU_Native.PrecisionOf(single_precision), ForceCPU_IBC.cutoff, type, pp.CoefsDouble8, types, ions);
+            this.ions = ions;
+            bounds = new int[Workers + 1];
+            seconds = new double[Workers];
+            ReportRows();
+            return ions;
+        }
+        public void Force()
+        {
+            partition.Force(pos, acc);
+        }
+        public double Energy()
+        {
+            double energy = partition.Energy(pos, acc);
+            ReportRows();
+            return energy;
+        }
+        private void ReportRows()
+        {
+            var last = (int[])bounds.Clone();
+            partition.GetRows(bounds, seconds);
+            bool cut = false;
+            for (int w = 0; w <= Workers; w++) cut |= last[w] != bounds[w];
+            if (Output == null || !cut) return;
+            var s = String.Format("\r\n{0} workers at {1}, rows:", Workers, address);
+            for (int w = 0; w < Workers; w++)
+                s += String.Format(" [{0}, {1}) {2:F1} ms;", bounds[w], bounds[w + 1], seconds[w] * 1000);
+            Output(s);
+        }
+
+        private static Partition partition;
+        private static string address;
+        private bool single_precision;
+        private int ions;
+        private Double3[] pos, acc;
+        private int[] bounds;
+        private double[] seconds;
+    }
+}
@@ -1,4 +1,6 @@
 using System;
+using System.Collections.Generic;
+using System.Runtime.InteropServices;
 using M.Tools;
 
 namespace IDGPU
@@ -12,4 +14,45 @@ namespace IDGPU
         double Energy();
         void Dispose();
     }
+
+    // Techniques that also integrate: MDIBC hands them the state once (InitDynamics) and then runs whole steps on their
+    // side instead of Force + the managed integration ("native-step" of the configuration)
+    public interface IDynamics
+    {
+        void InitDynamics(Double3[] pos, Double3[] vel, double[] mass);
+        // temperatures[k]: T_system of step p.step + 1 + k, energies[k]: the potential energy on energy-interval steps
+        void Step(DynamicsParameters p, int steps, double[] temperatures, double[] energies);
+        void GetState(Double3[] pos, Double3[] vel); // either may be null
+    }
+
+    // Techniques that compute the short-range forces (the terms cut at the cutoff: Born-Mayer, Morse, Buckingham4 O-O)
+    // and the long-range ones (Coulomb, the uncut dispersion) separately, for the multiple time steps of MDIBC
+    // ("respa-outer"). Force writes the part only to acc of SetPositions and returns its energy if energy, else 0.
+    public enum ForcePart { Short, Long }
+    public interface ISplitForce : IForce
+    {
+        double Force(ForcePart part, bool energy);
+    }
+
+    // Techniques with launch parameters to tune (Tuning.cs): Init takes them from Tuning if it is set, else from
+    // TuningDatabase.Default for Device, Form and Precision, else its own defaults. The three keys are valid after Init.
+    public interface ITunable : IForce
+    {
+        string Device { get; } // the adapter with its ids, or the instruction set and the hardware threads
+        string Form { get; } // of the kernels: the potential form, "Table", ...
+        string Precision { get; }
+        TuningParameters Tuning { get; set; }
+        IEnumerable<TuningParameters> Candidates(int ions);
+        int Granularity(string parameter); // > 0: interpolated between the tuned numbers of ions, a multiple of it
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct DynamicsParameters
+    {
+        public double dt, T; // 1e-14 s, K
+        public double tau, tau_relaxation; // in steps
+        public double evaporation_r2; // A^2, see MDIBC.RevertEvaporatedParticles
+        public int step, relaxation, energy_interval; // step before the first one, steps of relaxation, steps
+        public int respa_outer; // > 1: the long-range forces every respa_outer steps (see MDIBC.Force)
+    }
 }
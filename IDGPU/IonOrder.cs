@@ -0,0 +1,73 @@
+﻿using System;
+using M.Tools;
+
+namespace IDGPU
+{
+    // Order of the ions along a Morton (Z-order) curve over the bounding cube of the cluster, within each block of one
+    // type (MDIBC sorts the ions by type), so that ions near each other in the arrays are near in space: the cells and
+    // lists of the CPU techniques, the tree and the tiles of the GPU kernels then touch fewer cache lines and tiles of
+    // near pairs. Locality is the cheap measure of how far the order has drifted: the mean distance between ions that
+    // follow each other in a type block.
+    public static class IonOrder
+    {
+        public const int Bits = 21; // per axis, 63 bits of a key
+
+        // order[k]: the index of the ion that goes to k; type blocks stay where they are
+        public static int[] Morton(Double3[] pos, int[] type)
+        {
+            int ions = pos.Length;
+            Double3 min = pos[0], max = pos[0];
+            for (int i = 1; i < ions; i++)
+            {
+                min.x = Math.Min(min.x, pos[i].x); min.y = Math.Min(min.y, pos[i].y); min.z = Math.Min(min.z, pos[i].z);
+                max.x = Math.Max(max.x, pos[i].x); max.y = Math.Max(max.y, pos[i].y); max.z = Math.Max(max.z, pos[i].z);
+            }
+            double edge = Math.Max(max.x - min.x, Math.Max(max.y - min.y, max.z - min.z));
+            double scale = edge > 0 ? ((1 << Bits) - 1) / edge : 0;
+
+            var keys = new ulong[ions];
+            var order = new int[ions];
+            for (int i = 0; i < ions; i++)
+            {
+                order[i] = i;
+                keys[i] = Spread((uint)((pos[i].x - min.x) * scale)) | Spread((uint)((pos[i].y - min.y) * scale)) << 1 |
+                          Spread((uint)((pos[i].z - min.z) * scale)) << 2;
+            }
+            for (int begin = 0, end; begin < ions; begin = end)
+            {
+                for (end = begin + 1; end < ions && type[end] == type[begin]; end++) ;
+                Array.Sort(keys, order, begin, end - begin);
+            }
+            return order;
+        }
+
+        // The mean distance between consecutive ions of the same type, in A
+        public static double Locality(Double3[] pos, int[] type)
+        {
+            double sum = 0;
+            int n = 0;
+            for (int i = 1; i < pos.Length; i++)
+                if (type[i] == type[i - 1]) { sum += (pos[i] - pos[i - 1]).Length(); n++; }
+            return n > 0 ? sum / n : 0;
+        }
+
+        // a[k] = a[order[k]] for every k, in place; temp holds a.Length items
+        public static void Permute<T>(T[] a, int[] order, T[] temp)
+        {
+            Array.Copy(a, temp, a.Length);
+            for (int k = 0; k < a.Length; k++) a[k] = temp[order[k]];
+        }
+
+        // The low Bits bits of x at every third bit
+        private static ulong Spread(uint x)
+        {
+            ulong v = x & 0x1FFFFF;
+            v = (v | v << 32) & 0x1F00000000FFFF;
+            v = (v | v << 16) & 0x1F0000FF0000FF;
+            v = (v | v << 8) & 0x100F00F00F00F00F;
+            v = (v | v << 4) & 0x10C30C30C30C30C3;
+            v = (v | v << 2) & 0x1249249249249249;
+            return v;
+        }
+    }
+}
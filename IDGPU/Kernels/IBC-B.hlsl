@@ -1,7 +1,14 @@
 // #define threads 256
+#ifndef unroll
+#define unroll 2 // texels per read of the type and the coefs: 1, 2 or 4, a run of a type starts at a multiple of 4
+#endif
+#ifndef compensated
+#define compensated 0 // 1: Kahan sums of the pair terms and of the bj slices (mixed precision of ForceDX11_IBC)
+#endif
+#define host_kernels IBC-B // native versions of these kernels for the host backend: DX11One\HostKernels.cpp
 
-#define FF { force_i0 += force_ij(pos_i0, pos[uint2(x, y)], CC1, CC2); force_i1 += force_ij(pos_i1, pos[uint2(x, y)], CC1, CC2); force_i2 += force_ij(pos_i2, pos[uint2(x, y)], CC1, CC2); force_i3 += force_ij(pos_i3, pos[uint2(x, y)], CC1, CC2); x++; }
-#define EE { force_i0 += energy_ij(pos_i0, pos[uint2(x, y)], CC1, CC2); force_i1 += energy_ij(pos_i1, pos[uint2(x, y)], CC1, CC2); force_i2 += energy_ij(pos_i2, pos[uint2(x, y)], CC1, CC2); force_i3 += energy_ij(pos_i3, pos[uint2(x, y)], CC1, CC2); x++; }
+#define FF { add(force_i0, comp_i0, force_ij(pos_i0, pos[uint2(x, y)], CC1, CC2)); add(force_i1, comp_i1, force_ij(pos_i1, pos[uint2(x, y)], CC1, CC2)); add(force_i2, comp_i2, force_ij(pos_i2, pos[uint2(x, y)], CC1, CC2)); add(force_i3, comp_i3, force_ij(pos_i3, pos[uint2(x, y)], CC1, CC2)); x++; }
+#define EE { add(force_i0, comp_i0, energy_ij(pos_i0, pos[uint2(x, y)], CC1, CC2)); add(force_i1, comp_i1, energy_ij(pos_i1, pos[uint2(x, y)], CC1, CC2)); add(force_i2, comp_i2, energy_ij(pos_i2, pos[uint2(x, y)], CC1, CC2)); add(force_i3, comp_i3, energy_ij(pos_i3, pos[uint2(x, y)], CC1, CC2)); x++; }
 
 cbuffer cTiling : register( b0 )
 {
@@ -14,6 +21,17 @@ Texture2D<float4> coefs : register ( t2 );
 
 RWStructuredBuffer<float4> force;
 
+// a += b; c keeps the rounding errors of the Kahan sum a - c (compensated 1), precise so that they are not folded away
+void add(inout float4 a, inout float4 c, float4 b)
+{
+#if compensated
+	precise float4 y = b - c, s = a + y, e = (s - a) - y;
+	c = e; a = s;
+#else
+	a += b;
+#endif
+}
+
 float4 force_ij(float4 pos_i, float4 pos_j, float4 c1, float4 c2)
 {
 	float3 R = pos_i.xyz - pos_j.xyz;
@@ -41,10 +59,10 @@ void ForceNxN(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID, uint3 tg : SV_Di
 	uint i = (t.x + g.x * threads) * 4, x = i % ww, y = i / ww;
 	if (i < n)
 	{
-		float4 pos_i0 = pos[uint2(x + 0, y)], force_i0 = 0;
-		float4 pos_i1 = pos[uint2(x + 1, y)], force_i1 = 0;
-		float4 pos_i2 = pos[uint2(x + 2, y)], force_i2 = 0;
-		float4 pos_i3 = pos[uint2(x + 3, y)], force_i3 = 0;
+		float4 pos_i0 = pos[uint2(x + 0, y)], force_i0 = 0, comp_i0 = 0;
+		float4 pos_i1 = pos[uint2(x + 1, y)], force_i1 = 0, comp_i1 = 0;
+		float4 pos_i2 = pos[uint2(x + 2, y)], force_i2 = 0, comp_i2 = 0;
+		float4 pos_i3 = pos[uint2(x + 3, y)], force_i3 = 0, comp_i3 = 0;
 		uint type_i = type[uint2(x, y)] * 2;
 
 		for (y = g.y; y < hh; y += bj)
@@ -54,14 +72,14 @@ void ForceNxN(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID, uint3 tg : SV_Di
 				uint k = type_i + type[uint2(x, y)];
 				float4 CC1 = coefs[uint2(0, k)], CC2 = coefs[uint2(1, k)];
 
-				FF FF
+				[unroll] for (uint u = 0; u < unroll; u++) FF
 			}
 		}
 
-		force[i + g.y * n + 0] = force_i0;
-		force[i + g.y * n + 1] = force_i1;
-		force[i + g.y * n + 2] = force_i2;
-		force[i + g.y * n + 3] = force_i3;
+		force[i + g.y * n + 0] = force_i0 - comp_i0;
+		force[i + g.y * n + 1] = force_i1 - comp_i1;
+		force[i + g.y * n + 2] = force_i2 - comp_i2;
+		force[i + g.y * n + 3] = force_i3 - comp_i3;
 	}
 }
 
@@ -71,10 +89,10 @@ void EnergyNxN(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID, uint3 tg : SV_D
 	uint i = (t.x + g.x * threads) * 4, x = i % ww, y = i / ww;
 	if (i < n)
 	{
-		float4 pos_i0 = pos[uint2(x + 0, y)], force_i0 = 0;
-		float4 pos_i1 = pos[uint2(x + 1, y)], force_i1 = 0;
-		float4 pos_i2 = pos[uint2(x + 2, y)], force_i2 = 0;
-		float4 pos_i3 = pos[uint2(x + 3, y)], force_i3 = 0;
+		float4 pos_i0 = pos[uint2(x + 0, y)], force_i0 = 0, comp_i0 = 0;
+		float4 pos_i1 = pos[uint2(x + 1, y)], force_i1 = 0, comp_i1 = 0;
+		float4 pos_i2 = pos[uint2(x + 2, y)], force_i2 = 0, comp_i2 = 0;
+		float4 pos_i3 = pos[uint2(x + 3, y)], force_i3 = 0, comp_i3 = 0;
 		uint type_i = type[uint2(x, y)] * 2;
 
 		for (y = g.y; y < hh; y += bj)
@@ -84,32 +102,32 @@ void EnergyNxN(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID, uint3 tg : SV_D
 				uint k = type_i + type[uint2(x, y)];
 				float4 CC1 = coefs[uint2(0, k)], CC2 = coefs[uint2(1, k)];
 
-				EE EE
+				[unroll] for (uint u = 0; u < unroll; u++) EE
 			}
 		}
 
-		force[i + g.y * n + 0] = force_i0;
-		force[i + g.y * n + 1] = force_i1;
-		force[i + g.y * n + 2] = force_i2;
-		force[i + g.y * n + 3] = force_i3;
+		force[i + g.y * n + 0] = force_i0 - comp_i0;
+		force[i + g.y * n + 1] = force_i1 - comp_i1;
+		force[i + g.y * n + 2] = force_i2 - comp_i2;
+		force[i + g.y * n + 3] = force_i3 - comp_i3;
 	}
 }
 
 [numthreads(threads, 1, 1)]
 void Sum(uint3 tg : SV_DispatchThreadID)
 {
-	float4 sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0; uint i = tg.x * 4;
+	float4 sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0, comp0 = 0, comp1 = 0, comp2 = 0, comp3 = 0; uint i = tg.x * 4;
 	if (i < n)
 	{
 		for (uint j = 0; j < bj; j++) {
-			sum0 += force[i + j * n + 0];
-			sum1 += force[i + j * n + 1];
-			sum2 += force[i + j * n + 2];
-			sum3 += force[i + j * n + 3];
+			add(sum0, comp0, force[i + j * n + 0]);
+			add(sum1, comp1, force[i + j * n + 1]);
+			add(sum2, comp2, force[i + j * n + 2]);
+			add(sum3, comp3, force[i + j * n + 3]);
 		}
-		force[i + 0] = sum0;
-		force[i + 1] = sum1;
-		force[i + 2] = sum2;
-		force[i + 3] = sum3;
+		force[i + 0] = sum0 - comp0;
+		force[i + 1] = sum1 - comp1;
+		force[i + 2] = sum2 - comp2;
+		force[i + 3] = sum3 - comp3;
 	}
 }
@@ -1,7 +1,19 @@
 // #define threads 256
+#ifndef unroll
+#define unroll 2 // texels per read of the type and the coefs: 1, 2 or 4, a run of a type starts at a multiple of 4
+#endif
+#ifndef compensated
+#define compensated 0 // 1: Kahan sums of the pair terms and of the bj slices (mixed precision of ForceDX11_IBC)
+#endif
+#define host_kernels IBC-B4 // native versions of these kernels for the host backend: DX11One\HostKernels.cpp
+#ifndef spline_range2 // the O-O spline of the potential set, defined by ForceDX11_IBC (Morelon-03 by default)
+#define spline_range2 -27.244726f, 246.43471f, -881.96861f, 1562.2235f, -1372.5306f, 479.95538f // U below spline_bounds[0], the 5th power first
+#define spline_range3 -3.1313949f, 23.077354f, -55.496531f, 42.891691f // U below spline_bounds[1]
+#define spline_bounds 2.1f, 2.6f
+#endif
 
-#define FF { force_i0 += force_ij(pos_i0, pos[uint2(x, y)], CC1, CC2, k); force_i1 += force_ij(pos_i1, pos[uint2(x, y)], CC1, CC2, k); force_i2 += force_ij(pos_i2, pos[uint2(x, y)], CC1, CC2, k); force_i3 += force_ij(pos_i3, pos[uint2(x, y)], CC1, CC2, k); x++; }
-#define EE { force_i0 += energy_ij(pos_i0, pos[uint2(x, y)], CC1, CC2, k); force_i1 += energy_ij(pos_i1, pos[uint2(x, y)], CC1, CC2, k); force_i2 += energy_ij(pos_i2, pos[uint2(x, y)], CC1, CC2, k); force_i3 += energy_ij(pos_i3, pos[uint2(x, y)], CC1, CC2, k); x++; }
+#define FF { add(force_i0, comp_i0, force_ij(pos_i0, pos[uint2(x, y)], CC1, CC2, k)); add(force_i1, comp_i1, force_ij(pos_i1, pos[uint2(x, y)], CC1, CC2, k)); add(force_i2, comp_i2, force_ij(pos_i2, pos[uint2(x, y)], CC1, CC2, k)); add(force_i3, comp_i3, force_ij(pos_i3, pos[uint2(x, y)], CC1, CC2, k)); x++; }
+#define EE { add(force_i0, comp_i0, energy_ij(pos_i0, pos[uint2(x, y)], CC1, CC2, k)); add(force_i1, comp_i1, energy_ij(pos_i1, pos[uint2(x, y)], CC1, CC2, k)); add(force_i2, comp_i2, energy_ij(pos_i2, pos[uint2(x, y)], CC1, CC2, k)); add(force_i3, comp_i3, energy_ij(pos_i3, pos[uint2(x, y)], CC1, CC2, k)); x++; }
 
 cbuffer cTiling : register( b0 )
 {
@@ -13,6 +25,18 @@ Texture2D<int> type : register ( t1 );
 Texture2D<float4> coefs : register ( t2 );
 
 RWStructuredBuffer<float4> force;
+static const float range2[6] = { spline_range2 }, range3[4] = { spline_range3 }, bounds[2] = { spline_bounds };
+
+// a += b; c keeps the rounding errors of the Kahan sum a - c (compensated 1), precise so that they are not folded away
+void add(inout float4 a, inout float4 c, float4 b)
+{
+#if compensated
+	precise float4 y = b - c, s = a + y, e = (s - a) - y;
+	c = e; a = s;
+#else
+	a += b;
+#endif
+}
 
 float4 force_ij(float4 pos_i, float4 pos_j, float4 c1, float4 c2, int type_ij)
 {
@@ -23,8 +47,8 @@ float4 force_ij(float4 pos_i, float4 pos_j, float4 c1, float4 c2, int type_ij)
 	{
         case 0:
             //if (_r < 1.2f) dU += c1.z * c1.y * exp(c1.z * _r) * r; else
-            if (_r < 2.1f) dU -= ((((-27.244726f * 5 * _r + 246.43471f * 4) * _r - 881.96861f * 3) * _r + 1562.2235f * 2) * _r - 1372.5306f) * r;
-            else if (_r < 2.6f) dU -= ((-3.1313949f * 3 * _r + 23.077354f * 2) * _r - 55.496531f) * r;
+            if (_r < bounds[0]) dU -= ((((range2[0] * 5 * _r + range2[1] * 4) * _r + range2[2] * 3) * _r + range2[3] * 2) * _r + range2[4]) * r;
+            else if (_r < bounds[1]) dU -= ((range3[0] * 3 * _r + range3[1] * 2) * _r + range3[2]) * r;
             else dU -= 6 * c1.w * r2 * r2 * r2 * r2;
             break;
         case 1:
@@ -46,15 +70,15 @@ float4 energy_ij(float4 pos_i, float4 pos_j, float4 c1, float4 c2, int type_ij)
 		switch (type_ij) // type_ij = (type_i * types=3 * 2) + (type_j[j] * 2) * 10
 		{
 			case 0:
-				if (_r < 2.1f)
+				if (_r < bounds[0])
 				{
-					dU -= ((((-27.244726f * 5 * _r + 246.43471f * 4) * _r - 881.96861f * 3) * _r + 1562.2235f * 2) * _r - 1372.5306f) * r;
-					energy += ((((-27.244726f * _r + 246.43471f) * _r - 881.96861f) * _r + 1562.2235f) * _r - 1372.5306f) * _r + 479.95538f;
+					dU -= ((((range2[0] * 5 * _r + range2[1] * 4) * _r + range2[2] * 3) * _r + range2[3] * 2) * _r + range2[4]) * r;
+					energy += ((((range2[0] * _r + range2[1]) * _r + range2[2]) * _r + range2[3]) * _r + range2[4]) * _r + range2[5];
 				}
-				else if (_r < 2.6f)
+				else if (_r < bounds[1])
 				{
-					dU -= ((-3.1313949f * 3 * _r + 23.077354f * 2) * _r - 55.496531f) * r;
-					energy += ((-3.1313949f * _r + 23.077354f) * _r - 55.496531f) * _r + 42.891691f;
+					dU -= ((range3[0] * 3 * _r + range3[1] * 2) * _r + range3[2]) * r;
+					energy += ((range3[0] * _r + range3[1]) * _r + range3[2]) * _r + range3[3];
 				}
 				else
 				{
@@ -78,10 +102,10 @@ void ForceNxN(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID, uint3 tg : SV_Di
 	uint i = (t.x + g.x * threads) * 4, x = i % ww, y = i / ww;
 	if (i < n)
 	{
-		float4 pos_i0 = pos[uint2(x + 0, y)], force_i0 = 0;
-		float4 pos_i1 = pos[uint2(x + 1, y)], force_i1 = 0;
-		float4 pos_i2 = pos[uint2(x + 2, y)], force_i2 = 0;
-		float4 pos_i3 = pos[uint2(x + 3, y)], force_i3 = 0;
+		float4 pos_i0 = pos[uint2(x + 0, y)], force_i0 = 0, comp_i0 = 0;
+		float4 pos_i1 = pos[uint2(x + 1, y)], force_i1 = 0, comp_i1 = 0;
+		float4 pos_i2 = pos[uint2(x + 2, y)], force_i2 = 0, comp_i2 = 0;
+		float4 pos_i3 = pos[uint2(x + 3, y)], force_i3 = 0, comp_i3 = 0;
 		uint type_i = type[uint2(x, y)] * 2;
 
 		for (y = g.y; y < hh; y += bj)
@@ -91,14 +115,14 @@ void ForceNxN(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID, uint3 tg : SV_Di
 				uint k = type_i + type[uint2(x, y)];
 				float4 CC1 = coefs[uint2(0, k)], CC2 = coefs[uint2(1, k)];
 
-				FF FF
+				[unroll] for (uint u = 0; u < unroll; u++) FF
 			}
 		}
 
-		force[i + g.y * n + 0] = force_i0;
-		force[i + g.y * n + 1] = force_i1;
-		force[i + g.y * n + 2] = force_i2;
-		force[i + g.y * n + 3] = force_i3;
+		force[i + g.y * n + 0] = force_i0 - comp_i0;
+		force[i + g.y * n + 1] = force_i1 - comp_i1;
+		force[i + g.y * n + 2] = force_i2 - comp_i2;
+		force[i + g.y * n + 3] = force_i3 - comp_i3;
 	}
 }
 
@@ -108,10 +132,10 @@ void EnergyNxN(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID, uint3 tg : SV_D
 	uint i = (t.x + g.x * threads) * 4, x = i % ww, y = i / ww;
 	if (i < n)
 	{
-		float4 pos_i0 = pos[uint2(x + 0, y)], force_i0 = 0;
-		float4 pos_i1 = pos[uint2(x + 1, y)], force_i1 = 0;
-		float4 pos_i2 = pos[uint2(x + 2, y)], force_i2 = 0;
-		float4 pos_i3 = pos[uint2(x + 3, y)], force_i3 = 0;
+		float4 pos_i0 = pos[uint2(x + 0, y)], force_i0 = 0, comp_i0 = 0;
+		float4 pos_i1 = pos[uint2(x + 1, y)], force_i1 = 0, comp_i1 = 0;
+		float4 pos_i2 = pos[uint2(x + 2, y)], force_i2 = 0, comp_i2 = 0;
+		float4 pos_i3 = pos[uint2(x + 3, y)], force_i3 = 0, comp_i3 = 0;
 		uint type_i = type[uint2(x, y)] * 2;
 
 		for (y = g.y; y < hh; y += bj)
@@ -121,32 +145,32 @@ void EnergyNxN(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID, uint3 tg : SV_D
 				uint k = type_i + type[uint2(x, y)];
 				float4 CC1 = coefs[uint2(0, k)], CC2 = coefs[uint2(1, k)];
 
-				EE EE
+				[unroll] for (uint u = 0; u < unroll; u++) EE
 			}
 		}
 
-		force[i + g.y * n + 0] = force_i0;
-		force[i + g.y * n + 1] = force_i1;
-		force[i + g.y * n + 2] = force_i2;
-		force[i + g.y * n + 3] = force_i3;
+		force[i + g.y * n + 0] = force_i0 - comp_i0;
+		force[i + g.y * n + 1] = force_i1 - comp_i1;
+		force[i + g.y * n + 2] = force_i2 - comp_i2;
+		force[i + g.y * n + 3] = force_i3 - comp_i3;
 	}
 }
 
 [numthreads(threads, 1, 1)]
 void Sum(uint3 tg : SV_DispatchThreadID)
 {
-	float4 sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0; uint i = tg.x * 4;
+	float4 sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0, comp0 = 0, comp1 = 0, comp2 = 0, comp3 = 0; uint i = tg.x * 4;
 	if (i < n)
 	{
 		for (uint j = 0; j < bj; j++) {
-			sum0 += force[i + j * n + 0];
-			sum1 += force[i + j * n + 1];
-			sum2 += force[i + j * n + 2];
-			sum3 += force[i + j * n + 3];
+			add(sum0, comp0, force[i + j * n + 0]);
+			add(sum1, comp1, force[i + j * n + 1]);
+			add(sum2, comp2, force[i + j * n + 2]);
+			add(sum3, comp3, force[i + j * n + 3]);
 		}
-		force[i + 0] = sum0;
-		force[i + 1] = sum1;
-		force[i + 2] = sum2;
-		force[i + 3] = sum3;
+		force[i + 0] = sum0 - comp0;
+		force[i + 1] = sum1 - comp1;
+		force[i + 2] = sum2 - comp2;
+		force[i + 3] = sum3 - comp3;
 	}
 }
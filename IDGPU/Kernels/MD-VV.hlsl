@@ -0,0 +1,153 @@
+// #define threads 64
+#define host_kernels MD-VV // native versions of these kernels for the host backend: DX11One\HostKernels.cpp
+
+// Integration of MDIBC.Update on the device (ForceDX11_IBC as IDynamics): positions, velocities and masses stay in
+// device memory between steps, one step is ForceNxN/EnergyNxN (and Sum) of IBC-*.hlsl and then
+//  Kick:      v += f dt / m, per-group sums of the impulse, angular momentum, positions, inertia tensor and energy;
+//  Correct:   one group: impulse per ion and angular velocity w = I^-1 (L - R x P) from the sums, as CPUOne\Dynamics.cpp;
+//  Kinetic:   v -= impulse / m + w x r, per-group sums of m v^2;
+//  Berendsen: one group: T_system and the Berendsen scale, T_system and the energy into history[slot];
+//  Drift:     v *= scale, r += v dt, evaporation guard.
+// Positions are the float texture of the pair kernels plus the rounding remainder in pos_lo, so the drift of many
+// steps does not lose the small increments v dt against the coordinate.
+
+#define Kb 8.617342791E-5f // eV / K, the same as MDIBC.Kb
+
+cbuffer cDynamics : register( b0 )
+{
+	float dt, T, tau, evaporation_r2; // tau of the current step (tau-t or tau-t-relaxation)
+	uint ions, ww, groups, slot; // slot: element of history for the current step
+}
+
+RWStructuredBuffer<float4> vel : register( u0 ); // xyz, w = mass
+RWStructuredBuffer<float4> pos_lo : register( u1 );
+RWStructuredBuffer<float4> force : register( u2 ); // the first slice after Sum, w = energy of the ion
+RWStructuredBuffer<float4> partial : register( u3 ); // 4 per group, then P, w and (scale, T_system) at groups * 4
+RWStructuredBuffer<float4> history : register( u4 ); // per step of a call: T_system, potential energy
+RWTexture2D<float4> pos : register( u5 );
+
+// partial sums: (impulse, energy), (moment, -m xy), (position, -m yz), (m (yy + zz), m (xx + zz), m (xx + yy), -m xz)
+groupshared float4 s0[threads], s1[threads], s2[threads], s3[threads];
+
+float3 position(uint i)
+{
+	return pos[uint2(i % ww, i / ww)].xyz + pos_lo[i].xyz;
+}
+void Reduce(uint t, bool all)
+{
+	for (uint k = threads / 2; k > 0; k >>= 1)
+	{
+		GroupMemoryBarrierWithGroupSync();
+		if (t < k)
+		{
+			s0[t] += s0[t + k];
+			if (all) { s1[t] += s1[t + k]; s2[t] += s2[t + k]; s3[t] += s3[t + k]; }
+		}
+	}
+	GroupMemoryBarrierWithGroupSync();
+}
+
+[numthreads(threads, 1, 1)]
+void Kick(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID)
+{
+	uint i = g.x * threads + t.x;
+	float4 a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+	if (i < ions)
+	{
+		float4 v = vel[i], f = force[i];
+		float m = v.w;
+		float3 r = position(i), u = v.xyz + f.xyz * (dt / m);
+		vel[i] = float4(u, m);
+		a0 = float4(m * u, f.w);
+		a1 = float4(m * cross(r, u), -m * r.x * r.y);
+		a2 = float4(r, -m * r.y * r.z);
+		a3 = float4(m * (r.y * r.y + r.z * r.z), m * (r.x * r.x + r.z * r.z), m * (r.x * r.x + r.y * r.y), -m * r.x * r.z);
+	}
+	s0[t.x] = a0; s1[t.x] = a1; s2[t.x] = a2; s3[t.x] = a3;
+	Reduce(t.x, true);
+	if (t.x == 0)
+	{
+		partial[g.x * 4 + 0] = s0[0];
+		partial[g.x * 4 + 1] = s1[0];
+		partial[g.x * 4 + 2] = s2[0];
+		partial[g.x * 4 + 3] = s3[0];
+	}
+}
+
+[numthreads(threads, 1, 1)]
+void Correct(uint3 t : SV_GroupThreadID)
+{
+	float4 a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+	for (uint k = t.x; k < groups; k += threads)
+	{
+		a0 += partial[k * 4 + 0];
+		a1 += partial[k * 4 + 1];
+		a2 += partial[k * 4 + 2];
+		a3 += partial[k * 4 + 3];
+	}
+	s0[t.x] = a0; s1[t.x] = a1; s2[t.x] = a2; s3[t.x] = a3;
+	Reduce(t.x, true);
+	if (t.x == 0)
+	{
+		float3 P = s0[0].xyz / ions, L = s1[0].xyz - cross(s2[0].xyz, P);
+		float xx = s3[0].x, yy = s3[0].y, zz = s3[0].z, xy = s1[0].w, yz = s2[0].w, xz = s3[0].w;
+		float c0 = yy * zz - yz * yz, c1 = xz * yz - xy * zz, c2 = xy * yz - yy * xz;
+		float3x3 inv = float3x3(
+			c0, c1, c2,
+			c1, xx * zz - xz * xz, xy * xz - xx * yz,
+			c2, xy * xz - xx * yz, xx * yy - xy * xy) / (xx * c0 + xy * c1 + xz * c2);
+		partial[groups * 4 + 0] = float4(P, 0);
+		partial[groups * 4 + 1] = float4(mul(inv, L), 0);
+		history[slot] = float4(0, 0.5f * s0[0].w, 0, 0);
+	}
+}
+
+[numthreads(threads, 1, 1)]
+void Kinetic(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID)
+{
+	uint i = g.x * threads + t.x;
+	float mvv = 0;
+	if (i < ions)
+	{
+		float3 P = partial[groups * 4 + 0].xyz, w = partial[groups * 4 + 1].xyz;
+		float4 v = vel[i];
+		float3 u = v.xyz - P / v.w - cross(w, position(i));
+		vel[i] = float4(u, v.w);
+		mvv = v.w * dot(u, u);
+	}
+	s0[t.x] = float4(mvv, 0, 0, 0);
+	Reduce(t.x, false);
+	if (t.x == 0) partial[g.x * 4] = s0[0];
+}
+
+[numthreads(threads, 1, 1)]
+void Berendsen(uint3 t : SV_GroupThreadID)
+{
+	float mvv = 0;
+	for (uint k = t.x; k < groups; k += threads) mvv += partial[k * 4].x;
+	s0[t.x] = float4(mvv, 0, 0, 0);
+	Reduce(t.x, false);
+	if (t.x == 0)
+	{
+		float T_system = s0[0].x / (Kb * 3 * ions);
+		partial[groups * 4 + 2] = float4(sqrt(1 + (T / T_system - 1) / tau), T_system, 0, 0); // tau = 1 step is DumbVelScaling
+		history[slot].x = T_system;
+	}
+}
+
+[numthreads(threads, 1, 1)]
+void Drift(uint3 t : SV_GroupThreadID, uint3 g : SV_GroupID)
+{
+	uint i = g.x * threads + t.x;
+	if (i < ions)
+	{
+		uint2 xy = uint2(i % ww, i / ww);
+		float4 v = vel[i], hi = pos[xy];
+		float3 u = v.xyz * partial[groups * 4 + 2].x;
+		precise float3 d = pos_lo[i].xyz + u * dt, r = hi.xyz + d, lo = d - (r - hi.xyz);
+		if (dot(r, r) > evaporation_r2) u = -sign(r) * abs(u); // RevertEvaporatedParticles
+		vel[i] = float4(u, v.w);
+		pos[xy] = float4(r, hi.w);
+		pos_lo[i] = float4(lo, 0);
+	}
+}
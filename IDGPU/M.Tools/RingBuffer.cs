@@ -0,0 +1,59 @@
+using System;
+
+namespace M.Tools
+{
+    // The last Capacity values of a series: Add overwrites the oldest one when full, [0] is the oldest kept and
+    // [Count - 1] the newest. Sum and Mean are kept as values come and go; the sum is added up again from the values
+    // each time the buffer wraps, so the rounding of the running updates does not build up over a long run.
+    // All the memory is taken by the constructor.
+    public class RingBuffer
+    {
+        public int Count { get { return count; } }
+        public int Capacity { get { return values.Length; } }
+        public double Sum { get { return sum; } }
+        public double Mean { get { return count > 0 ? sum / count : 0; } }
+        public double this[int index]
+        {
+            get
+            {
+                if (index < 0 || index >= count) throw new ArgumentOutOfRangeException("index");
+                index += head;
+                return values[index < values.Length ? index : index - values.Length];
+            }
+        }
+
+        public RingBuffer(int capacity)
+        {
+            values = new double[Math.Max(capacity, 0)];
+        }
+
+        public void Clear()
+        {
+            head = count = 0;
+            sum = 0;
+        }
+        public void Add(double value)
+        {
+            if (values.Length == 0) return;
+            int tail = head + count;
+            if (tail >= values.Length) tail -= values.Length;
+            if (count < values.Length) count++;
+            else
+            {
+                sum -= values[tail];
+                if (++head == values.Length) head = 0;
+            }
+            values[tail] = value;
+            sum += value;
+            if (tail == values.Length - 1)
+            {
+                sum = 0;
+                for (int i = 0; i < count; i++) sum += values[i];
+            }
+        }
+
+        private double[] values;
+        private int head, count;
+        private double sum;
+    }
+}
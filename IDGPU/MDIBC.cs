@@ -1,7 +1,6 @@
 ﻿using System;
 using System.IO;
 using System.Linq;
-using System.Xml.Linq;
 using M.Tools;
 
 namespace IDGPU
@@ -17,9 +16,9 @@ namespace IDGPU
         public const double Kb = 8.617342791E-5; // eV / K
         private static Random rand = new Random(0);
 
-        public static double dt = 0.5; // in 1e-14 sec
-        public static double T = 2400; // in K
-        public static double kJ_mol; // Conversion factor of energy to kJ/mol
+        public static double dt = 0.5; // in 1e-14 sec, shared by the runs of an ensemble
+        public double T = 2400; // in K
+        public double kJ_mol; // Conversion factor of energy to kJ/mol
 
         public int Ions { get { return type.Length; } }
         public int Step { get { return step; } }
@@ -32,6 +31,10 @@ namespace IDGPU
             }
         }
         public IForce Technique { get { return technique; } }
+        // Runs of an ensemble (ForceEnsemble): the positions go to the technique before Update, which then finds the forces
+        // of the next step computed; EnergyStep says whether that step needs the energy too
+        public bool EnergyStep { get { return (step + 1) % energy_interval == 0; } }
+        public void SetForcePositions() { technique.SetPositions(pos, acc); }
 
         public MDIBC(Configuration cfg, Crystal c, PairPotentials pp, IForce technique, Action<string> append_text)
         {
@@ -46,6 +49,17 @@ namespace IDGPU
             tau_t = cfg.GetTimeInFractionalSteps("tau-t");
             tau_t_relaxation = cfg.GetTimeInFractionalSteps("tau-t-relaxation");
             MSD_reset_interval = cfg.GetTimeInSteps("MSD-reset-interval");
+            native_step = cfg["native-step"].ToInt();
+            respa_outer = Math.Max(cfg["respa-outer"].ToInt(), 1);
+            native_analysis = cfg["native-analysis"].ToInt() > 0;
+            rdf_interval = cfg.GetTimeInSteps("rdf-interval");
+            if (cfg["rdf-rmax"].Length > 0) rdf_r_max = cfg["rdf-rmax"].ToDouble();
+            if (cfg["rdf-bins"].Length > 0) rdf_bins = cfg["rdf-bins"].ToInt();
+            trajectory_interval = cfg.GetTimeInSteps("trajectory");
+            if (cfg["trajectory-precision"].Length > 0) trajectory_precision = cfg["trajectory-precision"].ToDouble();
+            trajectory_velocities = cfg["trajectory-velocities"].ToInt() > 0;
+            reorder_interval = cfg.GetTimeInSteps("reorder-interval");
+            if (cfg["reorder-threshold"].Length > 0) reorder_threshold = cfg["reorder-threshold"].ToDouble();
 
             kJ_mol = 96.485 / c.Ions * c.Cell.IonsInMolecule;
             this.pp = pp;
@@ -85,141 +99,231 @@ namespace IDGPU
                 Utility.Swap(ref origin[i], ref origin[j]);
                 Utility.Swap(ref vel[i], ref vel[j]);
             }
-
-            periods = new IndexableQueue<double>(); mean_periods = new IndexableQueue<double>();
-            central_periods = new IndexableQueue<double>(); central_mean_periods = new IndexableQueue<double>();
-            temperatures = new IndexableQueue<double>(); mean_temperatures = new IndexableQueue<double>();
-            energies = new IndexableQueue<double>();
+            // External numbers of the ions: their index after the type sort, the order of Save and the trajectory
+            id = new int[Ions];
+            for (i = 0; i < Ions; i++) id[i] = i;
+
+            // Series of the window of output steps and of the autosave steps; the per-output-step CKC series below keep an
+            // autosave of them, so stepping adds to them without allocation
+            int kept = autosave / output;
+            periods = new RingBuffer(output); mean_periods = new RingBuffer(autosave);
+            central_periods = new RingBuffer(output); central_mean_periods = new RingBuffer(autosave);
+            temperatures = new RingBuffer(output); mean_temperatures = new RingBuffer(autosave);
+            energies = new RingBuffer(autosave / energy_interval);
 
             technique.Init(type, pp, Types, Ions);
-
-            layer_count = new IndexableQueue<int>[edge_cells / 2][][];
-            layer_dist = new IndexableQueue<double>[edge_cells / 2][][];
+            dynamics = native_step > 0 ? technique as IDynamics : null;
+            split = respa_outer > 1 ? technique as ISplitForce : null;
+            if (respa_outer > 1 && split == null)
+                append_text(String.Format("\r\nrespa-outer {0}: {1} does not split its forces, every step computes all of them", respa_outer, technique.Name));
+            acc_long = split != null ? new Double3[Ions] : null;
+            if (reorder_interval > 0) Reorder(); // within the type blocks, so type is what the technique got
+            if (dynamics != null) dynamics.InitDynamics(pos, vel, mass);
+
+            // Sums of Analyze
+            Close();
+            analysis = native_analysis ? new CPUOne.Analysis(type, Types) : null;
+            rfr = new int[Types * rfr_intervals];
+            layer_count_sums = new int[edge_cells / 2 * (edge_cells / 2) * Types]; layer_dist_sums = new double[layer_count_sums.Length];
+            bilayer_count_sums = new int[2 * Types]; bilayer_dist_sums = new double[2 * Types];
+            rdf = rdf_interval > 0 ? new PairDistribution(type, Types, rdf_r_max, rdf_bins) : null;
+
+            // A trajectory per run, named by its first step, so a restart does not overwrite the previous one
+            if (trajectory_interval > 0)
+                trajectory = new TrajectoryWriter(String.Format("{0} {1}{2}", ResultsPath, step, Trajectory.Extension), type, trajectory_interval,
+                                                  trajectory_precision, trajectory_velocities ? trajectory_precision / dt : 0);
+
+            layer_count = new RingBuffer[edge_cells / 2][][];
+            layer_dist = new RingBuffer[edge_cells / 2][][];
             last_layer_count = new int[edge_cells / 2][][];
             last_layer_dist = new double[edge_cells / 2][][];
             for (i = 0; i < edge_cells / 2; i++)
             {
-                layer_count[i] = new IndexableQueue<int>[edge_cells / 2][];
-                layer_dist[i] = new IndexableQueue<double>[edge_cells / 2][];
+                layer_count[i] = new RingBuffer[edge_cells / 2][];
+                layer_dist[i] = new RingBuffer[edge_cells / 2][];
                 last_layer_count[i] = new int[edge_cells / 2][];
                 last_layer_dist[i] = new double[edge_cells / 2][];
                 for (j = 0; j < edge_cells / 2; j++)
                 {
-                    layer_count[i][j] = new IndexableQueue<int>[Types];
-                    layer_dist[i][j] = new IndexableQueue<double>[Types];
+                    layer_count[i][j] = new RingBuffer[Types];
+                    layer_dist[i][j] = new RingBuffer[Types];
                     last_layer_count[i][j] = new int[Types];
                     last_layer_dist[i][j] = new double[Types];
                     for (k = 0; k < Types; k++)
                     {
-                        layer_count[i][j][k] = new IndexableQueue<int>();
-                        layer_dist[i][j][k] = new IndexableQueue<double>();
+                        layer_count[i][j][k] = new RingBuffer(kept);
+                        layer_dist[i][j][k] = new RingBuffer(kept);
                     }
                 }
             }
 
-            bilayer_count = new IndexableQueue<int>[2][];
-            bilayer_dist = new IndexableQueue<double>[2][];
+            bilayer_count = new RingBuffer[2][];
+            bilayer_dist = new RingBuffer[2][];
             last_bilayer_count = new int[2][];
             last_bilayer_dist = new double[2][];
             for (i = 0; i < 2; i++)
             {
-                bilayer_count[i] = new IndexableQueue<int>[Types];
-                bilayer_dist[i] = new IndexableQueue<double>[Types];
+                bilayer_count[i] = new RingBuffer[Types];
+                bilayer_dist[i] = new RingBuffer[Types];
                 last_bilayer_count[i] = new int[Types];
                 last_bilayer_dist[i] = new double[Types];
                 for (k = 0; k < Types; k++)
                 {
-                    bilayer_count[i][k] = new IndexableQueue<int>();
-                    bilayer_dist[i][k] = new IndexableQueue<double>();
+                    bilayer_count[i][k] = new RingBuffer(kept);
+                    bilayer_dist[i][k] = new RingBuffer(kept);
                 }
             }
         }
 
         public void Load(string filename)
         {
-            var root = XDocument.Load(filename).Root;
-            var m = MainForm.materials[root.Attribute("material").Value];
-            pp = PairPotentials.LoadPotentialsFromFile(m, MainForm.potentials_filename)[root.Attribute("potentials").Value];
-            edge_cells = root.Int("edge-cells");
-            T = root.Double("T");
-            dt = root.Double("timestep");
-            autosave = root.Int("autosave-step");
-            step = root.Element("Ions").Int("step");
-            var ions = root.Element("Ions").Elements().ToArray();
-            type = new int[ions.Length];
-            pos = new Double3[ions.Length];
-            origin = new Double3[ions.Length];
-            vel = new Double3[ions.Length];
-            acc = new Double3[ions.Length];
-            for (int i = 0; i < ions.Length; i++)
+            var c = Checkpoint.Read(filename); // .simb or the XML .sim
+            var m = MainForm.materials[c.Material];
+            pp = PairPotentials.LoadPotentialsFromFile(m, MainForm.potentials_filename)[c.Potentials];
+            edge_cells = c.EdgeCells;
+            T = c.T;
+            dt = c.Timestep;
+            autosave = c.Autosave;
+            step = c.Step;
+            type = c.Type;
+            pos = c.Pos;
+            origin = c.Origin;
+            vel = c.Vel;
+            acc = new Double3[Ions];
+            Init();
+        }
+        public void Close() // finishes the trajectory and the autosaves, releases the native analysis
+        {
+            if (analysis != null) analysis.Dispose();
+            analysis = null;
+            if (checkpoints != null)
             {
-                type[i] = ions[i].Int("type");
-                var d = ions[i].Attribute("pos").Value.ToDoubleArray();
-                pos[i] = new Double3(d[0], d[1], d[2]);
-                d = ions[i].Attribute("origin").Value.ToDoubleArray();
-                origin[i] = new Double3(d[0], d[1], d[2]);
-                d = ions[i].Attribute("vel").Value.ToDoubleArray();
-                vel[i] = new Double3(d[0], d[1], d[2]);
+                checkpoints.Dispose();
+                if (checkpoints.Skipped > 0) append_text(String.Format("\r\nAutosave: {0} checkpoints written, {1} skipped", checkpoints.Written, checkpoints.Skipped));
+                if (checkpoints.Error != null) append_text("\r\nAutosave failed: " + checkpoints.Error.Message);
+                checkpoints = null;
             }
-            Init();
+            if (trajectory == null) return;
+            trajectory.Dispose();
+            if (trajectory.Dropped > 0) append_text(String.Format("\r\nTrajectory: {0} frames written, {1} dropped", trajectory.Frames, trajectory.Dropped));
+            trajectory = null;
         }
         public void Save(string filename)
         {
-            var ions = new XElement("Ions", new XAttribute("step", step));
-            for (int i = 0; i < Ions; i++)
-                ions.Add(new XElement("Ion",
-                            new XAttribute("type", type[i]),
-                            new XAttribute("pos", pos[i].ToString("F9")),
-                            new XAttribute("origin", origin[i].ToString("F9")),
-                            new XAttribute("vel", vel[i].ToString("F9"))));
-
-            new XDocument(
-                    new XElement("Simulation",
-                        new XAttribute("material", pp.Material.Formula),
-                        new XAttribute("potentials", pp.Name),
-                        new XAttribute("edge-cells", edge_cells),
-                        new XAttribute("T", T),
-                        new XAttribute("timestep", dt),
-                        new XAttribute("autosave-step", autosave),
-                        ions
-                    )
-                ).Save(filename);
+            Snapshot().Write(filename);
+        }
+        private Checkpoint Snapshot() // with arrays of its own, so the simulation goes on while a CheckpointWriter writes it
+        {
+            return new Checkpoint {
+                Material = pp.Material.Formula, Potentials = pp.Name, EdgeCells = edge_cells, T = T, Timestep = dt,
+                Autosave = autosave, Step = step, Type = (int[])type.Clone(), Pos = ExternalCopy(pos), Origin = ExternalCopy(origin), Vel = ExternalCopy(vel)
+            };
         }
         public void SaveResults(string path)
         {
             int i, j, k;
+            if (rdf != null) rdf.Save(path, pp.Material.IonName);
             string filename = path + ".txt";
             if (File.Exists(filename)) File.Copy(filename, filename + ".bak", true);
             using (var w = new StreamWriter(filename, true))
                 for (i = output; i <= mean_periods.Count; i += output)
                 {
+                    int b = bilayer_dist[0][0].Count - mean_periods.Count / output + i / output - 1; // the CKC of the same output step
                     double time = (step - mean_periods.Count + i) * dt / 100.0; // Save time in picoseconds instead of just steps
                     j = Math.Max(1, i / energy_interval);
                     w.Write("{0:F1}\t{1:F1}\t{2:F4}\t{3:F4}\t{4:F2}\t",
                         time, mean_temperatures[i - 1], mean_periods[i - 1], central_mean_periods[i - 1], energies[j - 1]);
                     for (j = 0; j < Types; j++)
                         for (k = 0; k < 2; k++)
-                            w.Write("{0:F3}\t", bilayer_dist[k][j].Dequeue());
+                            w.Write("{0:F3}\t", b >= 0 ? bilayer_dist[k][j][b] : 0);
                     //for (j = 0; j < Types; j++)
                     //    for (k = 0; k < edge_cells / 2; k++)
-                    //    {
-                    //        w.Write("{0:F3}\t", layer_dist[k][k][j][i / output - 1]);
-                    //        layer_count[k][k][j].Dequeue(); layer_dist[k][k][j].Dequeue();
-                    //    }
+                    //        w.Write("{0:F3}\t", layer_dist[k][k][j][b]);
                     w.WriteLine();
                 }
         }
+        // With respa-outer k > 1 (r-RESPA): the short-range forces every step and k times the long-range ones every k-th
+        // step, one impulse where the half kicks of two outer steps meet in the kick-drift scheme of Update; the long part
+        // is also computed on energy steps, for the energy only. Correct still runs every step of dt, so T_system is
+        // measured after every kick and the Berendsen tau keeps its meaning.
         private void Force()
         {
+            bool energy_step = step % energy_interval == 0;
+            if (split == null)
+            {
+                technique.SetPositions(pos, acc);
+                if (energy_step) StackEnergy(technique.Energy());
+                else technique.Force();
+                return;
+            }
+            bool outer = step % respa_outer == 0;
+            double U = 0;
+            if (outer || energy_step)
+            {
+                technique.SetPositions(pos, acc_long);
+                U += split.Force(ForcePart.Long, energy_step);
+            }
             technique.SetPositions(pos, acc);
-            if (step % energy_interval == 0)
+            U += split.Force(ForcePart.Short, energy_step);
+            if (outer)
+                for (int i = 0; i < Ions; i++) acc[i] += acc_long[i] * respa_outer;
+            if (energy_step) StackEnergy(U);
+        }
+        // The ions of each type block in the order of the Morton curve (IonOrder), every per-ion array alike
+        private void Reorder()
+        {
+            var order = IonOrder.Morton(pos, type);
+            var temp = new Double3[Ions];
+            foreach (var a in new[] { pos, vel, acc, origin, acc_long })
+                if (a != null) IonOrder.Permute(a, order, temp);
+            IonOrder.Permute(id, order, new int[Ions]);
+            locality = IonOrder.Locality(pos, type);
+        }
+        private Double3[] External(Double3[] a) // in the order of the external numbers
+        {
+            if (reorder_interval == 0) return a;
+            var e = new Double3[Ions];
+            for (int i = 0; i < Ions; i++) e[id[i]] = a[i];
+            return e;
+        }
+        private Double3[] ExternalCopy(Double3[] a)
+        {
+            var e = External(a);
+            return e == a ? (Double3[])a.Clone() : e;
+        }
+        private void StackEnergy(double potential)
+        {
+            energy = (potential + k3N * T_system / 2) * kJ_mol;
+            energies.Add(energy);
+        }
+        private int NativeSteps() // Steps up to the next one that needs the positions on the host, at most native_step
+        {
+            int n = 1;
+            for (; n < native_step; n++)
             {
-                energy = (technique.Energy() + k3N * T_system / 2) * kJ_mol;
-                energies.Enqueue(energy); if (energies.Count * energy_interval > autosave) energies.Dequeue();
+                int s = step + n;
+                if (s % output == 0 || s % MainForm.text_output_interval == 0 || s == relaxation) break;
+                if ((MSD_reset_interval > 0 && s % MSD_reset_interval == 0) || (autosave > 0 && s % autosave == 0)) break;
+                if (trajectory != null && s % trajectory.Interval == 0) break;
+                if (rdf != null && s > relaxation && s % rdf_interval == 0) break;
+                if (reorder_interval > 0 && s % reorder_interval == 0) break;
             }
-            else
+            return n;
+        }
+        private void NativeStep(int steps) // Force, integration, Correct and RevertEvaporatedParticles of the technique
+        {
+            if (step_temperature.Length < steps) { step_temperature = new double[steps]; step_energy = new double[steps]; }
+            var p = new DynamicsParameters {
+                dt = dt, T = T, tau = tau_t, tau_relaxation = tau_t_relaxation, evaporation_r2 = EvaporationRadius2,
+                step = step - steps, relaxation = relaxation, energy_interval = energy_interval,
+                respa_outer = split != null ? respa_outer : 1 };
+            dynamics.Step(p, steps, step_temperature, step_energy);
+            dynamics.GetState(pos, null);
+            for (int k = 0; k < steps; k++)
             {
-                technique.Force();
+                if ((p.step + 1 + k) % energy_interval == 0) StackEnergy(step_energy[k]); // with T_system of the previous step, as Force
+                T_system = step_temperature[k];
+                StackTemperature();
             }
         }
         private double Temperature()
@@ -250,17 +354,22 @@ namespace IDGPU
             wel = Double3.TransformCoordinate(moment, inertia); // Compute angular velocity
             for (i = 0; i < Ions; i++) vel[i] -= Double3.Cross(wel, pos[i]); // Correct moment
 
-            // Stack temperatures for averaging and saving
-            T_system = Temperature(); temperatures.Enqueue(T_system); if (temperatures.Count > output) temperatures.Dequeue();
-            T_mean = 0; foreach (double t in temperatures) T_mean += t; T_mean /= temperatures.Count;
-            mean_temperatures.Enqueue(T_mean); if (mean_temperatures.Count > autosave) mean_temperatures.Dequeue();
+            T_system = Temperature();
+            StackTemperature();
 
             double tau = step < relaxation ? tau_t_relaxation : tau_t;
             for (i = 0; i < Ions; i++) vel[i] *= Math.Sqrt(1 + (T / T_system - 1) / tau); // Berendsen, if tau = 1 step then DumbVelScaling
         }
+        private void StackTemperature() // Stack temperatures for averaging and saving
+        {
+            temperatures.Add(T_system);
+            T_mean = temperatures.Mean;
+            mean_temperatures.Add(T_mean);
+        }
+        private double EvaporationRadius2 { get { return 2 * edge_cells * edge_cells * Period * Period; } } // Some empirical radius of bounding sphere
         private void RevertEvaporatedParticles()
         {
-            double r2 = 2 * edge_cells * edge_cells * Period * Period; // Some empirical radius of bounding sphere
+            double r2 = EvaporationRadius2;
             for (int i = 0; i < Ions; i++)
             {
                 if (pos[i].LengthSq() > r2)
@@ -271,18 +380,66 @@ namespace IDGPU
                 }
             }
         }
-        private void ComputeDensity()
+        private static int Layer(double r, double period, int layers) // SphereLayers: the largest j < layers with r > j * period, or 0
         {
-            int i, j;
+            int j = Math.Min(Math.Max((int)Math.Ceiling(r / period) - 1, 0), layers - 1);
+            if (j > 0 && !(r > j * period)) j--; // the division may round across a border
+            else if (j + 1 < layers && r > (j + 1) * period) j++;
+            return j;
+        }
+        private void Analyze() // The per-ion part of ComputeDensity and ComputeCKC in one sweep: RFR, and the layer sums at output steps
+        {
+            int L = edge_cells / 2;
+            bool layers = step % output == 0;
+            double P = Period, border = (edge_cells * 0.5 - 1.0) * P;
+            if (analysis != null)
+            {
+                var p = new CPUOne.AnalysisParameters { rfr_radius = rfr_radius, period = P, border = border, rfr_intervals = rfr_intervals, layers = L };
+                analysis.Analyze(pos, origin, p, rfr, layers ? layer_count_sums : null, layer_dist_sums, bilayer_count_sums, bilayer_dist_sums);
+                return;
+            }
 
-            // Compute RFR
-            int[][] rfr = new int[Types][];
-            for (i = 0; i < Types; i++) rfr[i] = new int[rfr_intervals];
-            for (i = 0; i < Ions; i++)
+            Array.Clear(rfr, 0, rfr.Length);
+            if (layers)
+            {
+                Array.Clear(layer_count_sums, 0, layer_count_sums.Length); Array.Clear(layer_dist_sums, 0, layer_dist_sums.Length);
+                Array.Clear(bilayer_count_sums, 0, bilayer_count_sums.Length); Array.Clear(bilayer_dist_sums, 0, bilayer_dist_sums.Length);
+            }
+            for (int i = 0; i < Ions; i++)
             {
-                j = (int)(pos[i].Length() * rfr_intervals / rfr_radius);
-                if (j >= 0 && j < rfr_intervals) rfr[type[i]][j]++;
+                double r = pos[i].Length();
+                int t = type[i], j = (int)(r * rfr_intervals / rfr_radius);
+                if (j >= 0 && j < rfr_intervals) rfr[t * rfr_intervals + j]++;
+                if (!layers) continue;
+
+                double o = origin[i].Length(), d2 = (pos[i] - origin[i]).LengthSq();
+                int layer_o = Layer(o, P, L), layer_r = Layer(r, P, L), n = (layer_o * L + layer_r) * Types + t;
+                layer_count_sums[n]++;
+                layer_dist_sums[n] += layer_o == layer_r ? d2 : layer_o > layer_r ? (layer_r + 1) * P - r : r - layer_r * P;
+
+                j = o < border && r < border ? 0 : o > border && r > border ? 1 : -1; // joined core and surface
+                if (j >= 0)
+                {
+                    bilayer_count_sums[j * Types + t]++;
+                    bilayer_dist_sums[j * Types + t] += d2;
+                }
             }
+        }
+        private void SampleRDF() // g(r) and S(k) after relaxation, with the densities from the RFR histogram of Analyze
+        {
+            var density = new double[Types];
+            double volume = 4 * Math.PI / 3 * rfr_radius * rfr_radius * rfr_radius;
+            for (int i = 0; i < Types; i++)
+            {
+                int n = 0;
+                for (int j = 0; j < rfr_intervals; j++) n += rfr[i * rfr_intervals + j];
+                density[i] = n / volume;
+            }
+            rdf.Sample(pos, rfr_radius, density, analysis);
+        }
+        private void ComputeDensity(int steps) // steps > 1: the sample stands for every step of a native block
+        {
+            int i, j;
 
             // Compute internal density and period
             double[] density = new double[Types], N = new double[Types];
@@ -291,14 +448,12 @@ namespace IDGPU
                 double r = (j + 1) * rfr_radius / rfr_intervals;
                 for (i = 0; i < Types; i++)
                 {
-                    N[i] += rfr[i][j];
+                    N[i] += rfr[i * rfr_intervals + j];
                     if (j >= skip_intervals) density[i] += N[i] / (r * r * r); // D += N(r)/V(r), but join several first intervals to avoid small denominators
                 }
             }
             for (i = 0; i < Types; i++) density[i] /= (double)(4 * Math.PI / 3) * (rfr_intervals - 2 * skip_intervals);
-            central_periods.Enqueue((double)Math.Pow(4 / density[1], 1 / 3.0)); if (central_periods.Count > output) central_periods.Dequeue();
-            central_period = 0; foreach (double p in central_periods) central_period += p; central_period /= central_periods.Count;
-            central_mean_periods.Enqueue(periods.Count < 10 ? Period : central_period); if (central_mean_periods.Count > autosave) central_mean_periods.Dequeue();
+            double central_sample = (double)Math.Pow(4 / density[1], 1 / 3.0);
 
             // Compute density and period
             density = new double[Types]; N = new double[Types];
@@ -307,112 +462,106 @@ namespace IDGPU
                 double r = (j + 1) * rfr_radius / rfr_intervals;
                 for (i = 0; i < Types; i++)
                 {
-                    N[i] += rfr[i][j];
+                    N[i] += rfr[i * rfr_intervals + j];
                     if (j >= skip_intervals) density[i] += N[i] / (r * r * r); // D += N(r)/V(r), but join several first intervals to avoid small denominators
                 }
             }
             for (i = 0; i < Types; i++) density[i] /= (double)(4 * Math.PI / 3) * (rfr_intervals - skip_intervals);
-            periods.Enqueue((double)Math.Pow(4 / density[1], 1 / 3.0)); if (periods.Count > output) periods.Dequeue();
-            period = 0; foreach (double p in periods) period += p; period /= periods.Count;
-            mean_periods.Enqueue(Period); if (mean_periods.Count > autosave) mean_periods.Dequeue();
+            double sample = (double)Math.Pow(4 / density[1], 1 / 3.0);
+
+            for (int k = 0; k < steps; k++)
+            {
+                central_periods.Add(central_sample);
+                central_period = central_periods.Mean;
+                central_mean_periods.Add(periods.Count < 10 ? Period : central_period);
+
+                periods.Add(sample);
+                period = periods.Mean;
+                mean_periods.Add(Period);
+            }
             rfr_radius = (double)(Period * edge_cells * 0.5);
         }
-        private void ComputeCKC()
+        private void ComputeCKC() // Averages of the layer and bilayer sums of Analyze
         {
-            int i, j, k;
-            if (step % output == 0)
-            {
-                for (i = 0; i < edge_cells / 2; i++)
-                    for (j = 0; j < edge_cells / 2; j++)
-                        for (k = 0; k < Types; k++)
-                        {
-                            last_layer_count[i][j][k] = 0;
-                            last_layer_dist[i][j][k] = 0;
-                        }
-                for (i = 0; i < Ions; i++)
-                {
-                    double o = origin[i].Length(), r = pos[i].Length(); // SphereLayers
-                    int layer_o = 0, layer_r = 0; // joined core, if "= 1" and every "for" [from 0 to cells / 2] starts from 1
-                    for (j = 0; j < edge_cells / 2; j++)
+            if (step % output != 0) return;
+            int i, j, k, n, L = edge_cells / 2;
+            for (n = i = 0; i < L; i++)
+                for (j = 0; j < L; j++)
+                    for (k = 0; k < Types; k++, n++)
                     {
-                        if (o > j * Period) layer_o = j;
-                        if (r > j * Period) layer_r = j;
+                        last_layer_count[i][j][k] = layer_count_sums[n];
+                        last_layer_dist[i][j][k] = layer_dist_sums[n];
+                        if (last_layer_count[i][j][k] > 0) last_layer_dist[i][j][k] /= last_layer_count[i][j][k];
+                        layer_count[i][j][k].Add(last_layer_count[i][j][k]);
+                        layer_dist[i][j][k].Add(last_layer_dist[i][j][k]);
                     }
-                    last_layer_count[layer_o][layer_r][type[i]]++;
-                    if (layer_o == layer_r) last_layer_dist[layer_o][layer_r][type[i]] += (pos[i] - origin[i]).LengthSq();
-                    else if (layer_o > layer_r) last_layer_dist[layer_o][layer_r][type[i]] += (layer_r + 1) * Period - r;
-                    else if (layer_o < layer_r) last_layer_dist[layer_o][layer_r][type[i]] += r - layer_r * Period;
-                }
-                for (i = 0; i < edge_cells / 2; i++)
-                    for (j = 0; j < edge_cells / 2; j++)
-                        for (k = 0; k < Types; k++)
-                        {
-                            if (last_layer_count[i][j][k] > 0) last_layer_dist[i][j][k] /= last_layer_count[i][j][k];
-                            layer_count[i][j][k].Enqueue(last_layer_count[i][j][k]);
-                            layer_dist[i][j][k].Enqueue(last_layer_dist[i][j][k]);
-                        }
-            }
-            if (step % output == 0)
-            {
-                for (i = 0; i < 2; i++)
-                    for (k = 0; k < Types; k++)
-                    {
-                        last_bilayer_count[i][k] = 0;
-                        last_bilayer_dist[i][k] = 0;
-                    }
-                for (i = 0; i < Ions; i++)
+            for (n = i = 0; i < 2; i++)
+                for (k = 0; k < Types; k++, n++)
                 {
-                    //Float o = origin[i].Length(), r = pos[i].Length(), border = (Float)((cells * 0.5 - 1.125) * Period); // SphereLayers
-                    double o = origin[i].Length(), r = pos[i].Length(), border = (edge_cells * 0.5 - 1.0) * Period; // SphereLayers
-                    j = -1; if (o < border && r < border) j = 0; if (o > border && r > border) j = 1;
-                    if (j >= 0)
-                    {
-                        last_bilayer_count[j][type[i]]++;
-                        last_bilayer_dist[j][type[i]] += (pos[i] - origin[i]).LengthSq();
-                    }
+                    last_bilayer_count[i][k] = bilayer_count_sums[n];
+                    last_bilayer_dist[i][k] = bilayer_dist_sums[n];
+                    if (last_bilayer_count[i][k] > 0) last_bilayer_dist[i][k] /= last_bilayer_count[i][k];
+                    bilayer_count[i][k].Add(last_bilayer_count[i][k]);
+                    bilayer_dist[i][k].Add(last_bilayer_dist[i][k]);
                 }
-                for (i = 0; i < 2; i++)
-                    for (k = 0; k < Types; k++)
-                    {
-                        if (last_bilayer_count[i][k] > 0) last_bilayer_dist[i][k] /= last_bilayer_count[i][k];
-                        bilayer_count[i][k].Enqueue(last_bilayer_count[i][k]);
-                        bilayer_dist[i][k].Enqueue(last_bilayer_dist[i][k]);
-                    }
-            }
         }
         public void Update()
         {
-            // One MD step: compute forces, then update velocities and correct them, then update positions and compute density
-            step++;
+            // One MD step: compute forces, then update velocities and correct them, then update positions and compute density.
+            // The native integration (native-step N) runs up to N steps on the technique before the analysis
+            int steps = dynamics != null ? NativeSteps() : 1;
+            step += steps;
 
-            Force();
-
-            // Integration and corrections
-            int i;
-            for (i = 0; i < Ions; i++)
+            if (dynamics != null) NativeStep(steps);
+            else
             {
-                vel[i] += acc[i] * (dt / mass[type[i]]);
-                acc[i] = Double3.Empty;
+                Force();
+
+                // Integration and corrections
+                int i;
+                for (i = 0; i < Ions; i++)
+                {
+                    vel[i] += acc[i] * (dt / mass[type[i]]);
+                    acc[i] = Double3.Empty;
+                }
+                Correct();
+                for (i = 0; i < Ions; i++) pos[i] += vel[i] * dt;
+                RevertEvaporatedParticles();
             }
-            Correct();
-            for (i = 0; i < Ions; i++) pos[i] += vel[i] * dt;
 
             // Analysis
-            RevertEvaporatedParticles();
-            ComputeDensity();
+            Analyze();
+            if (rdf != null && step > relaxation && step % rdf_interval == 0) SampleRDF();
+            ComputeDensity(steps);
             ComputeCKC();
 
             // Reset origin of each ion after relaxation and at the given intervals
             if (step == relaxation || (MSD_reset_interval > 0 && step % MSD_reset_interval == 0)) pos.CopyTo(origin, 0);
 
+            // Reorder once the ions have drifted from the curve: the technique starts over in the new order
+            double drifted = reorder_interval > 0 && step % reorder_interval == 0 ? IonOrder.Locality(pos, type) : 0;
+            if (drifted > reorder_threshold * locality)
+            {
+                if (dynamics != null) dynamics.GetState(null, vel);
+                Reorder();
+                technique.Init(type, pp, Types, Ions);
+                if (dynamics != null) dynamics.InitDynamics(pos, vel, mass);
+                append_text(String.Format("\r\nReordered the ions at step {0}: {1:F2} A between neighbors in the arrays, was {2:F2} A", step, locality, drifted));
+            }
+
             // Output to screen and files
+            if (trajectory != null && step % trajectory.Interval == 0)
+            {
+                if (dynamics != null && trajectory.Velocities) dynamics.GetState(null, vel);
+                trajectory.Write(step, External(pos), trajectory.Velocities ? External(vel) : vel);
+            }
             if (autosave > 0 && step % autosave == 0)
             {
-                string path = "results " + Program.started.ToString("yyyy-MM-dd");
-                if (!Directory.Exists(path)) Directory.CreateDirectory(path);
-                path += String.Format("\\{0}-{1}-{2:F0}", pp.Name, Ions, T);
+                string path = ResultsPath;
                 SaveResults(path);
-                Save(String.Format("{0} {1}.sim", path, step));
+                if (dynamics != null) dynamics.GetState(pos, vel);
+                if (checkpoints == null) checkpoints = new CheckpointWriter();
+                checkpoints.Save(Snapshot(), String.Format("{0} {1}{2}", path, step, Checkpoint.Extension));
             }
             if (step % MainForm.text_output_interval == 0)
             {
@@ -422,16 +571,39 @@ namespace IDGPU
             }
         }
 
+        private string ResultsPath // directory of the day and the name of the run, without extension
+        {
+            get
+            {
+                string path = "results " + Program.started.ToString("yyyy-MM-dd");
+                if (!Directory.Exists(path)) Directory.CreateDirectory(path);
+                return path + String.Format("\\{0}-{1}-{2:F0}", pp.Name, Ions, T);
+            }
+        }
+
         private Action<string> append_text;
         private IForce technique;
+        private IDynamics dynamics; // the technique, if it integrates too (native_step)
+        private int native_step; // > 0: steps of the technique between readbacks of the positions
+        private ISplitForce split; // the technique, if respa_outer > 1 and it splits its forces
+        private int respa_outer; // steps of the long-range forces, 1 = every step
+        private Double3[] acc_long;
+        private double[] step_temperature = new double[1], step_energy = new double[1];
         private PairPotentials pp;
+        private TrajectoryWriter trajectory;
+        private CheckpointWriter checkpoints; // autosave
+        private CPUOne.Analysis analysis; // native Analyze (native-analysis)
+        private bool native_analysis;
+        private PairDistribution rdf; // g(r) and S(k) (rdf-interval)
 
         // Current state
         private int step, edge_cells;
         private double T_mean, T_system, period, central_period, energy, rfr_radius, k3N;
-        private IndexableQueue<double> periods, mean_periods, temperatures, mean_temperatures, energies;
-        private IndexableQueue<double> central_periods, central_mean_periods; // Bulk (internal) lattice period
+        private RingBuffer periods, mean_periods, temperatures, mean_temperatures, energies;
+        private RingBuffer central_periods, central_mean_periods; // Bulk (internal) lattice period
         public int[] type;
+        private int[] id; // external number of the ion at each index, see Reorder
+        private double locality; // IonOrder.Locality after the last Reorder
         public double[] mass;
         public Double3[] pos, vel, acc, origin;
 
@@ -440,21 +612,30 @@ namespace IDGPU
         private double MSD_reset_interval = 1000000; // in steps
         private int relaxation = 1000; // in steps
         private int rfr_intervals = 1000, skip_intervals; // For density computation
+        private int[] rfr, layer_count_sums, bilayer_count_sums; // of Analyze, flat: [type][interval], [layer_o][layer_r][type], [bulk, surface][type]
+        private double[] layer_dist_sums, bilayer_dist_sums;
+        private int rdf_interval, rdf_bins = 200; // in steps, 0 = no g(r)
+        private double rdf_r_max = 10; // in A
 
         // Parameters of output
         private int output = 200; // in steps
         private int energy_interval = 200; // in steps
-        public static int autosave = 5000; // in steps
+        public int autosave = 5000; // in steps
+        private int trajectory_interval; // in steps, 0 = no trajectory
+        private double trajectory_precision = 0.001; // in A, velocities to trajectory_precision / dt
+        private bool trajectory_velocities;
+        private int reorder_interval; // in steps between checks of IonOrder.Locality, 0 = the order of the type sort
+        private double reorder_threshold = 1.5; // reorder when Locality has grown by this factor
 
         // Multiple layer diffusion
-        IndexableQueue<int>[][][] layer_count;
-        IndexableQueue<double>[][][] layer_dist;
+        RingBuffer[][][] layer_count;
+        RingBuffer[][][] layer_dist;
         int[][][] last_layer_count;
         double[][][] last_layer_dist;
 
         // Two layer diffusion (bulk + surface)
-        IndexableQueue<int>[][] bilayer_count;
-        IndexableQueue<double>[][] bilayer_dist;
+        RingBuffer[][] bilayer_count;
+        RingBuffer[][] bilayer_dist;
         int[][] last_bilayer_count;
         public double[][] last_bilayer_dist;
     }
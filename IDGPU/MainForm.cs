@@ -1,8 +1,11 @@
 ﻿using System;
 using System.Windows.Forms;
 using System.Collections.Generic;
+using System.Linq;
 using System.Threading;
+using System.Threading.Tasks;
 using M.Tools;
+using DirectCompute;
 
 namespace IDGPU
 {
@@ -42,8 +45,10 @@ namespace IDGPU
         {
             Utility.SetDecimalSeparator();
 
-            foreach (var c in Configuration.LoadConfigurationsFromFile(config_filename))
+            var configs = Configuration.LoadConfigurationsFromFile(config_filename);
+            for (int n = 0; n < configs.Length; n++)
             {
+                var c = configs[n];
                 cells_filename = c["cells-filename"];
                 unit_cells = UnitCell.LoadUnitCellsFromFile(cells_filename);
                 materials_filename = c["materials-filename"];
@@ -51,29 +56,70 @@ namespace IDGPU
                 potentials_filename = c["potentials-filename"];
                 var m = materials[c["material"]];
                 ForceDX11_IBC.ParametersFilename = c["dx11-parameters-filename"];
+                if (c.ContainsKey("tuning-filename")) TuningDatabase.Filename = c["tuning-filename"];
+                ForceCPU_Native.NeighborSkin = c["neighbor-skin"].ToDouble();
+                ForceCPU_Native.TreeTheta = c.ContainsKey("tree-theta") ? c["tree-theta"].ToDouble() : 0.2;
+                ForceCPU_Native.TreeOrder = c.ContainsKey("tree-order") ? c["tree-order"].ToInt() : 2;
+                ForceCPU_Native.Output = AppendText;
+                // Float pair terms added up with Kahan sums by the float CPU techniques and the GPU kernels
+                ForceCPU_Native.MixedPrecision = ForceDX11_IBC.MixedPrecision = c["mixed-precision"].ToInt() != 0;
+                if (c.ContainsKey("partition-address")) ForcePartitioned.Address = c["partition-address"];
+                if (c.ContainsKey("partition-workers")) ForcePartitioned.Workers = c["partition-workers"].ToInt();
+                if (c.ContainsKey("partition-timeout")) ForcePartitioned.Timeout = c["partition-timeout"].ToDouble();
+                ForcePartitioned.MaxIons = c["partition-max-ions"].ToInt();
+                ForcePartitioned.Output = AppendText;
+                PotentialTable.Points = c["potential-table"].ToInt();
                 text_output_interval = c["text-output-interval"].ToInt();
+                if (c["technique"] == ForceEnsemble.Name(false) || c["technique"] == ForceEnsemble.Name(true))
+                {
+                    n += RunEnsemble(configs, n) - 1;
+                    continue;
+                }
 
                 var cell = unit_cells[m.UnitCell];
                 potentials = PairPotentials.LoadPotentialsFromFile(m, potentials_filename);
                 var crystal = Crystal.Create(cell, c.Get("crystal"));
 
-                double optimize = c["optimize-tiling"].ToDouble();
-                if (optimize > 0) ForceDX11_IBC.OptimizeTiling(optimize, crystal, AppendText);
-
                 var techniques = new Dictionary<string, IForce>();
                 IForce technique = new ForceDX11_IBC();
                 techniques.Add(technique.Name, technique);
                 technique = new ForceCPU_IBC();
                 techniques.Add(technique.Name, technique);
+                technique = new ForceCPU_Native(false);
+                techniques.Add(technique.Name, technique);
+                technique = new ForceCPU_Native(true);
+                techniques.Add(technique.Name, technique);
+                technique = new ForceCPU_Native(false, true);
+                techniques.Add(technique.Name, technique);
+                technique = new ForcePartitioned(false);
+                techniques.Add(technique.Name, technique);
+                technique = new ForcePartitioned(true);
+                techniques.Add(technique.Name, technique);
                 technique = techniques[c["technique"]];
 
+                // Compiled kernels kept between runs, keyed by their source and defines (DX11One\ShaderCache.h)
+                if (c["shader-cache"].Length > 0 && technique is ForceDX11_IBC)
+                    KernelRepository.SetCache(c["shader-cache"], c["shader-cache-mb"].Length > 0 ? c["shader-cache-mb"].ToInt() : 64);
+                // Released buffers and textures kept for the next Init (DX11One\ResourcePool.h)
+                if (c["resource-pool-mb"].Length > 0 && technique is ForceDX11_IBC) KernelRepository.SetPool(c["resource-pool-mb"].ToInt());
+
+                // Seconds per round of the tuner, once per device, kernels and bucket of ions (Tuning.cs)
+                double optimize = c["optimize-tiling"].ToDouble();
+                if (optimize > 0 && technique is ITunable)
+                    Tuner.Tune((ITunable)technique, crystal, potentials[c["potentials"]], optimize, AppendText);
+
                 int finish_steps = c.GetTimeInSteps("finish-at");
                 MDIBC md = new MDIBC(c, crystal, potentials[c["potentials"]], technique, AppendText);
                 Clock clock = new Clock();
 
                 var filename = c["load"];
+                if (c["convert-sim"].Length > 0) AppendText("Converted to " + Checkpoint.ConvertSim(c["convert-sim"]) + Environment.NewLine);
                 if (filename.Length > 0) md.Load(filename);
 
+                // Calls of DX11One kept for a Chrome trace (Trace.h), written with the counters at the end of the run
+                int trace_events = c["trace-events"].ToInt();
+                if (trace_events > 0 && technique is ForceDX11_IBC) KernelRepository.Device.TraceEvents = trace_events;
+
                 Paused = false;
                 float besttime = 1000, mean_time = 0;
                 while (finish_steps == 0 || md.Step < finish_steps)
@@ -90,16 +136,81 @@ namespace IDGPU
                     {
                         mean_time /= text_output_interval;
                         SetTitle(String.Format("{0} T={1} N={2} dt={3:F3} {4} {5}",
-                                               md.Step, MDIBC.T, md.Ions, MDIBC.dt, md.Technique.Name, besttime));
+                                               md.Step, md.T, md.Ions, MDIBC.dt, md.Technique.Name, besttime));
                         mean_time = 0;
                     }
                 }
 
+                if (trace_events > 0 && technique is ForceDX11_IBC)
+                {
+                    KernelRepository.Device.WriteTrace("DX11One trace.json");
+                    foreach (var s in KernelRepository.Device.Stats) AppendText(s.Key + ": " + s.Value + Environment.NewLine);
+                    AppendText("Shader cache: " + KernelRepository.CacheStats + Environment.NewLine);
+                    AppendText("Resource pool: " + KernelRepository.PoolStats + Environment.NewLine);
+                    KernelRepository.Device.TraceEvents = 0;
+                }
+                md.Close();
                 technique.Dispose();
             }
+            ForcePartitioned.Release();
             Invoke(new Action(Close));
             Application.Exit();
         }
+        // Up to "ensemble" consecutive runs of the ensemble technique with the same dt (MDIBC.dt is shared) step together:
+        // one ForceEnsemble.Compute for the forces of all of them, then their Update in parallel. A run that reaches its
+        // finish-at stops updating while the others go on. Returns the number of runs taken.
+        private int RunEnsemble(Configuration[] configs, int first)
+        {
+            var c = configs[first];
+            int size = Math.Max(c["ensemble"].ToInt(), 1);
+            double dt = c.Get_dt_in_fs();
+            var runs = new List<MDIBC>();
+            var finish = new List<int>();
+            using (var ensemble = new ForceEnsemble(c["technique"] == ForceEnsemble.Name(true)))
+            {
+                for (int n = first; n < configs.Length && runs.Count < size; n++)
+                {
+                    var r = configs[n];
+                    if (r["technique"] != c["technique"] || r.Get_dt_in_fs() != dt) break;
+                    unit_cells = UnitCell.LoadUnitCellsFromFile(r["cells-filename"]);
+                    materials = Material.LoadMaterialsFromFile(r["materials-filename"]);
+                    potentials_filename = r["potentials-filename"];
+                    var m = materials[r["material"]];
+                    potentials = PairPotentials.LoadPotentialsFromFile(m, potentials_filename);
+                    var md = new MDIBC(r, Crystal.Create(unit_cells[m.UnitCell], r.Get("crystal")), potentials[r["potentials"]], ensemble.Add(), AppendText);
+                    if (r["load"].Length > 0) md.Load(r["load"]);
+                    runs.Add(md);
+                    finish.Add(r.GetTimeInSteps("finish-at"));
+                }
+                AppendText(String.Format("\r\nEnsemble of {0} runs, {1} ions", runs.Count, runs.Sum(md => md.Ions)));
+
+                Clock clock = new Clock();
+                Paused = false;
+                float besttime = 1000;
+                var active = new List<MDIBC>();
+                for (;;)
+                {
+                    while (Paused) Thread.Sleep(10);
+                    active.Clear();
+                    for (int k = 0; k < runs.Count; k++)
+                        if (finish[k] == 0 || runs[k].Step < finish[k]) active.Add(runs[k]);
+                    if (active.Count == 0) break;
+
+                    float time = clock.ElapsedTime;
+                    foreach (var md in active) md.SetForcePositions();
+                    ensemble.Compute(active.Any(md => md.EnergyStep));
+                    Parallel.ForEach(active, md => md.Update());
+                    time = clock.ElapsedTime - time;
+                    besttime = Math.Min(time, besttime);
+
+                    if (active[0].Step % text_output_interval == 0)
+                        SetTitle(String.Format("{0} ensemble x{1} N={2} dt={3:F3} {4} {5}",
+                                               active[0].Step, active.Count, active.Sum(md => md.Ions), MDIBC.dt, active[0].Technique.Name, besttime));
+                }
+                foreach (var md in runs) md.Close();
+            }
+            return runs.Count;
+        }
         private void SetTitle(string s)
         {
             if (InvokeRequired)
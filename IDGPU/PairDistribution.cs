@@ -0,0 +1,164 @@
+﻿using System;
+using System.IO;
+using M.Tools;
+
+namespace IDGPU
+{
+    // Running averages of the partial radial distribution functions g_ab(r) and the Ashcroft-Langreth structure factors
+    // S_ab(k) of the cluster, for a <= b. A sample counts the pairs closer than r_max around the centers, the ions inside
+    // the sphere of radius - r_max (so their shells are inside the cluster), on a cell grid in O(N): natively by
+    // CPUOne.Analysis or by Histogram here. With the densities rho of the types inside the radius
+    //  g_ab(r) = (pairs_ab + pairs_ba) / ((centers_a rho_b + centers_b rho_a) * volume of the shell), a != b;
+    //  S_ab(k) = delta_ab + 4 pi sqrt(rho_a rho_b) Int r^2 (g_ab(r) - 1) sin(kr) / (kr) L(r) dr, from the averages,
+    // where L(r) = sin(pi r / r_max) / (pi r / r_max) (Lorch) damps the ripples of the cut at r_max.
+    public class PairDistribution
+    {
+        public PairDistribution(int[] type, int types, double r_max, int bins)
+        {
+            this.type = type;
+            this.types = types;
+            this.r_max = r_max;
+            this.bins = bins;
+            pairs = types * (types + 1) / 2;
+            histogram = new int[types * types * bins];
+            centers = new int[types];
+            g_sum = new double[pairs * bins];
+            density_sum = new double[types];
+        }
+
+        public int Samples { get { return samples; } }
+
+        // density - ions per A^3 of every type inside radius
+        public void Sample(Double3[] pos, double radius, double[] density, CPUOne.Analysis analysis)
+        {
+            double core = radius - r_max, dr = r_max / bins;
+            if (core <= 0) return;
+            if (analysis != null) analysis.PairHistogram(pos, r_max, core, bins, histogram, centers);
+            else Histogram(pos, core);
+
+            for (int a = 0, p = 0; a < types; a++)
+                for (int b = a; b < types; b++, p++)
+                {
+                    double norm = centers[a] * density[b] + (a != b ? centers[b] * density[a] : 0);
+                    if (norm <= 0) continue;
+                    for (int k = 0; k < bins; k++)
+                    {
+                        double shell = 4 * Math.PI / 3 * dr * dr * dr * (3 * k * k + 3 * k + 1); // (k + 1)^3 - k^3
+                        int n = histogram[(a * types + b) * bins + k] + (a != b ? histogram[(b * types + a) * bins + k] : 0);
+                        g_sum[p * bins + k] += n / (norm * shell);
+                    }
+                }
+            for (int a = 0; a < types; a++) density_sum[a] += density[a];
+            samples++;
+        }
+
+        // path + " g(r).txt" and path + " S(k).txt": a column per pair of types (names of the ions), a <= b
+        public void Save(string path, string[] names)
+        {
+            if (samples == 0) return;
+            double dr = r_max / bins, dk = Math.PI / r_max;
+            string header = "";
+            for (int a = 0; a < types; a++)
+                for (int b = a; b < types; b++)
+                    header += String.Format("\t{0}-{1}", names[a], names[b]);
+
+            using (var w = new StreamWriter(path + " g(r).txt"))
+            {
+                w.WriteLine("r" + header);
+                for (int k = 0; k < bins; k++)
+                {
+                    w.Write("{0:F3}", (k + 0.5) * dr);
+                    for (int p = 0; p < pairs; p++) w.Write("\t{0:F4}", g_sum[p * bins + k] / samples);
+                    w.WriteLine();
+                }
+            }
+            using (var w = new StreamWriter(path + " S(k).txt"))
+            {
+                w.WriteLine("k" + header);
+                for (int n = 1; n <= bins / 2; n++)
+                {
+                    double q = n * dk;
+                    w.Write("{0:F4}", q);
+                    for (int a = 0, p = 0; a < types; a++)
+                        for (int b = a; b < types; b++, p++)
+                        {
+                            double s = 0;
+                            for (int k = 0; k < bins; k++)
+                            {
+                                double r = (k + 0.5) * dr, x = Math.PI * r / r_max;
+                                s += r * r * (g_sum[p * bins + k] / samples - 1) * Math.Sin(q * r) / (q * r) * Math.Sin(x) / x;
+                            }
+                            double rho = Math.Sqrt(density_sum[a] * density_sum[b]) / samples;
+                            w.Write("\t{0:F4}", (a == b ? 1 : 0) + 4 * Math.PI * rho * s * dr);
+                        }
+                    w.WriteLine();
+                }
+            }
+        }
+
+        // The grid of CPUOne\Analysis.cpp (AnalysisEngine::PairHistogram)
+        private void Histogram(Double3[] pos, double core)
+        {
+            int ions = pos.Length, i, a;
+            Array.Clear(histogram, 0, histogram.Length);
+            Array.Clear(centers, 0, centers.Length);
+
+            Double3 lo = pos[0], hi = pos[0];
+            for (i = 1; i < ions; i++)
+            {
+                lo.x = Math.Min(lo.x, pos[i].x); lo.y = Math.Min(lo.y, pos[i].y); lo.z = Math.Min(lo.z, pos[i].z);
+                hi.x = Math.Max(hi.x, pos[i].x); hi.y = Math.Max(hi.y, pos[i].y); hi.z = Math.Max(hi.z, pos[i].z);
+            }
+            double size = r_max;
+            int nx, ny, nz;
+            for (; ; size *= 1.25)
+            {
+                nx = (int)((hi.x - lo.x) / size) + 1; ny = (int)((hi.y - lo.y) / size) + 1; nz = (int)((hi.z - lo.z) / size) + 1;
+                if ((double)nx * ny * nz <= 2.0 * ions + 27) break;
+            }
+            if (cell == null || cell.Length != ions) { cell = new int[ions]; cell_ions = new int[ions]; }
+            var start = new int[nx * ny * nz + 1];
+            for (i = 0; i < ions; i++)
+            {
+                int cx = Math.Min((int)((pos[i].x - lo.x) / size), nx - 1);
+                int cy = Math.Min((int)((pos[i].y - lo.y) / size), ny - 1);
+                int cz = Math.Min((int)((pos[i].z - lo.z) / size), nz - 1);
+                cell[i] = (cz * ny + cy) * nx + cx;
+                start[cell[i] + 1]++;
+            }
+            for (a = 0; a + 1 < start.Length; a++) start[a + 1] += start[a];
+            var fill = (int[])start.Clone();
+            for (i = 0; i < ions; i++) cell_ions[fill[cell[i]]++] = i;
+
+            double core2 = core * core, r2_max = r_max * r_max, scale = bins / r_max;
+            for (i = 0; i < ions; i++)
+            {
+                var r = pos[i];
+                if (r.LengthSq() >= core2) continue;
+                int ti = type[i], c = cell[i], cx = c % nx, cy = c / nx % ny, cz = c / (nx * ny);
+                centers[ti]++;
+                for (int gz = Math.Max(cz - 1, 0); gz <= cz + 1 && gz < nz; gz++)
+                    for (int gy = Math.Max(cy - 1, 0); gy <= cy + 1 && gy < ny; gy++)
+                        for (int gx = Math.Max(cx - 1, 0); gx <= cx + 1 && gx < nx; gx++)
+                        {
+                            int g = (gz * ny + gy) * nx + gx;
+                            for (int m = start[g]; m < start[g + 1]; m++)
+                            {
+                                int j = cell_ions[m];
+                                double d2 = (pos[j] - r).LengthSq();
+                                if (d2 >= r2_max || j == i) continue;
+                                int bin = (int)(Math.Sqrt(d2) * scale);
+                                if (bin < bins) histogram[(ti * types + type[j]) * bins + bin]++;
+                            }
+                        }
+            }
+        }
+
+        private int[] type;
+        private int types, bins, pairs, samples;
+        private double r_max;
+        private int[] histogram, centers; // of the last sample
+        private double[] g_sum, density_sum; // sums over the samples
+        private int[] cell, cell_ions; // grid of Histogram
+    }
+}
@@ -46,16 +46,73 @@ namespace IDGPU
         {
             get { return coefs; }
         }
+        // 8 coefficients of every pair of types; Buckingham4 appends the O-O spline: Range2 (6), Range3 (4) and Bounds (2),
+        // the layout of the coefs of CPUOne InitEngine
         public double[] CoefsDouble8
         {
             get
             {
-                return new[] {
+                double[] pairs = new[] {
                     MDIBC.Ke * charge[0] * charge[0], Coefs[1], Coefs[2], Coefs[3], 0, 0, 0, 0, 
                     MDIBC.Ke * charge[0] * charge[1], Coefs[4], Coefs[5], 0, Coefs[6], Coefs[7], Coefs[8], 0,
                     MDIBC.Ke * charge[0] * charge[1], Coefs[4], Coefs[5], 0, Coefs[6], Coefs[7], Coefs[8], 0,
                     MDIBC.Ke * charge[1] * charge[1], Coefs[9], Coefs[10], 0, 0, 0, 0, 0,
                 };
+                if (form != "Buckingham4") return pairs;
+                PairTerms oo = Terms(0, 0);
+                if (!oo.Spline || oo.Range2.Coefs.Length != 6 || oo.Range3.Coefs.Length != 4)
+                    throw new InvalidOperationException("The Buckingham4 set " + name + " has no O-O spline: Range2 of 6 and Range3 of 4 coefficients.");
+                return pairs.Concat(oo.Range2.Coefs).Concat(oo.Range3.Coefs).Concat(oo.Bounds.Take(2)).ToArray();
+            }
+        }
+
+        // Terms of the pair of types ti, tj ([ti * types + tj]) as written in the .spp file, for any form
+        public PairTerms Terms(int ti, int tj)
+        {
+            return terms[ti * charge.Length + tj];
+        }
+
+        // Terms of a <Pair>: BornMayer="A B" (A exp(-B R)), Dispersion="C" (-C / R^6), Morse="D alpha r0"
+        // (D (exp(-2 alpha (R - r0)) - 2 exp(-alpha (R - r0)))) and the Buckingham4 spline: polynomials Range2, Range3 (the
+        // highest power first) below Bounds[0] and Bounds[1], the dispersion above. Born-Mayer of a spline pair is not used,
+        // the same as in Buckingham4_Force of ForceCPU_IBC.
+        public class PairTerms
+        {
+            public double A, B, C, D, Alpha, R0;
+            public Polynom Range2, Range3;
+            public double[] Bounds = { 2.1, 2.6 };
+            public bool Spline { get { return Range2 != null && Range3 != null; } }
+
+            public PairTerms(XElement x)
+            {
+                if (x == null) return;
+                var c = x.AttributeOrEmpty("BornMayer").ToDoubleArray();
+                if (c.Length >= 2) { A = c[0]; B = c[1]; }
+                C = x.Double("Dispersion");
+                c = x.AttributeOrEmpty("Morse").ToDoubleArray();
+                if (c.Length >= 3) { D = c[0]; Alpha = c[1]; R0 = c[2]; }
+                if (x.Attribute("Range2") != null) Range2 = new Polynom(x.AttributeOrEmpty("Range2"));
+                if (x.Attribute("Range3") != null) Range3 = new Polynom(x.AttributeOrEmpty("Range3"));
+                c = x.AttributeOrEmpty("Bounds").ToDoubleArray();
+                if (c.Length >= 2) Bounds = c;
+            }
+
+            // Terms cut at ForceCPU_IBC.cutoff (Born-Mayer, Morse, the whole spline), without the cut: dU as in ForceCPU_IBC
+            // (acc_i += (pos_i - pos_j) * dU) and U. Coulomb and the dispersion of other pairs are long-range.
+            public double ShortRange(double R, out double U)
+            {
+                double dU_dR;
+                if (Spline)
+                {
+                    if (R < Bounds[0]) { U = Range2.Eval(R); dU_dR = Range2.Derivative(R); }
+                    else if (R < Bounds[1]) { U = Range3.Eval(R); dU_dR = Range3.Derivative(R); }
+                    else { double r6 = Math.Pow(R, -6); U = -C * r6; dU_dR = 6 * C * r6 / R; }
+                    return -dU_dR / R;
+                }
+                double e = A * Math.Exp(-B * R), ee = Math.Exp(-Alpha * (R - R0));
+                U = e + D * ee * (ee - 2);
+                dU_dR = -B * e - 2 * Alpha * D * ee * (ee - 1);
+                return -dU_dR / R;
             }
         }
 
@@ -104,6 +161,14 @@ namespace IDGPU
                     coefs[8] = c[2];
                 }
             }
+            int types = m.IonName.Length;
+            terms = new PairTerms[types * types];
+            for (int i = 0; i < types; i++)
+                for (int j = 0; j < types; j++)
+                {
+                    string ij = m.IonName[i] + " " + m.IonName[j], ji = m.IonName[j] + " " + m.IonName[i];
+                    terms[i * types + j] = new PairTerms(pairs.ContainsKey(ij) ? pairs[ij] : (pairs.ContainsKey(ji) ? pairs[ji] : null));
+                }
             x = pairs.ContainsKey(P11) ? pairs[P11] : null;
             if (x != null)
             {
@@ -126,6 +191,7 @@ namespace IDGPU
         private Material m;
         private string name, form, material_name;
         private double[] coefs, charge;
+        private PairTerms[] terms;
         private double T_melting, T_superionic;
         private Polynom solid_period;
     }
@@ -17,6 +17,12 @@ namespace IDGPU
             c = coefs.Split(new char[] {' '}, StringSplitOptions.RemoveEmptyEntries).Select(word => double.Parse(word)).ToArray();
         }
 
+        // Coefficients, the highest power first
+        public double[] Coefs
+        {
+            get { return c; }
+        }
+
         public double Eval(double x)
         {
             double y = c[0];
@@ -24,6 +30,13 @@ namespace IDGPU
             return y;
         }
 
+        public double Derivative(double x)
+        {
+            double y = 0;
+            for (int i = 0; i < c.Length - 1; i++) y = y * x + c[i] * (c.Length - 1 - i);
+            return y;
+        }
+
         private double[] c;
     }
 }
@@ -0,0 +1,77 @@
+using System;
+
+namespace IDGPU
+{
+    // The short-range terms of every type pair (PairPotentials.PairTerms.ShortRange: Born-Mayer, Morse, Buckingham4
+    // spline) as cubic Hermite splines on a uniform grid of R^2 from MinR^2 to cutoff^2, so a kernel looks up R^2 directly:
+    // one interpolation instead of exp, polynomials and branches, and any .spp form runs the same kernel. Coulomb and
+    // the uncut dispersion stay analytic (LongRange).
+    // Coefs[(k * Intervals + i) * 8 + m], k = type_i * types + type_j: m = 0..3 dU (acc_i += (pos_i - pos_j) * dU),
+    // m = 4..7 U of the interval i as a + t * (b + t * (c + t * d)); x = (R^2 - R2Min) * Scale, i = floor(x), t = x - i.
+    public class PotentialTable
+    {
+        public static int Points = 0; // intervals, "potential-table" of the configuration; 0: analytic kernels
+        public static double MinR = 0.5; // A, the table is constant below
+
+        public int Types { get { return types; } }
+        public int Intervals { get { return intervals; } }
+        public double R2Min { get { return r2_min; } }
+        public double Scale { get { return scale; } }
+        public double Cutoff { get { return cutoff; } }
+        public double[] Coefs { get { return coefs; } }
+        // CoefsDouble8 with Coulomb (c0) and the dispersion not cut at the cutoff (c3) only
+        public double[] LongRange { get { return long_range; } }
+
+        public PotentialTable(PairPotentials pp, int types, double cutoff, int intervals)
+        {
+            if (cutoff <= MinR || intervals < 2) throw new ArgumentException("Potential table needs a cutoff and at least 2 intervals");
+            this.types = types;
+            this.intervals = intervals;
+            this.cutoff = cutoff;
+            r2_min = MinR * MinR;
+            double step = (cutoff * cutoff - r2_min) / intervals;
+            scale = 1 / step;
+
+            coefs = new double[types * types * intervals * 8];
+            long_range = new double[types * types * 8];
+            double[] c8 = pp.CoefsDouble8;
+            for (int ti = 0; ti < types; ti++)
+                for (int tj = 0; tj < types; tj++)
+                {
+                    int k = ti * types + tj;
+                    var terms = pp.Terms(ti, tj);
+                    long_range[k * 8] = c8[k * 8];
+                    if (!terms.Spline) long_range[k * 8 + 3] = c8[k * 8 + 3];
+
+                    // Values and derivatives by R^2 at the nodes: dU/d(R^2) = -dU / 2 in the dU convention above,
+                    // the derivative of dU by a central difference
+                    double[] f = new double[intervals + 1], u = new double[intervals + 1], df = new double[intervals + 1];
+                    for (int i = 0; i <= intervals; i++)
+                    {
+                        double s = r2_min + i * step, h = 1e-3 * step, U;
+                        f[i] = terms.ShortRange(Math.Sqrt(s), out u[i]);
+                        df[i] = (terms.ShortRange(Math.Sqrt(s + h), out U) - terms.ShortRange(Math.Sqrt(s - h), out U)) / (2 * h);
+                    }
+                    for (int i = 0; i < intervals; i++)
+                    {
+                        int o = (k * intervals + i) * 8;
+                        Hermite(coefs, o, f[i], f[i + 1], df[i] * step, df[i + 1] * step);
+                        Hermite(coefs, o + 4, u[i], u[i + 1], -0.5 * f[i] * step, -0.5 * f[i + 1] * step);
+                    }
+                }
+        }
+
+        // Cubic on t = 0..1 with the values y0, y1 and the derivatives m0, m1 at the ends
+        private static void Hermite(double[] c, int o, double y0, double y1, double m0, double m1)
+        {
+            c[o] = y0;
+            c[o + 1] = m0;
+            c[o + 2] = 3 * (y1 - y0) - 2 * m0 - m1;
+            c[o + 3] = 2 * (y0 - y1) + m0 + m1;
+        }
+
+        private int types, intervals;
+        private double r2_min, scale, cutoff;
+        private double[] coefs, long_range;
+    }
+}
@@ -0,0 +1,345 @@
+﻿using System;
+using System.IO;
+using System.Threading;
+using M.Tools;
+
+namespace IDGPU
+{
+    // Trajectory of positions (and velocities) every interval steps. The format (.trj, version 1, little endian):
+    //  header: magic "IDTJ", version, ions, flags (1 = velocities), interval (steps), key interval (frames),
+    //  precision of positions and of velocities (doubles), then the type of every ion (ints);
+    //  frames: step, key (1 = key frame), payload bytes, payload.
+    // A payload has for every column (x, y, z of the positions, then of the velocities) a width in bits and the values
+    // of the ions packed at that width: the zigzag code of round(x / precision) on a key frame, of its difference to the
+    // previous frame otherwise, so a slowly moving ion costs a few bits per coordinate.
+    // The index (.trj.idx) has step, key and offset of every frame, written after the frame is on disk.
+    public static class Trajectory
+    {
+        public const string Extension = ".trj", IndexExtension = ".idx";
+        public const int Version = 1;
+        internal const uint Magic = 0x4A544449; // "IDTJ"
+        internal const int Velocities = 1;
+
+        internal static ulong ZigZag(long v) { return (ulong)((v << 1) ^ (v >> 63)); }
+        internal static long UnZigZag(ulong v) { return (long)(v >> 1) ^ -(long)(v & 1); }
+
+        // Columns of bit-packed values, a width byte before every column
+        internal class BitStream
+        {
+            public BitStream(byte[] data) { this.data = data; }
+            public int Position { get { return position; } set { position = value; acc = 0; bits = 0; } }
+
+            public void Pack(long[] values, int offset, int count)
+            {
+                ulong all = 0;
+                for (int i = 0; i < count; i++) all |= ZigZag(values[offset + i]);
+                int width = 0;
+                while (width < 64 && (all >> width) != 0) width++;
+                data[position++] = (byte)width;
+                for (int i = 0; i < count; i++) Put(ZigZag(values[offset + i]), width);
+                if (bits > 0) data[position++] = (byte)acc;
+                acc = 0; bits = 0;
+            }
+            public void Unpack(long[] values, int offset, int count)
+            {
+                int width = data[position++];
+                for (int i = 0; i < count; i++) values[offset + i] = UnZigZag(Get(width));
+                acc = 0; bits = 0;
+            }
+
+            private void Put(ulong v, int width)
+            {
+                while (width > 0)
+                {
+                    int n = Math.Min(width, 32);
+                    acc |= (v & ((1UL << n) - 1)) << bits;
+                    bits += n; v >>= n; width -= n;
+                    for (; bits >= 8; bits -= 8, acc >>= 8) data[position++] = (byte)acc;
+                }
+            }
+            private ulong Get(int width)
+            {
+                ulong v = 0;
+                for (int shift = 0; shift < width; )
+                {
+                    if (bits == 0) { acc = data[position++]; bits = 8; }
+                    int n = Math.Min(width - shift, bits);
+                    v |= (acc & ((1UL << n) - 1)) << shift;
+                    acc >>= n; bits -= n; shift += n;
+                }
+                return v;
+            }
+
+            private byte[] data;
+            private int position, bits;
+            private ulong acc;
+        }
+    }
+
+    // Write copies the frame into a pooled buffer and returns; a background thread quantizes, packs and writes it.
+    // The frames go between the threads through two single-producer single-consumer rings (filled and free), so the
+    // simulation thread never waits on the disk: when every buffer of the pool is queued, the frame is dropped and
+    // counted in Dropped.
+    public class TrajectoryWriter : IDisposable
+    {
+        public TrajectoryWriter(string filename, int[] type, int interval, double precision, double velocity_precision, int key_interval = 100, int pool = 8)
+        {
+            if (precision <= 0 || interval <= 0 || key_interval <= 0 || pool <= 0) throw new ArgumentException("Invalid trajectory parameters");
+            ions = type.Length;
+            columns = velocity_precision > 0 ? 6 : 3;
+            this.precision = precision;
+            this.velocity_precision = velocity_precision;
+            this.key_interval = key_interval;
+            Interval = interval;
+
+            stream = new FileStream(filename, FileMode.Create, FileAccess.Write, FileShare.Read, 1 << 16);
+            index = new FileStream(filename + Trajectory.IndexExtension, FileMode.Create, FileAccess.Write, FileShare.Read, 1 << 12);
+            writer = new BinaryWriter(stream);
+            index_writer = new BinaryWriter(index);
+            writer.Write(Trajectory.Magic); writer.Write(Trajectory.Version); writer.Write(ions);
+            writer.Write(columns == 6 ? Trajectory.Velocities : 0); writer.Write(interval); writer.Write(key_interval);
+            writer.Write(precision); writer.Write(velocity_precision);
+            foreach (int t in type) writer.Write(t);
+            writer.Flush();
+
+            q = new long[columns * ions];
+            previous = new long[columns * ions];
+            payload = new byte[columns * (1 + ions * 8 + 1)];
+            filled = new Ring(pool);
+            free = new Ring(pool);
+            for (int i = 0; i < pool; i++) free.TryAdd(new Frame { values = new double[columns * ions] });
+
+            thread = new Thread(Run) { IsBackground = true, Name = "Trajectory", Priority = ThreadPriority.BelowNormal };
+            thread.Start();
+        }
+
+        public int Interval { get; private set; }
+        public bool Velocities { get { return columns == 6; } }
+        public int Frames { get { return frames; } } // written
+        public int Dropped { get { return dropped; } }
+
+        // vel is ignored without velocities
+        public bool Write(int step, Double3[] pos, Double3[] vel)
+        {
+            if (error != null) throw new IOException("Trajectory writer failed", error);
+            Frame f;
+            if (!free.TryTake(out f)) { dropped++; return false; }
+            f.step = step;
+            var v = f.values;
+            for (int i = 0; i < ions; i++) { v[i] = pos[i].x; v[ions + i] = pos[i].y; v[2 * ions + i] = pos[i].z; }
+            if (Velocities)
+                for (int i = 0; i < ions; i++) { v[3 * ions + i] = vel[i].x; v[4 * ions + i] = vel[i].y; v[5 * ions + i] = vel[i].z; }
+            filled.TryAdd(f); // cannot fail, there are as many slots as frames
+            signal.Set();
+            return true;
+        }
+
+        public void Dispose()
+        {
+            if (thread == null) return;
+            closing = true;
+            signal.Set();
+            thread.Join();
+            thread = null;
+            writer.Close();
+            index_writer.Close();
+            signal.Close();
+        }
+
+        private void Run()
+        {
+            try
+            {
+                for (; ; )
+                {
+                    bool last = closing; // read before the ring: frames added before closing are taken below
+                    Frame f;
+                    if (filled.TryTake(out f))
+                    {
+                        WriteFrame(f);
+                        free.TryAdd(f);
+                        continue;
+                    }
+                    if (last) break;
+                    signal.WaitOne();
+                }
+            }
+            catch (Exception e)
+            {
+                error = e;
+            }
+        }
+        private void WriteFrame(Frame f)
+        {
+            bool key = frames % key_interval == 0;
+            var v = f.values;
+            for (int c = 0; c < columns; c++)
+            {
+                double scale = 1 / (c < 3 ? precision : velocity_precision);
+                for (int i = c * ions, end = i + ions; i < end; i++)
+                {
+                    long value = (long)Math.Round(v[i] * scale);
+                    q[i] = key ? value : value - previous[i];
+                    previous[i] = value;
+                }
+            }
+            var bits = new Trajectory.BitStream(payload);
+            for (int c = 0; c < columns; c++) bits.Pack(q, c * ions, ions);
+
+            long offset = stream.Position;
+            writer.Write(f.step); writer.Write(key ? 1 : 0); writer.Write(bits.Position);
+            writer.Write(payload, 0, bits.Position);
+            writer.Flush();
+            index_writer.Write(f.step); index_writer.Write(key ? 1 : 0); index_writer.Write(offset);
+            index_writer.Flush();
+            frames++;
+        }
+
+        private class Frame
+        {
+            public int step;
+            public double[] values; // columns of ions
+        }
+        private class Ring // one producer and one consumer, no locks
+        {
+            public Ring(int capacity) { items = new Frame[capacity + 1]; }
+            public bool TryAdd(Frame f)
+            {
+                int t = tail, next = (t + 1) % items.Length;
+                if (next == Thread.VolatileRead(ref head)) return false;
+                items[t] = f;
+                Thread.VolatileWrite(ref tail, next);
+                return true;
+            }
+            public bool TryTake(out Frame f)
+            {
+                int h = head;
+                f = null;
+                if (h == Thread.VolatileRead(ref tail)) return false;
+                f = items[h];
+                items[h] = null;
+                Thread.VolatileWrite(ref head, (h + 1) % items.Length);
+                return true;
+            }
+
+            private Frame[] items;
+            private int head, tail;
+        }
+
+        private int ions, columns, key_interval, dropped;
+        private volatile int frames;
+        private double precision, velocity_precision;
+        private FileStream stream, index;
+        private BinaryWriter writer, index_writer;
+        private Ring filled, free;
+        private Thread thread;
+        private AutoResetEvent signal = new AutoResetEvent(false);
+        private volatile bool closing;
+        private volatile Exception error;
+        private long[] q, previous; // the background thread only
+        private byte[] payload;
+    }
+
+    // Random access to the frames of a .trj: Read decodes from the key frame at or before the frame, or only the
+    // frame itself when it follows the last one read.
+    public class TrajectoryReader : IDisposable
+    {
+        public TrajectoryReader(string filename)
+        {
+            stream = new FileStream(filename, FileMode.Open, FileAccess.Read, FileShare.ReadWrite, 1 << 16);
+            reader = new BinaryReader(stream);
+            if (reader.ReadUInt32() != Trajectory.Magic) throw new InvalidDataException(filename + " is not a trajectory");
+            int version = reader.ReadInt32();
+            if (version != Trajectory.Version) throw new InvalidDataException(filename + ": trajectory version " + version + " is not supported");
+            int ions = reader.ReadInt32();
+            columns = (reader.ReadInt32() & Trajectory.Velocities) != 0 ? 6 : 3;
+            Interval = reader.ReadInt32();
+            reader.ReadInt32(); // key interval
+            precision = reader.ReadDouble();
+            velocity_precision = reader.ReadDouble();
+            Type = new int[ions];
+            for (int i = 0; i < ions; i++) Type[i] = reader.ReadInt32();
+
+            // The index, or a scan of the frame headers if it is missing; a frame cut off by a crash is left out
+            string index_filename = filename + Trajectory.IndexExtension;
+            if (File.Exists(index_filename))
+            {
+                var bytes = File.ReadAllBytes(index_filename);
+                int n = bytes.Length / 16;
+                steps = new int[n]; keys = new bool[n]; offsets = new long[n];
+                for (int k = 0; k < n; k++)
+                {
+                    steps[k] = BitConverter.ToInt32(bytes, k * 16);
+                    keys[k] = BitConverter.ToInt32(bytes, k * 16 + 4) != 0;
+                    offsets[k] = BitConverter.ToInt64(bytes, k * 16 + 8);
+                }
+            }
+            else
+            {
+                var s = new System.Collections.Generic.List<int>();
+                var k = new System.Collections.Generic.List<bool>();
+                var o = new System.Collections.Generic.List<long>();
+                for (long offset = stream.Position; offset + 12 <= stream.Length; )
+                {
+                    stream.Position = offset;
+                    int step = reader.ReadInt32(), key = reader.ReadInt32(), length = reader.ReadInt32();
+                    if (offset + 12 + length > stream.Length) break;
+                    s.Add(step); k.Add(key != 0); o.Add(offset);
+                    offset += 12 + length;
+                }
+                steps = s.ToArray(); keys = k.ToArray(); offsets = o.ToArray();
+            }
+            q = new long[columns * ions];
+            delta = new long[columns * ions];
+        }
+        public void Dispose()
+        {
+            reader.Close();
+        }
+
+        public int[] Type { get; private set; }
+        public int Ions { get { return Type.Length; } }
+        public int Interval { get; private set; }
+        public bool Velocities { get { return columns == 6; } }
+        public int Frames { get { return steps.Length; } }
+        public int Step(int frame) { return steps[frame]; }
+
+        // vel may be null
+        public void Read(int frame, Double3[] pos, Double3[] vel)
+        {
+            if (frame < 0 || frame >= Frames) throw new ArgumentOutOfRangeException("frame");
+            int k = frame;
+            if (!(frame == current + 1 && !keys[frame])) while (!keys[k]) k--;
+            for (; k <= frame; k++) Decode(k);
+            current = frame;
+
+            int ions = Ions;
+            for (int i = 0; i < ions; i++)
+                pos[i] = new Double3(q[i] * precision, q[ions + i] * precision, q[2 * ions + i] * precision);
+            if (vel != null && Velocities)
+                for (int i = 0; i < ions; i++)
+                    vel[i] = new Double3(q[3 * ions + i] * velocity_precision, q[4 * ions + i] * velocity_precision, q[5 * ions + i] * velocity_precision);
+        }
+
+        private void Decode(int frame)
+        {
+            stream.Position = offsets[frame] + 8;
+            int length = reader.ReadInt32();
+            if (payload == null || payload.Length < length) payload = new byte[length];
+            if (reader.Read(payload, 0, length) != length) throw new EndOfStreamException();
+            var bits = new Trajectory.BitStream(payload);
+            bool key = keys[frame];
+            for (int c = 0; c < columns; c++) bits.Unpack(key ? q : delta, c * Ions, Ions);
+            if (!key) for (int i = 0; i < q.Length; i++) q[i] += delta[i];
+        }
+
+        private FileStream stream;
+        private BinaryReader reader;
+        private int columns, current = -2;
+        private double precision, velocity_precision;
+        private int[] steps;
+        private bool[] keys;
+        private long[] offsets, q, delta;
+        private byte[] payload;
+    }
+}
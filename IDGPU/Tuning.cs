@@ -0,0 +1,180 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using M.Tools;
+
+namespace IDGPU
+{
+    // Launch parameters of a technique by name, "width=128 threads=64" in the database
+    public class TuningParameters : SortedDictionary<string, int>
+    {
+        public TuningParameters() { }
+        public TuningParameters(IDictionary<string, int> p) : base(p) { }
+
+        public int Get(string name, int default_value) { int value; return TryGetValue(name, out value) ? value : default_value; }
+
+        public override string ToString() { return String.Join(" ", this.Select(p => p.Key + "=" + p.Value)); }
+        public static TuningParameters Parse(string s)
+        {
+            var p = new TuningParameters();
+            foreach (var word in s.Split(new[] { ' ' }, StringSplitOptions.RemoveEmptyEntries))
+            {
+                var pair = word.Split('=');
+                p[pair[0]] = int.Parse(pair[1]);
+            }
+            return p;
+        }
+    }
+
+    // The best parameters found by Tuner, a line per (device, form, precision, bucket of the number of ions):
+    //  device <tab> form <tab> precision <tab> ions <tab> parameters <tab> seconds per Force
+    // Buckets are quarters of an octave of ions. Lookup interpolates between the tuned numbers of ions around N:
+    // parameters with a granularity (ITunable) geometrically, rounded to a multiple of it, the others are taken from the
+    // nearer entry in log N; beyond the tuned range the nearest entry is used as is.
+    public class TuningDatabase
+    {
+        public static string Filename = "Data\\Tuning.txt";
+        public static TuningDatabase Default
+        {
+            get
+            {
+                if (instance == null || instance.filename != Filename) instance = new TuningDatabase(Filename);
+                return instance;
+            }
+        }
+        private static TuningDatabase instance;
+
+        public TuningDatabase(string filename)
+        {
+            this.filename = filename;
+            if (!File.Exists(filename)) return;
+            foreach (var line in File.ReadAllLines(filename))
+            {
+                if (line.Length == 0 || line[0] == '#') continue;
+                var words = line.Split('\t');
+                entries.Add(new Entry {
+                    device = words[0], form = words[1], precision = words[2], ions = int.Parse(words[3]),
+                    parameters = TuningParameters.Parse(words[4]), time = words[5].ToDouble() });
+            }
+        }
+
+        public static int Bucket(int ions) { return (int)Math.Round(Math.Log(ions, 2) * 4); }
+
+        // Of the device, form and precision of the technique after its Init; null if it has never been tuned there
+        public TuningParameters Lookup(ITunable t, int ions)
+        {
+            var tuned = Entries(t).OrderBy(e => e.ions).ToList();
+            if (tuned.Count == 0) return null;
+            var same = tuned.FirstOrDefault(e => Bucket(e.ions) == Bucket(ions));
+            if (same != null) return new TuningParameters(same.parameters);
+            var lo = tuned.LastOrDefault(e => e.ions < ions);
+            var hi = tuned.FirstOrDefault(e => e.ions > ions);
+            if (lo == null || hi == null) return new TuningParameters((lo ?? hi).parameters);
+
+            double x = (Math.Log(ions) - Math.Log(lo.ions)) / (Math.Log(hi.ions) - Math.Log(lo.ions));
+            var p = new TuningParameters(x < 0.5 ? lo.parameters : hi.parameters);
+            foreach (var name in p.Keys.ToList())
+            {
+                int g = t.Granularity(name);
+                if (g <= 0 || !lo.parameters.ContainsKey(name) || !hi.parameters.ContainsKey(name)) continue;
+                double a = Math.Log(lo.parameters[name]), b = Math.Log(hi.parameters[name]);
+                p[name] = Math.Max(g, (int)Math.Round(Math.Exp(a + x * (b - a)) / g) * g);
+            }
+            return p;
+        }
+        public bool Contains(ITunable t, int ions) { return Entries(t).Any(e => Bucket(e.ions) == Bucket(ions)); }
+
+        // Replaces the entry of the bucket and saves the file
+        public void Store(ITunable t, int ions, TuningParameters p, double time)
+        {
+            entries.RemoveAll(e => e.device == t.Device && e.form == t.Form && e.precision == t.Precision && Bucket(e.ions) == Bucket(ions));
+            entries.Add(new Entry { device = t.Device, form = t.Form, precision = t.Precision, ions = ions, parameters = p, time = time });
+            var lines = new List<string> { "# device\tform\tprecision\tions\tparameters\tseconds per Force (IDGPU Tuner)" };
+            lines.AddRange(entries.OrderBy(e => e.device).ThenBy(e => e.form).ThenBy(e => e.precision).ThenBy(e => e.ions).Select(e =>
+                String.Format("{0}\t{1}\t{2}\t{3}\t{4}\t{5:F6}", e.device, e.form, e.precision, e.ions, e.parameters, e.time)));
+            File.WriteAllLines(filename, lines);
+        }
+
+        private IEnumerable<Entry> Entries(ITunable t)
+        {
+            return entries.Where(e => e.device == t.Device && e.form == t.Form && e.precision == t.Precision);
+        }
+
+        private class Entry
+        {
+            public string device, form, precision;
+            public int ions;
+            public TuningParameters parameters;
+            public double time;
+        }
+        private string filename;
+        private List<Entry> entries = new List<Entry>();
+    }
+
+    // Successive halving over the candidates of a technique: every round spends round_time on the survivors, times each
+    // at least 3 Force calls after a warm-up one (the kernels compile and the buffers fill), and keeps the faster half by
+    // the median time, so the time per candidate doubles from round to round until one is left. The winner goes to
+    // TuningDatabase.Default; a number of ions whose bucket is already there is not tuned again.
+    public static class Tuner
+    {
+        public static TuningParameters Tune(ITunable technique, Crystal c, PairPotentials pp, double round_time, Action<string> output)
+        {
+            int ions = c.Ions, types = c.Type.Max() + 1, round = 0;
+            Double3[] pos = c.Scale(5.5), acc = new Double3[ions];
+            var database = TuningDatabase.Default;
+            technique.Tuning = null;
+            technique.Init(c.Type, pp, types, ions);
+            if (database.Contains(technique, ions))
+            {
+                technique.Dispose();
+                return database.Lookup(technique, ions);
+            }
+
+            var clock = new Clock();
+            var survivors = technique.Candidates(ions).ToList();
+            var timed = new List<KeyValuePair<float, TuningParameters>>();
+            output(String.Format("Tuning {0} on {1}, {2} {3}, {4} ions: {5} candidates\r\n",
+                technique.Name, technique.Device, technique.Form, technique.Precision, ions, survivors.Count));
+            do
+            {
+                float budget = (float)(round_time / survivors.Count);
+                timed.Clear();
+                foreach (var p in survivors)
+                {
+                    var times = new List<float>();
+                    try
+                    {
+                        technique.Tuning = p;
+                        technique.Init(c.Type, pp, types, ions);
+                        technique.SetPositions(pos, acc);
+                        technique.Force();
+                        float started = clock.ElapsedTime;
+                        while (times.Count < 3 || clock.ElapsedTime - started < budget)
+                        {
+                            float time = clock.ElapsedTime;
+                            technique.Force();
+                            times.Add(clock.ElapsedTime - time);
+                        }
+                    }
+                    catch (Exception e)
+                    {
+                        output(String.Format("{0}: {1}\r\n", p, e.Message));
+                        continue;
+                    }
+                    times.Sort();
+                    timed.Add(new KeyValuePair<float, TuningParameters>(times[times.Count / 2], p));
+                }
+                if (timed.Count == 0) throw new InvalidOperationException("No candidate of " + technique.Name + " runs");
+                timed.Sort((a, b) => a.Key.CompareTo(b.Key));
+                survivors = timed.Take((timed.Count + 1) / 2).Select(pair => pair.Value).ToList();
+                output(String.Format("round {0}: {1} timed, best {2} {3:F6} s\r\n", round++, timed.Count, timed[0].Value, timed[0].Key));
+            } while (survivors.Count > 1);
+
+            technique.Tuning = null;
+            technique.Dispose();
+            database.Store(technique, ions, timed[0].Value, timed[0].Key);
+            return timed[0].Value;
+        }
+    }
+}
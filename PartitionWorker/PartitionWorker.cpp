@@ -0,0 +1,40 @@
+// Worker process of a partitioned force (CPUOne\Partition.h): connects to the master of IDGPU ("CPU Partitioned IBC",
+// partition-address and partition-workers of the configuration) and computes the rows it is given until the master
+// releases the partition. One process per worker rank, on this machine (shm: or tcp:) or on others (tcp:).
+// g++ -std=c++11 -O3 -I../CPUOne -o PartitionWorker PartitionWorker.cpp -L../CPUOne -lCPUOne -lpthread -Wl,-rpath,'$ORIGIN/../CPUOne'
+// PartitionWorker address rank [--threads 0] [--timeout 60]
+//  PartitionWorker shm:idgpu 0 & PartitionWorker shm:idgpu 1 &
+//  PartitionWorker tcp:master-node:7300 3 --threads 16
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CPUOne.h"
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		fprintf(stderr, "PartitionWorker address rank [--threads 0] [--timeout 60]\n address: shm:name or tcp:host:port\n");
+		return 2;
+	}
+	const char* address = argv[1];
+	int rank = atoi(argv[2]), threads = 0;
+	double timeout = 60;
+	for (int k = 3; k + 1 < argc; k += 2)
+	{
+		if (strcmp(argv[k], "--threads") == 0) threads = atoi(argv[k + 1]);
+		else if (strcmp(argv[k], "--timeout") == 0) timeout = atof(argv[k + 1]);
+		else { fprintf(stderr, "Unknown option %s\n", argv[k]); return 2; }
+	}
+
+	HRESULT hr = RunPartitionWorker(address, rank, threads, timeout);
+	if (FAILED(hr))
+	{
+		const char* message;
+		DecodeError(hr, &message);
+		fprintf(stderr, "Worker %d at %s: 0x%08X %s\n", rank, address, (unsigned)hr, message);
+		return 1;
+	}
+	return 0;
+}